@@ -292,6 +292,8 @@ static SrnRet read_application_config_from_cfg(config_t *cfg,
             &app_cfg->ui->window.send_on_ctrl_enter);
     config_lookup_bool_ex(cfg, "exit-on-close",
             &app_cfg->ui->window.exit_on_close);
+    config_lookup_bool_ex(cfg, "io-thread", &app_cfg->io_thread);
+    config_lookup_int(cfg, "timer-slack", &app_cfg->timer_slack);
 
     /* Read auto connect server list */
     config_setting_t *auto_connect;
@@ -311,6 +313,32 @@ static SrnRet read_application_config_from_cfg(config_t *cfg,
         }
     }
 
+    /* Read chat log config */
+    config_setting_t *chat_log;
+    chat_log = config_lookup(cfg, "chat-log");
+    if (chat_log){
+        config_setting_lookup_bool_ex(chat_log, "fsync",
+                &app_cfg->chat_log->fsync);
+        config_setting_lookup_int(chat_log, "flush-interval",
+                &app_cfg->chat_log->flush_interval);
+        config_setting_lookup_bool_ex(chat_log, "store",
+                &app_cfg->chat_log->store);
+        config_setting_lookup_int(chat_log, "compress-after",
+                &app_cfg->chat_log->compress_after);
+        config_setting_lookup_int(chat_log, "compact-threshold",
+                &app_cfg->chat_log->compact_threshold);
+    }
+
+    /* Read reconnect config */
+    config_setting_t *reconnect;
+    reconnect = config_lookup(cfg, "reconnect");
+    if (reconnect){
+        config_setting_lookup_int(reconnect, "concurrency",
+                &app_cfg->reconn_concurrency);
+        config_setting_lookup_int(reconnect, "stable-time",
+                &app_cfg->reconn_stable_time);
+    }
+
     return SRN_OK;
 }
 
@@ -433,6 +461,24 @@ static SrnRet read_server_config_from_server(config_setting_t *server,
         }
     }
 
+    /* Read ignored hostmask list */
+    config_setting_t *masks;
+    masks = config_setting_lookup(server, "ignore-masks");
+    if (masks){
+        for (int i = 0; i < config_setting_length(masks); i++){
+            const char *val;
+            config_setting_t *mask;
+
+            mask = config_setting_get_elem(masks, i);
+            if (!mask) continue;
+            val = config_setting_get_string(mask);
+            if (!val) continue;
+
+            cfg->ignore_mask_list = g_list_append(cfg->ignore_mask_list,
+                    g_strdup(val));
+        }
+    }
+
     return SRN_OK;
 }
 
@@ -630,6 +676,24 @@ static SrnRet read_user_config_from_user(config_setting_t *user, SrnUserConfig *
     config_setting_lookup_string_ex(user, "away-message", &cfg->away_message);
     config_setting_lookup_string_ex(user, "quit-message", &cfg->quit_message);
 
+    /* Read highlight keyword list */
+    config_setting_t *keywords;
+    keywords = config_setting_lookup(user, "highlight-keywords");
+    if (keywords){
+        for (int i = 0; i < config_setting_length(keywords); i++){
+            const char *val;
+            config_setting_t *keyword;
+
+            keyword = config_setting_get_elem(keywords, i);
+            if (!keyword) continue;
+            val = config_setting_get_string(keyword);
+            if (!val) continue;
+
+            cfg->highlight_keywords = g_list_append(cfg->highlight_keywords,
+                    g_strdup(val));
+        }
+    }
+
     return SRN_OK;
 }
 
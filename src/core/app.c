@@ -26,6 +26,7 @@
 
 #include "core/core.h"
 #include "sui/sui.h"
+#include "render/render.h"
 #include "config/reader.h"
 #include "meta.h"
 #include "log.h"
@@ -33,6 +34,7 @@
 #include "path.h"
 #include "utils.h"
 #include "pattern_set.h"
+#include "timer_wheel.h"
 
 #include "app_event.h"
 #include "chat_command.h"
@@ -42,6 +44,8 @@ static SrnApplication *app_instance = NULL;
 
 static void init_logger(SrnApplication *app);
 static void finalize_logger(SrnApplication *app);
+static void run_autorun_commands(SrnServer *srv, bool registered,
+        gpointer user_data);
 
 /*****************************************************************************
  * Exported functions
@@ -93,6 +97,9 @@ SrnApplication* srn_application_new(void){
     app->cfg_mgr = cfg_mgr;
 
     init_logger(app);
+    app->chat_log_writer = srn_chat_log_writer_new(cfg->chat_log);
+    sirc_set_io_thread(cfg->io_thread);
+    srn_timer_wheel_set_slack(cfg->timer_slack);
     srn_application_init_ui_event(app);
     srn_application_init_irc_event(app);
 
@@ -114,8 +121,20 @@ SrnApplication* srn_application_get_default(void){
     return app_instance;
 }
 
+/**
+ * @brief ``srn_application_quit`` stops background threads of application
+ * and frees its logger, the default logger before application starts is
+ * restored. Render workers should be stopped before calling this.
+ *
+ * @param app
+ */
 void srn_application_quit(SrnApplication *app){
     // TODO: cleanup
+    if (app->chat_log_writer){
+        srn_chat_log_writer_free(app->chat_log_writer);
+        app->chat_log_writer = NULL;
+    }
+    sirc_stop_io_thread();
     finalize_logger(app);
 }
 
@@ -125,6 +144,9 @@ void srn_application_run(SrnApplication *app, int argc, char *argv[]){
 
 void srn_application_set_config(SrnApplication *app, SrnApplicationConfig  *cfg){
     sui_application_set_config(app->ui, cfg->ui);
+    srn_chat_log_writer_set_config(app->chat_log_writer, cfg->chat_log);
+    sirc_set_io_thread(cfg->io_thread);
+    srn_timer_wheel_set_slack(cfg->timer_slack);
     app->cfg = cfg;
 }
 
@@ -151,6 +173,9 @@ SrnRet srn_application_reload_config(SrnApplication *app){
         return ret;
     }
 
+    /* Render workers may access the configs to be replaced */
+    srn_render_sync();
+
     /* Update log config */
     logger_cfg = srn_logger_config_new();
     old_logger_cfg = srn_logger_get_config(app->logger);
@@ -163,6 +188,7 @@ SrnRet srn_application_reload_config(SrnApplication *app){
         goto ERR_RELOAD_LOGGER;
     }
     srn_logger_set_config(app->logger, logger_cfg);
+    app->logger_cfg = logger_cfg;
     srn_logger_config_free(old_logger_cfg);
 
     /* Update application config */
@@ -300,31 +326,8 @@ SrnRet srn_application_add_server_with_config(SrnApplication *app,
         }
     }
 
-    /* Run server autorun commands */
-    for (GList *lst = srv->cfg->auto_run_cmd_list; lst; lst = g_list_next(lst)){
-        const char *cmd;
-        SrnRet ret;
-        SrnChat *chat;
-
-        cmd = lst->data;
-        chat = srv->chat;
-        ret = srn_chat_run_command(chat, cmd);
-
-        // NOTE: The server and chat may be invlid after running command
-        if (!srn_server_is_valid(srv) || !srn_server_is_chat_valid(srv, chat)){
-            return ret;
-        }
-
-        if (RET_IS_OK(ret)){
-            if (ret != SRN_OK) { // Has OK message
-                srn_chat_add_misc_message_fmt(chat,
-                       _("Autorun command: %1$s"), RET_MSG(ret));
-            }
-        } else {
-            srn_chat_add_error_message_fmt(chat,
-                       _("Autorun command: %1$s"), RET_MSG(ret));
-        }
-    }
+    /* Run server autorun commands once the server is registered */
+    srn_server_on_registered(srv, run_autorun_commands, NULL, NULL);
 
     return SRN_OK;
 }
@@ -340,6 +343,8 @@ SrnRet srn_application_rm_server(SrnApplication *app, SrnServer *srv) {
     if (app->cur_srv == srv) {
         app->cur_srv = NULL;
     }
+    // Server is freed, fail whoever is waiting for its registration
+    srn_server_finish_registered(srv, FALSE);
     app->srv_list = g_list_delete_link(app->srv_list, lst);
 
     srv_cfg = srv->cfg;
@@ -426,10 +431,44 @@ static void init_logger(SrnApplication *app) {
         // TODO
     }
     app->logger = srn_logger_new(app->logger_cfg);
+    app->prev_logger = srn_logger_get_default();
     srn_logger_set_default(app->logger);
 }
 
 static void finalize_logger(SrnApplication *app) {
+    srn_logger_set_default(app->prev_logger);
     srn_logger_free(app->logger);
     srn_logger_config_free(app->logger_cfg);
 }
+
+static void run_autorun_commands(SrnServer *srv, bool registered,
+        gpointer user_data){
+    if (!registered){
+        return;
+    }
+
+    for (GList *lst = srv->cfg->auto_run_cmd_list; lst; lst = g_list_next(lst)){
+        const char *cmd;
+        SrnRet ret;
+        SrnChat *chat;
+
+        cmd = lst->data;
+        chat = srv->chat;
+        ret = srn_chat_run_command(chat, cmd);
+
+        // NOTE: The server and chat may be invlid after running command
+        if (!srn_server_is_valid(srv) || !srn_server_is_chat_valid(srv, chat)){
+            return;
+        }
+
+        if (RET_IS_OK(ret)){
+            if (ret != SRN_OK) { // Has OK message
+                srn_chat_add_misc_message_fmt(chat,
+                       _("Autorun command: %1$s"), RET_MSG(ret));
+            }
+        } else {
+            srn_chat_add_error_message_fmt(chat,
+                       _("Autorun command: %1$s"), RET_MSG(ret));
+        }
+    }
+}
@@ -1,20 +1,38 @@
 #include "core/core.h"
+#include "i18n.h"
+#include "timer_wheel.h"
 
 SrnApplicationConfig *srn_application_config_new(void){
     SrnApplicationConfig *cfg;
 
     cfg = g_malloc0(sizeof(SrnApplicationConfig));
+    cfg->chat_log = srn_chat_log_config_new();
     cfg->ui = sui_application_config_new();
+    cfg->timer_slack = SRN_TIMER_WHEEL_SLACK;
+    cfg->reconn_concurrency = SRN_SERVER_RECONN_CONCURRENCY;
+    cfg->reconn_stable_time = SRN_SERVER_RECONN_STABLE_TIME;
 
     return cfg;
 }
 
 void srn_application_config_free(SrnApplicationConfig *cfg){
     g_list_free_full(cfg->auto_connect_srv_list, g_free);
+    srn_chat_log_config_free(cfg->chat_log);
     sui_application_config_free(cfg->ui);
     g_free(cfg);
 }
 
 SrnRet srn_application_config_check(SrnApplicationConfig *cfg){
-    return SRN_OK;
+    if (cfg->timer_slack < 0){
+        return RET_ERR(_("Invalid timer slack: %1$d"), cfg->timer_slack);
+    }
+    if (cfg->reconn_concurrency <= 0){
+        return RET_ERR(_("Invalid reconnect concurrency: %1$d"),
+                cfg->reconn_concurrency);
+    }
+    if (cfg->reconn_stable_time < 0){
+        return RET_ERR(_("Invalid reconnect stable time: %1$d"),
+                cfg->reconn_stable_time);
+    }
+    return srn_chat_log_config_check(cfg->chat_log);
 }
@@ -40,8 +40,10 @@
 #include "log.h"
 #include "meta.h"
 #include "utils.h"
+#include "timer_wheel.h"
 
 static gboolean irc_period_ping(gpointer user_data);
+static void update_user_origin(SircSession *sirc, SrnServerUser *srv_user);
 
 static void irc_event_connect(SircSession *sirc, const char *event);
 static void irc_event_connect_fail(SircSession *sirc, const char *event,
@@ -89,11 +91,16 @@ static void irc_event_pong(SircSession *sirc, const char *event,
         const char *origin, const char **params, int count);
 static void irc_event_error(SircSession *sirc, const char *event,
         const char *origin, const char **params, int count);
+static void irc_event_batch(SircSession *sirc, const char *event,
+        const char *origin, const char **params, int count);
 static void irc_event_welcome(SircSession *sirc, int event,
         const char *origin, const char *params[], int count);
 static void irc_event_numeric (SircSession *sirc, int event,
         const char *origin, const char *params[], int count);
 
+static void join_chats(SrnServer *srv);
+static void parse_isupport(SrnServer *srv, const char **params, int count);
+
 void srn_application_init_irc_event(SrnApplication *app) {
     app->irc_events.connect = irc_event_connect;
     app->irc_events.connect_fail = irc_event_connect_fail;
@@ -120,13 +127,16 @@ void srn_application_init_irc_event(SrnApplication *app) {
     app->irc_events.ping = irc_event_ping;
     app->irc_events.pong = irc_event_pong;
     app->irc_events.error = irc_event_error;
+    app->irc_events.batch = irc_event_batch;
     app->irc_events.numeric = irc_event_numeric;
 }
 
 static void irc_event_connect(SircSession *sirc, const char *event){
+    char *caps;
     GList *list;
     SrnRet ret;
     SrnServer *srv;
+    SrnServerAddr *addr;
     SrnChat *chat;
 
     srv = sirc_get_ctx(sirc);
@@ -139,6 +149,15 @@ static void irc_event_connect(SircSession *sirc, const char *event){
     srv->registered = FALSE;
     srv->loggedin = FALSE;
     srv->negotiated = FALSE;
+    srv->chats_joined = FALSE;
+    srv->join_targmax = 0;
+    g_hash_table_remove_all(srv->join_pending_table);
+
+    /* Addresses were attempted concurrently, see srn_server_connect_addrs() */
+    addr = g_list_nth_data(srv->cfg->addrs, sirc_get_addr_index(sirc));
+    if (addr){
+        srv->addr = addr;
+    }
 
     srn_chat_add_misc_message_fmt(srv->chat,
             _("Connected to %1$s(%2$s:%3$d)"),
@@ -151,9 +170,29 @@ static void irc_event_connect(SircSession *sirc, const char *event){
                 srv->name, srv->addr->host, srv->addr->port);
         list = g_list_next(list);
     }
+    if (srv->cfg->irc->tls){
+        int full;
+        int resumed;
 
-    /* Start client capability negotiation */
+        if (sirc_get_tls_stats(srv->irc, &full, &resumed)){
+            srn_chat_add_misc_message_fmt(srv->chat,
+                    _("TLS handshakes: %1$d full, %2$d resumed"),
+                    full, resumed);
+        }
+    }
+
+    /* Start client capability negotiation, capabilities enabled on last
+     * connection are requested without waiting for the reply of CAP LS.
+     * All registration commands are sent at once, the server holds
+     * registration until negotiation ends. */
     sirc_cmd_cap_ls(srv->irc, "302");
+    caps = srn_server_cap_speculate(srv->cap);
+    if (caps){
+        srn_chat_add_misc_message_fmt(srv->chat,
+                _("Requesting capabilities: %1$s"), caps);
+        sirc_cmd_cap_req(srv->irc, caps);
+        g_free(caps);
+    }
 
     if (srv->cfg->password){
         /* Send connection password, you should send it command before sending
@@ -202,7 +241,7 @@ static void irc_event_connect_fail(SircSession *sirc, const char *event,
                     srv->name,
                     srv->addr->host,
                     srv->addr->port,
-                    (srv->reconn_interval * 1.0) / 1000);
+                    (srv->reconn_delay * 1.0) / 1000);
         }
 
         list = g_list_next(list);
@@ -225,7 +264,7 @@ static void irc_event_connect_fail(SircSession *sirc, const char *event,
                 srv->name,
                 srv->addr->host,
                 srv->addr->port,
-                (srv->reconn_interval * 1.0) / 1000);
+                (srv->reconn_delay * 1.0) / 1000);
     }
 }
 
@@ -249,7 +288,7 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
     /* Stop period ping */
     if (srv->ping_timer){
         DBG_FR("Ping timer %d removed", srv->ping_timer);
-        g_source_remove(srv->ping_timer);
+        srn_timer_wheel_remove(srv->ping_timer);
         srv->ping_timer = 0;
     }
 
@@ -268,6 +307,13 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
     srv->loggedin = FALSE;
     srv->negotiated = FALSE;
 
+    /* Playback batches are never ended, show what has been replayed */
+    if (srv->playback_batches){
+        g_list_free_full(srv->playback_batches, g_free);
+        srv->playback_batches = NULL;
+        srn_server_finish_playback(srv);
+    }
+
     /* Mark all channels as unjoined */
     list = srv->chat_list;
     while (list){
@@ -286,7 +332,7 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
                     srv->name,
                     srv->addr->host,
                     srv->addr->port,
-                    (srv->reconn_interval * 1.0) / 1000);
+                    (srv->reconn_delay * 1.0) / 1000);
         }
 
         list = g_list_next(list);
@@ -301,7 +347,7 @@ static void irc_event_disconnect(SircSession *sirc, const char *event,
                 srv->name,
                 srv->addr->host,
                 srv->addr->port,
-                (srv->reconn_interval * 1.0) / 1000);
+                (srv->reconn_delay * 1.0) / 1000);
     }
 }
 
@@ -310,7 +356,6 @@ static void irc_event_welcome(SircSession *sirc, int event,
     bool try_login;
     bool nick_match;
     const char *nick ;
-    GList *list;
     SrnServer *srv;
 
     g_return_if_fail(count >= 1);
@@ -321,10 +366,14 @@ static void irc_event_welcome(SircSession *sirc, int event,
 
     // You have registered when you recived a RPL_WELCOME(001) message
     srv->registered = TRUE;
+    srn_chat_add_misc_message_fmt(srv->chat, _("Registered in %1$.2f seconds"),
+            (double)(g_get_monotonic_time() - srv->connect_time)
+            / G_USEC_PER_SEC);
 
     /* Start peroid ping */
     srv->last_pong = get_time_since_first_call_ms();
-    srv->ping_timer = g_timeout_add(SRN_SERVER_PING_INTERVAL, irc_period_ping, srv);
+    srv->ping_timer = srn_timer_wheel_add(SRN_SERVER_PING_INTERVAL,
+            irc_period_ping, srv);
     DBG_FR("Ping timer %d created", srv->ping_timer);
 
     // Set your actually nick
@@ -380,15 +429,10 @@ static void irc_event_welcome(SircSession *sirc, int event,
         }
     }
 
-    /* Join all channels already exists */
-    list = srv->chat_list;
-    while (list){
-        SrnChat *chat = list->data;
-        if (sirc_target_is_channel(srv->irc, chat->name)){
-            sirc_cmd_join(srv->irc, chat->name, chat->cfg->password);
-        }
-        list = g_list_next(list);
-    }
+    // Channels are joined after RPL_ISUPPORT, see join_chats()
+
+    // Resume whoever is waiting for registration
+    srn_server_finish_registered(srv, TRUE);
 }
 
 static void irc_event_nick(SircSession *sirc, const char *event,
@@ -488,8 +532,10 @@ static void irc_event_join(SircSession *sirc, const char *event,
 
     srv_user = srn_server_add_and_get_user(srv, origin);
     srn_server_user_set_is_online(srv_user, TRUE);
+    update_user_origin(sirc, srv_user);
     if (srv_user->is_me) {
         /* You has join a channel */
+        srn_server_set_join_pending(srv, chan, FALSE);
         srn_server_add_chat(srv, chan);
     }
 
@@ -756,6 +802,7 @@ static void irc_event_channel(SircSession *sirc, const char *event,
     g_return_if_fail(chat);
     chat_user = srn_chat_get_user(chat, origin);
     g_return_if_fail(chat_user);
+    update_user_origin(sirc, chat_user->srv_user);
 
     srn_chat_add_recv_message(chat, chat_user, msg);
 }
@@ -775,6 +822,7 @@ static void irc_event_privmsg(SircSession *sirc, const char *event,
     g_return_if_fail(srn_server_is_valid(srv));
     srv_user = srn_server_add_and_get_user(srv, origin);
     g_return_if_fail(srv_user);
+    update_user_origin(sirc, srv_user);
     if (sirc_target_is_servername(sirc, origin)
             || sirc_target_is_service(sirc, origin)){
         chat = srn_server_get_chat(srv, origin);
@@ -806,6 +854,7 @@ static void irc_event_notice(SircSession *sirc, const char *event,
     g_return_if_fail(srn_server_is_valid(srv));
     srv_user = srn_server_add_and_get_user(srv, origin);
     g_return_if_fail(srv_user);
+    update_user_origin(sirc, srv_user);
     if (sirc_target_is_servername(sirc, origin)
             || sirc_target_is_service(sirc, origin)){
         chat = srn_server_get_chat(srv, origin);
@@ -840,6 +889,7 @@ static void irc_event_channel_notice(SircSession *sirc, const char *event,
     g_return_if_fail(chat);
     chat_user = srn_chat_get_user(chat, origin);
     g_return_if_fail(chat_user);
+    update_user_origin(sirc, chat_user->srv_user);
 
     srn_chat_add_notice_message(chat, chat_user, msg);
 }
@@ -903,6 +953,7 @@ static void irc_event_ctcp_req(SircSession *sirc, const char *event,
     g_return_if_fail(chat);
     srv_user = srn_server_add_and_get_user(srv, origin);
     g_return_if_fail(srv_user);
+    update_user_origin(sirc, srv_user);
     chat_user = srn_chat_add_and_get_user(chat, srv_user);
     g_return_if_fail(chat_user);
 
@@ -1052,7 +1103,8 @@ static void irc_event_cap(SircSession *sirc, const char *event,
                 value++; // Skip '='
             }
             if (srn_server_cap_is_support(srv->cap, name, value)
-                    && RET_IS_OK(srn_server_cap_server_enable(srv->cap, name, TRUE))){
+                    && RET_IS_OK(srn_server_cap_server_enable(srv->cap, name, TRUE))
+                    && !srn_server_cap_is_speculated(srv->cap, name)){
                 g_string_append_printf(buf, "%s ", name);
             }
         }
@@ -1063,6 +1115,8 @@ static void irc_event_cap(SircSession *sirc, const char *event,
             srn_chat_add_misc_message_fmt(srv->chat,
                     _("Requesting capabilities: %1$s"), buf->str);
             sirc_cmd_cap_req(sirc, buf->str);
+        } else if (srv->cap->speculating){
+            // Wait for the reply of speculative request
         } else {
             srn_chat_add_misc_message_fmt(srv->chat,
                     _("No capability to be requested"));
@@ -1111,6 +1165,8 @@ static void irc_event_cap(SircSession *sirc, const char *event,
                     _("No acknowledged capability"));
         }
     } else if (g_ascii_strcasecmp(cap_event, "ACK") == 0){
+        // Speculative request is always replied first
+        srv->cap->speculating = FALSE;
         for (int i = 0; caps[i]; i++){
             bool enable;
             const char *name;
@@ -1133,6 +1189,11 @@ static void irc_event_cap(SircSession *sirc, const char *event,
             if (!RET_IS_OK(srn_server_cap_client_enable(srv->cap, name, enable))){
                 WARN_FR("Unknown capability: %s", name);
             }
+            if (enable){
+                // Speculated capability may be acknowledged without being
+                // listed in CAP LS reply
+                srn_server_cap_server_enable(srv->cap, name, TRUE);
+            }
 
             if (srn_server_cap_all_enabled(srv->cap)){
                 cap_end = TRUE;
@@ -1164,7 +1225,29 @@ static void irc_event_cap(SircSession *sirc, const char *event,
         srn_chat_add_misc_message_fmt(srv->chat,
                 _("Server has deleted capabilities: %1$s"), rawcaps);
     } else if (g_ascii_strcasecmp(cap_event, "NAK") == 0){
-        cap_end = TRUE;
+        if (srv->cap->speculating){
+            GString *buf;
+
+            /* Server no longer supports some of speculated capabilities,
+             * request the supported ones according to CAP LS reply */
+            srv->cap->speculating = FALSE;
+            buf = g_string_new(NULL);
+            for (int i = 0; caps[i]; i++){
+                if (srn_server_cap_server_is_enabled(srv->cap, caps[i])){
+                    g_string_append_printf(buf, "%s ", caps[i]);
+                }
+            }
+            if (buf->len > 0){
+                srn_chat_add_misc_message_fmt(srv->chat,
+                        _("Requesting capabilities: %1$s"), buf->str);
+                sirc_cmd_cap_req(sirc, buf->str);
+            } else {
+                cap_end = TRUE;
+            }
+            g_string_free(buf, TRUE);
+        } else {
+            cap_end = TRUE;
+        }
     } else {
         g_warn_if_reached();
     }
@@ -1333,6 +1416,55 @@ static void irc_event_error(SircSession *sirc, const char *event,
     srn_chat_add_error_message_fmt(srv->cur_chat, _("ERROR: %1$s"), msg);
 }
 
+/**
+ * @brief Backlog replayed by bouncer or CHATHISTORY is sent in a playback
+ * batch, its messages are held by chats and shown in bulk when all playback
+ * batches are ended, see srn_chat_flush_playback().
+ */
+static void irc_event_batch(SircSession *sirc, const char *event,
+        const char *origin, const char **params, int count){
+    const char *ref;
+    SrnServer *srv;
+
+    srv = sirc_get_ctx(sirc);
+    g_return_if_fail(srn_server_is_valid(srv));
+
+    g_return_if_fail(count >= 1);
+    ref = params[0];
+
+    if (ref[0] == '+'){
+        const char *type;
+
+        g_return_if_fail(count >= 2);
+        type = params[1];
+        // Batches nested in playback batch are playback as well
+        if (g_ascii_strcasecmp(type, "chathistory") == 0
+                || g_ascii_strcasecmp(type, "draft/chathistory") == 0
+                || g_ascii_strcasecmp(type, "znc.in/playback") == 0
+                || srn_server_is_playback(srv)){
+            srv->playback_batches = g_list_prepend(srv->playback_batches,
+                    g_strdup(ref + 1));
+            srn_server_start_playback(srv);
+        }
+    } else if (ref[0] == '-'){
+        GList *lst;
+
+        for (lst = srv->playback_batches; lst; lst = g_list_next(lst)){
+            if (g_str_equal(lst->data, ref + 1)){
+                break;
+            }
+        }
+        if (!lst){
+            return;
+        }
+        g_free(lst->data);
+        srv->playback_batches = g_list_delete_link(srv->playback_batches, lst);
+        if (!srv->playback_batches){
+            srn_server_finish_playback(srv);
+        }
+    }
+}
+
 static void irc_event_numeric(SircSession *sirc, int event,
         const char *origin, const char **params, int count){
     SrnServer *srv;
@@ -1346,6 +1478,14 @@ static void irc_event_numeric(SircSession *sirc, int event,
     chat_user = srn_chat_add_and_get_user(srv->chat, srv_user);
     g_return_if_fail(chat_user);
 
+    if (event == SIRC_RFC_RPL_ISUPPORT){
+        parse_isupport(srv, params, count);
+    }
+    /* RPL_ISUPPORT is always sent before MOTD */
+    if (event == SIRC_RFC_RPL_ENDOFMOTD || event == SIRC_RFC_ERR_NOMOTD){
+        join_chats(srv);
+    }
+
     switch (event) {
         case SIRC_RFC_RPL_WELCOME:
         case SIRC_RFC_RPL_YOURHOST:
@@ -1915,3 +2055,104 @@ static gboolean irc_period_ping(gpointer user_data){
 
     return G_SOURCE_CONTINUE;
 }
+
+/**
+ * @brief Update username and hostname of user from the prefix of message
+ * currently being handled, they are used for matching ignored hostmasks.
+ *
+ * @param sirc
+ * @param srv_user
+ */
+static void update_user_origin(SircSession *sirc, SrnServerUser *srv_user){
+    const char *user;
+    const char *host;
+
+    user = sirc_get_origin_user(sirc);
+    host = sirc_get_origin_host(sirc);
+    if (user && g_strcmp0(srv_user->username, user) != 0){
+        srn_server_user_set_username(srv_user, user);
+    }
+    if (host && g_strcmp0(srv_user->hostname, host) != 0){
+        srn_server_user_set_hostname(srv_user, host);
+    }
+}
+
+/**
+ * @brief Join all existing channels of server with as few JOIN messages as
+ * possible. Channels which are already joined or being joined, such as by
+ * autorun commands, are skipped.
+ */
+static void join_chats(SrnServer *srv){
+    int count;
+    const char **chans;
+    const char **passwds;
+
+    if (srv->chats_joined){
+        return;
+    }
+    srv->chats_joined = TRUE;
+
+    count = 0;
+    chans = g_malloc0_n(g_list_length(srv->chat_list), sizeof(char *));
+    passwds = g_malloc0_n(g_list_length(srv->chat_list), sizeof(char *));
+    for (GList *lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        SrnChat *chat;
+
+        chat = lst->data;
+        if (chat->is_joined || srn_server_is_join_pending(srv, chat->name)){
+            continue;
+        }
+        if (sirc_target_is_channel(srv->irc, chat->name)){
+            chans[count] = chat->name;
+            passwds[count] = chat->cfg->password;
+            count++;
+        }
+    }
+    if (count){
+        sirc_cmd_join_list(srv->irc, chans, passwds, count, srv->join_targmax);
+        for (int i = 0; i < count; i++){
+            srn_server_set_join_pending(srv, chans[i], TRUE);
+        }
+    }
+    g_free(chans);
+    g_free(passwds);
+}
+
+/**
+ * @brief Parse parameters we care about in RPL_ISUPPORT, such as
+ * ``TARGMAX=JOIN:4,PRIVMSG:4`` and ``CASEMAPPING=rfc1459``.
+ */
+static void parse_isupport(SrnServer *srv, const char **params, int count){
+    // The first param is nick and the last one is human-readable message
+    for (int i = 1; i < count - 1; i++){
+        char **targets;
+
+        if (g_str_has_prefix(params[i], "CASEMAPPING=")){
+            const char *val;
+
+            val = params[i] + strlen("CASEMAPPING=");
+            if (g_ascii_strcasecmp(val, "ascii") == 0){
+                srn_server_set_casemapping(srv, SRN_CASEMAPPING_ASCII);
+            } else if (g_ascii_strcasecmp(val, "strict-rfc1459") == 0){
+                srn_server_set_casemapping(srv, SRN_CASEMAPPING_STRICT_RFC1459);
+            } else if (g_ascii_strcasecmp(val, "rfc1459") == 0){
+                srn_server_set_casemapping(srv, SRN_CASEMAPPING_RFC1459);
+            } else {
+                WARN_FR("Unsupported casemapping: %s", val);
+            }
+            continue;
+        }
+        if (!g_str_has_prefix(params[i], "TARGMAX=")){
+            continue;
+        }
+        targets = g_strsplit(params[i] + strlen("TARGMAX="), ",", 0);
+        for (int j = 0; targets[j]; j++){
+            if (g_ascii_strncasecmp(targets[j], "JOIN:", strlen("JOIN:")) == 0){
+                // Empty value means unlimited
+                srv->join_targmax = atoi(targets[j] + strlen("JOIN:"));
+                DBG_FR("Max targets of JOIN: %d", srv->join_targmax);
+            }
+        }
+        g_strfreev(targets);
+    }
+}
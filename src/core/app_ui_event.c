@@ -58,6 +58,7 @@ static SrnRet ui_event_invite(SuiBuffer *sui, SuiEvent event, GVariantDict *para
 static SrnRet ui_event_whois(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 static SrnRet ui_event_ignore(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 static SrnRet ui_event_cutover(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
+static SrnRet ui_event_load_history(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 static SrnRet ui_event_chan_list(SuiBuffer *sui, SuiEvent event, GVariantDict *params);
 
 void srn_application_init_ui_event(SrnApplication *app){
@@ -82,6 +83,7 @@ void srn_application_init_ui_event(SrnApplication *app){
     app->ui_events.ignore = ui_event_ignore;
     app->ui_events.cutover = ui_event_cutover;
     app->ui_events.chan_list = ui_event_chan_list;
+    app->ui_events.load_history = ui_event_load_history;
 }
 
 static SrnRet ui_event_open(SuiApplication *app, SuiEvent event, GVariantDict *params){
@@ -127,6 +129,13 @@ static SrnRet ui_event_activate(SuiApplication *app, SuiEvent event, GVariantDic
 }
 
 static SrnRet ui_event_shutdown(SuiApplication *app, SuiEvent event, GVariantDict *params){
+    SrnApplication *srn_app;
+
+    srn_app = sui_application_get_ctx(app);
+    /* Write all pending chat logs */
+    srn_chat_log_writer_free(srn_app->chat_log_writer);
+    srn_app->chat_log_writer = NULL;
+
     return SRN_OK;
 }
 
@@ -412,6 +421,17 @@ static SrnRet ui_event_chan_list(SuiBuffer *sui, SuiEvent event, GVariantDict *p
     return sirc_cmd_list(srv->irc, NULL, NULL);
 }
 
+static SrnRet ui_event_load_history(SuiBuffer *sui, SuiEvent event, GVariantDict *params){
+    SrnChat *chat;
+
+    chat = ctx_get_chat(sui);
+    g_return_val_if_fail(chat, SRN_ERR);
+
+    srn_chat_load_history(chat, SRN_CHAT_HISTORY_LINES);
+
+    return SRN_OK;
+}
+
 /* Get a SrnServer object from SuiBuffer context (sui->ctx) */
 static SrnServer* ctx_get_server(SuiBuffer *sui){
     SrnChat *chat;
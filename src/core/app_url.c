@@ -35,6 +35,8 @@
 #include "utils.h"
 
 static SrnRet join_comma_separated_chans(SrnServer *srv, const char *comma_chans);
+static void on_server_registered(SrnServer *srv, bool registered,
+        gpointer user_data);
 
 SrnRet srn_application_open_url(SrnApplication *app, const char *url){
     const char *scheme;
@@ -44,6 +46,7 @@ SrnRet srn_application_open_url(SrnApplication *app, const char *url){
     int port;
     const char *path;
     const char *fragment;
+    char *chans;
     SoupURI *suri;
     SrnRet ret;
     SrnServer *srv;
@@ -51,6 +54,7 @@ SrnRet srn_application_open_url(SrnApplication *app, const char *url){
     SrnServerAddr *addr;
 
     ret = SRN_ERR;
+    chans = NULL;
     srv = NULL;
     cfg = NULL;
     addr = NULL;
@@ -75,6 +79,13 @@ SrnRet srn_application_open_url(SrnApplication *app, const char *url){
     path = soup_uri_get_path(suri);
     fragment = soup_uri_get_fragment(suri);
 
+    /*  Channels in URL path and fragment */
+    if (path && path[0] == '/') {
+        path++;    // Skip root of URL path
+    }
+    chans = g_strdup_printf("%s,%s",
+            path ? path : "", fragment ? fragment : "");
+
     addr = srn_server_addr_new(host, port);
     // Try looking for server with the same address in server list
     srv = srn_application_get_server_by_addr(app, addr);
@@ -128,7 +139,11 @@ SrnRet srn_application_open_url(SrnApplication *app, const char *url){
             goto FIN;
         }
 
-        srn_server_wait_until_registered(srv);
+        // Channels are joined after registration
+        srn_server_on_registered(srv, on_server_registered, chans, g_free);
+        chans = NULL; // Ownership changed to continuation
+        ret = SRN_OK;
+        goto FIN;
     }
 
     if (!srn_server_is_registered(srv)){
@@ -137,28 +152,18 @@ SrnRet srn_application_open_url(SrnApplication *app, const char *url){
     }
 
     /*  Join channels in URL */
-    if (!str_is_empty(path)){
-        if (path[0] == '/') {
-            path++;    // Skip root of URL path
-        }
-        ret = join_comma_separated_chans(srv, path);
-        if (!RET_IS_OK(ret)) {
-            ret = RET_ERR(_("Failed to join channel on server \"%1$s\": %2$s"),
-                    srv->name, RET_MSG(ret));
-            goto FIN;
-        }
-    }
-    if (!str_is_empty(fragment)){
-        ret = join_comma_separated_chans(srv, fragment);
-        if (!RET_IS_OK(ret)) {
-            ret = RET_ERR(_("Failed to join channel on server \"%1$s\": %2$s"),
-                    srv->name, RET_MSG(ret));
-            goto FIN;
-        }
+    ret = join_comma_separated_chans(srv, chans);
+    if (!RET_IS_OK(ret)) {
+        ret = RET_ERR(_("Failed to join channel on server \"%1$s\": %2$s"),
+                srv->name, RET_MSG(ret));
+        goto FIN;
     }
 
     ret = SRN_OK;
 FIN:
+    if (chans){
+        g_free(chans);
+    }
     if (suri){
         soup_uri_free(suri);
     }
@@ -224,3 +229,23 @@ static SrnRet join_comma_separated_chans(SrnServer *srv, const char *comma_chans
 
     return ret;
 }
+
+static void on_server_registered(SrnServer *srv, bool registered,
+        gpointer user_data){
+    const char *chans;
+    SrnRet ret;
+
+    chans = user_data;
+    if (!registered){
+        srn_chat_add_error_message_fmt(srv->chat,
+                _("Failed to register on server \"%1$s\""), srv->name);
+        return;
+    }
+
+    ret = join_comma_separated_chans(srv, chans);
+    if (!RET_IS_OK(ret)) {
+        srn_chat_add_error_message_fmt(srv->chat,
+                _("Failed to join channel on server \"%1$s\": %2$s"),
+                srv->name, RET_MSG(ret));
+    }
+}
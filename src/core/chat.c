@@ -29,14 +29,35 @@
 #include "utils.h"
 #include "config/config.h"
 #include "extra_data.h"
+#include "path.h"
 
 #include "sirc/sirc.h"
 
+typedef struct _PendingMessage {
+    SrnChat *chat;
+    SrnMessage *msg;
+    SrnFilterFlags fflags;
+    SrnRenderJob *job; // Not NULL when message is being rendered
+    SrnRet ret;
+    bool playback; // Message is replayed in a playback batch
+    char *msgid;   // "msgid" tag of message
+} PendingMessage;
+
+static void queue_message(SrnChat *self, SrnMessage *msg,
+        SrnRenderFlags rflags, SrnFilterFlags fflags);
+static void on_message_rendered(SrnMessage *msg, SrnRet ret, void *user_data);
+static void commit_messages(SrnChat *self);
 static void add_message(SrnChat *self, SrnMessage *msg);
+static void add_playback_messages(SrnChat *self);
+static bool is_logged(SrnChat *self, gint64 time, const char *msgid);
+static void update_last_log(SrnChat *self, SrnMessage *msg, const char *msgid);
+static SrnMessage* history_message_new(SrnChat *self,
+        SrnScrollbackEntry *entry);
 
 SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type,
         SrnChatConfig *cfg){
     SrnChat *self;
+    char *log_dir;
     SuiBufferEvents *events;
 
     self = g_malloc0(sizeof(SrnChat));
@@ -49,6 +70,7 @@ SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type,
     self->user = srn_chat_add_and_get_user(self, srv->user);
     self->_user = srn_chat_add_and_get_user(self, srv->_user);
     self->extra_data = srn_extra_data_new();
+    self->pending_msg_queue = g_queue_new();
 
     // Init self->ui
     events = &srn_application_get_default()->ui_events;
@@ -67,11 +89,33 @@ SrnChat* srn_chat_new(SrnServer *srv, const char *name, SrnChatType type,
             g_warn_if_reached();
     }
 
+    // Recent history is loaded when the chat is viewed for the first time
+    log_dir = srn_get_log_dir(srv->name);
+    self->scrollback = srn_scrollback_new(log_dir, self->name);
+    self->last_log_time = srn_scrollback_get_last_time(self->scrollback);
+    g_free(log_dir);
+
     return self;
 }
 
 void srn_chat_free(SrnChat *self){
+    PendingMessage *pmsg;
+
+    // Drop messages which are not yet committed
+    while ((pmsg = g_queue_pop_head(self->pending_msg_queue))){
+        if (pmsg->job){
+            srn_render_job_cancel(pmsg->job);
+        }
+        srn_message_free(pmsg->msg);
+        g_free(pmsg->msgid);
+        g_free(pmsg);
+    }
+    g_queue_free(self->pending_msg_queue);
+    g_list_free_full(self->playback_msg_list, (GDestroyNotify)srn_message_free);
+    srn_scrollback_free(self->scrollback);
+
     str_assign(&self->name, NULL);
+    str_assign(&self->last_log_msgid, NULL);
 
     srn_extra_data_free(self->extra_data);
 
@@ -172,20 +216,7 @@ void srn_chat_add_sent_message(SrnChat *self, const char *content){
     fflags = SRN_FILTER_FLAG_LOG;
     msg = srn_message_new(self, user, content, SRN_MESSAGE_TYPE_SENT);
 
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-    if (!srn_filter_message(msg, fflags)){
-        /* Ignore this message */
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, fflags);
 }
 
 void srn_chat_add_recv_message(SrnChat *self, SrnChatUser *user, const char *content){
@@ -202,19 +233,7 @@ void srn_chat_add_recv_message(SrnChat *self, SrnChatUser *user, const char *con
     fflags = SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN | SRN_FILTER_FLAG_LOG;
 
     msg = srn_message_new(self, user, content, SRN_MESSAGE_TYPE_RECV);
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-    if (!srn_filter_message(msg, fflags)){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, fflags);
 }
 
 void srn_chat_add_notice_message(SrnChat *self, SrnChatUser *user, const char *content){
@@ -231,19 +250,7 @@ void srn_chat_add_notice_message(SrnChat *self, SrnChatUser *user, const char *c
     fflags = SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN | SRN_FILTER_FLAG_LOG;
 
     msg = srn_message_new(self, user, content, SRN_MESSAGE_TYPE_NOTICE);
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-    if (!srn_filter_message(msg, fflags)){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, fflags);
 }
 
 void srn_chat_add_action_message(SrnChat *self, SrnChatUser *user, const char *content){
@@ -264,23 +271,7 @@ void srn_chat_add_action_message(SrnChat *self, SrnChatUser *user, const char *c
         fflags |= SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN;
         rflags |= SRN_RENDER_FLAG_PATTERN | SRN_RENDER_FLAG_MENTION;
     }
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-    if (!srn_filter_message(msg, fflags)){
-        goto cleanup;
-    }
-
-    if (!msg->ui){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, fflags);
 }
 
 /**
@@ -302,15 +293,7 @@ void srn_chat_add_misc_message(SrnChat *self, const char *content){
 
     rflags = SRN_RENDER_FLAG_URL;
     msg = srn_message_new(self, self->_user, content, SRN_MESSAGE_TYPE_MISC);
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, 0);
 }
 
 /**
@@ -340,18 +323,7 @@ void srn_chat_add_misc_message_with_user(SrnChat *self, SrnChatUser *user,
     rflags = SRN_RENDER_FLAG_URL;
     fflags = SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN | SRN_FILTER_FLAG_LOG;
     msg = srn_message_new(self, user, content, SRN_MESSAGE_TYPE_MISC);
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-    if (!srn_filter_message(msg, fflags)){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, fflags);
 }
 
 void srn_chat_add_misc_message_with_user_fmt(SrnChat *self, SrnChatUser *user,
@@ -378,15 +350,7 @@ void srn_chat_add_error_message(SrnChat *self, const char *content){
 
     rflags = SRN_RENDER_FLAG_URL;
     msg = srn_message_new(self, self->_user, content, SRN_MESSAGE_TYPE_ERROR);
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, 0);
 }
 
 /**
@@ -416,19 +380,7 @@ void srn_chat_add_error_message_with_user(SrnChat *self, SrnChatUser *user,
     rflags = SRN_RENDER_FLAG_URL;
     fflags = SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN | SRN_FILTER_FLAG_LOG;
     msg = srn_message_new(self, user, content, SRN_MESSAGE_TYPE_ERROR);
-    if (srn_render_message(msg, rflags) != SRN_OK){
-        goto cleanup;
-    }
-    if (!srn_filter_message(msg, fflags)){
-        goto cleanup;
-    }
-
-    add_message(self, msg);
-
-    return;
-
-cleanup:
-    srn_message_free(msg);
+    queue_message(self, msg, rflags, fflags);
 }
 
 void srn_chat_add_error_message_with_user_fmt(SrnChat *self, SrnChatUser *user,
@@ -465,6 +417,230 @@ void srn_chat_set_topic_setter(SrnChat *self, const char *setter){
     sui_set_topic_setter(self->ui, setter);
 }
 
+/**
+ * @brief ``srn_chat_load_history`` reads history messages from chat logs and
+ * adds them to the top of chat, messages older than the ones loaded by last
+ * call are loaded.
+ *
+ * History messages are neither filtered nor logged, and never notified.
+ *
+ * @param self
+ * @param count Max count of loaded messages
+ *
+ * @return Count of loaded messages
+ */
+int srn_chat_load_history(SrnChat *self, int count){
+    int n;
+    GList *entries;
+
+    n = srn_scrollback_read(self->scrollback, count, &entries);
+
+    // Prepend from the newest one
+    for (GList *lst = g_list_last(entries); lst; lst = g_list_previous(lst)){
+        SrnMessage *msg;
+
+        msg = history_message_new(self, lst->data);
+        if (!msg){
+            continue;
+        }
+        srn_message_create_ui(msg);
+        self->msg_list = g_list_prepend(self->msg_list, msg);
+        sui_buffer_prepend_message(self->ui, msg->ui);
+    }
+    g_list_free_full(entries, (GDestroyNotify)srn_scrollback_entry_free);
+
+    return n;
+}
+
+/**
+ * @brief ``srn_chat_start_playback`` is called when a playback batch is
+ * opened, playback messages are held until the batch is ended.
+ *
+ * @param self
+ */
+void srn_chat_start_playback(SrnChat *self){
+    self->playback_flush = FALSE;
+}
+
+/**
+ * @brief ``srn_chat_flush_playback`` shows playback messages of chat in bulk
+ * once all of them are rendered.
+ *
+ * @param self
+ */
+void srn_chat_flush_playback(SrnChat *self){
+    self->playback_flush = TRUE;
+    commit_messages(self);
+}
+
+/**
+ * @brief Filter message by its sender and raw content, then render it in
+ * background, the message will be added to chat in the order of calling
+ * this function.
+ *
+ * @param self
+ * @param msg
+ * @param rflags
+ * @param fflags
+ */
+static void queue_message(SrnChat *self, SrnMessage *msg,
+        SrnRenderFlags rflags, SrnFilterFlags fflags){
+    gint64 time;
+    PendingMessage *pmsg;
+
+    /* Use time given by server-time capability */
+    time = sirc_get_message_time(self->srv->irc);
+    if (time){
+        GDateTime *date;
+
+        date = g_date_time_new_from_unix_local(time / G_USEC_PER_SEC);
+        srn_message_set_time(msg, date);
+        g_date_time_unref(date);
+    }
+
+    /* Drop message as early as possible */
+    if (!srn_filter_message(msg, fflags & SRN_FILTER_FLAG_PRE_RENDER)){
+        srn_message_free(msg);
+        return;
+    }
+
+    pmsg = g_malloc0(sizeof(PendingMessage));
+    pmsg->chat = self;
+    pmsg->msg = msg;
+    pmsg->fflags = fflags & ~(SRN_FILTER_FLAG_PRE_RENDER);
+    pmsg->playback = srn_server_is_playback(self->srv);
+    pmsg->msgid = g_strdup(sirc_get_message_msgid(self->srv->irc));
+    if (pmsg->playback){
+        // Replayed messages are not notified, and not logged twice
+        if (is_logged(self, time, pmsg->msgid)){
+            pmsg->fflags &= ~SRN_FILTER_FLAG_LOG;
+        }
+        self->playback_pending++;
+    }
+    pmsg->job = srn_render_job_new(msg, rflags, on_message_rendered, pmsg);
+    g_queue_push_tail(self->pending_msg_queue, pmsg);
+
+    // NOTE: on_message_rendered() may be called before returning
+    srn_render_job_submit(pmsg->job);
+}
+
+static void on_message_rendered(SrnMessage *msg, SrnRet ret, void *user_data){
+    PendingMessage *pmsg;
+
+    pmsg = user_data;
+    pmsg->job = NULL;
+    pmsg->ret = ret;
+
+    commit_messages(pmsg->chat);
+}
+
+/**
+ * @brief Filter and add all rendered messages at the head of pending queue.
+ *
+ * Playback messages are held until ``srn_chat_flush_playback()`` is called
+ * or a live message follows them, then added in bulk.
+ *
+ * @param self
+ */
+static void commit_messages(SrnChat *self){
+    PendingMessage *pmsg;
+
+    while ((pmsg = g_queue_peek_head(self->pending_msg_queue))
+            && !pmsg->job){
+        SrnMessage *msg;
+
+        g_queue_pop_head(self->pending_msg_queue);
+        msg = pmsg->msg;
+        if (pmsg->playback){
+            self->playback_pending--;
+        } else if (self->playback_msg_list){
+            // Keep the order of messages
+            add_playback_messages(self);
+        }
+
+        if (!RET_IS_OK(pmsg->ret)
+                || !srn_filter_message(msg, pmsg->fflags)){
+            srn_message_free(msg);
+        } else {
+            if (pmsg->fflags & SRN_FILTER_FLAG_LOG){
+                update_last_log(self, msg, pmsg->msgid);
+            }
+            if (pmsg->playback){
+                self->playback_msg_list = g_list_prepend(
+                        self->playback_msg_list, msg);
+            } else {
+                srn_message_create_ui(msg);
+                add_message(self, msg);
+            }
+        }
+        g_free(pmsg->msgid);
+        g_free(pmsg);
+    }
+
+    if (self->playback_flush && !self->playback_pending){
+        add_playback_messages(self);
+        self->playback_flush = FALSE;
+    }
+}
+
+static SrnMessage* history_message_new(SrnChat *self,
+        SrnScrollbackEntry *entry){
+    SrnChatUser *user;
+    SrnMessage *msg;
+    SrnMessageType type;
+    SrnRenderFlags rflags;
+
+    rflags = SRN_RENDER_FLAG_URL;
+    if (self->cfg->render_mirc_color) {
+        rflags |= SRN_RENDER_FLAG_MIRC_COLORIZE;
+    } else {
+        rflags |= SRN_RENDER_FLAG_MIRC_STRIP;
+    }
+
+    switch (entry->type){
+        case SRN_SCROLLBACK_ENTRY_SENT:
+            type = SRN_MESSAGE_TYPE_SENT;
+            user = self->user;
+            break;
+        case SRN_SCROLLBACK_ENTRY_RECV:
+            type = SRN_MESSAGE_TYPE_RECV;
+            user = self->_user;
+            break;
+        case SRN_SCROLLBACK_ENTRY_ACTION:
+            type = SRN_MESSAGE_TYPE_ACTION;
+            user = self->_user;
+            break;
+        case SRN_SCROLLBACK_ENTRY_MISC:
+            type = SRN_MESSAGE_TYPE_MISC;
+            user = self->_user;
+            break;
+        case SRN_SCROLLBACK_ENTRY_ERROR:
+            type = SRN_MESSAGE_TYPE_ERROR;
+            user = self->_user;
+            break;
+        default:
+            g_warn_if_reached();
+            return NULL;
+    }
+    g_return_val_if_fail(user, NULL);
+
+    msg = srn_message_new(self, user, entry->content, type);
+    srn_message_set_time(msg, entry->time);
+    /* Historical senders may have left long ago, show their nicks without
+     * adding them to user list of chat and server */
+    if (entry->sender
+            && (type == SRN_MESSAGE_TYPE_RECV || type == SRN_MESSAGE_TYPE_ACTION)){
+        g_free(msg->rendered_sender);
+        msg->rendered_sender = g_markup_escape_text(entry->sender, -1);
+    }
+    if (!RET_IS_OK(srn_render_message(msg, rflags))){
+        srn_message_free(msg);
+        return NULL;
+    }
+
+    return msg;
+}
+
 static void add_message(SrnChat *self, SrnMessage *msg){
     self->msg_list = g_list_append(self->msg_list, msg);
     self->last_msg = msg;
@@ -477,3 +653,61 @@ static void add_message(SrnChat *self, SrnMessage *msg){
         sui_notify_message(msg->ui);
     }
 }
+
+/**
+ * @brief Add all held playback messages to chat at once, without notifying.
+ *
+ * @param self
+ */
+static void add_playback_messages(SrnChat *self){
+    GList *lst;
+    GList *msgs;
+
+    if (!self->playback_msg_list){
+        return;
+    }
+
+    msgs = NULL;
+    self->playback_msg_list = g_list_reverse(self->playback_msg_list);
+    for (lst = self->playback_msg_list; lst; lst = g_list_next(lst)){
+        SrnMessage *msg;
+
+        msg = lst->data;
+        srn_message_create_ui(msg);
+        msgs = g_list_prepend(msgs, msg->ui);
+        self->last_msg = msg;
+    }
+    msgs = g_list_reverse(msgs);
+
+    self->msg_list = g_list_concat(self->msg_list, self->playback_msg_list);
+    self->playback_msg_list = NULL;
+
+    sui_buffer_add_messages(self->ui, msgs);
+    g_list_free(msgs);
+}
+
+/**
+ * @brief Whether a playback message is already in chat logs. It is if it is
+ * the newest logged one or not newer than it, in seconds as chat logs are.
+ * Message without server time is assumed to be logged.
+ */
+static bool is_logged(SrnChat *self, gint64 time, const char *msgid){
+    if (msgid && g_strcmp0(msgid, self->last_log_msgid) == 0){
+        return TRUE;
+    }
+    if (!time){
+        return TRUE;
+    }
+
+    return time / G_USEC_PER_SEC <= self->last_log_time;
+}
+
+static void update_last_log(SrnChat *self, SrnMessage *msg, const char *msgid){
+    gint64 time;
+
+    time = g_date_time_to_unix(msg->time);
+    if (time >= self->last_log_time){
+        self->last_log_time = time;
+        str_assign(&self->last_log_msgid, msgid);
+    }
+}
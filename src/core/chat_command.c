@@ -43,6 +43,11 @@
 #include "filter/filter.h"
 #include "utils.h"
 #include "pattern_set.h"
+#include "hostmask.h"
+#include "chat_log.h"
+#include "message_store.h"
+#include "log_grep.h"
+#include "path.h"
 #include "chat_command.h"
 
 typedef struct _SrnChatCommandContext {
@@ -51,6 +56,34 @@ typedef struct _SrnChatCommandContext {
     SrnChat *chat;
 } SrnChatCommandContext;
 
+typedef struct _SrnSearchJob {
+    char *srv_name; // Where search results are shown
+    char *chat_name;
+    SrnMessageStore *store;
+    SrnChatLogWriter *writer;
+    SrnMessageStoreQuery *query;
+    GList *results;
+    SrnRet ret;
+    gint64 elapsed;
+} SrnSearchJob;
+
+typedef struct _SrnGrepContext {
+    char *srv_name; // Where matched lines are shown
+    char *chat_name;
+    gint64 start_time;
+} SrnGrepContext;
+
+static gpointer search_thread(gpointer user_data);
+static gboolean finish_search(gpointer user_data);
+static char* search_result_location(SrnSearchJob *job,
+        SrnMessageStoreResult *res);
+static void on_grep_match(const SrnLogGrepMatch *match, gpointer user_data);
+static void on_grep_finish(int nmatch, gpointer user_data);
+static SrnChat* grep_context_get_chat(SrnGrepContext *ctx);
+static SrnRet parse_date(const char *str, bool end_of_day, gint64 *time);
+static void on_server_registered(SrnServer *srv, bool registered,
+        gpointer user_data);
+
 static SrnApplication* ctx_get_app(SrnChatCommandContext *cctx);
 static SrnServer* ctx_get_server(SrnChatCommandContext *cctx);
 static SrnChat* ctx_get_chat(SrnChatCommandContext *cctx);
@@ -164,10 +197,7 @@ SrnRet on_command_server(SrnCommand *cmd, void *user_data){
             return ret;
         }
 
-        srn_server_wait_until_registered(srv); // FIXME: busy wait
-        if (!srn_server_is_registered(srv)){
-            return RET_ERR(_("Failed to register on server \"%1$s\""), name);
-        }
+        srn_server_on_registered(srv, on_server_registered, NULL, NULL);
 
         return SRN_OK;
     }
@@ -301,11 +331,7 @@ SrnRet on_command_connect(SrnCommand *cmd, void *user_data){
         goto FIN;
     }
 
-    srn_server_wait_until_registered(srv);
-    if (!srn_server_is_registered(srv)){
-        ret = RET_ERR(_("Failed to register on server \"%1$s\""), srv->name);
-        goto FIN;
-    }
+    srn_server_on_registered(srv, on_server_registered, NULL, NULL);
 
     ret = SRN_OK;
 FIN:
@@ -340,6 +366,26 @@ SrnRet on_command_ignore(SrnCommand *cmd, void *user_data){
     }
     g_return_val_if_fail(chat, SRN_ERR);
 
+    /* Hostmasks are always ignored in whole server */
+    if (srn_hostmask_is_mask(nick)){
+        char *mask;
+        SrnRet ret;
+
+        ret = srn_hostmask_set_add(chat->srv->ignore_masks, nick);
+        if (!RET_IS_OK(ret)){
+            return ret;
+        }
+        // Persist the mask in the same form as ignore set
+        mask = srn_hostmask_normalize(nick);
+        chat->srv->ignore_mask_list = g_list_append(
+                chat->srv->ignore_mask_list, mask);
+        ret = srn_server_save_ignore_mask_list(chat->srv);
+        if (!RET_IS_OK(ret)){
+            return ret;
+        }
+        return RET_OK(_("\"%1$s\" has ignored"), mask);
+    }
+
     user = srn_server_get_user(chat->srv, nick);
     if(!user){
         user = srn_server_add_and_get_user(chat->srv, nick);
@@ -368,6 +414,40 @@ SrnRet on_command_unignore(SrnCommand *cmd, void *user_data){
         g_return_val_if_fail(srv, SRN_ERR);
         chat = srv->chat;
     }
+    g_return_val_if_fail(chat, SRN_ERR);
+
+    if (srn_hostmask_is_mask(nick)){
+        char *mask;
+        SrnRet ret;
+        GList *lst;
+
+        ret = srn_hostmask_set_rm(chat->srv->ignore_masks, nick);
+        if (!RET_IS_OK(ret)){
+            return ret;
+        }
+        mask = srn_hostmask_normalize(nick);
+        lst = chat->srv->ignore_mask_list;
+        while (lst){
+            GList *next;
+            char *tmp;
+
+            next = g_list_next(lst);
+            tmp = srn_hostmask_normalize(lst->data);
+            if (g_strcmp0(tmp, mask) == 0){
+                g_free(lst->data);
+                chat->srv->ignore_mask_list = g_list_delete_link(
+                        chat->srv->ignore_mask_list, lst);
+            }
+            g_free(tmp);
+            lst = next;
+        }
+        ret = srn_server_save_ignore_mask_list(chat->srv);
+        if (RET_IS_OK(ret)){
+            ret = RET_OK(_("\"%1$s\" has unignored"), mask);
+        }
+        g_free(mask);
+        return ret;
+    }
 
     user = srn_server_get_user(chat->srv, nick);
     if(!user){
@@ -478,6 +558,7 @@ SrnRet on_command_join(SrnCommand *cmd, void *user_data){
     const char *chan;
     const char *passwd;
     SrnServer *srv;
+    SrnRet ret;
 
     srv = ctx_get_server(user_data);
     g_return_val_if_fail(srv, SRN_ERR);
@@ -487,7 +568,12 @@ SrnRet on_command_join(SrnCommand *cmd, void *user_data){
 
     g_return_val_if_fail(chan, SRN_ERR);
 
-    return sirc_cmd_join(srv->irc, chan, passwd);
+    ret = sirc_cmd_join(srv->irc, chan, passwd);
+    if (RET_IS_OK(ret)){
+        srn_server_set_join_pending(srv, chan, TRUE);
+    }
+
+    return ret;
 }
 
 SrnRet on_command_part(SrnCommand *cmd, void *user_data){
@@ -888,10 +974,389 @@ SrnRet on_command_unrender(SrnCommand *cmd, void *user_data){
             srv_user->nick, chat->name, pattern);
 }
 
+SrnRet on_command_search(SrnCommand *cmd, void *user_data){
+    const char *words;
+    const char *val;
+    SrnApplication *app;
+    SrnChat *chat;
+    SrnMessageStore *store;
+    SrnMessageStoreQuery *query;
+    SrnSearchJob *job;
+    SrnRet ret;
+
+    app = ctx_get_app(user_data);
+    g_return_val_if_fail(app, SRN_ERR);
+    chat = ctx_get_chat(user_data);
+    g_return_val_if_fail(chat, SRN_ERR);
+
+    if (!app->chat_log_writer
+            || !(store = srn_chat_log_writer_get_store(app->chat_log_writer))){
+        return RET_ERR(_("Message store is disabled, please set \"chat-log.store\" to true"));
+    }
+
+    query = srn_message_store_query_new();
+
+    /* Search current chat by default, or all chats of server if command is
+     * run in server chat */
+    if (!srn_command_get_opt(cmd, "-all", NULL)){
+        query->srv_name = g_strdup(chat->srv->name);
+        if (chat != chat->srv->chat){
+            query->chat_name = g_strdup(chat->name);
+        }
+    }
+    if (srn_command_get_opt(cmd, "-server", &val)){
+        str_assign(&query->srv_name, val);
+        str_assign(&query->chat_name, NULL);
+    }
+    if (srn_command_get_opt(cmd, "-chat", &val)){
+        str_assign(&query->chat_name, val);
+    }
+    if (srn_command_get_opt(cmd, "-from", &val)){
+        str_assign(&query->sender, val);
+    }
+    if (srn_command_get_opt(cmd, "-since", &val)){
+        ret = parse_date(val, FALSE, &query->since);
+        if (!RET_IS_OK(ret)){
+            srn_message_store_query_free(query);
+            return ret;
+        }
+    }
+    if (srn_command_get_opt(cmd, "-until", &val)){
+        ret = parse_date(val, TRUE, &query->until);
+        if (!RET_IS_OK(ret)){
+            srn_message_store_query_free(query);
+            return ret;
+        }
+    }
+    if (srn_command_get_opt(cmd, "-limit", &val)){
+        query->limit = g_ascii_strtoll(val, NULL, 10);
+        if (query->limit <= 0){
+            srn_message_store_query_free(query);
+            return RET_ERR(_("Invalid limit: %1$s"), val);
+        }
+    }
+    words = srn_command_get_arg(cmd, 0);
+    if (words){
+        str_assign(&query->text, words);
+    }
+    if (!query->text && !query->sender){
+        srn_message_store_query_free(query);
+        return RET_ERR(_("Nothing to search, please specify words or sender"));
+    }
+
+    job = g_malloc0(sizeof(SrnSearchJob));
+    job->srv_name = g_strdup(chat->srv->name);
+    job->chat_name = g_strdup(chat->name);
+    job->store = store;
+    job->writer = app->chat_log_writer;
+    job->query = query;
+    // Released by search thread, writer is not freed until then
+    srn_chat_log_writer_hold(job->writer);
+    g_thread_unref(g_thread_new("search", search_thread, job));
+
+    return RET_OK(_("Searching..."));
+}
+
+SrnRet on_command_grep(SrnCommand *cmd, void *user_data){
+    char *log_dir;
+    const char *val;
+    SrnChat *chat;
+    SrnLogGrepQuery *query;
+    SrnGrepContext *ctx;
+    SrnRet ret;
+
+    chat = ctx_get_chat(user_data);
+    g_return_val_if_fail(chat, SRN_ERR);
+
+    query = srn_log_grep_query_new();
+    query->pattern = g_strdup(srn_command_get_arg(cmd, 0));
+    if (srn_command_get_opt(cmd, "-server", &val)){
+        query->srv_name = g_strdup(val);
+    }
+    if (srn_command_get_opt(cmd, "-chat", &val)){
+        query->chat_name = g_strdup(val);
+    }
+    if (srn_command_get_opt(cmd, "-since", &val)){
+        gint64 since;
+        GDateTime *date;
+
+        ret = parse_date(val, FALSE, &since);
+        if (!RET_IS_OK(ret)){
+            srn_log_grep_query_free(query);
+            return ret;
+        }
+        date = g_date_time_new_from_unix_local(since);
+        query->since = g_date_time_format(date, "%F");
+        g_date_time_unref(date);
+    }
+
+    ctx = g_malloc0(sizeof(SrnGrepContext));
+    ctx->srv_name = g_strdup(chat->srv->name);
+    ctx->chat_name = g_strdup(chat->name);
+    ctx->start_time = g_get_monotonic_time();
+
+    log_dir = srn_get_log_dir(NULL);
+    ret = srn_log_grep(log_dir, query, on_grep_match, on_grep_finish, ctx);
+    g_free(log_dir);
+    if (!RET_IS_OK(ret)){
+        g_free(ctx->srv_name);
+        g_free(ctx->chat_name);
+        g_free(ctx);
+        return ret;
+    }
+
+    return RET_OK(_("Searching chat logs..."));
+}
+
 /*******************************************************************************
  * Misc
  ******************************************************************************/
 
+/**
+ * @brief search_thread is run in a new thread, messages are searched
+ * without blocking UI.
+ */
+static gpointer search_thread(gpointer user_data){
+    gint64 start;
+    SrnSearchJob *job;
+
+    job = user_data;
+    start = g_get_monotonic_time();
+
+    // Make sure all queued messages can be found
+    srn_chat_log_writer_flush(job->writer);
+    job->ret = srn_message_store_search(job->store, job->query, &job->results);
+    job->elapsed = g_get_monotonic_time() - start;
+    srn_chat_log_writer_release(job->writer);
+    job->writer = NULL;
+    job->store = NULL;
+
+    g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, finish_search, job, NULL);
+
+    return NULL;
+}
+
+/**
+ * @brief finish_search is run in main thread, shows search results in the
+ * search panel of chat where search is started, if it still exists.
+ */
+static gboolean finish_search(gpointer user_data){
+    char *summary;
+    SrnServer *srv;
+    SrnChat *chat;
+    SrnSearchJob *job;
+
+    job = user_data;
+    srv = srn_application_get_server(srn_application_get_default(),
+            job->srv_name);
+    chat = srv ? srn_server_get_chat_fallback(srv, job->chat_name) : NULL;
+    if (!chat){
+        goto FIN;
+    }
+
+    if (!RET_IS_OK(job->ret)){
+        srn_chat_add_error_message_fmt(chat,
+                _("Failed to search messages: %1$s"), RET_MSG(job->ret));
+        goto FIN;
+    }
+
+    sui_search_result_start(chat->ui);
+    // Results are sorted newest first, show them in chronological order
+    for (GList *lst = g_list_last(job->results); lst; lst = g_list_previous(lst)){
+        char *time;
+        char *location;
+        char *content;
+        GDateTime *date;
+        SrnMessageStoreResult *res;
+
+        res = lst->data;
+        date = g_date_time_new_from_unix_local(res->time);
+        time = g_date_time_format(date, "%F %T");
+        location = search_result_location(job, res);
+        content = srn_render_strip_mirc(res->content);
+        sui_search_result_add(chat->ui, time, location, res->sender, content);
+        g_free(content);
+        g_free(location);
+        g_free(time);
+        g_date_time_unref(date);
+    }
+    summary = g_strdup_printf(_("%1$d message(s) found in %2$.3f seconds"),
+            g_list_length(job->results),
+            (double)job->elapsed / G_TIME_SPAN_SECOND);
+    sui_search_result_end(chat->ui, summary);
+    g_free(summary);
+
+FIN:
+    g_list_free_full(job->results,
+            (GDestroyNotify)srn_message_store_result_free);
+    srn_message_store_query_free(job->query);
+    g_free(job->srv_name);
+    g_free(job->chat_name);
+    g_free(job);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief search_result_location returns where a found message is from, as
+ * "chat" or "server/chat" if all servers are searched.
+ *
+ * Names stored in message store are escaped to be used as file names, so the
+ * names given in query, and then names of opened servers and chats are
+ * preferred.
+ */
+static char* search_result_location(SrnSearchJob *job,
+        SrnMessageStoreResult *res){
+    const char *srv_name;
+    const char *chat_name;
+    SrnServer *srv;
+    GList *lst;
+
+    srv_name = job->query->srv_name;
+    srv = NULL;
+    if (!srv_name){
+        lst = srn_application_get_default()->srv_list;
+        while (lst){
+            char *name;
+
+            name = srn_escape_file_name(((SrnServer *)lst->data)->name);
+            if (g_strcmp0(name, res->srv_name) == 0){
+                srv = lst->data;
+            }
+            g_free(name);
+            if (srv){
+                break;
+            }
+            lst = g_list_next(lst);
+        }
+        srv_name = srv ? srv->name : res->srv_name;
+    } else {
+        srv = srn_application_get_server(srn_application_get_default(),
+                srv_name);
+    }
+
+    chat_name = job->query->chat_name;
+    if (!chat_name && srv){
+        lst = srv->chat_list;
+        while (lst){
+            char *name;
+
+            name = srn_escape_file_name(((SrnChat *)lst->data)->name);
+            if (g_strcmp0(name, res->chat_name) == 0){
+                chat_name = ((SrnChat *)lst->data)->name;
+            }
+            g_free(name);
+            if (chat_name){
+                break;
+            }
+            lst = g_list_next(lst);
+        }
+    }
+    if (!chat_name){
+        chat_name = res->chat_name;
+    }
+
+    if (job->query->srv_name){
+        return g_strdup(chat_name);
+    }
+    return g_strdup_printf("%s/%s", srv_name, chat_name);
+}
+
+/**
+ * @brief on_grep_match is called in main thread for every matched line of
+ * ``/grep`` command, lines are shown as soon as they are found.
+ */
+static void on_grep_match(const SrnLogGrepMatch *match, gpointer user_data){
+    SrnChat *chat;
+
+    chat = grep_context_get_chat(user_data);
+    if (!chat){
+        return;
+    }
+    srn_chat_add_misc_message_fmt(chat, "%s/%s %s %s",
+            match->srv_name, match->chat_name, match->date, match->line);
+}
+
+static void on_grep_finish(int nmatch, gpointer user_data){
+    SrnChat *chat;
+    SrnGrepContext *ctx;
+
+    ctx = user_data;
+    chat = grep_context_get_chat(ctx);
+    if (chat){
+        if (nmatch >= SRN_LOG_GREP_MAX_MATCHES){
+            srn_chat_add_misc_message_fmt(chat,
+                    _("Too many matched lines, only the first %1$d lines are shown"),
+                    nmatch);
+        } else {
+            srn_chat_add_misc_message_fmt(chat,
+                    _("%1$d line(s) matched in %2$.3f seconds"), nmatch,
+                    (double)(g_get_monotonic_time() - ctx->start_time)
+                    / G_TIME_SPAN_SECOND);
+        }
+    }
+
+    g_free(ctx->srv_name);
+    g_free(ctx->chat_name);
+    g_free(ctx);
+}
+
+/* Chat may be closed during grep */
+static SrnChat* grep_context_get_chat(SrnGrepContext *ctx){
+    SrnServer *srv;
+
+    srv = srn_application_get_server(srn_application_get_default(),
+            ctx->srv_name);
+    if (!srv){
+        return NULL;
+    }
+
+    return srn_server_get_chat_fallback(srv, ctx->chat_name);
+}
+
+/**
+ * @brief Parse date in format "YYYY-MM-DD" to unix time.
+ *
+ * @param str
+ * @param end_of_day Get the last second of the day rather than the first
+ * @param time
+ *
+ * @return SRN_OK if success
+ */
+static SrnRet parse_date(const char *str, bool end_of_day, gint64 *time){
+    int year;
+    int month;
+    int day;
+    GDateTime *date;
+
+    if (sscanf(str, "%d-%d-%d", &year, &month, &day) != 3){
+        return RET_ERR(_("Invalid date: %1$s, expect YYYY-MM-DD"), str);
+    }
+    date = g_date_time_new_local(year, month, day, 0, 0, 0);
+    if (!date){
+        return RET_ERR(_("Invalid date: %1$s, expect YYYY-MM-DD"), str);
+    }
+    *time = g_date_time_to_unix(date);
+    if (end_of_day){
+        *time += 24 * 60 * 60 - 1;
+    }
+    g_date_time_unref(date);
+
+    return SRN_OK;
+}
+
+/**
+ * @brief Commands return once connecting started, report the failure of
+ * registration to server's chat.
+ */
+static void on_server_registered(SrnServer *srv, bool registered,
+        gpointer user_data){
+    if (!registered){
+        srn_chat_add_error_message_fmt(srv->chat,
+                _("Failed to register on server \"%1$s\""), srv->name);
+    }
+}
+
 static SrnApplication* ctx_get_app(SrnChatCommandContext *cctx){
     g_return_val_if_fail(cctx, NULL);
     g_return_val_if_fail(cctx->app, NULL);
@@ -47,6 +47,8 @@ SrnRet on_command_away(SrnCommand *cmd, void *user_data);
 SrnRet on_command_pattern(SrnCommand *cmd, void *user_data);
 SrnRet on_command_render(SrnCommand *cmd, void *user_data);
 SrnRet on_command_unrender(SrnCommand *cmd, void *user_data);
+SrnRet on_command_search(SrnCommand *cmd, void *user_data);
+SrnRet on_command_grep(SrnCommand *cmd, void *user_data);
 
 static SrnCommandBinding cmd_bindings[] = {
     {
@@ -244,6 +246,33 @@ static SrnCommandBinding cmd_bindings[] = {
         },
         .cb = on_command_unrender,
     },
+    {
+        .name = "/search",
+        .argc = 1, // <words>
+        .opt = {
+            {.key = "-server",  .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-chat",    .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-from",    .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-since",   .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-until",   .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-limit",   .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-all",     .val = SRN_COMMAND_OPT_NO_VAL },
+            SRN_COMMAND_EMPTY_OPT,
+        },
+        .flags = SRN_COMMAND_FLAG_OMIT_ARG,
+        .cb = on_command_search,
+    },
+    {
+        .name = "/grep",
+        .argc = 1, // <pattern>
+        .opt = {
+            {.key = "-server",  .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-chat",    .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            {.key = "-since",   .val = SRN_COMMAND_OPT_NO_DEFAULT },
+            SRN_COMMAND_EMPTY_OPT,
+        },
+        .cb = on_command_grep,
+    },
     SRN_COMMAND_EMPTY,
 };
 
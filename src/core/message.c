@@ -20,9 +20,13 @@
 
 #include "core/core.h"
 
+#include "render/render.h"
+
 #include "srain.h"
 #include "utils.h"
 
+static void render_time(SrnMessage *self);
+
 SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user,
         const char *content, SrnMessageType type){
     SrnMessage *self;
@@ -42,22 +46,52 @@ SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user,
     self->sender = user;
     self->chat = chat;
     self->content = g_strdup(content);
+    self->plain_content = srn_render_strip_mirc(content);
     self->time = g_date_time_new_now_local();
+    if (chat->srv && chat->srv->addr){
+        self->server_url = g_strdup_printf("%s://%s:%d",
+                chat->srv->cfg->irc->tls ? "ircs" : "irc",
+                chat->srv->addr->host,
+                chat->srv->addr->port);
+    }
 
     // Inital render
     self->rendered_sender = g_markup_escape_text(user->srv_user->nick, -1);
     self->rendered_remark = g_markup_escape_text("", -1);
     self->rendered_content = g_markup_escape_text(content, -1);
-    self->rendered_short_time = g_date_time_format(self->time, "%R");
-#ifdef G_OS_WIN32
-    // FIXME: g_date_time_format(xxx, "%c") does not work on MS Windows
-    self->rendered_full_time = g_date_time_format(self->time, "%F %R");
-#else
-    self->rendered_full_time = g_date_time_format(self->time, "%c");
-#endif
+    render_time(self);
 
     self->mentioned = FALSE;
 
+    return self;
+}
+
+/**
+ * @brief ``srn_message_set_time`` sets the time of message, it is used for
+ * messages which are not created at the moment, such as history messages.
+ *
+ * @param self
+ * @param time
+ */
+void srn_message_set_time(SrnMessage *self, GDateTime *time){
+    g_date_time_unref(self->time);
+    self->time = g_date_time_ref(time);
+
+    str_assign(&self->rendered_short_time, NULL);
+    str_assign(&self->rendered_full_time, NULL);
+    render_time(self);
+}
+
+/**
+ * @brief ``srn_message_create_ui`` creates the UI widget of message.
+ * It should be called only when the message is going to be shown, so that
+ * filtered message costs no widget.
+ *
+ * @param self
+ */
+void srn_message_create_ui(SrnMessage *self){
+    g_return_if_fail(!self->ui);
+
     switch (self->type){
         case SRN_MESSAGE_TYPE_SENT:
             self->ui = sui_new_send_message(self);
@@ -81,8 +115,6 @@ SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user,
             self->ui = sui_new_misc_message(self, SUI_MISC_MESSAGE_STYLE_NORMAL);
             g_warn_if_reached();
     }
-
-    return self;
 }
 
 char* srn_message_to_string(const SrnMessage *self){
@@ -128,7 +160,9 @@ char* srn_message_to_string(const SrnMessage *self){
 
 void srn_message_free(SrnMessage *self){
     str_assign(&self->content, NULL);
+    str_assign(&self->plain_content, NULL);
     g_date_time_unref(self->time);
+    str_assign(&self->server_url, NULL);
 
     str_assign(&self->rendered_sender, NULL);
     str_assign(&self->rendered_remark, NULL);
@@ -139,3 +173,13 @@ void srn_message_free(SrnMessage *self){
 
     g_free(self);
 }
+
+static void render_time(SrnMessage *self){
+    self->rendered_short_time = g_date_time_format(self->time, "%R");
+#ifdef G_OS_WIN32
+    // FIXME: g_date_time_format(xxx, "%c") does not work on MS Windows
+    self->rendered_full_time = g_date_time_format(self->time, "%F %R");
+#else
+    self->rendered_full_time = g_date_time_format(self->time, "%c");
+#endif
+}
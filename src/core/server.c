@@ -36,6 +36,20 @@
 #include "log.h"
 #include "utils.h"
 #include "i18n.h"
+#include "path.h"
+
+typedef struct _RegisteredCont RegisteredCont;
+
+struct _RegisteredCont {
+    SrnServerRegisteredFunc func;
+    gpointer user_data;
+    GDestroyNotify destroy;
+};
+
+static void update_highlighter(SrnServer *srv);
+static void update_ignore_masks(SrnServer *srv);
+static void load_ignore_mask_list(SrnServer *srv);
+static void registered_cont_free(RegisteredCont *cont);
 
 SrnServer* srn_server_new(const char *name, SrnServerConfig *cfg){
     SrnServer *srv;
@@ -64,6 +78,9 @@ SrnServer* srn_server_new(const char *name, SrnServerConfig *cfg){
     /* srv->ping_timer = 0; */ // by g_malloc0()
     /* srv->reconn_timer = 0; */ // by g_malloc0()
 
+    srv->join_pending_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, NULL);
+
     /* Server user */
     srv->user_table = g_hash_table_new_full(
             g_str_hash, g_str_equal,
@@ -74,6 +91,13 @@ SrnServer* srn_server_new(const char *name, SrnServerConfig *cfg){
     srn_server_user_set_realname(srv->user, srv->cfg->user->realname);
     srn_server_user_set_is_me(srv->user, TRUE);
 
+    /* rfc1459 is the default casemapping until server tells us via
+     * RPL_ISUPPORT, see srn_server_set_casemapping() */
+    srv->highlighter = srn_highlighter_new(SRN_CASEMAPPING_RFC1459);
+    update_highlighter(srv);
+    load_ignore_mask_list(srv);
+    update_ignore_masks(srv);
+
     /* sirc */
     srv->irc = sirc_new_session(
             &srn_application_get_default()->irc_events,
@@ -94,6 +118,11 @@ void srn_server_free(SrnServer *srv){
 
     sirc_free_session(srv->irc);
 
+    // Continuations are finished when server is disconnected, just in case
+    g_list_free_full(srv->registered_conts,
+            (GDestroyNotify)registered_cont_free);
+    g_list_free_full(srv->playback_batches, g_free);
+
     g_list_free_full(srv->chat_list, (GDestroyNotify)srn_chat_free);
     // Server's chat should be freed after all chat in chat list are freed
     srn_chat_free(srv->chat);
@@ -101,7 +130,11 @@ void srn_server_free(SrnServer *srv){
     // srv->user and srv->_user are freed here as well
     g_hash_table_remove_all(srv->user_table);
 
+    g_hash_table_destroy(srv->join_pending_table);
     srn_server_cap_free(srv->cap);
+    srn_highlighter_free(srv->highlighter);
+    srn_hostmask_set_free(srv->ignore_masks);
+    g_list_free_full(srv->ignore_mask_list, g_free);
 
     str_assign(&srv->name, NULL);
 
@@ -113,6 +146,9 @@ void srn_server_set_config(SrnServer *srv, SrnServerConfig *cfg){
 
     srv->cfg = cfg;
     srv->addr = cfg->addrs->data;
+
+    update_highlighter(srv);
+    update_ignore_masks(srv);
 }
 
 SrnRet srn_server_reload_config(SrnServer *srv){
@@ -153,6 +189,52 @@ ERR:
     return SRN_OK;
 }
 
+/**
+ * @brief ``srn_server_save_ignore_mask_list`` writes hostmasks ignored via
+ * command to the ignore list file of server, so that they survive restarts.
+ *
+ * @param srv
+ *
+ * @return SRN_OK if the file is written.
+ */
+SrnRet srn_server_save_ignore_mask_list(SrnServer *srv){
+    char *path;
+    char *dir;
+    GList *lst;
+    GString *content;
+    GError *err;
+    SrnRet ret;
+
+    path = srn_get_ignore_list_file(srv->name);
+    dir = g_path_get_dirname(path);
+    content = g_string_new(NULL);
+    ret = SRN_OK;
+
+    if (g_mkdir_with_parents(dir, 0700) != 0){
+        ret = RET_ERR(_("Failed to create directory \"%1$s\""), dir);
+        goto FIN;
+    }
+
+    lst = srv->ignore_mask_list;
+    while (lst){
+        g_string_append_printf(content, "%s\n", (char *)lst->data);
+        lst = g_list_next(lst);
+    }
+
+    err = NULL;
+    if (!g_file_set_contents(path, content->str, content->len, &err)){
+        ret = RET_ERR(_("Failed to save ignore list: %1$s"), err->message);
+        g_error_free(err);
+    }
+
+FIN:
+    g_string_free(content, TRUE);
+    g_free(dir);
+    g_free(path);
+
+    return ret;
+}
+
 bool srn_server_is_valid(SrnServer *srv){
     SrnApplication *app;
 
@@ -211,14 +293,157 @@ bool srn_server_is_registered(SrnServer *srv){
     return srv->state == SRN_SERVER_STATE_CONNECTED && srv->registered == TRUE;
 }
 
-void srn_server_wait_until_registered(SrnServer *srv){
+/**
+ * @brief ``srn_server_on_registered`` queues a continuation which is called
+ * when the server is registered, or when the server gives up connecting or
+ * is freed before registration. Failed connection attempts which are going
+ * to be retried do not fail the continuation.
+ *
+ * @param srv
+ * @param func Called with ``registered`` set to TRUE if server is registered
+ * @param user_data
+ * @param destroy Called on ``user_data`` after ``func`` is called, can be NULL
+ *
+ * If server is already registered, ``func`` is called immediately.
+ */
+void srn_server_on_registered(SrnServer *srv, SrnServerRegisteredFunc func,
+        gpointer user_data, GDestroyNotify destroy){
+    RegisteredCont *cont;
+
     g_return_if_fail(srn_server_is_valid(srv));
+    g_return_if_fail(func);
+
+    cont = g_malloc0(sizeof(RegisteredCont));
+    cont->func = func;
+    cont->user_data = user_data;
+    cont->destroy = destroy;
+    srv->registered_conts = g_list_append(srv->registered_conts, cont);
+
+    if (srn_server_is_registered(srv)){
+        srn_server_finish_registered(srv, TRUE);
+    }
+}
+
+/**
+ * @brief ``srn_server_finish_registered`` calls and drops all continuations
+ * queued by ``srn_server_on_registered()``.
+ *
+ * @param srv
+ * @param registered Whether the server is registered
+ */
+void srn_server_finish_registered(SrnServer *srv, bool registered){
+    GList *lst;
+    GList *conts;
+
+    // Continuations queued during draining wait for the next registration
+    conts = srv->registered_conts;
+    srv->registered_conts = NULL;
 
-    /* Waiting for connection established */
-    while (srv->state == SRN_SERVER_STATE_CONNECTING) sui_proc_pending_event();
-    /* Waiting until server registered */
-    while (srv->state == SRN_SERVER_STATE_CONNECTED && srv->registered == FALSE)
-        sui_proc_pending_event();
+    for (lst = conts; lst; lst = g_list_next(lst)){
+        RegisteredCont *cont;
+
+        cont = lst->data;
+        cont->func(srv, registered, cont->user_data);
+        registered_cont_free(cont);
+    }
+    g_list_free(conts);
+}
+
+/**
+ * @brief ``srn_server_is_playback`` returns whether the message currently
+ * being handled belongs to a playback batch, such as backlog replayed by
+ * bouncer or reply of CHATHISTORY.
+ *
+ * @param srv
+ *
+ * @return TRUE if message is a playback message
+ */
+bool srn_server_is_playback(SrnServer *srv){
+    const char *batch;
+
+    if (!srv->playback_batches){
+        return FALSE;
+    }
+    batch = sirc_get_message_batch(srv->irc);
+    if (!batch){
+        return FALSE;
+    }
+
+    for (GList *lst = srv->playback_batches; lst; lst = g_list_next(lst)){
+        if (g_str_equal(lst->data, batch)){
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief ``srn_server_start_playback`` is called when a playback batch is
+ * opened, playback messages of all chats are held until all playback
+ * batches are ended.
+ *
+ * @param srv
+ */
+void srn_server_start_playback(SrnServer *srv){
+    srn_chat_start_playback(srv->chat);
+    for (GList *lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        srn_chat_start_playback(lst->data);
+    }
+}
+
+/**
+ * @brief ``srn_server_finish_playback`` shows playback messages of all chats
+ * of server in bulk, it is called when all playback batches are ended.
+ *
+ * @param srv
+ */
+void srn_server_finish_playback(SrnServer *srv){
+    srn_chat_flush_playback(srv->chat);
+    for (GList *lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        srn_chat_flush_playback(lst->data);
+    }
+}
+
+/**
+ * @brief ``srn_server_set_join_pending`` marks channels which JOIN is sent to
+ * as pending, so that they are not joined again before the reply.
+ *
+ * @param srv
+ * @param chans Comma-separated channel names, as in JOIN message
+ * @param pending
+ */
+void srn_server_set_join_pending(SrnServer *srv, const char *chans,
+        bool pending){
+    char **names;
+
+    names = g_strsplit(chans, ",", 0);
+    for (int i = 0; names[i]; i++){
+        char *name;
+
+        if (str_is_empty(names[i])){
+            continue;
+        }
+        name = g_ascii_strdown(names[i], -1);
+        if (pending){
+            g_hash_table_add(srv->join_pending_table, name);
+        } else {
+            g_hash_table_remove(srv->join_pending_table, name);
+            g_free(name);
+        }
+    }
+    g_strfreev(names);
+}
+
+bool srn_server_is_join_pending(SrnServer *srv, const char *chan){
+    bool pending;
+    char *name;
+
+    name = g_ascii_strdown(chan, -1);
+    pending = g_hash_table_contains(srv->join_pending_table, name);
+    g_free(name);
+
+    return pending;
 }
 
 SrnRet srn_server_add_chat(SrnServer *srv, const char *name){
@@ -389,6 +614,109 @@ SrnRet srn_server_rename_user(SrnServer *srv, SrnServerUser *user,
         return SRN_ERR;
     }
     srn_server_user_set_nick(user, nick);
+    if (user == srv->user){
+        update_highlighter(srv);
+    }
     return g_hash_table_insert(srv->user_table, user->nick, user) ?
         SRN_OK : SRN_ERR;
 }
+
+/**
+ * @brief ``srn_server_set_casemapping`` follows the CASEMAPPING of
+ * RPL_ISUPPORT.
+ *
+ * @param srv
+ * @param casemapping
+ */
+void srn_server_set_casemapping(SrnServer *srv, SrnCasemapping casemapping){
+    srn_highlighter_set_casemapping(srv->highlighter, casemapping);
+    update_highlighter(srv);
+}
+
+/**
+ * @brief Rebuild the highlighter of server, should be called when nick or
+ * highlight keywords changed.
+ *
+ * @param srv
+ */
+static void update_highlighter(SrnServer *srv){
+    srn_highlighter_build(srv->highlighter,
+            srv->user->nick, srv->cfg->user->highlight_keywords);
+}
+
+/**
+ * @brief Rebuild the ignored hostmask set of server from config and masks
+ * ignored via command, should be called when config changed.
+ *
+ * @param srv
+ */
+static void update_ignore_masks(SrnServer *srv){
+    GList *lst;
+
+    if (srv->ignore_masks){
+        srn_hostmask_set_free(srv->ignore_masks);
+    }
+    srv->ignore_masks = srn_hostmask_set_new();
+
+    lst = srv->cfg->ignore_mask_list;
+    while (lst){
+        SrnRet ret;
+
+        ret = srn_hostmask_set_add(srv->ignore_masks, lst->data);
+        if (!RET_IS_OK(ret)){
+            WARN_FR("Failed to add ignored hostmask %s: %s",
+                    (char *)lst->data, RET_MSG(ret));
+        }
+        lst = g_list_next(lst);
+    }
+    lst = srv->ignore_mask_list;
+    while (lst){
+        srn_hostmask_set_add(srv->ignore_masks, lst->data);
+        lst = g_list_next(lst);
+    }
+}
+
+/**
+ * @brief ``load_ignore_mask_list`` loads hostmasks ignored via command from
+ * the ignore list file of server, one mask per line.
+ *
+ * @param srv
+ */
+static void load_ignore_mask_list(SrnServer *srv){
+    char *path;
+    char *content;
+    char **lines;
+    GError *err;
+
+    path = srn_get_ignore_list_file(srv->name);
+    content = NULL;
+    err = NULL;
+    if (!g_file_get_contents(path, &content, NULL, &err)){
+        if (!g_error_matches(err, G_FILE_ERROR, G_FILE_ERROR_NOENT)){
+            WARN_FR("Failed to load ignore list %s: %s", path, err->message);
+        }
+        g_error_free(err);
+        g_free(path);
+        return;
+    }
+
+    lines = g_strsplit(content, "\n", -1);
+    for (int i = 0; lines[i]; i++){
+        g_strstrip(lines[i]);
+        if (!srn_hostmask_is_mask(lines[i])){
+            continue;
+        }
+        srv->ignore_mask_list = g_list_append(srv->ignore_mask_list,
+                srn_hostmask_normalize(lines[i]));
+    }
+    g_strfreev(lines);
+    g_free(content);
+    g_free(path);
+}
+
+static void registered_cont_free(RegisteredCont *cont){
+    if (cont->destroy){
+        cont->destroy(cont->user_data);
+    }
+    g_free(cont);
+}
@@ -79,11 +79,16 @@ static ServerCapSupport supported_caps[] = {
         .on_enable = sasl_on_enable,
     },
 
-    // /* IRCv3.2 */
-    // {
-    //     .name = "server-time",
-    //     .offset = offsetof(EnabledCap, server_time),
-    // },
+    /* IRCv3.2 */
+    {
+        .name = "server-time",
+        .offset = offsetof(EnabledCap, server_time),
+    },
+    {
+        // Playback of bouncer is received in bulk, see irc_event_batch()
+        .name = "batch",
+        .offset = offsetof(EnabledCap, batch),
+    },
     // {
     //     .name = "userhost-in-names",
     //     .offset = offsetof(EnabledCap, userhost_in_names),
@@ -98,15 +103,15 @@ static ServerCapSupport supported_caps[] = {
     //     .offset = offsetof(EnabledCap, chghost),
     // },
 
-    // /* ZNC */
-    // {
-    //     .name = "znc.in/server-time-iso",
-    //     .offset = offsetof(EnabledCap, znc_server_time_iso),
-    // },
-    // {
-    //     .name = "znc.in/server-time",
-    //     .offset = offsetof(EnabledCap, znc_server_time),
-    // },
+    /* ZNC */
+    {
+        .name = "znc.in/server-time-iso",
+        .offset = offsetof(EnabledCap, znc_server_time_iso),
+    },
+    {
+        .name = "znc.in/server-time",
+        .offset = offsetof(EnabledCap, znc_server_time),
+    },
     {
         // END
         .name = NULL,
@@ -222,6 +227,73 @@ char* srn_server_cap_dump(SrnServerCap *scap){
     return res;
 }
 
+/**
+ * @brief ``srn_server_cap_speculate`` resets capabilities for a new
+ * connection, and returns capabilities which were enabled by server on last
+ * connection, so that they can be requested before CAP LS is replied.
+ *
+ * Speculated capabilities are skipped when processing CAP LS reply.
+ *
+ * @param scap
+ *
+ * @return Space separated capability names, NULL if there is nothing to be
+ *         requested speculatively
+ */
+char* srn_server_cap_speculate(SrnServerCap *scap){
+    GString *str;
+
+    g_return_val_if_fail(scap, NULL);
+
+    scap->speculated = scap->server_enabled;
+    memset(&scap->server_enabled, 0, sizeof(scap->server_enabled));
+    memset(&scap->client_enabled, 0, sizeof(scap->client_enabled));
+
+    str = g_string_new(NULL);
+    for (int i = 0; supported_caps[i].name; i++){
+        bool *cap = (void *)&scap->speculated + supported_caps[i].offset;
+        if (*cap){
+            g_string_append_printf(str, "%s ", supported_caps[i].name);
+        }
+    }
+
+    scap->speculating = str->len > 0;
+    if (!scap->speculating){
+        g_string_free(str, TRUE);
+        return NULL;
+    }
+
+    return g_string_free(str, FALSE);
+}
+
+bool srn_server_cap_server_is_enabled(SrnServerCap *scap, const char *name){
+    g_return_val_if_fail(scap, FALSE);
+
+    for (int i = 0; supported_caps[i].name; i++){
+        if (g_ascii_strcasecmp(name, supported_caps[i].name) == 0){
+            bool *cap = (void *)&scap->server_enabled + supported_caps[i].offset;
+            return *cap;
+        }
+    }
+
+    return FALSE;
+}
+
+bool srn_server_cap_is_speculated(SrnServerCap *scap, const char *name){
+    g_return_val_if_fail(scap, FALSE);
+
+    if (!scap->speculating){
+        return FALSE;
+    }
+    for (int i = 0; supported_caps[i].name; i++){
+        if (g_ascii_strcasecmp(name, supported_caps[i].name) == 0){
+            bool *cap = (void *)&scap->speculated + supported_caps[i].offset;
+            return *cap;
+        }
+    }
+
+    return FALSE;
+}
+
 static bool sasl_is_support(const char *value){
     bool supported;
     char **mechs;
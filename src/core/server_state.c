@@ -22,6 +22,12 @@
  * @author Shengyu Zhang <i@silverrainz.me>
  * @version 0.06.3
  * @date 2018-01-22
+ *
+ * Reconnecting of all servers is coordinated: a server is scheduled to
+ * reconnect after a jittered exponential backoff, then it waits in a queue
+ * until the count of reconnecting servers is less than the configured
+ * concurrency. Servers with channels are taken from the queue first. The
+ * backoff is reset once a connection lasts for the configured stable time.
  */
 
 #include <stdio.h>
@@ -34,10 +40,21 @@
 #include "log.h"
 #include "utils.h"
 #include "i18n.h"
+#include "timer_wheel.h"
 
 static const char *srn_server_state_to_string(SrnServerState state);
 static const char *srn_server_action_to_string(SrnServerAction action);
 static gboolean srn_server_reconnect_timeout(gpointer user_data);
+static void srn_server_connect_addrs(SrnServer *srv);
+static void srn_server_schedule_reconnect(SrnServer *srv);
+static void srn_server_enqueue_reconnect(SrnServer *srv);
+static bool srn_server_update_reconnect(SrnServer *srv);
+static void srn_server_admit_reconnect(void);
+static int srn_server_get_reconnect_priority(SrnServer *srv);
+
+static GList *reconn_queue = NULL;  // Servers waiting for a slot, in order
+                                    // of priority
+static int reconn_slots = 0;        // Count of servers holding a slot
 
 /**
  * @brief server_state_transfrom SrnServer's connection state macheine, accept a
@@ -52,6 +69,7 @@ static gboolean srn_server_reconnect_timeout(gpointer user_data);
  */
 SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction action){
     bool free;
+    bool admit;
     const char *unallowed;
     SrnRet ret;
     SrnServerState cur_state;
@@ -68,9 +86,12 @@ SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction action){
     switch (srv->state) {
         case SRN_SERVER_STATE_DISCONNECTED:
             switch (action) {
-                case SRN_SERVER_ACTION_RECONNECT:
                 case SRN_SERVER_ACTION_CONNECT:
-                    sirc_connect(srv->irc, srv->addr->host, srv->addr->port);
+                    // Connected by user, start a fresh backoff
+                    srv->reconn_interval = SRN_SERVER_RECONN_INTERVAL;
+                    // Fallthrough
+                case SRN_SERVER_ACTION_RECONNECT:
+                    srn_server_connect_addrs(srv);
                     next_state = SRN_SERVER_STATE_CONNECTING;
                     break;
                 case SRN_SERVER_ACTION_DISCONNECT:
@@ -92,13 +113,12 @@ SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction action){
                     ret = RET_ERR(unallowed, _("Hold on, srain is connecting to the server, please do not repeat the action"));
                     break;
                 case SRN_SERVER_ACTION_CONNECT_FAIL:
-                    srv->reconn_timer = g_timeout_add(srv->reconn_interval,
-                            srn_server_reconnect_timeout, srv);
+                    srn_server_schedule_reconnect(srv);
                     next_state = SRN_SERVER_STATE_RECONNECTING;
                     break;
                 case SRN_SERVER_ACTION_CONNECT_FINISH:
-                    // TODO: reset reconn_interval after connection becomes stable
-                    srv->reconn_interval = SRN_SERVER_RECONN_STEP;
+                    // Backoff is reset when disconnecting from a stable
+                    // connection
                     next_state = SRN_SERVER_STATE_CONNECTED;
                     break;
                 case SRN_SERVER_ACTION_DISCONNECT:
@@ -132,11 +152,18 @@ SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction action){
                     sirc_cmd_quit(srv->irc, NULL);
                     next_state = SRN_SERVER_STATE_QUITING;
                     break;
-                case SRN_SERVER_ACTION_DISCONNECT_FINISH:
-                    srv->reconn_timer = g_timeout_add(srv->reconn_interval,
-                            srn_server_reconnect_timeout, srv);
+                case SRN_SERVER_ACTION_DISCONNECT_FINISH:{
+                    SrnApplication *app;
+
+                    app = srn_application_get_default();
+                    if (g_get_monotonic_time() - srv->connect_time
+                            >= app->cfg->reconn_stable_time * G_TIME_SPAN_SECOND){
+                        srv->reconn_interval = SRN_SERVER_RECONN_INTERVAL;
+                    }
+                    srn_server_schedule_reconnect(srv);
                     next_state = SRN_SERVER_STATE_RECONNECTING;
                     break;
+                }
                 default:
                     ret = SRN_ERR;
                     g_warn_if_reached();
@@ -195,17 +222,25 @@ SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction action){
         case SRN_SERVER_STATE_RECONNECTING:
             switch (action) {
                 case SRN_SERVER_ACTION_CONNECT:
-                    sirc_connect(srv->irc, srv->addr->host, srv->addr->port);
+                    if (srv->reconn_timer){ // Connected by user
+                        srn_timer_wheel_remove(srv->reconn_timer);
+                        srv->reconn_timer = 0;
+                    }
+                    srn_server_connect_addrs(srv);
                     next_state = SRN_SERVER_STATE_CONNECTING;
                     break;
                 case SRN_SERVER_ACTION_DISCONNECT:
-                    g_source_remove(srv->reconn_timer);
-                    srv->reconn_timer = 0;
+                    if (srv->reconn_timer){ // Otherwise it is queued
+                        srn_timer_wheel_remove(srv->reconn_timer);
+                        srv->reconn_timer = 0;
+                    }
                     next_state = SRN_SERVER_STATE_DISCONNECTED;
                     break;
                 case SRN_SERVER_ACTION_QUIT:
-                    g_source_remove(srv->reconn_timer);
-                    srv->reconn_timer = 0;
+                    if (srv->reconn_timer){
+                        srn_timer_wheel_remove(srv->reconn_timer);
+                        srv->reconn_timer = 0;
+                    }
                     free = TRUE;
                     next_state = SRN_SERVER_STATE_DISCONNECTED;
                     break;
@@ -236,11 +271,23 @@ SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction action){
                 RET_MSG(ret));
     }
 
+    if (srv->registered_conts
+            && cur_state != SRN_SERVER_STATE_DISCONNECTED
+            && srv->state == SRN_SERVER_STATE_DISCONNECTED){
+        // Server gives up connecting before registration, a freed server is
+        // handled by srn_application_rm_server()
+        srn_server_finish_registered(srv, FALSE);
+    }
+    admit = srn_server_update_reconnect(srv);
+
     if (free){ // The server should be free now, be careful
         SrnApplication *app;
 
         app = srn_application_get_default();
-        return srn_application_rm_server(app, srv);
+        ret = srn_application_rm_server(app, srv);
+    }
+    if (admit){
+        srn_server_admit_reconnect();
     }
 
     return ret;
@@ -292,8 +339,139 @@ static gboolean srn_server_reconnect_timeout(gpointer user_data){
     SrnServer *srv;
 
     srv = user_data;
-    srv->reconn_interval += SRN_SERVER_RECONN_STEP;
-    srn_server_state_transfrom(srv, SRN_SERVER_ACTION_CONNECT);
+    srv->reconn_timer = 0;
+    srn_server_enqueue_reconnect(srv);
+    srn_server_admit_reconnect();
 
     return G_SOURCE_REMOVE;
 }
+
+/**
+ * @brief ``srn_server_connect_addrs`` connects to all addresses of server
+ * concurrently, the first connected one is used.
+ *
+ * @param srv
+ */
+static void srn_server_connect_addrs(SrnServer *srv){
+    int i;
+    int count;
+    int *ports;
+    const char **hosts;
+    GList *lst;
+
+    count = g_list_length(srv->cfg->addrs);
+    hosts = g_malloc0_n(count, sizeof(char *));
+    ports = g_malloc0_n(count, sizeof(int));
+    for (i = 0, lst = srv->cfg->addrs; lst; i++, lst = g_list_next(lst)){
+        SrnServerAddr *addr;
+
+        addr = lst->data;
+        hosts[i] = addr->host;
+        ports[i] = addr->port;
+    }
+
+    srv->connect_time = g_get_monotonic_time();
+    sirc_connect_any(srv->irc, hosts, ports, count);
+
+    g_free(hosts);
+    g_free(ports);
+}
+
+/**
+ * @brief ``srn_server_schedule_reconnect`` schedules a reconnect after a
+ * random delay between a half of backoff and full backoff, then doubles the
+ * backoff.
+ *
+ * @param srv
+ */
+static void srn_server_schedule_reconnect(SrnServer *srv){
+    unsigned long interval;
+
+    interval = srv->reconn_interval;
+    srv->reconn_delay = interval / 2 + g_random_int_range(0, interval / 2 + 1);
+    srv->reconn_timer = srn_timer_wheel_add(srv->reconn_delay,
+            srn_server_reconnect_timeout, srv);
+    srv->reconn_interval = MIN(interval * 2, SRN_SERVER_RECONN_MAX_INTERVAL);
+}
+
+/**
+ * @brief ``srn_server_enqueue_reconnect`` puts server into the reconnect
+ * queue, after servers with higher or equal priority.
+ *
+ * @param srv
+ */
+static void srn_server_enqueue_reconnect(SrnServer *srv){
+    int prio;
+    GList *lst;
+
+    prio = srn_server_get_reconnect_priority(srv);
+    for (lst = reconn_queue; lst; lst = g_list_next(lst)){
+        if (srn_server_get_reconnect_priority(lst->data) < prio){
+            break;
+        }
+    }
+    reconn_queue = g_list_insert_before(reconn_queue, lst, srv);
+    srv->reconn_queued = TRUE;
+}
+
+/**
+ * @brief ``srn_server_update_reconnect`` releases queue entry and slot which
+ * server no longer needs after its state changed.
+ *
+ * @param srv
+ *
+ * @return TRUE if a slot is released
+ */
+static bool srn_server_update_reconnect(SrnServer *srv){
+    if (srv->reconn_queued && srv->state != SRN_SERVER_STATE_RECONNECTING){
+        reconn_queue = g_list_remove(reconn_queue, srv);
+        srv->reconn_queued = FALSE;
+    }
+    if (srv->reconn_slot && srv->state != SRN_SERVER_STATE_CONNECTING){
+        srv->reconn_slot = FALSE;
+        reconn_slots--;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief ``srn_server_admit_reconnect`` reconnects queued servers until
+ * concurrency limit is reached.
+ */
+static void srn_server_admit_reconnect(void){
+    SrnApplication *app;
+
+    app = srn_application_get_default();
+    while (reconn_queue && reconn_slots < app->cfg->reconn_concurrency){
+        SrnServer *srv;
+
+        srv = reconn_queue->data;
+        reconn_queue = g_list_delete_link(reconn_queue, reconn_queue);
+        srv->reconn_queued = FALSE;
+        srv->reconn_slot = TRUE;
+        reconn_slots++;
+        // Slot is released as soon as server is not connecting
+        srn_server_state_transfrom(srv, SRN_SERVER_ACTION_CONNECT);
+    }
+}
+
+/**
+ * @brief Servers with more channels to be rejoined are reconnected first.
+ */
+static int srn_server_get_reconnect_priority(SrnServer *srv){
+    int prio;
+    GList *lst;
+
+    prio = 0;
+    for (lst = srv->chat_list; lst; lst = g_list_next(lst)){
+        SrnChat *chat;
+
+        chat = lst->data;
+        if (chat->type == SRN_CHAT_TYPE_CHANNEL){
+            prio++;
+        }
+    }
+
+    return prio;
+}
@@ -55,10 +55,13 @@ int main(int argc, char *argv[]){
     app = srn_application_new();
     srn_application_run(app, argc, argv);
 
+    // Threads which may log are stopped before freeing logger of application
     srn_render_finalize();
+    // ret_finalize() may log, so it is called before freeing any logger
+    ret_finalize();
+    srn_application_quit(app);
     srn_filter_finalize();
     srn_logger_free(logger);
-    ret_finalize();
 
     return 0;
 }
@@ -62,6 +62,8 @@ void srn_user_config_free(SrnUserConfig *self){
     str_assign(&self->kick_message, NULL);
     str_assign(&self->quit_message, NULL);
 
+    g_list_free_full(self->highlight_keywords, g_free);
+
     srn_login_config_free(self->login);
 
     g_free(self);
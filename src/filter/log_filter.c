@@ -32,7 +32,7 @@
 #include "srain.h"
 #include "log.h"
 #include "i18n.h"
-#include "path.h"
+#include "chat_log.h"
 
 #include "./filter.h"
 
@@ -47,41 +47,33 @@ SrnMessageFilter log_filter = {
 };
 
 bool filter(const SrnMessage *msg) {
-    char *date_str;
     char *msg_str;
-    FILE *fp;
-    char *file;
-    GString *basename;
+    const char *sender;
+    SrnApplication *app;
 
-    date_str = g_date_time_format(msg->time, "%F");
-    g_return_val_if_fail(date_str, TRUE);
-
-    basename = g_string_new("");
-    g_string_append_printf(basename, "%s.%s.log", date_str, msg->chat->name);
-    file = srn_create_log_file(msg->chat->srv->name, basename->str);
-
-    if (!file){
-        ERR_FR("Failed to create log file");
-        goto cleanup1;
+    app = srn_application_get_default();
+    if (!app->chat_log_writer){
+        return TRUE;
     }
 
-    fp = fopen(file, "a+");
-    if (!fp){
-        ERR_FR("Failed to open file '%s'", file);
-        goto cleanup2;
+    switch (msg->type){
+        case SRN_MESSAGE_TYPE_SENT:
+        case SRN_MESSAGE_TYPE_RECV:
+        case SRN_MESSAGE_TYPE_ACTION:
+        case SRN_MESSAGE_TYPE_NOTICE:
+            sender = msg->sender->srv_user->nick;
+            break;
+        default:
+            sender = NULL; // Not going to be stored
     }
 
     msg_str = srn_message_to_string(msg);
     if (msg_str){
-        fprintf(fp, "%s\n", msg_str);
+        srn_chat_log_writer_write(app->chat_log_writer,
+                msg->chat->srv->name, msg->chat->name, msg->time, msg_str,
+                sender, msg->content);
         g_free(msg_str);
     }
 
-    fclose(fp);
-cleanup2:
-    g_free(file);
-cleanup1:
-    g_string_free(basename, TRUE);
-
     return TRUE; // Always TRUE
 }
@@ -17,23 +17,20 @@
  */
 
 #include "core/core.h"
-#include "markup_renderer.h"
 #include "pattern_set.h"
 
 #include "./filter.h"
 
 #define PATTERNS_KEY "pattern_filter_module_patterns"
+#define CACHE_KEY "pattern_filter_module_cache"
 
-static void init(void);
-static void finalize(void);
 static bool filter(const SrnMessage *msg);
 static GList** alloc_patterns();
 static void free_patterns(GList **patterns);
 static GList* get_patterns(const SrnMessage *msg);
-static void text(GMarkupParseContext *context, const gchar *text,
-        gsize text_len, gpointer user_data, GError **error);
+static SrnPatternCache* get_cache(const SrnMessage *msg);
 
-static SrnMarkupRenderer *markup_renderer;
+static unsigned patterns_serial; // Increased when any pattern is attached or detached
 
 /**
  * @brief pattern_filter is a filter module for filtering message which matches
@@ -41,64 +38,22 @@ static SrnMarkupRenderer *markup_renderer;
  */
 SrnMessageFilter pattern_filter = {
     .name = "pattern",
-    .init = init,
-    .finalize = finalize,
     .filter = filter,
 };
 
-void init(void) {
-    GMarkupParser *parser;
-
-    markup_renderer = srn_markup_renderer_new();
-    parser = srn_markup_renderer_get_markup_parser(markup_renderer);
-    parser->start_element = NULL;
-    parser->end_element = NULL;
-    parser->text = text;
-}
-
-void finalize(void) {
-    srn_markup_renderer_free(markup_renderer);
-}
-
+/**
+ * @brief filter matches patterns against raw content of message without mIRC
+ * formatting characters, so it can be applied before rendering.
+ */
 static bool filter(const SrnMessage *msg) {
-    bool drop;
-    char *raw_content;
-    GList *patterns;
-    GList *lst;
-    SrnRet ret;
-    SrnPatternSet *pattern_set;
-
-    pattern_set = srn_application_get_default()->pattern_set;
-    g_return_val_if_fail(pattern_set, TRUE);
+    SrnPatternCache *cache;
 
-    raw_content = NULL;
-    ret = srn_markup_renderer_render(markup_renderer,
-            msg->rendered_content, &raw_content, NULL);
-    if (!RET_IS_OK(ret)){
-        ERR_FR("Failed to render markup text: %1$s", RET_MSG(ret));
+    cache = get_cache(msg);
+    if (!cache) {
         return TRUE;
     }
 
-    drop = FALSE;
-    patterns = get_patterns(msg);
-    lst = patterns;
-    while (lst) {
-        const char *pattern;
-        const GRegex *regex;
-
-        pattern = lst->data;
-        regex = srn_pattern_set_get(pattern_set, pattern);
-        if (regex && g_regex_match(regex, raw_content, 0, NULL)) {
-            drop = TRUE;
-            break;
-        }
-        lst = g_list_next(lst);
-    }
-
-    g_list_free(patterns);
-    g_free(raw_content);
-
-    return !drop;
+    return !srn_pattern_cache_match(cache, msg->plain_content);
 }
 
 /**
@@ -131,6 +86,7 @@ SrnRet srn_filter_attach_pattern(SrnExtraData *extra_data, const char *pattern){
     }
 
     *patterns = g_list_append(*patterns, g_strdup(pattern));
+    patterns_serial++;
 
     return SRN_OK;
 }
@@ -163,6 +119,7 @@ SrnRet srn_filter_detach_pattern(SrnExtraData *extra_data, const char *pattern){
 
     g_free(lst->data);
     *patterns = g_list_delete_link(*patterns, lst);
+    patterns_serial++;
 
     return SRN_OK;
 }
@@ -215,7 +172,32 @@ static GList* get_patterns(const SrnMessage *msg) {
     return patterns;
 }
 
-static void text(GMarkupParseContext *context, const gchar *text,
-        gsize text_len, gpointer user_data, GError **error){
-    g_string_append_len(srn_markup_renderer_get_markup(user_data), text, text_len);
+/**
+ * @brief get_cache returns the compiled patterns which should be applied to
+ * given message. The cache is attached to sender of message and recompiled
+ * when any pattern is attached, detached, added or removed.
+ *
+ * @return a SrnPatternCache, or NULL if no pattern available.
+ */
+static SrnPatternCache* get_cache(const SrnMessage *msg) {
+    GList *patterns;
+    SrnPatternCache *cache;
+    SrnPatternSet *pattern_set;
+
+    pattern_set = srn_application_get_default()->pattern_set;
+    g_return_val_if_fail(pattern_set, NULL);
+
+    cache = srn_extra_data_get(msg->sender->extra_data, CACHE_KEY);
+    if (!cache) {
+        cache = srn_pattern_cache_new();
+        srn_extra_data_set(msg->sender->extra_data, CACHE_KEY, cache,
+                (GDestroyNotify)srn_pattern_cache_free);
+    }
+    if (!srn_pattern_cache_is_valid(cache, pattern_set, patterns_serial)) {
+        patterns = get_patterns(msg);
+        srn_pattern_cache_update(cache, pattern_set, patterns, patterns_serial);
+        g_list_free(patterns);
+    }
+
+    return srn_pattern_cache_get_regexes(cache) ? cache : NULL;
 }
@@ -25,7 +25,9 @@
 static bool filter(const SrnMessage *msg);
 
 /**
- * @brief user_filter is a filter module for filtering ignored user.
+ * @brief user_filter is a filter module for filtering ignored user, a user is
+ * ignored if it is marked as ignored or matches any ignored hostmask of
+ * server.
  */
 SrnMessageFilter user_filter = {
     .name = "user",
@@ -33,5 +35,15 @@ SrnMessageFilter user_filter = {
 };
 
 bool filter(const SrnMessage *msg) {
-    return !(msg->sender->is_ignored || msg->sender->srv_user->is_ignored);
+    SrnServerUser *srv_user;
+
+    srv_user = msg->sender->srv_user;
+    if (msg->sender->is_ignored || srv_user->is_ignored){
+        return FALSE;
+    }
+    if (srv_user->is_me){
+        return TRUE;
+    }
+    return !srn_hostmask_set_match(srv_user->srv->ignore_masks,
+            srv_user->nick, srv_user->username, srv_user->hostname);
 }
@@ -19,7 +19,71 @@
 #ifndef __CHAT_LOG_H
 #define __CHAT_LOG_H
 
-void srn_chat_log_log(const char *srv_name, const char *chan_name, const char *msg);
-void srn_chat_log_fmt(const char *srv_name, const char *chan_name, const char *fmt, ...);
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "srain.h"
+#include "ret.h"
+#include "message_store.h"
+
+#define SRN_CHAT_LOG_FLUSH_INTERVAL 1000 // ms
+#define SRN_CHAT_LOG_COMPRESS_AFTER 7 // days
+#define SRN_CHAT_LOG_COMPACT_THRESHOLD 256 // MiB
+
+typedef struct _SrnChatLogConfig SrnChatLogConfig;
+typedef struct _SrnChatLogWriter SrnChatLogWriter;
+typedef struct _SrnChatLogFile SrnChatLogFile;
+typedef enum _SrnChatLogFileType SrnChatLogFileType;
+typedef bool (*SrnChatLogReadFunc) (const char *date, GBytes *bytes,
+        gpointer user_data);
+
+struct _SrnChatLogConfig {
+    bool fsync;             // Call fsync() after every flush
+    int flush_interval;     // Interval of flushing chat logs to disk, in ms
+    bool store;             // Also write messages to searchable message store
+    int compress_after;     // Compress logs older than given days, 0 for never
+    int compact_threshold;  // Compact compressed logs into monthly archives
+                            // when size of all logs exceeds given MiB,
+                            // 0 for never
+};
+
+enum _SrnChatLogFileType {
+    SRN_CHAT_LOG_FILE_PLAIN,    // <YYYY-MM-DD>.<chat_name>.log
+    SRN_CHAT_LOG_FILE_GZIP,     // <YYYY-MM-DD>.<chat_name>.log.gz
+    SRN_CHAT_LOG_FILE_ARCHIVE,  // <YYYY-MM>.<chat_name>.log.gz
+};
+
+struct _SrnChatLogFile {
+    SrnChatLogFileType type;
+    char *path;
+    char *date;         // "YYYY-MM-DD", or "YYYY-MM" for monthly archive
+    char *chat_name;
+};
+
+SrnChatLogWriter* srn_chat_log_writer_new(SrnChatLogConfig *cfg);
+void srn_chat_log_writer_free(SrnChatLogWriter *self);
+void srn_chat_log_writer_set_config(SrnChatLogWriter *self, SrnChatLogConfig *cfg);
+void srn_chat_log_writer_write(SrnChatLogWriter *self, const char *srv_name,
+        const char *chat_name, GDateTime *time, const char *line,
+        const char *sender, const char *content);
+void srn_chat_log_writer_flush(SrnChatLogWriter *self);
+SrnMessageStore* srn_chat_log_writer_get_store(SrnChatLogWriter *self);
+void srn_chat_log_writer_hold(SrnChatLogWriter *self);
+void srn_chat_log_writer_release(SrnChatLogWriter *self);
+
+GList* srn_chat_log_list_files(const char *dir, const char *chat_name);
+SrnRet srn_chat_log_file_read(SrnChatLogFile *file, SrnChatLogReadFunc func,
+        gpointer user_data);
+void srn_chat_log_file_free(SrnChatLogFile *file);
+void srn_chat_log_file_hold(const char *path);
+void srn_chat_log_file_release(const char *path);
+void srn_chat_log_compress(const char *log_dir, int days,
+        GCancellable *cancellable);
+void srn_chat_log_compact(const char *log_dir, goffset threshold,
+        GCancellable *cancellable);
+
+SrnChatLogConfig* srn_chat_log_config_new(void);
+void srn_chat_log_config_free(SrnChatLogConfig *cfg);
+SrnRet srn_chat_log_config_check(SrnChatLogConfig *cfg);
 
 #endif /* __CHAT_LOG_H */
@@ -26,6 +26,7 @@
 #include "config/config.h"
 #include "version.h"
 #include "log.h"
+#include "chat_log.h"
 #include "pattern_set.h"
 #include "command.h"
 
@@ -45,6 +46,8 @@ struct _SrnApplication {
 
     SrnLogger *logger;
     SrnLoggerConfig *logger_cfg;
+    SrnLogger *prev_logger;     // Default logger before application starts
+    SrnChatLogWriter *chat_log_writer;
 
     SuiApplication *ui;
     SuiApplicationEvents ui_app_events;
@@ -64,8 +67,13 @@ struct _SrnApplication {
 struct _SrnApplicationConfig {
     bool prompt_on_quit; // TODO
     char *id;
+    bool io_thread;
+    int timer_slack;
+    int reconn_concurrency;
+    int reconn_stable_time;
     GList *auto_connect_srv_list;
 
+    SrnChatLogConfig *chat_log;
     SuiApplicationConfig *ui;
 };
 
@@ -25,11 +25,14 @@
 #include "sui/sui.h"
 #include "ret.h"
 #include "extra_data.h"
+#include "scrollback.h"
 
 #ifndef __IN_CORE_H
 	#error This file should not be included directly, include just core.h
 #endif
 
+#define SRN_CHAT_HISTORY_LINES  50  // Lines of history loaded at once
+
 typedef struct _SrnChat SrnChat;
 typedef enum   _SrnChatType SrnChatType;
 typedef struct _SrnChatConfig SrnChatConfig;
@@ -57,6 +60,15 @@ struct _SrnChat {
 
     GList *msg_list;
     SrnMessage *last_msg;
+    GQueue *pending_msg_queue; // Messages being rendered, in received order
+    GList *playback_msg_list;  // Playback messages to be shown in bulk,
+                               // newest first
+    int playback_pending;      // Count of playback messages being rendered
+    bool playback_flush;       // Show playback messages once all rendered
+    gint64 last_log_time;      // Unix time of the newest logged message,
+                               // 0 if there is no chat log
+    char *last_log_msgid;      // msgid of the newest logged message
+    SrnScrollback *scrollback; // History messages from chat logs
 
     /* Used by Filters & Decorators */
     GList *ignore_regex_list;
@@ -127,6 +139,9 @@ void srn_chat_add_error_message_with_user(SrnChat *chat, SrnChatUser *user, cons
 void srn_chat_add_error_message_with_user_fmt(SrnChat *chat, SrnChatUser *user, const char *fmt, ...);
 void srn_chat_set_topic(SrnChat *chat, SrnChatUser *user, const char *topic);
 void srn_chat_set_topic_setter(SrnChat *chat, const char *setter);
+int srn_chat_load_history(SrnChat *chat, int count);
+void srn_chat_start_playback(SrnChat *chat);
+void srn_chat_flush_playback(SrnChat *chat);
 
 SrnChatConfig *srn_chat_config_new();
 void srn_chat_config_free(SrnChatConfig *cfg);
@@ -47,7 +47,14 @@ struct _SrnMessage {
 
     /* Raw message */
     char *content;  // Raw message content
+    /* Raw message content without mIRC formatting, it is what filters and
+     * the mention renderer match against */
+    char *plain_content;
     GDateTime *time; // Local time when creating message
+    /* Snapshot of server address, like "ircs://chat.freenode.net:6697",
+     * renderers running in render workers use it instead of accessing
+     * SrnServer */
+    char *server_url;
 
     /* NOTE: All rendered_xxx fields MUST be valid XML and never be NULL */
     char *rendered_sender; // Sender name
@@ -59,11 +66,13 @@ struct _SrnMessage {
 
     bool mentioned; // Whether this message should be mentioned
 
-    SuiMessage *ui;
+    SuiMessage *ui; // Created when message is going to be shown
 };
 
 SrnMessage* srn_message_new(SrnChat *chat, SrnChatUser *user, const char *content, SrnMessageType type);
 void srn_message_free(SrnMessage *msg);
+void srn_message_set_time(SrnMessage *msg, GDateTime *time);
+void srn_message_create_ui(SrnMessage *msg);
 char* srn_message_to_string(const SrnMessage *self);
 
 #endif /* __MESSAGE_H */
@@ -25,6 +25,8 @@
 #include "sui/sui.h"
 #include "ret.h"
 #include "extra_data.h"
+#include "highlight.h"
+#include "hostmask.h"
 
 #ifndef __IN_CORE_H
 	#error This file should not be included directly, include just core.h
@@ -34,7 +36,9 @@
 #define SRN_SERVER_PING_INTERVAL    (30 * 1000)
 #define SRN_SERVER_PING_TIMEOUT     (SRN_SERVER_PING_INTERVAL * 2)
 #define SRN_SERVER_RECONN_INTERVAL  (5 * 1000)
-#define SRN_SERVER_RECONN_STEP      SRN_SERVER_RECONN_INTERVAL
+#define SRN_SERVER_RECONN_MAX_INTERVAL  (5 * 60 * 1000)
+#define SRN_SERVER_RECONN_CONCURRENCY   4
+#define SRN_SERVER_RECONN_STABLE_TIME   60  // In seconds
 
 typedef struct _SrnServerUser SrnServerUser;
 typedef struct _SrnServerAddr SrnServerAddr;
@@ -47,6 +51,8 @@ typedef struct _SrnUserConfig SrnUserConfig;
 typedef struct _SrnServerConfig SrnServerConfig;
 typedef struct _EnabledCap EnabledCap;
 typedef struct _SrnServerCap SrnServerCap;
+typedef void (*SrnServerRegisteredFunc) (SrnServer *srv, bool registered,
+        gpointer user_data);
 
 #include "chat.h"
 
@@ -103,13 +109,21 @@ struct _SrnServer {
     bool negotiated;    // Client capability negotiation has finished
     bool registered;    // User has a nickname
     bool loggedin;      // User has identified as a certain account
+    gint64 connect_time;    // Monotonic time when connecting started, in us
+    bool chats_joined;  // Channels have been joined after registration
+    GHashTable *join_pending_table; // Lowercase names of channels which JOIN
+                                    // is sent to but not yet replied
+    int join_targmax;   // Max targets of JOIN from RPL_ISUPPORT, 0 for unlimited
 
     /* Keep alive */
     unsigned long last_pong;        // Last pong time, in ms
     unsigned long delay;            // Delay in ms
-    unsigned long reconn_interval;  // Interval of next reconnect, in ms
+    unsigned long reconn_interval;  // Backoff of next reconnect, in ms
+    unsigned long reconn_delay;     // Jittered delay of scheduled reconnect, in ms
     int ping_timer;
     int reconn_timer;
+    bool reconn_queued;     // Waiting for a slot of reconnecting
+    bool reconn_slot;       // Holding a slot of reconnecting
 
     SrnServerCap *cap;      // Server capabilities
 
@@ -120,7 +134,16 @@ struct _SrnServer {
     GList *chat_list;      // List of SrnChat
     GHashTable *user_table; // Hash table of SrnServerUser
 
+    SrnHighlighter *highlighter; // Matches nick and highlight keywords
+    SrnHostmaskSet *ignore_masks;   // Masks from config and ignore_mask_list
+    GList *ignore_mask_list;        // List of masks ignored via command
+
     SircSession *irc; // IRC session
+
+    GList *registered_conts;    // Continuations waiting for registration,
+                                // see srn_server_on_registered()
+    GList *playback_batches;    // Reference tags of open playback batches,
+                                // see irc_event_batch()
 };
 
 enum _SrnLoginMethod {
@@ -150,6 +173,8 @@ struct _SrnUserConfig {
     char *kick_message;
     char *quit_message;
 
+    GList *highlight_keywords; // List of keywords that highlight messages
+
     SrnLoginConfig *login;
 };
 
@@ -164,6 +189,7 @@ struct _SrnServerConfig {
     char *password;
     GList *auto_join_chat_list;
     GList *auto_run_cmd_list; // List of autorun commands
+    GList *ignore_mask_list; // List of ignored hostmasks
 
     /* SrnServerUser */
     SrnUserConfig *user;
@@ -184,6 +210,7 @@ struct _EnabledCap {
     bool userhost_in_names;
     bool cap_notify;
     bool chghost;
+    bool batch;
 
     // Vendor-Specific
     bool znc_server_time_iso;
@@ -194,6 +221,8 @@ struct _SrnServerCap {
     /* Capabilities */
     EnabledCap client_enabled;
     EnabledCap server_enabled;
+    EnabledCap speculated;  // Requested before receiving CAP LS reply
+    bool speculating;       // Speculative request is not yet replied
 
     SrnServer *srv;
 };
@@ -203,6 +232,7 @@ void srn_server_free(SrnServer *srv);
 SrnRet srn_server_quit(SrnServer *srv, const char *reason);
 void srn_server_set_config(SrnServer *srv, SrnServerConfig *cfg);
 SrnRet srn_server_reload_config(SrnServer *srv);
+SrnRet srn_server_save_ignore_mask_list(SrnServer *srv);
 bool srn_server_is_valid(SrnServer *srv);
 bool srn_server_is_chat_valid(SrnServer *srv, SrnChat *chat);
 SrnRet srn_server_connect(SrnServer *srv);
@@ -210,7 +240,15 @@ SrnRet srn_server_disconnect(SrnServer *srv);
 SrnRet srn_server_reconnect(SrnServer *srv);
 SrnRet srn_server_state_transfrom(SrnServer *srv, SrnServerAction act);
 bool srn_server_is_registered(SrnServer *srv);
-void srn_server_wait_until_registered(SrnServer *srv);
+void srn_server_set_casemapping(SrnServer *srv, SrnCasemapping casemapping);
+void srn_server_on_registered(SrnServer *srv, SrnServerRegisteredFunc func,
+        gpointer user_data, GDestroyNotify destroy);
+void srn_server_finish_registered(SrnServer *srv, bool registered);
+bool srn_server_is_playback(SrnServer *srv);
+void srn_server_start_playback(SrnServer *srv);
+void srn_server_finish_playback(SrnServer *srv);
+void srn_server_set_join_pending(SrnServer *srv, const char *chans, bool pending);
+bool srn_server_is_join_pending(SrnServer *srv, const char *chan);
 int srn_server_add_chat(SrnServer *srv, const char *name);
 SrnRet srn_server_rm_chat(SrnServer *srv, SrnChat *chat);
 SrnChat* srn_server_get_chat(SrnServer *srv, const char *name);
@@ -266,5 +304,8 @@ SrnRet srn_server_cap_client_enable(SrnServerCap *scap, const char *name, bool e
 bool srn_server_cap_all_enabled(SrnServerCap *scap);
 bool srn_server_cap_is_support(SrnServerCap *scap, const char *name, const char *value);
 char* srn_server_cap_dump(SrnServerCap *scap);
+char* srn_server_cap_speculate(SrnServerCap *scap);
+bool srn_server_cap_server_is_enabled(SrnServerCap *scap, const char *name);
+bool srn_server_cap_is_speculated(SrnServerCap *scap, const char *name);
 
 #endif /* __SERVER_H */
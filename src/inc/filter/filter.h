@@ -35,6 +35,10 @@ typedef int SrnFilterFlags;
 #define SRN_FILTER_FLAG_PATTERN     1 << 1
 #define SRN_FILTER_FLAG_LOG         1 << 2
 
+/* Filters which only look at sender and raw content of message, they should
+ * be applied before rendering, so that dropped message is never rendered */
+#define SRN_FILTER_FLAG_PRE_RENDER  (SRN_FILTER_FLAG_USER | SRN_FILTER_FLAG_PATTERN)
+
 void srn_filter_init(void);
 void srn_filter_finalize(void);
 
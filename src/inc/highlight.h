@@ -0,0 +1,48 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file highlight.h
+ * @brief Multi-keyword highlight matcher.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-02
+ */
+
+#ifndef __HIGHLIGHT_H
+#define __HIGHLIGHT_H
+
+#include <glib.h>
+#include "srain.h"
+
+typedef enum _SrnCasemapping SrnCasemapping;
+typedef struct _SrnHighlighter SrnHighlighter;
+
+enum _SrnCasemapping {
+    SRN_CASEMAPPING_ASCII,
+    SRN_CASEMAPPING_RFC1459,
+    SRN_CASEMAPPING_STRICT_RFC1459,
+};
+
+SrnHighlighter* srn_highlighter_new(SrnCasemapping casemapping);
+void srn_highlighter_free(SrnHighlighter *self);
+void srn_highlighter_set_casemapping(SrnHighlighter *self, SrnCasemapping casemapping);
+
+void srn_highlighter_build(SrnHighlighter *self, const char *nick, GList *keywords);
+bool srn_highlighter_match(SrnHighlighter *self, const char *text, int len);
+
+#endif /* __HIGHLIGHT_H */
@@ -0,0 +1,47 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file hostmask.h
+ * @brief Indexed set of "nick!user@host" wildcard masks.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-05
+ */
+
+#ifndef __HOSTMASK_H
+#define __HOSTMASK_H
+
+#include <glib.h>
+#include "srain.h"
+#include "ret.h"
+
+typedef struct _SrnHostmaskSet SrnHostmaskSet;
+
+SrnHostmaskSet* srn_hostmask_set_new(void);
+void srn_hostmask_set_free(SrnHostmaskSet *self);
+
+SrnRet srn_hostmask_set_add(SrnHostmaskSet *self, const char *mask);
+SrnRet srn_hostmask_set_rm(SrnHostmaskSet *self, const char *mask);
+GList* srn_hostmask_set_list(SrnHostmaskSet *self);
+bool srn_hostmask_set_match(SrnHostmaskSet *self, const char *nick,
+        const char *user, const char *host);
+
+bool srn_hostmask_is_mask(const char *str);
+char* srn_hostmask_normalize(const char *mask);
+
+#endif /* __HOSTMASK_H */
@@ -48,52 +48,37 @@ struct _SrnLoggerConfig {
     GList *error_targets;
 };
 
-/* Debug output */
-#define DBG_FR(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_DEBUG, TRUE, TRUE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-
-#define DBG_F(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_DEBUG, TRUE, FALSE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+/* Every callsite caches whether it is enabled in a static variable, the
+ * cache is valid only if it equals to srn_logger_generation, see
+ * ``srn_logger_log_site()``. So a disabled callsite costs only one branch. */
+#define SRN_LOG(lv, print_prompt, new_line, ...) \
+    do { \
+        static int _srn_log_site; \
+        if (G_UNLIKELY(_srn_log_site != srn_logger_generation)) { \
+            srn_logger_log_site(&_srn_log_site, lv, print_prompt, new_line, \
+                    __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__); \
+        } \
+    } while (0)
 
-#define DBG(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_DEBUG, FALSE, FALSE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+/* Debug output */
+#define DBG_FR(...) SRN_LOG(LOG_DEBUG, TRUE, TRUE, __VA_ARGS__)
+#define DBG_F(...) SRN_LOG(LOG_DEBUG, TRUE, FALSE, __VA_ARGS__)
+#define DBG(...) SRN_LOG(LOG_DEBUG, FALSE, FALSE, __VA_ARGS__)
 
 /* Info output */
-#define LOG_FR(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_INFO, TRUE, TRUE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-
-#define LOG_F(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_INFO, TRUE, FALSE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-
-#define LOG(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_INFO, FALSE, FALSE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#define LOG_FR(...) SRN_LOG(LOG_INFO, TRUE, TRUE, __VA_ARGS__)
+#define LOG_F(...) SRN_LOG(LOG_INFO, TRUE, FALSE, __VA_ARGS__)
+#define LOG(...) SRN_LOG(LOG_INFO, FALSE, FALSE, __VA_ARGS__)
 
 /* Warn output */
-#define WARN_FR(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_WARN, TRUE, TRUE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#define WARN_FR(...) SRN_LOG(LOG_WARN, TRUE, TRUE, __VA_ARGS__)
+#define WARN_F(...) SRN_LOG(LOG_WARN, TRUE, FALSE, __VA_ARGS__)
+#define WARN(...) SRN_LOG(LOG_WARN, FALSE, FALSE, __VA_ARGS__)
 
-#define WARN_F(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_WARN, TRUE, FALSE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+#define ERR_FR(...) SRN_LOG(LOG_ERROR, TRUE, TRUE, __VA_ARGS__)
+#define ERR_F(...) SRN_LOG(LOG_ERROR, TRUE, FALSE, __VA_ARGS__)
 
-#define WARN(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_WARN, FALSE, FALSE \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-
-#define ERR_FR(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_ERROR, TRUE, TRUE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
-
-#define ERR_F(...) \
-    srn_logger_log(srn_logger_get_default(), LOG_ERROR, TRUE, FALSE, \
-            __FILE__, __FUNCTION__, __LINE__, __VA_ARGS__)
+extern int srn_logger_generation;
 
 SrnLogger *srn_logger_get_default(void);
 void srn_logger_set_default(SrnLogger *logger);
@@ -105,6 +90,9 @@ SrnLoggerConfig *srn_logger_get_config(SrnLogger *logger);
 void srn_logger_log(SrnLogger *logger, SrnLogLevel lv, bool print_prompt,
         bool new_line, const char *file, const char *func, int line,
         const char *fmt, ...);
+void srn_logger_log_site(int *site, SrnLogLevel lv, bool print_prompt,
+        bool new_line, const char *file, const char *func, int line,
+        const char *fmt, ...);
 
 SrnLoggerConfig *srn_logger_config_new(void);
 void srn_logger_config_free(SrnLoggerConfig *cfg);
@@ -0,0 +1,64 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file log_grep.h
+ * @brief Parallel regex search of chat logs
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-12
+ */
+
+#ifndef __LOG_GREP_H
+#define __LOG_GREP_H
+
+#include <glib.h>
+
+#include "srain.h"
+#include "ret.h"
+
+#define SRN_LOG_GREP_MAX_MATCHES    500
+
+typedef struct _SrnLogGrepQuery SrnLogGrepQuery;
+typedef struct _SrnLogGrepMatch SrnLogGrepMatch;
+typedef void (*SrnLogGrepMatchFunc) (const SrnLogGrepMatch *match,
+        gpointer user_data);
+typedef void (*SrnLogGrepFinishFunc) (int nmatch, gpointer user_data);
+
+struct _SrnLogGrepQuery {
+    char *srv_name;     // NULL for all servers
+    char *chat_name;    // NULL for all chats
+    char *since;        // Date in format "YYYY-MM-DD", NULL for unlimited
+    char *pattern;      // Perl-compatible regular expression
+};
+
+struct _SrnLogGrepMatch {
+    const char *srv_name;
+    const char *chat_name;
+    const char *date;
+    const char *line;
+};
+
+SrnRet srn_log_grep(const char *log_dir, SrnLogGrepQuery *query,
+        SrnLogGrepMatchFunc match_cb, SrnLogGrepFinishFunc finish_cb,
+        gpointer user_data);
+
+SrnLogGrepQuery* srn_log_grep_query_new(void);
+void srn_log_grep_query_free(SrnLogGrepQuery *query);
+
+#endif /* __LOG_GREP_H */
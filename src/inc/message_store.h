@@ -0,0 +1,71 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file message_store.h
+ * @brief Indexed on-disk message store for searching chat history.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-08
+ */
+
+#ifndef __MESSAGE_STORE_H
+#define __MESSAGE_STORE_H
+
+#include <glib.h>
+
+#include "srain.h"
+#include "ret.h"
+
+#define SRN_MESSAGE_STORE_SEARCH_LIMIT  100
+
+typedef struct _SrnMessageStore SrnMessageStore;
+typedef struct _SrnMessageStoreQuery SrnMessageStoreQuery;
+typedef struct _SrnMessageStoreResult SrnMessageStoreResult;
+
+struct _SrnMessageStoreQuery {
+    char *srv_name;     // NULL for all servers
+    char *chat_name;    // NULL for all chats
+    char *sender;       // NULL for any sender
+    gint64 since;       // Unix time, 0 for unlimited
+    gint64 until;       // Unix time, 0 for unlimited
+    char *text;         // Words that all must appear in message
+    int limit;          // Max count of results
+};
+
+struct _SrnMessageStoreResult {
+    char *srv_name;
+    char *chat_name;
+    gint64 time;
+    char *sender;
+    char *content;
+};
+
+SrnMessageStore* srn_message_store_new(const char *dir);
+void srn_message_store_free(SrnMessageStore *self);
+SrnRet srn_message_store_append(SrnMessageStore *self, const char *srv_name,
+        const char *chat_name, gint64 time, const char *sender,
+        const char *content);
+void srn_message_store_flush(SrnMessageStore *self, bool sync);
+SrnRet srn_message_store_search(SrnMessageStore *self,
+        SrnMessageStoreQuery *query, GList **results);
+
+SrnMessageStoreQuery* srn_message_store_query_new(void);
+void srn_message_store_query_free(SrnMessageStoreQuery *query);
+void srn_message_store_result_free(SrnMessageStoreResult *result);
+
+#endif /* __MESSAGE_STORE_H */
@@ -25,6 +25,10 @@ char *srn_get_theme_file(const char *fname);
 char *srn_get_user_config_file();
 char *srn_get_system_config_file();
 char *srn_create_log_file(const char *srv_name, const char *fname);
+char *srn_get_log_dir(const char *srv_name);
+char *srn_get_message_store_dir();
+char *srn_get_ignore_list_file(const char *srv_name);
+char *srn_escape_file_name(const char *name);
 SrnRet srn_create_user_file();
 
 #endif /* __FILE_HELPER_H */
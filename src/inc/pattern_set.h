@@ -27,9 +27,11 @@
 #define __PATTERN_SET_H
 
 #include <glib.h>
+#include "srain.h"
 #include "ret.h"
 
 typedef struct _SrnPatternSet SrnPatternSet;
+typedef struct _SrnPatternCache SrnPatternCache;
 
 SrnPatternSet* srn_pattern_set_new(void);
 void srn_pattern_set_free(SrnPatternSet *self);
@@ -38,5 +40,13 @@ SrnRet srn_pattern_set_add(SrnPatternSet *self, const char *name, const char *pa
 SrnRet srn_pattern_set_rm(SrnPatternSet *self, const char *name);
 GRegex* srn_pattern_set_get(SrnPatternSet *self, const char *name);
 GList* srn_pattern_set_list(SrnPatternSet *self);
+unsigned srn_pattern_set_get_serial(SrnPatternSet *self);
+
+SrnPatternCache* srn_pattern_cache_new(void);
+void srn_pattern_cache_free(SrnPatternCache *self);
+bool srn_pattern_cache_is_valid(SrnPatternCache *self, SrnPatternSet *set, unsigned serial);
+void srn_pattern_cache_update(SrnPatternCache *self, SrnPatternSet *set, GList *names, unsigned serial);
+bool srn_pattern_cache_match(SrnPatternCache *self, const char *str);
+GList* srn_pattern_cache_get_regexes(SrnPatternCache *self);
 
 #endif /* __PATTERN_SET_H */
@@ -38,6 +38,18 @@ typedef int SrnRenderFlags;
 #define SRN_RENDER_FLAG_URL             1 << 3
 #define SRN_RENDER_FLAG_MENTION         1 << 4
 
+typedef struct _SrnRenderJob SrnRenderJob;
+
+/**
+ * @brief SrnRenderCallback is called in main thread when a SrnRenderJob is
+ * finished.
+ *
+ * @param msg is the rendered SrnMessage.
+ * @param ret is the result of rendering.
+ * @param user_data
+ */
+typedef void (*SrnRenderCallback) (SrnMessage *msg, SrnRet ret, void *user_data);
+
 void srn_render_init(void);
 void srn_render_finalize(void);
 
@@ -52,6 +64,55 @@ void srn_render_finalize(void);
  */
 SrnRet srn_render_message(SrnMessage *msg, SrnRenderFlags flags);
 
+/**
+ * @brief srn_render_job_new creates a job for rendering SrnMessage in
+ * background, the job is freed by render module after callback is called or
+ * job is cancelled.
+ *
+ * @param msg is a SrnMessage instance, it should not be accessed until
+ * callback is called.
+ * @param flags indicates which render moduele to use.
+ * @param cb is called in main thread when rendering is finished.
+ * @param user_data
+ *
+ * @return a SrnRenderJob, submit it via srn_render_job_submit().
+ */
+SrnRenderJob* srn_render_job_new(SrnMessage *msg, SrnRenderFlags flags,
+        SrnRenderCallback cb, void *user_data);
+
+/**
+ * @brief srn_render_job_submit submits a SrnRenderJob to render workers.
+ * If no renderer of job can be run in worker, the job is rendered and
+ * callback is called before this function returns.
+ *
+ * @param job
+ */
+void srn_render_job_submit(SrnRenderJob *job);
+
+/**
+ * @brief srn_render_job_cancel waits for the job rendered by worker and
+ * frees it without calling callback, then the message of job can be freed.
+ *
+ * @param job is a submitted job whose callback has not yet been called.
+ */
+void srn_render_job_cancel(SrnRenderJob *job);
+
+/**
+ * @brief srn_render_sync waits for all submitted jobs rendered by workers,
+ * call it before modifying anything which can be accessed by renderers.
+ */
+void srn_render_sync(void);
+
+/**
+ * @brief srn_render_strip_mirc returns a copy of plain text without mIRC
+ * formatting characters, like what mirc_strip_renderer does.
+ *
+ * @param text is a plain text, not markup.
+ *
+ * @return a newly allocated string, should be freed by g_free().
+ */
+char* srn_render_strip_mirc(const char *text);
+
 SrnRet srn_render_attach_pattern(SrnExtraData *extra_data, const char *pattern);
 SrnRet srn_render_detach_pattern(SrnExtraData *extra_data, const char *pattern);
 
@@ -40,5 +40,6 @@ SrnRet ret_err(const char *fmt, ...);
 SrnRet ret_ok(const char *fmt, ...);
 const char *ret_get_message(SrnRet id);
 int ret_get_no(SrnRet id);
+unsigned ret_get_evicted_count();
 
 #endif /* __RET_H */
@@ -0,0 +1,60 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scrollback.h
+ * @brief Read history messages of chat from chat logs
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-10
+ */
+
+#ifndef __SCROLLBACK_H
+#define __SCROLLBACK_H
+
+#include <glib.h>
+
+#include "srain.h"
+
+typedef struct _SrnScrollback SrnScrollback;
+typedef struct _SrnScrollbackEntry SrnScrollbackEntry;
+typedef enum _SrnScrollbackEntryType SrnScrollbackEntryType;
+
+enum _SrnScrollbackEntryType {
+    SRN_SCROLLBACK_ENTRY_SENT,
+    SRN_SCROLLBACK_ENTRY_RECV,
+    SRN_SCROLLBACK_ENTRY_ACTION,
+    SRN_SCROLLBACK_ENTRY_MISC,
+    SRN_SCROLLBACK_ENTRY_ERROR,
+};
+
+struct _SrnScrollbackEntry {
+    SrnScrollbackEntryType type;
+    GDateTime *time;
+    char *sender;   // NULL for misc and error entries
+    char *content;
+};
+
+SrnScrollback* srn_scrollback_new(const char *log_dir, const char *chat_name);
+void srn_scrollback_free(SrnScrollback *self);
+gint64 srn_scrollback_get_last_time(SrnScrollback *self);
+int srn_scrollback_read(SrnScrollback *self, int count, GList **entries);
+
+void srn_scrollback_entry_free(SrnScrollbackEntry *entry);
+
+#endif /* __SCROLLBACK_H */
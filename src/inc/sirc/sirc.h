@@ -32,6 +32,9 @@ typedef struct _SircSession SircSession;
 #define SIRC_SESSION_IPV6           1 << 3 // Not support yet
 
 #define SIRC_BUF_LEN    1024
+#define SIRC_MSG_LEN    512     // Max length of message, including CRLF
+#define SIRC_TAGS_LEN   8191    // Max length of IRCv3 message tags, including
+                                // leading '@' and trailing space
 
 #define __IN_SIRC_H
 #include "sirc_cmd.h"
@@ -45,12 +48,25 @@ SircSession* sirc_new_session(SircEvents *events, SircConfig *cfg);
 void sirc_free_session(SircSession *sirc);
 void sirc_set_config(SircSession *sirc, SircConfig *cfg);
 void sirc_connect(SircSession *sirc, const char *host, int port);
+void sirc_connect_any(SircSession *sirc, const char **hosts, const int *ports,
+        int count);
 void sirc_cancel_connect(SircSession *sirc);
 void sirc_disconnect(SircSession *sirc);
 int sirc_get_fd(SircSession *sirc);
 GIOStream* sirc_get_stream(SircSession *sirc);
+int sirc_get_addr_index(SircSession *sirc);
+bool sirc_get_tls_stats(SircSession *sirc, int *full, int *resumed);
 SircEvents* sirc_get_events(SircSession *sirc);
 void* sirc_get_ctx(SircSession *sirc);
 void sirc_set_ctx(SircSession *sirc, void *ctx);
+const char* sirc_get_origin_user(SircSession *sirc);
+const char* sirc_get_origin_host(SircSession *sirc);
+gint64 sirc_get_message_time(SircSession *sirc);
+const char* sirc_get_message_msgid(SircSession *sirc);
+const char* sirc_get_message_batch(SircSession *sirc);
+const char* sirc_get_message_account(SircSession *sirc);
+char* sirc_get_message_tag(SircSession *sirc, const char *key);
+void sirc_set_io_thread(bool enable);
+void sirc_stop_io_thread(void);
 
 #endif /* __IRC_H */
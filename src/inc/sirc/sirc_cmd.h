@@ -27,6 +27,7 @@
 int sirc_cmd_ping(SircSession *sirc, const char *data);
 int sirc_cmd_pong(SircSession *sirc, const char *data);
 int sirc_cmd_join(SircSession *sirc, const char *chan, const char *passwd);
+int sirc_cmd_join_list(SircSession *sirc, const char **chans, const char **passwds, int count, int max_targets);
 int sirc_cmd_user(SircSession *sirc, const char *username, const char *hostname, const char *servername, const char *realname);
 int sirc_cmd_part(SircSession *sirc, const char *chan, const char *reason);
 int sirc_cmd_nick(SircSession *sirc, const char *nick);
@@ -56,6 +56,7 @@ typedef struct {
     SircEventCallback           ping;
     SircEventCallback           pong;
     SircEventCallback           error;
+    SircEventCallback           batch;
     SircEventCallback           unknown;
 
     SircNumericEventCallback    numeric;
@@ -68,6 +68,8 @@ void sui_activate_buffer(SuiBuffer *buf);
 void* sui_buffer_get_ctx(SuiBuffer *buf);
 void sui_buffer_set_config(SuiBuffer *buf, SuiBufferConfig *cfg);
 void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg);
+void sui_buffer_add_messages(SuiBuffer *buf, GList *msgs);
+void sui_buffer_prepend_message(SuiBuffer *buf, SuiMessage *msg);
 
 /* SuiMessage */
 SuiMessage *sui_new_misc_message(void *ctx, SuiMiscMessageStyle style);
@@ -93,4 +95,9 @@ void sui_chan_list_start(SuiBuffer *sui);
 void sui_chan_list_add(SuiBuffer *sui, const char *chan, int users, const char *topic);
 void sui_chan_list_end(SuiBuffer *sui);
 
+void sui_search_result_start(SuiBuffer *sui);
+void sui_search_result_add(SuiBuffer *sui, const char *time, const char *chat,
+        const char *sender, const char *content);
+void sui_search_result_end(SuiBuffer *sui, const char *summary);
+
 #endif /* __SUI_H */
@@ -0,0 +1,39 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file timer_wheel.h
+ * @brief Coalescing timers shared by the whole application
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-23
+ */
+
+#ifndef __TIMER_WHEEL_H
+#define __TIMER_WHEEL_H
+
+#include <glib.h>
+
+#define SRN_TIMER_WHEEL_TICK    10  // ms
+#define SRN_TIMER_WHEEL_SLACK   50  // ms, default coalescing slack
+
+guint srn_timer_wheel_add(guint interval, GSourceFunc func, gpointer user_data);
+void srn_timer_wheel_remove(guint id);
+void srn_timer_wheel_set_slack(guint slack);
+
+#endif /* __TIMER_WHEEL_H */
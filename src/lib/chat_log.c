@@ -0,0 +1,546 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file chat_log.c
+ * @brief Buffered chat log writer
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-06
+ *
+ * Log lines are pushed to a lock-free stack by the main thread, and written
+ * by a background thread which periodically drains the stack. The writer
+ * thread keeps one buffered file per chat, the file is reopened when date
+ * changes and closed after being idle for a while.
+ *
+ * When message store is enabled, messages which have a sender are also
+ * appended to the message store by the writer thread, so that they can be
+ * searched later.
+ *
+ * Another low priority thread compresses old log files and compacts them into
+ * monthly archives when logs grow too large, see chat_log_file.c.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#endif
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "chat_log.h"
+
+#define LOG_FILE_IDLE_TIMEOUT   (60 * G_TIME_SPAN_SECOND)
+#define MAINTAIN_INTERVAL       G_TIME_SPAN_DAY
+
+typedef struct _LogEntry LogEntry;
+typedef struct _LogFile LogFile;
+
+struct _LogEntry {
+    char *srv_name;
+    char *chat_name;
+    char *date;
+    char *line;
+    gint64 time;    // Unix time of message
+    char *sender;   // NULL if message has no sender
+    char *content;
+
+    LogEntry *next;
+};
+
+struct _LogFile {
+    char *date;
+    char *path;       // Held until closed, see srn_chat_log_file_hold()
+    FILE *fp;
+    bool dirty;       // Written since last flush
+    gint64 last_used; // Monotonic time of last write
+};
+
+struct _SrnChatLogWriter {
+    /* Copied from config, accessed atomically */
+    int fsync;
+    int flush_interval;
+    int store_enabled;
+    int compress_after;
+    int compact_threshold;
+
+    LogEntry *queue;    // Lock-free stack of pending entries, newest first
+
+    GThread *thread;
+    GThread *maintain_thread;
+    GMutex mutex;       // Protects following fields
+    GCond cond;
+    bool stopping;
+    unsigned flush_req;
+    unsigned flush_done;
+    int holders;        // Threads which are using writer or its store
+    GCancellable *cancellable; // Cancelled when stopping
+
+    GHashTable *file_table; // Only accessed by writer thread
+    SrnMessageStore *store;
+};
+
+static gpointer writer_thread(gpointer user_data);
+static gpointer maintain_thread(gpointer user_data);
+static LogEntry* take_entries(SrnChatLogWriter *self);
+static void write_entries(SrnChatLogWriter *self, LogEntry *entries);
+static LogFile* get_file(SrnChatLogWriter *self, LogEntry *entry);
+static void flush_files(SrnChatLogWriter *self);
+static void log_entry_free(LogEntry *entry);
+static void log_file_free(LogFile *file);
+
+SrnChatLogWriter* srn_chat_log_writer_new(SrnChatLogConfig *cfg){
+    char *store_dir;
+    SrnChatLogWriter *self;
+
+    store_dir = srn_get_message_store_dir();
+    self = g_malloc0(sizeof(SrnChatLogWriter));
+    srn_chat_log_writer_set_config(self, cfg);
+    self->store = srn_message_store_new(store_dir);
+    g_free(store_dir);
+    g_mutex_init(&self->mutex);
+    g_cond_init(&self->cond);
+    self->cancellable = g_cancellable_new();
+    self->file_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)log_file_free);
+    self->thread = g_thread_new("chat-log", writer_thread, self);
+    self->maintain_thread = g_thread_new("chat-log-gc", maintain_thread, self);
+
+    return self;
+}
+
+/**
+ * @brief ``srn_chat_log_writer_free`` waits for all holders released, writes
+ * all pending logs, closes all files and then frees the writer.
+ *
+ * @param self
+ */
+void srn_chat_log_writer_free(SrnChatLogWriter *self){
+    g_mutex_lock(&self->mutex);
+    while (self->holders > 0){
+        g_cond_wait(&self->cond, &self->mutex);
+    }
+    self->stopping = TRUE;
+    g_cond_broadcast(&self->cond);
+    g_mutex_unlock(&self->mutex);
+    // Interrupt the ongoing compression or compaction
+    g_cancellable_cancel(self->cancellable);
+
+    g_thread_join(self->thread);
+    g_thread_join(self->maintain_thread);
+
+    g_object_unref(self->cancellable);
+    g_hash_table_destroy(self->file_table);
+    srn_message_store_free(self->store);
+    g_cond_clear(&self->cond);
+    g_mutex_clear(&self->mutex);
+    g_free(self);
+}
+
+void srn_chat_log_writer_set_config(SrnChatLogWriter *self,
+        SrnChatLogConfig *cfg){
+    g_atomic_int_set(&self->fsync, cfg->fsync);
+    g_atomic_int_set(&self->flush_interval, cfg->flush_interval);
+    g_atomic_int_set(&self->store_enabled, cfg->store);
+    g_atomic_int_set(&self->compress_after, cfg->compress_after);
+    g_atomic_int_set(&self->compact_threshold, cfg->compact_threshold);
+}
+
+/**
+ * @brief ``srn_chat_log_writer_write`` queues a line of chat log, it never
+ * waits for disk I/O.
+ *
+ * @param self
+ * @param srv_name
+ * @param chat_name
+ * @param time Time of message, determines which file the line is written to
+ * @param line Line without trailing newline
+ * @param sender Nickname of sender, NULL if message is not sent by anyone,
+ *        such messages are not stored to message store
+ * @param content Raw content of message
+ */
+void srn_chat_log_writer_write(SrnChatLogWriter *self, const char *srv_name,
+        const char *chat_name, GDateTime *time, const char *line,
+        const char *sender, const char *content){
+    LogEntry *entry;
+    LogEntry *head;
+
+    entry = g_malloc0(sizeof(LogEntry));
+    entry->srv_name = g_strdup(srv_name);
+    entry->chat_name = g_strdup(chat_name);
+    entry->date = g_date_time_format(time, "%F");
+    entry->line = g_strdup(line);
+    entry->time = g_date_time_to_unix(time);
+    entry->sender = g_strdup(sender);
+    entry->content = g_strdup(content);
+
+    do {
+        head = g_atomic_pointer_get(&self->queue);
+        entry->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&self->queue, head, entry));
+
+    if (!head){
+        // Wake up the idle writer thread for the first pending entry
+        g_mutex_lock(&self->mutex);
+        g_cond_broadcast(&self->cond);
+        g_mutex_unlock(&self->mutex);
+    }
+}
+
+/**
+ * @brief ``srn_chat_log_writer_flush`` blocks until all logs queued before
+ * calling are written to disk.
+ *
+ * @param self
+ */
+void srn_chat_log_writer_flush(SrnChatLogWriter *self){
+    unsigned req;
+
+    g_mutex_lock(&self->mutex);
+    req = ++self->flush_req;
+    g_cond_broadcast(&self->cond);
+    while ((int)(self->flush_done - req) < 0){
+        g_cond_wait(&self->cond, &self->mutex);
+    }
+    g_mutex_unlock(&self->mutex);
+}
+
+/**
+ * @brief ``srn_chat_log_writer_get_store`` returns the message store of
+ * writer, or NULL if message store is disabled.
+ *
+ * @param self
+ *
+ * @return
+ */
+SrnMessageStore* srn_chat_log_writer_get_store(SrnChatLogWriter *self){
+    if (!g_atomic_int_get(&self->store_enabled)){
+        return NULL;
+    }
+    return self->store;
+}
+
+/**
+ * @brief ``srn_chat_log_writer_hold`` prevents the writer and its message
+ * store from being freed, it should be called in main thread before passing
+ * them to another thread, which calls ``srn_chat_log_writer_release()``
+ * when it no longer uses them.
+ *
+ * @param self
+ */
+void srn_chat_log_writer_hold(SrnChatLogWriter *self){
+    g_mutex_lock(&self->mutex);
+    self->holders++;
+    g_mutex_unlock(&self->mutex);
+}
+
+void srn_chat_log_writer_release(SrnChatLogWriter *self){
+    g_mutex_lock(&self->mutex);
+    self->holders--;
+    g_cond_broadcast(&self->cond);
+    g_mutex_unlock(&self->mutex);
+}
+
+SrnChatLogConfig* srn_chat_log_config_new(void){
+    SrnChatLogConfig *cfg;
+
+    cfg = g_malloc0(sizeof(SrnChatLogConfig));
+    cfg->fsync = FALSE;
+    cfg->flush_interval = SRN_CHAT_LOG_FLUSH_INTERVAL;
+    cfg->store = FALSE;
+    cfg->compress_after = SRN_CHAT_LOG_COMPRESS_AFTER;
+    cfg->compact_threshold = SRN_CHAT_LOG_COMPACT_THRESHOLD;
+
+    return cfg;
+}
+
+void srn_chat_log_config_free(SrnChatLogConfig *cfg){
+    g_free(cfg);
+}
+
+SrnRet srn_chat_log_config_check(SrnChatLogConfig *cfg){
+    if (cfg->flush_interval <= 0){
+        return RET_ERR(_("Invalid chat log flush interval: %1$d"),
+                cfg->flush_interval);
+    }
+    if (cfg->compress_after < 0){
+        return RET_ERR(_("Invalid chat log compression age: %1$d"),
+                cfg->compress_after);
+    }
+    if (cfg->compact_threshold < 0){
+        return RET_ERR(_("Invalid chat log compaction threshold: %1$d"),
+                cfg->compact_threshold);
+    }
+    return SRN_OK;
+}
+
+static gpointer writer_thread(gpointer user_data){
+    SrnChatLogWriter *self;
+
+    self = user_data;
+    while (TRUE){
+        bool stopping;
+        unsigned req;
+        gint64 end_time;
+
+        g_mutex_lock(&self->mutex);
+        /* Sleep while nothing is queued, wake up only for closing idle files
+         * if any */
+        end_time = g_get_monotonic_time() + LOG_FILE_IDLE_TIMEOUT;
+        while (!self->stopping && self->flush_req == self->flush_done
+                && !g_atomic_pointer_get(&self->queue)){
+            if (g_hash_table_size(self->file_table) == 0){
+                g_cond_wait(&self->cond, &self->mutex);
+            } else if (!g_cond_wait_until(&self->cond, &self->mutex, end_time)){
+                break; // Timeout
+            }
+        }
+        /* Then wait for more entries, so that they are written in batch */
+        end_time = g_get_monotonic_time()
+            + g_atomic_int_get(&self->flush_interval) * G_TIME_SPAN_MILLISECOND;
+        while (!self->stopping && self->flush_req == self->flush_done
+                && g_atomic_pointer_get(&self->queue)){
+            if (!g_cond_wait_until(&self->cond, &self->mutex, end_time)){
+                break; // Timeout
+            }
+        }
+        stopping = self->stopping;
+        req = self->flush_req;
+        g_mutex_unlock(&self->mutex);
+
+        write_entries(self, take_entries(self));
+        flush_files(self);
+
+        g_mutex_lock(&self->mutex);
+        self->flush_done = req;
+        g_cond_broadcast(&self->cond);
+        g_mutex_unlock(&self->mutex);
+
+        if (stopping){
+            break;
+        }
+    }
+
+    g_hash_table_remove_all(self->file_table);
+
+    return NULL;
+}
+
+/**
+ * @brief Compress and compact chat logs at startup and then once a day.
+ * Late messages may still be written to files of past days, files opened by
+ * writer thread are held so that they are not compressed meanwhile.
+ */
+static gpointer maintain_thread(gpointer user_data){
+    char *log_dir;
+    SrnChatLogWriter *self;
+
+    self = user_data;
+#ifdef __linux__
+    // Only lower priority of current thread
+    setpriority(PRIO_PROCESS, 0, 19);
+#endif
+
+    log_dir = srn_get_log_dir(NULL);
+    g_mutex_lock(&self->mutex);
+    while (!self->stopping){
+        int days;
+        int threshold;
+        gint64 end_time;
+
+        g_mutex_unlock(&self->mutex);
+
+        days = g_atomic_int_get(&self->compress_after);
+        threshold = g_atomic_int_get(&self->compact_threshold);
+        if (days > 0){
+            srn_chat_log_compress(log_dir, days, self->cancellable);
+        }
+        if (days > 0 && threshold > 0){
+            srn_chat_log_compact(log_dir, (goffset)threshold * 1024 * 1024,
+                    self->cancellable);
+        }
+
+        g_mutex_lock(&self->mutex);
+        end_time = g_get_monotonic_time() + MAINTAIN_INTERVAL;
+        while (!self->stopping){
+            if (!g_cond_wait_until(&self->cond, &self->mutex, end_time)){
+                break; // Timeout
+            }
+        }
+    }
+    g_mutex_unlock(&self->mutex);
+    g_free(log_dir);
+
+    return NULL;
+}
+
+/**
+ * @brief Take all pending entries from queue.
+ *
+ * @return List of entries in the order they are queued.
+ */
+static LogEntry* take_entries(SrnChatLogWriter *self){
+    LogEntry *head;
+    LogEntry *prev;
+
+    do {
+        head = g_atomic_pointer_get(&self->queue);
+    } while (!g_atomic_pointer_compare_and_exchange(&self->queue, head, NULL));
+
+    /* Reverse the stack */
+    prev = NULL;
+    while (head){
+        LogEntry *next;
+
+        next = head->next;
+        head->next = prev;
+        prev = head;
+        head = next;
+    }
+
+    return prev;
+}
+
+static void write_entries(SrnChatLogWriter *self, LogEntry *entries){
+    bool store;
+
+    store = g_atomic_int_get(&self->store_enabled);
+    while (entries){
+        LogEntry *next;
+        LogFile *file;
+
+        file = get_file(self, entries);
+        if (file){
+            fputs(entries->line, file->fp);
+            fputc('\n', file->fp);
+            file->dirty = TRUE;
+            file->last_used = g_get_monotonic_time();
+        }
+        if (store && entries->sender){
+            srn_message_store_append(self->store,
+                    entries->srv_name, entries->chat_name,
+                    entries->time, entries->sender, entries->content);
+        }
+
+        next = entries->next;
+        log_entry_free(entries);
+        entries = next;
+    }
+}
+
+/**
+ * @brief Get opened log file for the entry, if the file of chat belongs to
+ * another day, it is closed and the file of the new day is opened.
+ */
+static LogFile* get_file(SrnChatLogWriter *self, LogEntry *entry){
+    char *key;
+    char *path;
+    char *name;
+    char *basename;
+    FILE *fp;
+    LogFile *file;
+
+    key = g_strdup_printf("%s\n%s", entry->srv_name, entry->chat_name);
+    file = g_hash_table_lookup(self->file_table, key);
+    if (file && g_strcmp0(file->date, entry->date) == 0){
+        g_free(key);
+        return file;
+    }
+
+    name = srn_escape_file_name(entry->chat_name);
+    basename = g_strdup_printf("%s.%s.log", entry->date, name);
+    path = srn_create_log_file(entry->srv_name, basename);
+    g_free(basename);
+    g_free(name);
+    if (!path){
+        ERR_FR("Failed to create log file");
+        g_free(key);
+        return NULL;
+    }
+
+    // Wait if the file is being compressed, it is created again if removed
+    srn_chat_log_file_hold(path);
+    fp = fopen(path, "a");
+    if (!fp){
+        ERR_FR("Failed to open file '%s'", path);
+        srn_chat_log_file_release(path);
+        g_free(path);
+        g_free(key);
+        return NULL;
+    }
+
+    file = g_malloc0(sizeof(LogFile));
+    file->date = g_strdup(entry->date);
+    file->path = path;
+    file->fp = fp;
+    // Previous file of the chat is closed here if any
+    g_hash_table_replace(self->file_table, key, file);
+
+    return file;
+}
+
+static void flush_files(SrnChatLogWriter *self){
+    bool sync;
+    gint64 now;
+    LogFile *file;
+    GHashTableIter iter;
+
+    sync = g_atomic_int_get(&self->fsync);
+    now = g_get_monotonic_time();
+
+    g_hash_table_iter_init(&iter, self->file_table);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&file)){
+        if (file->dirty){
+            if (fflush(file->fp) != 0){
+                ERR_FR("Failed to flush chat log");
+            }
+            if (sync){
+                fsync(fileno(file->fp));
+            }
+            file->dirty = FALSE;
+        }
+        if (now - file->last_used > LOG_FILE_IDLE_TIMEOUT){
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+
+    srn_message_store_flush(self->store, sync);
+}
+
+static void log_entry_free(LogEntry *entry){
+    g_free(entry->srv_name);
+    g_free(entry->chat_name);
+    g_free(entry->date);
+    g_free(entry->line);
+    g_free(entry->sender);
+    g_free(entry->content);
+    g_free(entry);
+}
+
+static void log_file_free(LogFile *file){
+    fclose(file->fp);
+    srn_chat_log_file_release(file->path);
+    g_free(file->path);
+    g_free(file->date);
+    g_free(file);
+}
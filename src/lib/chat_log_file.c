@@ -0,0 +1,973 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file chat_log_file.c
+ * @brief Reading, compression and compaction of chat log files
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-14
+ *
+ * Chat logs of a day are written to ``<YYYY-MM-DD>.<chat_name>.log``. Old
+ * log files are compressed to ``<YYYY-MM-DD>.<chat_name>.log.gz``, the
+ * original file name is stored in the gzip header.
+ *
+ * Messages may arrive late and be written to the plain log file of a day
+ * which has already been compressed, such file is compressed again as a new
+ * gzip member appended to the compressed file, so a compressed file may
+ * contain more than one gzip member.
+ *
+ * Compressed log files of a month can be compacted into a monthly archive
+ * ``<YYYY-MM>.<chat_name>.log.gz``, which is simply the concatenation of
+ * their gzip members. So an archive is still a valid gzip file, and every
+ * gzip member in it is a part of the log of one day.
+ *
+ * The writer thread holds the plain log files it opened, see
+ * ``srn_chat_log_file_hold()``, they are not compressed until released.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "chat_log.h"
+
+#define LOG_SUFFIX          ".log"
+#define GZIP_LOG_SUFFIX     ".log.gz"
+#define DATE_LEN            10  // YYYY-MM-DD
+#define MONTH_LEN           7   // YYYY-MM
+#define DECOMPRESS_BUF_SIZE (64 * 1024)
+#define FILE_COMPRESSING    -1  // Held count of file being compressed
+
+typedef struct _ReadContext ReadContext;
+typedef struct _CompactContext CompactContext;
+typedef bool (*GzipMemberFunc) (GFileInfo *info, const char *member,
+        gsize member_len, GBytes *bytes, gpointer user_data);
+
+struct _ReadContext {
+    SrnChatLogFile *file;
+    SrnChatLogReadFunc func;
+    gpointer user_data;
+};
+
+struct _CompactContext {
+    GHashTable *keys;   // Keys of gzip members already in archive
+    GOutputStream *out;
+    GCancellable *cancellable;
+    GError **err;
+};
+
+/* Held count of plain log files, protected by file_mutex */
+static GMutex file_mutex;
+static GCond file_cond;
+static GHashTable *file_holds;
+
+static SrnChatLogFile* parse_file_name(const char *dir, const char *name);
+static bool scan_gzip(const char *data, gsize size, GzipMemberFunc func,
+        gpointer user_data, GError **err);
+static SrnRet read_gzip(SrnChatLogFile *file, const char *data, gsize size,
+        SrnChatLogReadFunc func, gpointer user_data);
+static bool read_member(GFileInfo *info, const char *member, gsize member_len,
+        GBytes *bytes, gpointer user_data);
+static bool keep_last_member(GFileInfo *info, const char *member,
+        gsize member_len, GBytes *bytes, gpointer user_data);
+static bool compact_member(GFileInfo *info, const char *member,
+        gsize member_len, GBytes *bytes, gpointer user_data);
+static char* member_key(GFileInfo *info, GBytes *bytes);
+static bool try_lock_file(const char *path);
+static void unlock_file(const char *path);
+static SrnRet compress_file(SrnChatLogFile *file, GCancellable *cancellable);
+static gsize get_compressed_len(const char *path, const char *gz_path);
+static SrnRet compact_files(const char *dir, const char *month,
+        const char *chat_name, GList *files, GCancellable *cancellable);
+static bool append_file(GOutputStream *out, const char *path,
+        GCancellable *cancellable, GError **err);
+static void abort_output(GFile *file, GFileOutputStream *out);
+static goffset get_dir_size(const char *path, int depth);
+static int file_cmp(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief ``srn_chat_log_list_files`` lists log files of a server.
+ *
+ * @param dir Directory of chat logs of server
+ * @param chat_name Only list log files of given chat if not NULL
+ *
+ * @return List of SrnChatLogFile, newest first
+ */
+GList* srn_chat_log_list_files(const char *dir, const char *chat_name){
+    char *escaped;
+    const char *name;
+    GDir *gdir;
+    GList *files;
+
+    gdir = g_dir_open(dir, 0, NULL);
+    if (!gdir){
+        return NULL;
+    }
+
+    // Chat name in file name is escaped, see srn_escape_file_name()
+    escaped = chat_name ? srn_escape_file_name(chat_name) : NULL;
+    files = NULL;
+    while ((name = g_dir_read_name(gdir))){
+        SrnChatLogFile *file;
+
+        file = parse_file_name(dir, name);
+        if (!file){
+            continue;
+        }
+        if (escaped && g_ascii_strcasecmp(escaped, file->chat_name) != 0){
+            srn_chat_log_file_free(file);
+            continue;
+        }
+        files = g_list_prepend(files, file);
+    }
+    g_dir_close(gdir);
+    g_free(escaped);
+
+    return g_list_sort(files, file_cmp);
+}
+
+/**
+ * @brief ``srn_chat_log_file_read`` reads log of every day in the log file,
+ * compressed files are decompressed in a streaming manner, one day at a
+ * time.
+ *
+ * @param file
+ * @param func Called for log of every day in chronological order, return
+ *        FALSE to stop reading
+ * @param user_data
+ *
+ * @return SRN_OK if success
+ */
+SrnRet srn_chat_log_file_read(SrnChatLogFile *file, SrnChatLogReadFunc func,
+        gpointer user_data){
+    GError *err;
+    GBytes *bytes;
+    GMappedFile *mapped;
+    SrnRet ret;
+
+    err = NULL;
+    mapped = g_mapped_file_new(file->path, FALSE, &err);
+    if (!mapped){
+        ret = RET_ERR(_("Failed to map file '%1$s': %2$s"),
+                file->path, err->message);
+        g_error_free(err);
+        return ret;
+    }
+
+    ret = SRN_OK;
+    bytes = g_mapped_file_get_bytes(mapped);
+    if (file->type == SRN_CHAT_LOG_FILE_PLAIN){
+        func(file->date, bytes, user_data);
+    } else {
+        gsize size;
+        const char *data;
+
+        data = g_bytes_get_data(bytes, &size);
+        ret = read_gzip(file, data, size, func, user_data);
+    }
+    g_bytes_unref(bytes);
+    g_mapped_file_unref(mapped);
+
+    return ret;
+}
+
+void srn_chat_log_file_free(SrnChatLogFile *file){
+    g_free(file->path);
+    g_free(file->date);
+    g_free(file->chat_name);
+    g_free(file);
+}
+
+/**
+ * @brief ``srn_chat_log_file_hold`` prevents a plain log file from being
+ * compressed, it blocks if the file is being compressed. The writer thread
+ * holds files until it closes them.
+ *
+ * @param path Path of plain log file
+ */
+void srn_chat_log_file_hold(const char *path){
+    int held;
+
+    g_mutex_lock(&file_mutex);
+    if (!file_holds){
+        file_holds = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, NULL);
+    }
+    while ((held = GPOINTER_TO_INT(g_hash_table_lookup(file_holds, path)))
+            == FILE_COMPRESSING){
+        g_cond_wait(&file_cond, &file_mutex);
+    }
+    g_hash_table_insert(file_holds, g_strdup(path), GINT_TO_POINTER(held + 1));
+    g_mutex_unlock(&file_mutex);
+}
+
+void srn_chat_log_file_release(const char *path){
+    int held;
+
+    g_mutex_lock(&file_mutex);
+    held = GPOINTER_TO_INT(g_hash_table_lookup(file_holds, path));
+    if (held > 1){
+        g_hash_table_insert(file_holds, g_strdup(path), GINT_TO_POINTER(held - 1));
+    } else {
+        g_hash_table_remove(file_holds, path);
+    }
+    g_mutex_unlock(&file_mutex);
+}
+
+/**
+ * @brief ``srn_chat_log_compress`` compresses plain log files which are
+ * older than given days. It may take a long time, so it should be called
+ * from a background thread. Files held by the writer thread are skipped.
+ *
+ * @param log_dir Root directory of chat logs
+ * @param days
+ * @param cancellable
+ */
+void srn_chat_log_compress(const char *log_dir, int days,
+        GCancellable *cancellable){
+    char *limit;
+    const char *name;
+    GDir *dir;
+    GDateTime *now;
+    GDateTime *date;
+
+    now = g_date_time_new_now_local();
+    date = g_date_time_add_days(now, -days);
+    limit = g_date_time_format(date, "%F");
+    g_date_time_unref(date);
+    g_date_time_unref(now);
+
+    dir = g_dir_open(log_dir, 0, NULL);
+    if (!dir){
+        g_free(limit);
+        return;
+    }
+    while (!g_cancellable_is_cancelled(cancellable)
+            && (name = g_dir_read_name(dir))){
+        char *path;
+        GList *files;
+
+        path = g_build_filename(log_dir, name, NULL);
+        files = srn_chat_log_list_files(path, NULL);
+        for (GList *lst = files;
+                lst && !g_cancellable_is_cancelled(cancellable);
+                lst = g_list_next(lst)){
+            SrnChatLogFile *file;
+            SrnRet ret;
+
+            file = lst->data;
+            if (file->type != SRN_CHAT_LOG_FILE_PLAIN
+                    || strcmp(file->date, limit) >= 0){
+                continue;
+            }
+            ret = compress_file(file, cancellable);
+            if (!RET_IS_OK(ret)){
+                WARN_FR("Failed to compress chat log '%s': %s",
+                        file->path, RET_MSG(ret));
+            }
+        }
+        g_list_free_full(files, (GDestroyNotify)srn_chat_log_file_free);
+        g_free(path);
+    }
+    g_dir_close(dir);
+    g_free(limit);
+}
+
+/**
+ * @brief ``srn_chat_log_compact`` compacts compressed log files of past
+ * months into monthly archives if size of all chat logs exceeds the given
+ * threshold. It should be called from a background thread.
+ *
+ * @param log_dir Root directory of chat logs
+ * @param threshold In bytes
+ * @param cancellable
+ */
+void srn_chat_log_compact(const char *log_dir, goffset threshold,
+        GCancellable *cancellable){
+    char *cur_month;
+    const char *name;
+    GDir *dir;
+    GDateTime *now;
+
+    if (get_dir_size(log_dir, 2) <= threshold){
+        return;
+    }
+
+    dir = g_dir_open(log_dir, 0, NULL);
+    if (!dir){
+        return;
+    }
+    now = g_date_time_new_now_local();
+    cur_month = g_date_time_format(now, "%Y-%m");
+    g_date_time_unref(now);
+
+    while (!g_cancellable_is_cancelled(cancellable)
+            && (name = g_dir_read_name(dir))){
+        char *path;
+        GList *files;
+        GList *group;
+        GHashTable *groups;
+        GHashTableIter iter;
+
+        path = g_build_filename(log_dir, name, NULL);
+        files = srn_chat_log_list_files(path, NULL);
+
+        /* Group compressed files of past months by month and chat */
+        groups = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+        for (GList *lst = files; lst; lst = g_list_next(lst)){
+            char *key;
+            SrnChatLogFile *file;
+
+            file = lst->data;
+            if (file->type != SRN_CHAT_LOG_FILE_GZIP
+                    || strncmp(file->date, cur_month, MONTH_LEN) >= 0){
+                continue;
+            }
+            key = g_strdup_printf("%.*s\n%s",
+                    MONTH_LEN, file->date, file->chat_name);
+            group = g_hash_table_lookup(groups, key);
+            // Files are newest first, so prepending makes group chronological
+            g_hash_table_insert(groups, key, g_list_prepend(group, file));
+        }
+
+        g_hash_table_iter_init(&iter, groups);
+        while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&group)){
+            char *month;
+            SrnChatLogFile *file;
+            SrnRet ret;
+
+            if (g_cancellable_is_cancelled(cancellable)){
+                g_list_free(group);
+                continue;
+            }
+            file = group->data;
+            month = g_strndup(file->date, MONTH_LEN);
+            ret = compact_files(path, month, file->chat_name, group,
+                    cancellable);
+            if (!RET_IS_OK(ret)){
+                WARN_FR("Failed to compact chat logs of %s in %s: %s",
+                        file->chat_name, month, RET_MSG(ret));
+            }
+            g_free(month);
+            g_list_free(group);
+        }
+
+        g_hash_table_destroy(groups);
+        g_list_free_full(files, (GDestroyNotify)srn_chat_log_file_free);
+        g_free(path);
+    }
+
+    g_free(cur_month);
+    g_dir_close(dir);
+}
+
+static SrnChatLogFile* parse_file_name(const char *dir, const char *name){
+    gsize len;
+    gsize suffix_len;
+    gsize date_len;
+    SrnChatLogFileType type;
+    SrnChatLogFile *file;
+
+    len = strlen(name);
+    if (g_str_has_suffix(name, GZIP_LOG_SUFFIX)){
+        suffix_len = strlen(GZIP_LOG_SUFFIX);
+        type = SRN_CHAT_LOG_FILE_GZIP;
+    } else if (g_str_has_suffix(name, LOG_SUFFIX)){
+        suffix_len = strlen(LOG_SUFFIX);
+        type = SRN_CHAT_LOG_FILE_PLAIN;
+    } else {
+        return NULL;
+    }
+
+    if (len > DATE_LEN + 1 + suffix_len
+            && name[4] == '-' && name[7] == '-' && name[DATE_LEN] == '.'){
+        date_len = DATE_LEN;
+    } else if (type == SRN_CHAT_LOG_FILE_GZIP
+            && len > MONTH_LEN + 1 + suffix_len
+            && name[4] == '-' && name[MONTH_LEN] == '.'){
+        date_len = MONTH_LEN;
+        type = SRN_CHAT_LOG_FILE_ARCHIVE;
+    } else {
+        return NULL;
+    }
+
+    file = g_malloc0(sizeof(SrnChatLogFile));
+    file->type = type;
+    file->path = g_build_filename(dir, name, NULL);
+    file->date = g_strndup(name, date_len);
+    file->chat_name = g_strndup(name + date_len + 1,
+            len - date_len - 1 - suffix_len);
+
+    return file;
+}
+
+/**
+ * @brief Decompress every gzip member in data, and pass it to func together
+ * with its compressed data.
+ *
+ * @return FALSE if failed to decompress
+ */
+static bool scan_gzip(const char *data, gsize size, GzipMemberFunc func,
+        gpointer user_data, GError **err){
+    bool ok;
+    bool cont;
+    char *buf;
+    gsize off;
+
+    ok = TRUE;
+    cont = TRUE;
+    off = 0;
+    buf = g_malloc(DECOMPRESS_BUF_SIZE);
+    while (cont && off < size){
+        gsize start;
+        GByteArray *day;
+        GBytes *bytes;
+        GConverterResult res;
+        GZlibDecompressor *decompressor;
+
+        start = off;
+        decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP);
+        day = g_byte_array_new();
+        do {
+            gsize nread;
+            gsize nwritten;
+
+            res = g_converter_convert(G_CONVERTER(decompressor),
+                    data + off, size - off, buf, DECOMPRESS_BUF_SIZE,
+                    G_CONVERTER_INPUT_AT_END, &nread, &nwritten, err);
+            if (res == G_CONVERTER_ERROR){
+                break;
+            }
+            off += nread;
+            g_byte_array_append(day, (guint8 *)buf, nwritten);
+        } while (res != G_CONVERTER_FINISHED);
+
+        if (res == G_CONVERTER_ERROR){
+            ok = FALSE;
+            g_byte_array_free(day, TRUE);
+            g_object_unref(decompressor);
+            break;
+        }
+
+        bytes = g_byte_array_free_to_bytes(day);
+        cont = func(g_zlib_decompressor_get_file_info(decompressor),
+                data + start, off - start, bytes, user_data);
+        g_bytes_unref(bytes);
+        g_object_unref(decompressor);
+    }
+    g_free(buf);
+
+    return ok;
+}
+
+static SrnRet read_gzip(SrnChatLogFile *file, const char *data, gsize size,
+        SrnChatLogReadFunc func, gpointer user_data){
+    GError *err;
+    ReadContext ctx;
+    SrnRet ret;
+
+    err = NULL;
+    ctx.file = file;
+    ctx.func = func;
+    ctx.user_data = user_data;
+    if (!scan_gzip(data, size, read_member, &ctx, &err)){
+        ret = RET_ERR(_("Failed to decompress file '%1$s': %2$s"),
+                file->path, err->message);
+        g_error_free(err);
+        return ret;
+    }
+
+    return SRN_OK;
+}
+
+static bool read_member(GFileInfo *info, const char *member, gsize member_len,
+        GBytes *bytes, gpointer user_data){
+    bool cont;
+    const char *name;
+    ReadContext *ctx;
+
+    ctx = user_data;
+    cont = TRUE;
+    /* Get date from the original file name stored in gzip header */
+    name = info ? g_file_info_get_name(info) : NULL;
+    if (name && strlen(name) > DATE_LEN && name[DATE_LEN] == '.'){
+        char *date;
+
+        date = g_strndup(name, DATE_LEN);
+        cont = ctx->func(date, bytes, ctx->user_data);
+        g_free(date);
+    } else if (ctx->file->type == SRN_CHAT_LOG_FILE_GZIP){
+        cont = ctx->func(ctx->file->date, bytes, ctx->user_data);
+    } else {
+        WARN_FR("Unknown date of gzip member in '%s'", ctx->file->path);
+    }
+
+    return cont;
+}
+
+static bool keep_last_member(GFileInfo *info, const char *member,
+        gsize member_len, GBytes *bytes, gpointer user_data){
+    GBytes **last;
+
+    last = user_data;
+    if (*last){
+        g_bytes_unref(*last);
+    }
+    *last = g_bytes_ref(bytes);
+
+    return TRUE;
+}
+
+/**
+ * @brief Write the gzip member to archive unless it is already there.
+ */
+static bool compact_member(GFileInfo *info, const char *member,
+        gsize member_len, GBytes *bytes, gpointer user_data){
+    char *key;
+    CompactContext *ctx;
+
+    ctx = user_data;
+    key = member_key(info, bytes);
+    if (key && g_hash_table_contains(ctx->keys, key)){
+        g_free(key);
+        return TRUE;
+    }
+    if (!g_output_stream_write_all(ctx->out, member, member_len, NULL,
+                ctx->cancellable, ctx->err)){
+        g_free(key);
+        return FALSE;
+    }
+    if (key){
+        g_hash_table_add(ctx->keys, key);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Identify a gzip member by the name of its original file stored in
+ * gzip header, and the checksum of its content.
+ *
+ * @return NULL if the gzip header has no file name
+ */
+static char* member_key(GFileInfo *info, GBytes *bytes){
+    char *key;
+    char *checksum;
+    const char *name;
+
+    name = info ? g_file_info_get_name(info) : NULL;
+    if (!name){
+        return NULL;
+    }
+    checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA1, bytes);
+    key = g_strdup_printf("%s\n%s", name, checksum);
+    g_free(checksum);
+
+    return key;
+}
+
+/**
+ * @brief Lock a plain log file for compression.
+ *
+ * @return FALSE if the file is held by writer thread
+ */
+static bool try_lock_file(const char *path){
+    bool locked;
+
+    g_mutex_lock(&file_mutex);
+    if (!file_holds){
+        file_holds = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, NULL);
+    }
+    locked = !g_hash_table_contains(file_holds, path);
+    if (locked){
+        g_hash_table_insert(file_holds, g_strdup(path),
+                GINT_TO_POINTER(FILE_COMPRESSING));
+    }
+    g_mutex_unlock(&file_mutex);
+
+    return locked;
+}
+
+static void unlock_file(const char *path){
+    g_mutex_lock(&file_mutex);
+    g_hash_table_remove(file_holds, path);
+    g_cond_broadcast(&file_cond);
+    g_mutex_unlock(&file_mutex);
+}
+
+/**
+ * @brief Compress a plain log file to a new gzip member of the compressed
+ * file of the same day. The existing compressed file is never replaced
+ * before the new member is appended to its copy, and the plain file is
+ * removed only after that. If last compression was interrupted before the
+ * removal, content of the plain file which is already compressed is
+ * skipped.
+ */
+static SrnRet compress_file(SrnChatLogFile *file, GCancellable *cancellable){
+    char *gz_path;
+    char *tmp_path;
+    gsize len;
+    GError *err;
+    GFile *src;
+    GFile *tmp;
+    GFileInfo *info;
+    GFileInputStream *in;
+    GFileOutputStream *out;
+    GOutputStream *stream;
+    GZlibCompressor *compressor;
+    SrnRet ret;
+
+    if (!try_lock_file(file->path)){
+        return SRN_OK; // Being written, compress it next time
+    }
+
+    err = NULL;
+    in = NULL;
+    out = NULL;
+    gz_path = g_strconcat(file->path, ".gz", NULL);
+    tmp_path = g_strconcat(gz_path, ".tmp", NULL);
+    src = g_file_new_for_path(file->path);
+    tmp = g_file_new_for_path(tmp_path);
+
+    // File name and modification time are stored in gzip header
+    info = g_file_query_info(src,
+            G_FILE_ATTRIBUTE_STANDARD_NAME ","
+            G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+            G_FILE_ATTRIBUTE_TIME_MODIFIED,
+            G_FILE_QUERY_INFO_NONE, cancellable, &err);
+    if (!info){
+        goto FIN;
+    }
+    len = get_compressed_len(file->path, gz_path);
+    if (len == (gsize)g_file_info_get_size(info)){
+        g_file_delete(src, cancellable, &err);
+        goto FIN;
+    }
+
+    in = g_file_read(src, cancellable, &err);
+    if (!in){
+        goto FIN;
+    }
+    if (len > 0 && !g_seekable_seek(G_SEEKABLE(in), len, G_SEEK_SET,
+                cancellable, &err)){
+        goto FIN;
+    }
+    // Overwrite the temporary file left by an interrupted compression, if any
+    out = g_file_replace(tmp, NULL, FALSE, G_FILE_CREATE_PRIVATE,
+            cancellable, &err);
+    if (!out){
+        goto FIN;
+    }
+
+    /* Keep content of existing compressed file */
+    if (g_file_test(gz_path, G_FILE_TEST_EXISTS)
+            && !append_file(G_OUTPUT_STREAM(out), gz_path, cancellable, &err)){
+        goto ERR;
+    }
+
+    compressor = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1);
+    g_zlib_compressor_set_file_info(compressor, info);
+    stream = g_converter_output_stream_new(G_OUTPUT_STREAM(out),
+            G_CONVERTER(compressor));
+    g_object_unref(compressor);
+
+    if (g_output_stream_splice(stream, G_INPUT_STREAM(in),
+                G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE, cancellable, &err) < 0
+            || !g_output_stream_close(stream, cancellable, &err)){
+        g_object_unref(stream);
+        goto ERR;
+    }
+    g_object_unref(stream);
+
+    if (g_rename(tmp_path, gz_path) != 0){
+        g_set_error(&err, G_FILE_ERROR, g_file_error_from_errno(errno),
+                _("Failed to rename '%1$s' to '%2$s': %3$s"),
+                tmp_path, gz_path, g_strerror(errno));
+        g_file_delete(tmp, NULL, NULL);
+        goto FIN;
+    }
+    g_file_delete(src, NULL, &err);
+    goto FIN;
+
+ERR:
+    abort_output(tmp, out);
+FIN:
+    if (err){
+        ret = RET_ERR("%s", err->message);
+        g_error_free(err);
+    } else {
+        ret = SRN_OK;
+    }
+    if (out){
+        g_object_unref(out);
+    }
+    if (in){
+        g_object_unref(in);
+    }
+    if (info){
+        g_object_unref(info);
+    }
+    g_object_unref(tmp);
+    g_object_unref(src);
+    g_free(tmp_path);
+    g_free(gz_path);
+    unlock_file(file->path);
+
+    return ret;
+}
+
+/**
+ * @brief Get length of content of the plain log file which is already
+ * compressed to the last gzip member of compressed file. It is not zero only
+ * if last compression was interrupted before removing the plain file.
+ */
+static gsize get_compressed_len(const char *path, const char *gz_path){
+    gsize len;
+    gsize size;
+    const char *data;
+    GBytes *last;
+    GMappedFile *mapped;
+
+    mapped = g_mapped_file_new(gz_path, FALSE, NULL);
+    if (!mapped){
+        return 0;
+    }
+    last = NULL;
+    scan_gzip(g_mapped_file_get_contents(mapped),
+            g_mapped_file_get_length(mapped), keep_last_member, &last, NULL);
+    g_mapped_file_unref(mapped);
+    if (!last){
+        return 0;
+    }
+
+    len = 0;
+    data = g_bytes_get_data(last, &size);
+    mapped = g_mapped_file_new(path, FALSE, NULL);
+    if (mapped){
+        if (size > 0 && size <= g_mapped_file_get_length(mapped)
+                && memcmp(g_mapped_file_get_contents(mapped), data, size) == 0){
+            len = size;
+        }
+        g_mapped_file_unref(mapped);
+    }
+    g_bytes_unref(last);
+
+    return len;
+}
+
+/**
+ * @brief Concatenate gzip members of compressed log files of a month to the
+ * monthly archive, then delete them. The new archive is written to a
+ * temporary file which replaces the old one once it is complete. Members
+ * which are already in archive are skipped, so files left by an interrupted
+ * compaction are only deleted next time.
+ *
+ * @param dir
+ * @param month
+ * @param chat_name
+ * @param files Compressed log files in chronological order
+ * @param cancellable
+ *
+ * @return SRN_OK if success
+ */
+static SrnRet compact_files(const char *dir, const char *month,
+        const char *chat_name, GList *files, GCancellable *cancellable){
+    char *name;
+    char *path;
+    char *tmp_path;
+    GList *srcs;
+    GError *err;
+    GFile *tmp;
+    GFileOutputStream *out;
+    CompactContext ctx;
+    SrnRet ret;
+
+    name = g_strdup_printf("%s.%s" GZIP_LOG_SUFFIX, month, chat_name);
+    path = g_build_filename(dir, name, NULL);
+    tmp_path = g_strconcat(path, ".tmp", NULL);
+    tmp = g_file_new_for_path(tmp_path);
+    g_free(name);
+
+    /* Keep content of existing archive */
+    srcs = NULL;
+    for (GList *lst = files; lst; lst = g_list_next(lst)){
+        srcs = g_list_append(srcs, ((SrnChatLogFile *)lst->data)->path);
+    }
+    if (g_file_test(path, G_FILE_TEST_EXISTS)){
+        srcs = g_list_prepend(srcs, path);
+    }
+
+    err = NULL;
+    ctx.keys = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    ctx.cancellable = cancellable;
+    ctx.err = &err;
+    // Overwrite the temporary file left by an interrupted compaction, if any
+    out = g_file_replace(tmp, NULL, FALSE, G_FILE_CREATE_PRIVATE,
+            cancellable, &err);
+    if (!out){
+        goto FIN;
+    }
+    ctx.out = G_OUTPUT_STREAM(out);
+
+    for (GList *lst = srcs; lst; lst = g_list_next(lst)){
+        GMappedFile *mapped;
+
+        mapped = g_mapped_file_new(lst->data, FALSE, &err);
+        if (!mapped){
+            goto ERR;
+        }
+        scan_gzip(g_mapped_file_get_contents(mapped),
+                g_mapped_file_get_length(mapped), compact_member, &ctx, &err);
+        g_mapped_file_unref(mapped);
+        if (err){
+            goto ERR;
+        }
+    }
+
+    if (!g_output_stream_close(G_OUTPUT_STREAM(out), cancellable, &err)){
+        goto ERR;
+    }
+    if (g_rename(tmp_path, path) != 0){
+        g_set_error(&err, G_FILE_ERROR, g_file_error_from_errno(errno),
+                _("Failed to rename '%1$s' to '%2$s': %3$s"),
+                tmp_path, path, g_strerror(errno));
+        g_file_delete(tmp, NULL, NULL);
+        goto FIN;
+    }
+
+    for (GList *lst = files; lst; lst = g_list_next(lst)){
+        SrnChatLogFile *file;
+
+        file = lst->data;
+        if (g_remove(file->path) != 0){
+            WARN_FR("Failed to remove compacted chat log '%s'", file->path);
+        }
+    }
+    goto FIN;
+
+ERR:
+    abort_output(tmp, out);
+FIN:
+    if (err){
+        ret = RET_ERR("%s", err->message);
+        g_error_free(err);
+    } else {
+        ret = SRN_OK;
+    }
+    if (out){
+        g_object_unref(out);
+    }
+    g_hash_table_destroy(ctx.keys);
+    g_list_free(srcs);
+    g_object_unref(tmp);
+    g_free(tmp_path);
+    g_free(path);
+
+    return ret;
+}
+
+/**
+ * @brief Append content of file to the output stream.
+ */
+static bool append_file(GOutputStream *out, const char *path,
+        GCancellable *cancellable, GError **err){
+    gssize size;
+    GFile *file;
+    GFileInputStream *in;
+
+    file = g_file_new_for_path(path);
+    in = g_file_read(file, cancellable, err);
+    g_object_unref(file);
+    if (!in){
+        return FALSE;
+    }
+    size = g_output_stream_splice(out, G_INPUT_STREAM(in),
+            G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE, cancellable, err);
+    g_object_unref(in);
+
+    return size >= 0;
+}
+
+/**
+ * @brief Abort writing of a file opened by ``g_file_replace()``, the
+ * partially written file is removed.
+ */
+static void abort_output(GFile *file, GFileOutputStream *out){
+    GCancellable *cancellable;
+
+    cancellable = g_cancellable_new();
+    g_cancellable_cancel(cancellable);
+    g_output_stream_close(G_OUTPUT_STREAM(out), cancellable, NULL);
+    g_object_unref(cancellable);
+
+    g_file_delete(file, NULL, NULL);
+}
+
+static goffset get_dir_size(const char *path, int depth){
+    const char *name;
+    goffset size;
+    GDir *dir;
+
+    size = 0;
+    dir = g_dir_open(path, 0, NULL);
+    if (!dir){
+        return 0;
+    }
+    while ((name = g_dir_read_name(dir))){
+        char *child;
+        GStatBuf st;
+
+        child = g_build_filename(path, name, NULL);
+        if (g_stat(child, &st) == 0){
+            if (S_ISDIR(st.st_mode)){
+                if (depth > 1){
+                    size += get_dir_size(child, depth - 1);
+                }
+            } else {
+                size += st.st_size;
+            }
+        }
+        g_free(child);
+    }
+    g_dir_close(dir);
+
+    return size;
+}
+
+/* Newest log file first, plain file of a day which has been compressed
+ * contains late messages, so it is newer than the compressed one */
+static int file_cmp(gconstpointer a, gconstpointer b){
+    int res;
+    const SrnChatLogFile *file1 = a;
+    const SrnChatLogFile *file2 = b;
+
+    res = -g_strcmp0(file1->date, file2->date);
+    if (res == 0){
+        res = (int)file1->type - (int)file2->type;
+    }
+
+    return res;
+}
@@ -0,0 +1,289 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file highlight.c
+ * @brief Match a set of keywords (nickname, custom highlight words) against
+ * message text in a single pass, via a Aho-Corasick automaton.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-02
+ *
+ * The automaton is compiled to a full DFA over case-folded bytes, so matching
+ * is one table lookup per input byte. It should only be rebuilt when the
+ * keyword set changes (nick changed or config reloaded).
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "srain.h"
+#include "highlight.h"
+
+#define ALPHABET_SIZE 256
+
+struct _SrnHighlighter {
+    SrnCasemapping casemapping;
+    unsigned char fold[ALPHABET_SIZE]; // Case folding table
+
+    int nstate;
+    int cap;
+    int *next;  // Transition table, nstate * ALPHABET_SIZE
+    int *fail;  // Failure link
+    int *out;   // Length of keyword which ends at this state, 0 if none
+    int *dict;  // Nearest state in failure chain which has output, 0 if none
+};
+
+static void init_fold_table(SrnHighlighter *self);
+static void reset(SrnHighlighter *self);
+static int add_state(SrnHighlighter *self);
+static void add_keyword(SrnHighlighter *self, const char *keyword);
+static void build_links(SrnHighlighter *self);
+static bool is_word_char(unsigned char c);
+
+SrnHighlighter* srn_highlighter_new(SrnCasemapping casemapping){
+    SrnHighlighter *self;
+
+    self = g_malloc0(sizeof(SrnHighlighter));
+    self->casemapping = casemapping;
+    init_fold_table(self);
+    reset(self);
+
+    return self;
+}
+
+void srn_highlighter_free(SrnHighlighter *self){
+    g_free(self->next);
+    g_free(self->fail);
+    g_free(self->out);
+    g_free(self->dict);
+    g_free(self);
+}
+
+/**
+ * @brief ``srn_highlighter_set_casemapping`` changes the case folding rule,
+ * keywords are folded when they are added so the automaton should be rebuilt
+ * via ``srn_highlighter_build()`` after calling this function.
+ *
+ * @param self
+ * @param casemapping
+ */
+void srn_highlighter_set_casemapping(SrnHighlighter *self,
+        SrnCasemapping casemapping){
+    self->casemapping = casemapping;
+    init_fold_table(self);
+}
+
+/**
+ * @brief ``srn_highlighter_build`` rebuilds the automaton from given nickname
+ * and keyword list, previous keywords are dropped.
+ *
+ * @param self
+ * @param nick Nickname, can be NULL
+ * @param keywords List of string, can be NULL
+ */
+void srn_highlighter_build(SrnHighlighter *self, const char *nick,
+        GList *keywords){
+    GList *lst;
+
+    reset(self);
+
+    if (nick){
+        add_keyword(self, nick);
+    }
+    lst = keywords;
+    while (lst){
+        add_keyword(self, lst->data);
+        lst = g_list_next(lst);
+    }
+
+    build_links(self);
+}
+
+/**
+ * @brief ``srn_highlighter_match`` checks whether any keyword appears in the
+ * text as a whole word.
+ *
+ * @param self
+ * @param text
+ * @param len Length of text in bytes, -1 if text is nul-terminated
+ *
+ * @return TRUE if matched
+ */
+bool srn_highlighter_match(SrnHighlighter *self, const char *text, int len){
+    int state;
+    const unsigned char *buf;
+
+    g_return_val_if_fail(text, FALSE);
+
+    if (self->nstate <= 1){
+        return FALSE;
+    }
+    if (len < 0){
+        len = strlen(text);
+    }
+
+    buf = (const unsigned char *)text;
+    state = 0;
+    for (int i = 0; i < len; i++){
+        int s;
+
+        state = self->next[state * ALPHABET_SIZE + self->fold[buf[i]]];
+        s = self->out[state] ? state : self->dict[state];
+        while (s){
+            int start;
+            int end;
+
+            start = i + 1 - self->out[s];
+            end = i + 1;
+            if ((start == 0 || !is_word_char(buf[start - 1]))
+                    && (end == len || !is_word_char(buf[end]))){
+                return TRUE;
+            }
+            s = self->dict[s];
+        }
+    }
+
+    return FALSE;
+}
+
+static void init_fold_table(SrnHighlighter *self){
+    for (int i = 0; i < ALPHABET_SIZE; i++){
+        self->fold[i] = g_ascii_tolower(i);
+    }
+
+    switch (self->casemapping){
+        case SRN_CASEMAPPING_RFC1459:
+            self->fold['~'] = '^';
+            /* Fall through */
+        case SRN_CASEMAPPING_STRICT_RFC1459:
+            self->fold['['] = '{';
+            self->fold[']'] = '}';
+            self->fold['\\'] = '|';
+            break;
+        case SRN_CASEMAPPING_ASCII:
+        default:
+            break;
+    }
+}
+
+static void reset(SrnHighlighter *self){
+    self->nstate = 0;
+    add_state(self); // Root
+}
+
+static int add_state(SrnHighlighter *self){
+    int state;
+
+    if (self->nstate == self->cap){
+        self->cap = self->cap ? self->cap * 2 : 16;
+        self->next = g_realloc_n(self->next,
+                self->cap * ALPHABET_SIZE, sizeof(int));
+        self->fail = g_realloc_n(self->fail, self->cap, sizeof(int));
+        self->out = g_realloc_n(self->out, self->cap, sizeof(int));
+        self->dict = g_realloc_n(self->dict, self->cap, sizeof(int));
+    }
+
+    state = self->nstate++;
+    for (int i = 0; i < ALPHABET_SIZE; i++){
+        self->next[state * ALPHABET_SIZE + i] = -1;
+    }
+    self->fail[state] = 0;
+    self->out[state] = 0;
+    self->dict[state] = 0;
+
+    return state;
+}
+
+static void add_keyword(SrnHighlighter *self, const char *keyword){
+    int state;
+    int len;
+    const unsigned char *ptr;
+
+    len = strlen(keyword);
+    if (len == 0){
+        return;
+    }
+
+    state = 0;
+    ptr = (const unsigned char *)keyword;
+    for (int i = 0; i < len; i++){
+        int c;
+        int next;
+
+        c = self->fold[ptr[i]];
+        next = self->next[state * ALPHABET_SIZE + c];
+        if (next == -1){
+            next = add_state(self);
+            self->next[state * ALPHABET_SIZE + c] = next;
+        }
+        state = next;
+    }
+    self->out[state] = len;
+}
+
+/**
+ * @brief Compute failure links in BFS order and turn the trie into a full
+ * DFA, so that matching never follows failure links.
+ */
+static void build_links(SrnHighlighter *self){
+    int head;
+    int tail;
+    int *queue;
+
+    queue = g_malloc_n(self->nstate, sizeof(int));
+    head = tail = 0;
+
+    for (int c = 0; c < ALPHABET_SIZE; c++){
+        int s;
+
+        s = self->next[c];
+        if (s == -1){
+            self->next[c] = 0;
+        } else {
+            self->fail[s] = 0;
+            queue[tail++] = s;
+        }
+    }
+
+    while (head < tail){
+        int r;
+
+        r = queue[head++];
+        for (int c = 0; c < ALPHABET_SIZE; c++){
+            int s;
+            int f;
+
+            s = self->next[r * ALPHABET_SIZE + c];
+            f = self->next[self->fail[r] * ALPHABET_SIZE + c];
+            if (s == -1){
+                self->next[r * ALPHABET_SIZE + c] = f;
+                continue;
+            }
+            self->fail[s] = f;
+            self->dict[s] = self->out[f] ? f : self->dict[f];
+            queue[tail++] = s;
+        }
+    }
+
+    g_free(queue);
+}
+
+static bool is_word_char(unsigned char c){
+    return g_ascii_isalnum(c) || c == '_';
+}
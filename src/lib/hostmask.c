@@ -0,0 +1,454 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file hostmask.c
+ * @brief Indexed set of "nick!user@host" wildcard masks.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-05
+ *
+ * Masks are indexed by their host part, so that a lookup only tests masks
+ * which can possibly match:
+ *
+ * - "nick!user@host.isp.net": host without wildcard, stored in a hash table
+ *   keyed by host
+ * - "nick!user@*.isp.net": host is a wildcard followed by a literal suffix,
+ *   stored in a trie of reversed suffix
+ * - "nick!*@*": host is "*" and nick has no wildcard, stored in a hash table
+ *   keyed by nick
+ * - Others are stored in a list and tested one by one
+ *
+ * All masks are matched case-insensitively (ASCII only).
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "srain.h"
+#include "ret.h"
+#include "i18n.h"
+#include "hostmask.h"
+
+typedef struct _Mask Mask;
+typedef struct _TrieNode TrieNode;
+
+struct _Mask {
+    char *mask; // Normalized mask, "nick!user@host"
+    char *nick;
+    char *user;
+    char *host;
+    GPatternSpec *nick_spec; // NULL if matches anything
+    GPatternSpec *user_spec;
+    GPatternSpec *host_spec;
+
+    TrieNode *node; // Trie node of suffix mask, NULL if mask is not in trie
+};
+
+struct _TrieNode {
+    char ch;
+    TrieNode *child;
+    TrieNode *sibling;
+    GList *masks; // List of Mask whose reversed host suffix ends here
+};
+
+struct _SrnHostmaskSet {
+    GHashTable *mask_table; // Normalized mask string -> Mask, owns masks
+    GHashTable *host_table; // Host -> GList of Mask
+    GHashTable *nick_table; // Nick -> GList of Mask
+    TrieNode *suffix_trie;
+    GList *glob_list;       // List of Mask
+};
+
+static Mask* mask_new(const char *mask);
+static void mask_free(Mask *self);
+static bool mask_match(Mask *self, const char *nick, const char *user,
+        const char *host);
+static bool has_wildcard(const char *str);
+static void table_add(GHashTable *table, const char *key, Mask *mask);
+static void table_rm(GHashTable *table, const char *key, Mask *mask);
+static bool list_match(GList *lst, const char *nick, const char *user,
+        const char *host);
+static TrieNode* trie_node_new(char ch);
+static void trie_node_free(TrieNode *self);
+static TrieNode* trie_node_get_child(TrieNode *self, char ch, bool create);
+
+SrnHostmaskSet* srn_hostmask_set_new(void){
+    SrnHostmaskSet *self;
+
+    self = g_malloc0(sizeof(SrnHostmaskSet));
+    self->mask_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            NULL, (GDestroyNotify)mask_free);
+    self->host_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)g_list_free);
+    self->nick_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)g_list_free);
+    self->suffix_trie = trie_node_new('\0');
+
+    return self;
+}
+
+void srn_hostmask_set_free(SrnHostmaskSet *self){
+    g_list_free(self->glob_list);
+    trie_node_free(self->suffix_trie);
+    g_hash_table_destroy(self->nick_table);
+    g_hash_table_destroy(self->host_table);
+    g_hash_table_destroy(self->mask_table);
+    g_free(self);
+}
+
+/**
+ * @brief ``srn_hostmask_set_add`` adds a mask to set.
+ *
+ * @param self
+ * @param mask Mask in form of "nick!user@host", "user@host" or "nick",
+ * omitted parts are treated as "*"
+ *
+ * @return SRN_OK if added, error if mask is invalid or already exists
+ */
+SrnRet srn_hostmask_set_add(SrnHostmaskSet *self, const char *mask){
+    Mask *m;
+
+    m = mask_new(mask);
+    if (!m){
+        return RET_ERR(_("Invalid hostmask: %1$s"), mask);
+    }
+    if (g_hash_table_contains(self->mask_table, m->mask)){
+        SrnRet ret;
+
+        ret = RET_ERR(_("Hostmask \"%1$s\" already exists"), m->mask);
+        mask_free(m);
+        return ret;
+    }
+
+    if (!has_wildcard(m->host)){
+        table_add(self->host_table, m->host, m);
+    } else if (m->host[0] == '*' && m->host[1] != '\0'
+            && !has_wildcard(m->host + 1)){
+        TrieNode *node;
+
+        node = self->suffix_trie;
+        for (int i = (int)strlen(m->host) - 1; i > 0; i--){
+            node = trie_node_get_child(node, m->host[i], TRUE);
+        }
+        node->masks = g_list_prepend(node->masks, m);
+        m->node = node;
+    } else if (!m->host_spec && !has_wildcard(m->nick)){
+        table_add(self->nick_table, m->nick, m);
+    } else {
+        self->glob_list = g_list_prepend(self->glob_list, m);
+    }
+    g_hash_table_insert(self->mask_table, m->mask, m);
+
+    return SRN_OK;
+}
+
+SrnRet srn_hostmask_set_rm(SrnHostmaskSet *self, const char *mask){
+    Mask *m;
+    Mask *tmp;
+
+    tmp = mask_new(mask);
+    if (!tmp){
+        return RET_ERR(_("Invalid hostmask: %1$s"), mask);
+    }
+    m = g_hash_table_lookup(self->mask_table, tmp->mask);
+    mask_free(tmp);
+    if (!m){
+        return RET_ERR(_("Hostmask \"%1$s\" not found"), mask);
+    }
+
+    if (!has_wildcard(m->host)){
+        table_rm(self->host_table, m->host, m);
+    } else if (m->node){
+        // Empty trie nodes are kept, they are cheap and likely to be reused
+        m->node->masks = g_list_remove(m->node->masks, m);
+    } else if (!m->host_spec && !has_wildcard(m->nick)){
+        table_rm(self->nick_table, m->nick, m);
+    } else {
+        self->glob_list = g_list_remove(self->glob_list, m);
+    }
+    g_hash_table_remove(self->mask_table, m->mask);
+
+    return SRN_OK;
+}
+
+/**
+ * @brief ``srn_hostmask_set_list`` lists all masks in set.
+ *
+ * @param self
+ *
+ * @return A GList which contains constant normalized mask strings.
+ * The contained string MUST not be freed by user.
+ * The GList itself should be freed by user via g_list_free().
+ */
+GList* srn_hostmask_set_list(SrnHostmaskSet *self){
+    return g_hash_table_get_keys(self->mask_table);
+}
+
+/**
+ * @brief ``srn_hostmask_set_match`` checks whether any mask in set matches
+ * the given user.
+ *
+ * @param self
+ * @param nick
+ * @param user Username, NULL if unknown
+ * @param host Hostname, NULL if unknown
+ *
+ * @return TRUE if matched
+ */
+bool srn_hostmask_set_match(SrnHostmaskSet *self, const char *nick,
+        const char *user, const char *host){
+    bool matched;
+    char *lnick;
+    char *luser;
+    char *lhost;
+    TrieNode *node;
+
+    g_return_val_if_fail(nick, FALSE);
+
+    if (g_hash_table_size(self->mask_table) == 0){
+        return FALSE;
+    }
+
+    lnick = g_ascii_strdown(nick, -1);
+    luser = g_ascii_strdown(user ? user : "", -1);
+    lhost = g_ascii_strdown(host ? host : "", -1);
+
+    matched = list_match(g_hash_table_lookup(self->host_table, lhost),
+            lnick, luser, lhost);
+    if (matched) goto FIN;
+
+    matched = list_match(g_hash_table_lookup(self->nick_table, lnick),
+            lnick, luser, lhost);
+    if (matched) goto FIN;
+
+    node = self->suffix_trie;
+    for (int i = (int)strlen(lhost) - 1; i >= 0; i--){
+        node = trie_node_get_child(node, lhost[i], FALSE);
+        if (!node) break;
+        matched = list_match(node->masks, lnick, luser, lhost);
+        if (matched) goto FIN;
+    }
+
+    matched = list_match(self->glob_list, lnick, luser, lhost);
+
+FIN:
+    g_free(lnick);
+    g_free(luser);
+    g_free(lhost);
+
+    return matched;
+}
+
+/**
+ * @brief ``srn_hostmask_is_mask`` checks whether the string should be
+ * treated as a hostmask rather than a nickname.
+ *
+ * @param str
+ *
+ * @return TRUE if string contains any character which is not allowed in
+ * nickname
+ */
+bool srn_hostmask_is_mask(const char *str){
+    return strpbrk(str, "!@*?") != NULL;
+}
+
+/**
+ * @brief ``srn_hostmask_normalize`` converts a mask to the form used by
+ * SrnHostmaskSet, so that differently written masks can be compared.
+ *
+ * @param mask Mask in form of "nick!user@host", "user@host" or "nick"
+ *
+ * @return Normalized mask "nick!user@host" in lower case, NULL if mask is
+ * invalid. Should be freed by g_free()
+ */
+char* srn_hostmask_normalize(const char *mask){
+    char *normalized;
+    Mask *m;
+
+    m = mask_new(mask);
+    if (!m){
+        return NULL;
+    }
+    normalized = g_strdup(m->mask);
+    mask_free(m);
+
+    return normalized;
+}
+
+static Mask* mask_new(const char *mask){
+    char *tmp;
+    char *bang;
+    char *at;
+    Mask *self;
+
+    tmp = g_ascii_strdown(mask, -1);
+    g_strstrip(tmp);
+
+    bang = strchr(tmp, '!');
+    at = strchr(bang ? bang + 1 : tmp, '@');
+    if (bang) *bang = '\0';
+    if (at) *at = '\0';
+
+    self = g_malloc0(sizeof(Mask));
+    self->nick = g_strdup(bang || !at ? tmp : "*");
+    self->user = g_strdup(bang ? bang + 1 : at ? tmp : "*");
+    self->host = g_strdup(at ? at + 1 : "*");
+    g_free(tmp);
+
+    if (strlen(self->nick) == 0 || strlen(self->user) == 0
+            || strlen(self->host) == 0
+            || strpbrk(self->nick, "!@ ")
+            || strpbrk(self->user, "!@ ")
+            || strpbrk(self->host, "!@ ")){
+        mask_free(self);
+        return NULL;
+    }
+
+    self->mask = g_strdup_printf("%s!%s@%s",
+            self->nick, self->user, self->host);
+    if (strcmp(self->nick, "*") != 0){
+        self->nick_spec = g_pattern_spec_new(self->nick);
+    }
+    if (strcmp(self->user, "*") != 0){
+        self->user_spec = g_pattern_spec_new(self->user);
+    }
+    if (strcmp(self->host, "*") != 0){
+        self->host_spec = g_pattern_spec_new(self->host);
+    }
+
+    return self;
+}
+
+static void mask_free(Mask *self){
+    if (self->nick_spec){
+        g_pattern_spec_free(self->nick_spec);
+    }
+    if (self->user_spec){
+        g_pattern_spec_free(self->user_spec);
+    }
+    if (self->host_spec){
+        g_pattern_spec_free(self->host_spec);
+    }
+    g_free(self->mask);
+    g_free(self->nick);
+    g_free(self->user);
+    g_free(self->host);
+    g_free(self);
+}
+
+static bool mask_match(Mask *self, const char *nick, const char *user,
+        const char *host){
+    if (self->nick_spec && !g_pattern_match_string(self->nick_spec, nick)){
+        return FALSE;
+    }
+    if (self->user_spec && !g_pattern_match_string(self->user_spec, user)){
+        return FALSE;
+    }
+    if (self->host_spec && !g_pattern_match_string(self->host_spec, host)){
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static bool has_wildcard(const char *str){
+    return strpbrk(str, "*?") != NULL;
+}
+
+static void table_add(GHashTable *table, const char *key, Mask *mask){
+    GList *lst;
+
+    lst = g_hash_table_lookup(table, key);
+    if (lst){
+        // The list head is never changed by appending, so the value stored
+        // in table is still valid
+        lst = g_list_append(lst, mask);
+    } else {
+        g_hash_table_insert(table, g_strdup(key), g_list_append(NULL, mask));
+    }
+}
+
+static void table_rm(GHashTable *table, const char *key, Mask *mask){
+    GList *lst;
+
+    lst = g_hash_table_lookup(table, key);
+    g_return_if_fail(lst);
+
+    // Steal the list first, otherwise it is freed by value destroy function
+    lst = g_list_copy(lst);
+    lst = g_list_remove(lst, mask);
+    if (lst){
+        g_hash_table_insert(table, g_strdup(key), lst);
+    } else {
+        g_hash_table_remove(table, key);
+    }
+}
+
+static bool list_match(GList *lst, const char *nick, const char *user,
+        const char *host){
+    while (lst){
+        if (mask_match(lst->data, nick, user, host)){
+            return TRUE;
+        }
+        lst = g_list_next(lst);
+    }
+    return FALSE;
+}
+
+static TrieNode* trie_node_new(char ch){
+    TrieNode *self;
+
+    self = g_malloc0(sizeof(TrieNode));
+    self->ch = ch;
+
+    return self;
+}
+
+static void trie_node_free(TrieNode *self){
+    TrieNode *child;
+
+    child = self->child;
+    while (child){
+        TrieNode *next;
+
+        next = child->sibling;
+        trie_node_free(child);
+        child = next;
+    }
+    g_list_free(self->masks);
+    g_free(self);
+}
+
+static TrieNode* trie_node_get_child(TrieNode *self, char ch, bool create){
+    TrieNode *child;
+
+    for (child = self->child; child; child = child->sibling){
+        if (child->ch == ch){
+            return child;
+        }
+    }
+    if (!create){
+        return NULL;
+    }
+
+    child = trie_node_new(ch);
+    child->sibling = self->child;
+    self->child = child;
+
+    return child;
+}
@@ -22,6 +22,11 @@
  * @author Shengyu Zhang <i@silverrainz.me>
  * @version 0.06.2
  * @date 2017-06-24
+ *
+ * Logs are formatted in the calling thread and written to terminal by a
+ * background thread of logger, so logging never blocks on a slow terminal.
+ * Errors are the exception, the calling thread waits until they are written,
+ * so they are not lost if the program crashes right after.
  */
 
 #include <stdio.h>
@@ -32,12 +37,31 @@
 #include "config/config.h"
 #include "log.h"
 
+typedef struct _LogEntry LogEntry;
+
+struct _LogEntry {
+    bool to_stderr;
+    bool sync;      // Caller is waiting for the entry being written
+    bool done;      // Entry is written, protected by SrnLogger.sync_mutex
+    char *msg;      // NULL to stop the writer thread
+};
+
 struct _SrnLogger {
     SrnLoggerConfig *cfg;
+    GRWLock cfg_lock;   // Held for reading while cfg is used
+
+    GAsyncQueue *queue; // LogEntry waiting for writing
+    GThread *thread;
+    GMutex sync_mutex;
+    GCond sync_cond;
 };
 
 static SrnLogger *srn_logger = NULL;
 
+/* Increased by 2 whenever the result of is_enabled() may change, so it is
+ * never equal to an uninitialized callsite. */
+int srn_logger_generation = 2;
+
 static char *prompts[2][LOG_MAX] = {
     [0] = {
         [LOG_DEBUG] = "[ DBG %s] ",
@@ -53,79 +77,234 @@ static char *prompts[2][LOG_MAX] = {
     },
 };
 
+static void invalidate_sites(void);
+static void log_va(SrnLogger *logger, SrnLogLevel lv, bool print_prompt,
+        bool new_line, const char *file, const char *func, int line,
+        const char *fmt, va_list args);
+static gpointer writer_thread(gpointer user_data);
+static void log_buffer_free(gpointer data);
 static bool is_exist(GList *files, const char *file);
 static bool is_enabled(SrnLoggerConfig *cfg, SrnLogLevel lv, const char *file);
 
-/**
- * @brief log_print Print a log
- *
- * @param logger Instance of SrnLogger
- * @param lv Log level
- * @param print_prompt
- * @param new_line
- * @param file File name, shoule be the value of __FILE__
- * @param func Function name, shoule be the value of __FUNCTION__
- * @param line Line number in file, should be the value of __LINE__
- * @param fmt Format string
- * @param ...
- */
+/* Reusable buffer for formatting logs, one per thread */
+static GPrivate log_buffer = G_PRIVATE_INIT(log_buffer_free);
+
 SrnLogger* srn_logger_new(SrnLoggerConfig *cfg){
     SrnLogger *logger;
 
     logger = g_malloc0(sizeof(SrnLogger));
     logger->cfg = cfg;
+    g_rw_lock_init(&logger->cfg_lock);
+    logger->queue = g_async_queue_new();
+    g_mutex_init(&logger->sync_mutex);
+    g_cond_init(&logger->sync_cond);
+    logger->thread = g_thread_new("logger", writer_thread, logger);
 
     return logger;
 }
 
+/**
+ * @brief ``srn_logger_free`` writes all pending logs and frees the logger.
+ *
+ * @param logger
+ */
 void srn_logger_free(SrnLogger *logger){
+    LogEntry *entry;
+
+    if (srn_logger_get_default() == logger){
+        srn_logger_set_default(NULL);
+    }
+
+    entry = g_malloc0(sizeof(LogEntry));
+    g_async_queue_push(logger->queue, entry);
+    g_thread_join(logger->thread);
+    g_async_queue_unref(logger->queue);
+    g_cond_clear(&logger->sync_cond);
+    g_mutex_clear(&logger->sync_mutex);
+    g_rw_lock_clear(&logger->cfg_lock);
+
     g_free(logger);
 }
 
 void srn_logger_set_default(SrnLogger *logger) {
-    srn_logger = logger;
+    g_atomic_pointer_set(&srn_logger, logger);
+    invalidate_sites();
 }
 
 SrnLogger* srn_logger_get_default(void) {
-    return srn_logger;
+    return g_atomic_pointer_get(&srn_logger);
 }
 
+/**
+ * @brief ``srn_logger_set_config`` replaces config of logger, the old config
+ * is no longer used by any thread once this function returns, so the caller
+ * can free it.
+ *
+ * @param logger
+ * @param cfg
+ */
 void srn_logger_set_config(SrnLogger *logger, SrnLoggerConfig *cfg) {
+    g_rw_lock_writer_lock(&logger->cfg_lock);
     logger->cfg = cfg;
+    g_rw_lock_writer_unlock(&logger->cfg_lock);
+    invalidate_sites();
 }
 
 SrnLoggerConfig *srn_logger_get_config(SrnLogger *logger) {
     return logger->cfg;
 }
 
+/**
+ * @brief ``srn_logger_log`` prints a log if it is enabled by config.
+ *
+ * @param logger Instance of SrnLogger
+ * @param lv Log level
+ * @param print_prompt
+ * @param new_line
+ * @param file File name, shoule be the value of __FILE__
+ * @param func Function name, shoule be the value of __FUNCTION__
+ * @param line Line number in file, should be the value of __LINE__
+ * @param fmt Format string
+ * @param ...
+ */
 void srn_logger_log(SrnLogger *logger, SrnLogLevel lv, bool print_prompt,
         bool new_line, const char *file, const char *func, int line,
         const char *fmt, ...){
+    bool enabled;
     va_list args;
-    GString *prompt;
-    GString *output;
 
-    if (!file || !is_enabled(logger->cfg, lv, file)) {
+    if (!logger || !file) {
+        return;
+    }
+
+    g_rw_lock_reader_lock(&logger->cfg_lock);
+    enabled = is_enabled(logger->cfg, lv, file);
+    g_rw_lock_reader_unlock(&logger->cfg_lock);
+    if (!enabled) {
         return;
     }
 
-    output = g_string_new("");
+    va_start(args, fmt);
+    log_va(logger, lv, print_prompt, new_line, file, func, line, fmt, args);
+    va_end(args);
+}
+
+/**
+ * @brief ``srn_logger_log_site`` prints a log with the default logger if it
+ * is enabled, whether the callsite is enabled is cached in ``site``.
+ *
+ * The cache of enabled callsite is ``srn_logger_generation | 1``, and the
+ * cache of disabled callsite is ``srn_logger_generation``, which is checked
+ * by the caller, so this function is not called for disabled callsite until
+ * logger or its config is changed.
+ *
+ * @param site Cache of callsite, should be a static variable initialized to 0
+ * @param lv
+ * @param print_prompt
+ * @param new_line
+ * @param file
+ * @param func
+ * @param line
+ * @param fmt
+ * @param ...
+ */
+void srn_logger_log_site(int *site, SrnLogLevel lv, bool print_prompt,
+        bool new_line, const char *file, const char *func, int line,
+        const char *fmt, ...){
+    int gen;
+    va_list args;
+    SrnLogger *logger;
+
+    logger = srn_logger_get_default();
+    if (!logger){
+        return; // Do not cache anything without logger
+    }
+
+    gen = g_atomic_int_get(&srn_logger_generation);
+    if (g_atomic_int_get(site) != (gen | 1)){
+        bool enabled;
+
+        g_rw_lock_reader_lock(&logger->cfg_lock);
+        enabled = is_enabled(logger->cfg, lv, file);
+        g_rw_lock_reader_unlock(&logger->cfg_lock);
+        if (!enabled){
+            g_atomic_int_set(site, gen);
+            return;
+        }
+        g_atomic_int_set(site, gen | 1);
+    }
+
+    va_start(args, fmt);
+    log_va(logger, lv, print_prompt, new_line, file, func, line, fmt, args);
+    va_end(args);
+}
+
+SrnLoggerConfig *srn_logger_config_new(void){
+    return g_malloc0(sizeof(SrnLoggerConfig));
+}
+
+void srn_logger_config_free(SrnLoggerConfig *cfg){
+    if (cfg->debug_targets){
+        g_list_free_full(cfg->debug_targets, g_free);
+    }
+    if (cfg->info_targets){
+        g_list_free_full(cfg->info_targets, g_free);
+    }
+    if (cfg->warn_targets){
+        g_list_free_full(cfg->warn_targets, g_free);
+    }
+    if (cfg->error_targets){
+        g_list_free_full(cfg->error_targets, g_free);
+    }
+
+    g_free(cfg);
+}
+
+SrnRet srn_logger_config_check(SrnLoggerConfig *cfg){
+    return SRN_OK;
+}
+
+static void invalidate_sites(void){
+    g_atomic_int_add(&srn_logger_generation, 2);
+}
+
+/**
+ * @brief Format a log into buffer of current thread, and pass it to writer
+ * thread.
+ */
+static void log_va(SrnLogger *logger, SrnLogLevel lv, bool print_prompt,
+        bool new_line, const char *file, const char *func, int line,
+        const char *fmt, va_list args){
+    bool sync;
+    GString *output;
+    LogEntry *entry;
+    SrnLoggerConfig *cfg;
+
+    output = g_private_get(&log_buffer);
+    if (!output){
+        output = g_string_sized_new(256);
+        g_private_set(&log_buffer, output);
+    }
+    g_string_truncate(output, 0);
 
+    g_rw_lock_reader_lock(&logger->cfg_lock);
+    cfg = logger->cfg;
     if (print_prompt){
-        prompt = g_string_new("");
+        GString *prompt;
 
-        if (logger->cfg->prompt_file){
+        prompt = g_string_new("");
+        if (cfg->prompt_file){
             g_string_append_printf(prompt, "%s", file);
         }
-        if (logger->cfg->prompt_function){
-            if (logger->cfg->prompt_file){
+        if (cfg->prompt_function){
+            if (cfg->prompt_file){
                 prompt = g_string_append(prompt, "::");
             }
             g_string_append_printf(prompt, "%s", func);
         }
 
-        if (logger->cfg->prompt_line){
-            if (logger->cfg->prompt_file || logger->cfg->prompt_function){
+        if (cfg->prompt_line){
+            if (cfg->prompt_file || cfg->prompt_function){
                 g_string_append_printf(prompt, "#L%u", line);
             } else {
                 /* If neither file name or function name is printed, print line
@@ -133,50 +312,87 @@ void srn_logger_log(SrnLogger *logger, SrnLogLevel lv, bool print_prompt,
             }
         }
 
-        g_string_printf(output, prompts[logger->cfg->prompt_color][lv], prompt->str);
+        g_string_printf(output, prompts[cfg->prompt_color][lv], prompt->str);
         g_string_free(prompt, TRUE);
     }
+    g_rw_lock_reader_unlock(&logger->cfg_lock);
 
-    va_start(args, fmt);
     g_string_append_vprintf(output, fmt, args);
-    va_end(args);
 
     if (new_line){
         output = g_string_append_c(output, '\n');
     }
 
-    if (lv >= LOG_ERROR){
-        g_fprintf(stderr, "%s", output->str);
-    } else {
-        g_fprintf(stdout, "%s", output->str);
+    sync = lv >= LOG_ERROR;
+    entry = g_malloc0(sizeof(LogEntry));
+    entry->to_stderr = lv >= LOG_ERROR;
+    entry->sync = sync;
+    entry->msg = g_strndup(output->str, output->len);
+    g_async_queue_push(logger->queue, entry);
+
+    /* Wait for the error and all logs before it being written, entry is
+     * owned by writer thread if it is not synchronous */
+    if (sync){
+        g_mutex_lock(&logger->sync_mutex);
+        while (!entry->done){
+            g_cond_wait(&logger->sync_cond, &logger->sync_mutex);
+        }
+        g_mutex_unlock(&logger->sync_mutex);
+        g_free(entry->msg);
+        g_free(entry);
     }
 
-    g_string_free(output, TRUE);
+    /* Do not keep a huge buffer for a rare long log */
+    if (output->allocated_len > 4096){
+        g_private_replace(&log_buffer, NULL);
+    }
 }
 
-SrnLoggerConfig *srn_logger_config_new(void){
-    return g_malloc0(sizeof(SrnLoggerConfig));
-}
+static gpointer writer_thread(gpointer user_data){
+    SrnLogger *logger;
 
-void srn_logger_config_free(SrnLoggerConfig *cfg){
-    if (cfg->debug_targets){
-        g_list_free_full(cfg->debug_targets, g_free);
-    }
-    if (cfg->info_targets){
-        g_list_free_full(cfg->info_targets, g_free);
-    }
-    if (cfg->warn_targets){
-        g_list_free_full(cfg->warn_targets, g_free);
-    }
-    if (cfg->error_targets){
-        g_list_free_full(cfg->error_targets, g_free);
+    logger = user_data;
+    while (TRUE){
+        LogEntry *entry;
+
+        entry = g_async_queue_pop(logger->queue);
+        if (!entry->msg){
+            g_free(entry);
+            break;
+        }
+        if (entry->to_stderr){
+            g_fprintf(stderr, "%s", entry->msg);
+        } else {
+            g_fprintf(stdout, "%s", entry->msg);
+        }
+
+        if (entry->sync){
+            fflush(stdout);
+            fflush(stderr);
+            // Entry is freed by the waiting thread
+            g_mutex_lock(&logger->sync_mutex);
+            entry->done = TRUE;
+            g_cond_broadcast(&logger->sync_cond);
+            g_mutex_unlock(&logger->sync_mutex);
+            continue;
+        }
+        g_free(entry->msg);
+        g_free(entry);
+
+        if (g_async_queue_length(logger->queue) <= 0){
+            fflush(stdout);
+            fflush(stderr);
+        }
     }
 
-    g_free(cfg);
+    fflush(stdout);
+    fflush(stderr);
+
+    return NULL;
 }
 
-SrnRet srn_logger_config_check(SrnLoggerConfig *cfg){
-    return SRN_OK;
+static void log_buffer_free(gpointer data){
+    g_string_free(data, TRUE);
 }
 
 static bool is_exist(GList *targets, const char *file){
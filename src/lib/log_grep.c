@@ -0,0 +1,582 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file log_grep.c
+ * @brief Parallel regex search of chat logs
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-12
+ *
+ * Every log file is searched by a task of a thread pool. The longest literal
+ * substring which every match must contain is extracted from the pattern,
+ * the file is scanned for the literal first, and the regex is only run on
+ * lines containing it. Matches of each file are passed to main thread as
+ * soon as the file is searched.
+ *
+ * Compressed log files and monthly archives are decompressed day by day in
+ * the worker thread, see ``srn_chat_log_file_read()``.
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "chat_log.h"
+#include "log_grep.h"
+
+#define LOG_DATE_LEN        10  // YYYY-MM-DD
+#define MAX_GREP_WORKER     4
+
+typedef struct _GrepJob GrepJob;
+typedef struct _GrepTask GrepTask;
+typedef struct _GrepLine GrepLine;
+
+struct _GrepJob {
+    SrnLogGrepQuery *query;
+    GRegex *regex;
+    char *literal;      // Substring that every matched line contains
+    gsize literal_len;
+    bool literal_only;  // Pattern is a plain string, no need to run regex
+
+    int ntask;          // Tasks not yet finished, accessed atomically
+    int nmatch;         // Accessed atomically
+
+    SrnLogGrepMatchFunc match_cb;
+    SrnLogGrepFinishFunc finish_cb;
+    gpointer user_data;
+};
+
+struct _GrepTask {
+    GrepJob *job;
+    char *srv_name;
+    SrnChatLogFile *file;
+    const char *date; // Date of log being searched
+    GPtrArray *lines; // Matched GrepLine
+};
+
+struct _GrepLine {
+    char *date;
+    char *line;
+};
+
+static GList* list_tasks(GrepJob *job, const char *log_dir);
+static void list_server_tasks(GrepJob *job, const char *log_dir,
+        const char *srv_name, GList **tasks);
+static void grep_task(gpointer data, gpointer user_data);
+static bool grep_day(const char *date, GBytes *bytes, gpointer user_data);
+static void grep_data(GrepTask *task, const char *data, gsize size);
+static bool add_line(GrepTask *task, const char *line, gsize len);
+static gboolean finish_task(gpointer user_data);
+static gboolean finish_job(gpointer user_data);
+static char* extract_literal(const char *pattern, bool *literal_only);
+static const char* find_literal(const char *data, gsize len,
+        const char *literal, gsize literal_len);
+static void grep_task_free(GrepTask *task);
+static void grep_line_free(GrepLine *line);
+static int grep_task_cmp(gconstpointer a, gconstpointer b);
+
+/**
+ * @brief ``srn_log_grep`` searches lines matching given pattern in chat logs
+ * in background.
+ *
+ * @param log_dir Root directory of chat logs
+ * @param query Will be owned by the search
+ * @param match_cb Called in main thread for every matched line
+ * @param finish_cb Called in main thread after all logs are searched
+ * @param user_data
+ *
+ * @return SRN_OK if search is started, match_cb and finish_cb are only
+ *         called in this case
+ */
+SrnRet srn_log_grep(const char *log_dir, SrnLogGrepQuery *query,
+        SrnLogGrepMatchFunc match_cb, SrnLogGrepFinishFunc finish_cb,
+        gpointer user_data){
+    GError *err;
+    GList *tasks;
+    GThreadPool *pool;
+    GrepJob *job;
+
+    job = g_malloc0(sizeof(GrepJob));
+    job->query = query;
+    job->match_cb = match_cb;
+    job->finish_cb = finish_cb;
+    job->user_data = user_data;
+
+    err = NULL;
+    job->regex = g_regex_new(query->pattern, G_REGEX_OPTIMIZE, 0, &err);
+    if (!job->regex){
+        SrnRet ret;
+
+        ret = RET_ERR(_("Invalid pattern: %1$s"), err->message);
+        g_error_free(err);
+        srn_log_grep_query_free(query);
+        g_free(job);
+        return ret;
+    }
+    job->literal = extract_literal(query->pattern, &job->literal_only);
+    job->literal_len = job->literal ? strlen(job->literal) : 0;
+    DBG_FR("Literal of pattern '%s': '%s', literal only: %d",
+            query->pattern, job->literal, job->literal_only);
+
+    tasks = list_tasks(job, log_dir);
+    job->ntask = g_list_length(tasks);
+    if (!tasks){
+        g_idle_add(finish_job, job);
+        return SRN_OK;
+    }
+
+    pool = g_thread_pool_new(grep_task, job,
+            MIN(g_get_num_processors(), MAX_GREP_WORKER), FALSE, &err);
+    if (!pool){
+        ERR_FR("Failed to create grep workers, fallback to search in main "
+                "thread: %s", err->message);
+        g_error_free(err);
+    }
+    // Newest logs are searched first
+    for (GList *lst = tasks; lst; lst = g_list_next(lst)){
+        if (pool){
+            g_thread_pool_push(pool, lst->data, NULL);
+        } else {
+            grep_task(lst->data, job);
+        }
+    }
+    g_list_free(tasks);
+    if (pool){
+        // Pool is freed after all tasks are finished
+        g_thread_pool_free(pool, FALSE, FALSE);
+    }
+
+    return SRN_OK;
+}
+
+SrnLogGrepQuery* srn_log_grep_query_new(void){
+    return g_malloc0(sizeof(SrnLogGrepQuery));
+}
+
+void srn_log_grep_query_free(SrnLogGrepQuery *query){
+    g_free(query->srv_name);
+    g_free(query->chat_name);
+    g_free(query->since);
+    g_free(query->pattern);
+    g_free(query);
+}
+
+static GList* list_tasks(GrepJob *job, const char *log_dir){
+    const char *name;
+    GDir *dir;
+    GList *tasks;
+
+    tasks = NULL;
+    if (job->query->srv_name){
+        char *escaped;
+
+        escaped = srn_escape_file_name(job->query->srv_name);
+        list_server_tasks(job, log_dir, escaped, &tasks);
+        g_free(escaped);
+    } else {
+        dir = g_dir_open(log_dir, 0, NULL);
+        if (dir){
+            while ((name = g_dir_read_name(dir))){
+                list_server_tasks(job, log_dir, name, &tasks);
+            }
+            g_dir_close(dir);
+        }
+    }
+
+    return g_list_sort(tasks, grep_task_cmp);
+}
+
+/**
+ * @brief List log files of server which match the query.
+ */
+static void list_server_tasks(GrepJob *job, const char *log_dir,
+        const char *srv_name, GList **tasks){
+    char *path;
+    GList *files;
+    SrnLogGrepQuery *query;
+
+    query = job->query;
+    path = g_build_filename(log_dir, srv_name, NULL);
+    files = srn_chat_log_list_files(path, query->chat_name);
+    g_free(path);
+
+    for (GList *lst = files; lst; lst = g_list_next(lst)){
+        GrepTask *task;
+        SrnChatLogFile *file;
+
+        file = lst->data;
+        // Date of monthly archive is compared by month
+        if (query->since
+                && strncmp(file->date, query->since, strlen(file->date)) < 0){
+            srn_chat_log_file_free(file);
+            continue;
+        }
+
+        task = g_malloc0(sizeof(GrepTask));
+        task->job = job;
+        task->srv_name = g_strdup(srv_name);
+        task->file = file;
+        task->lines = g_ptr_array_new_with_free_func(
+                (GDestroyNotify)grep_line_free);
+
+        *tasks = g_list_prepend(*tasks, task);
+    }
+    g_list_free(files);
+}
+
+/**
+ * @brief grep_task is run in grep worker thread.
+ */
+static void grep_task(gpointer data, gpointer user_data){
+    GrepTask *task;
+
+    task = data;
+    if (g_atomic_int_get(&task->job->nmatch) < SRN_LOG_GREP_MAX_MATCHES){
+        SrnRet ret;
+
+        ret = srn_chat_log_file_read(task->file, grep_day, task);
+        if (!RET_IS_OK(ret)){
+            WARN_FR("Failed to read log file: %s", RET_MSG(ret));
+        }
+    }
+
+    // Pass matches to main thread
+    g_idle_add(finish_task, task);
+}
+
+static bool grep_day(const char *date, GBytes *bytes, gpointer user_data){
+    gsize size;
+    const char *data;
+    GrepTask *task;
+
+    task = user_data;
+    if (task->job->query->since
+            && strncmp(date, task->job->query->since, LOG_DATE_LEN) < 0){
+        return TRUE;
+    }
+
+    data = g_bytes_get_data(bytes, &size);
+    task->date = date;
+    grep_data(task, data, size);
+    task->date = NULL;
+
+    return g_atomic_int_get(&task->job->nmatch) < SRN_LOG_GREP_MAX_MATCHES;
+}
+
+static void grep_data(GrepTask *task, const char *data, gsize size){
+    const char *ptr;
+    const char *end;
+    GrepJob *job;
+
+    job = task->job;
+    ptr = data;
+    end = data + size;
+    while (ptr < end){
+        const char *line;
+        const char *line_end;
+
+        if (job->literal){
+            const char *hit;
+
+            hit = find_literal(ptr, end - ptr, job->literal, job->literal_len);
+            if (!hit){
+                break;
+            }
+            // Back to the start of line
+            line = hit;
+            while (line > ptr && line[-1] != '\n'){
+                line--;
+            }
+        } else {
+            line = ptr;
+        }
+
+        line_end = memchr(line, '\n', end - line);
+        if (!line_end){
+            line_end = end;
+        }
+        if (!add_line(task, line, line_end - line)){
+            break; // Too many matches
+        }
+        ptr = line_end + 1;
+    }
+}
+
+/**
+ * @brief Add line to matches if it matches the pattern.
+ *
+ * @return FALSE if there are too many matches
+ */
+static bool add_line(GrepTask *task, const char *line, gsize len){
+    GrepJob *job;
+    GrepLine *match;
+
+    job = task->job;
+    if (!job->literal_only){
+        if (!g_utf8_validate(line, len, NULL)
+                || !g_regex_match_full(job->regex, line, len, 0, 0, NULL, NULL)){
+            return TRUE;
+        }
+    }
+
+    if (g_atomic_int_add(&job->nmatch, 1) >= SRN_LOG_GREP_MAX_MATCHES){
+        return FALSE;
+    }
+    match = g_malloc0(sizeof(GrepLine));
+    match->date = g_strdup(task->date);
+    match->line = g_strndup(line, len);
+    g_ptr_array_add(task->lines, match);
+
+    return TRUE;
+}
+
+static gboolean finish_task(gpointer user_data){
+    GrepJob *job;
+    GrepTask *task;
+    SrnLogGrepMatch match;
+
+    task = user_data;
+    job = task->job;
+
+    match.srv_name = task->srv_name;
+    match.chat_name = task->file->chat_name;
+    for (int i = 0; i < task->lines->len; i++){
+        GrepLine *line;
+
+        line = g_ptr_array_index(task->lines, i);
+        match.date = line->date;
+        match.line = line->line;
+        job->match_cb(&match, job->user_data);
+    }
+    grep_task_free(task);
+
+    if (g_atomic_int_dec_and_test(&job->ntask)){
+        finish_job(job);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean finish_job(gpointer user_data){
+    GrepJob *job;
+
+    job = user_data;
+    job->finish_cb(MIN(g_atomic_int_get(&job->nmatch), SRN_LOG_GREP_MAX_MATCHES),
+            job->user_data);
+
+    srn_log_grep_query_free(job->query);
+    g_regex_unref(job->regex);
+    g_free(job->literal);
+    g_free(job);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Extract the longest literal substring from a regular expression,
+ * which must be contained in every string matching the regex.
+ *
+ * @param pattern
+ * @param literal_only Set to TRUE if the pattern is a plain string
+ *
+ * @return NULL if no literal is found
+ */
+static char* extract_literal(const char *pattern, bool *literal_only){
+    const char *ptr;
+    GString *run;
+    GString *best;
+    GSList *groups; // Best literals found before each open group
+
+    *literal_only = FALSE;
+    /* Give up on alternation and inline options such as "(?i)" */
+    if (strchr(pattern, '|') || strstr(pattern, "(?")){
+        return NULL;
+    }
+
+    *literal_only = TRUE;
+    run = g_string_new(NULL);
+    best = g_string_new(NULL);
+    groups = NULL;
+    for (ptr = pattern; *ptr; ptr++){
+        bool end_run;
+
+        end_run = FALSE;
+        switch (*ptr){
+            case '\\':
+                if (ptr[1] && !g_ascii_isalnum(ptr[1])){
+                    // Escaped punctuation is literal
+                    g_string_append_c(run, *++ptr);
+                    break;
+                }
+                if (strchr("xoucpPNgk", ptr[1]) || g_ascii_isdigit(ptr[1])){
+                    // Escapes with arguments, too complex to handle
+                    g_slist_free_full(groups, g_free);
+                    g_string_free(run, TRUE);
+                    g_string_free(best, TRUE);
+                    *literal_only = FALSE;
+                    return NULL;
+                }
+                *literal_only = FALSE;
+                end_run = TRUE;
+                if (ptr[1]){
+                    ptr++;
+                }
+                break;
+            case '?':
+            case '*':
+            case '{':
+                // Previous character may not appear, it may be multibyte
+                if (run->len){
+                    const char *prev;
+
+                    prev = g_utf8_find_prev_char(run->str, run->str + run->len);
+                    g_string_truncate(run, prev ? prev - run->str : 0);
+                }
+                if (*ptr == '{'){
+                    while (ptr[1] && *ptr != '}'){
+                        ptr++;
+                    }
+                }
+                *literal_only = FALSE;
+                end_run = TRUE;
+                break;
+            case '[':
+                // Skip character class
+                ptr++;
+                if (*ptr == '^'){
+                    ptr++;
+                }
+                if (*ptr == ']'){
+                    ptr++;
+                }
+                while (*ptr && *ptr != ']'){
+                    if (*ptr == '\\' && ptr[1]){
+                        ptr++;
+                    }
+                    ptr++;
+                }
+                if (!*ptr){
+                    ptr--;
+                }
+                *literal_only = FALSE;
+                end_run = TRUE;
+                break;
+            case '(':
+                if (run->len > best->len){
+                    g_string_assign(best, run->str);
+                }
+                g_string_truncate(run, 0);
+                groups = g_slist_prepend(groups, g_strdup(best->str));
+                *literal_only = FALSE;
+                end_run = TRUE;
+                break;
+            case ')':
+                if (groups){
+                    char *outer;
+
+                    outer = groups->data;
+                    groups = g_slist_delete_link(groups, groups);
+                    if (ptr[1] == '?' || ptr[1] == '*' || ptr[1] == '{'){
+                        // The whole group may not appear, forget its literals
+                        g_string_assign(best, outer);
+                        g_string_truncate(run, 0);
+                    }
+                    g_free(outer);
+                }
+                *literal_only = FALSE;
+                end_run = TRUE;
+                break;
+            case '+':
+            case '.':
+            case '^':
+            case '$':
+                *literal_only = FALSE;
+                end_run = TRUE;
+                break;
+            default:
+                g_string_append_c(run, *ptr);
+        }
+
+        if (end_run || !ptr[1]){
+            if (run->len > best->len){
+                g_string_assign(best, run->str);
+            }
+            g_string_truncate(run, 0);
+        }
+    }
+    g_slist_free_full(groups, g_free);
+    g_string_free(run, TRUE);
+
+    if (!best->len){
+        *literal_only = FALSE;
+        g_string_free(best, TRUE);
+        return NULL;
+    }
+
+    return g_string_free(best, FALSE);
+}
+
+static const char* find_literal(const char *data, gsize len,
+        const char *literal, gsize literal_len){
+    const char *ptr;
+    const char *last;
+
+    if (len < literal_len){
+        return NULL;
+    }
+
+    ptr = data;
+    last = data + len - literal_len; // Last possible position
+    while (ptr <= last){
+        ptr = memchr(ptr, literal[0], last - ptr + 1);
+        if (!ptr){
+            return NULL;
+        }
+        if (memcmp(ptr, literal, literal_len) == 0){
+            return ptr;
+        }
+        ptr++;
+    }
+
+    return NULL;
+}
+
+static void grep_task_free(GrepTask *task){
+    g_ptr_array_free(task->lines, TRUE);
+    srn_chat_log_file_free(task->file);
+    g_free(task->srv_name);
+    g_free(task);
+}
+
+static void grep_line_free(GrepLine *line){
+    g_free(line->date);
+    g_free(line->line);
+    g_free(line);
+}
+
+/* Newest log first */
+static int grep_task_cmp(gconstpointer a, gconstpointer b){
+    const GrepTask *task1 = a;
+    const GrepTask *task2 = b;
+
+    return -g_strcmp0(task1->file->date, task2->file->date);
+}
@@ -0,0 +1,1079 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file message_store.c
+ * @brief Indexed on-disk message store for searching chat history.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-08
+ *
+ * Messages of a chat are appended to one segment file per day:
+ * ``<dir>/<srv_name>/<chat_name>/<YYYY-MM-DD>.dat``, names of server and
+ * chat are escaped by ``srn_escape_file_name()``. Every record is:
+ *
+ *     guint32 length | gint64 time | guint16 sender length | sender | content
+ *
+ * where length is the size of the record without the length field itself.
+ *
+ * The index of segment (``<YYYY-MM-DD>.idx``) is built when the segment is
+ * searched for the first time. If the segment has grown since, postings of
+ * indexed records are loaded from the index and only the newly appended
+ * records are scanned.
+ * It contains offset and time of every record, a sender index and a
+ * inverted token index, both of them are sorted dictionaries of posting
+ * lists so that they can be searched without being loaded:
+ *
+ *     header | guint64 offsets[nrecord] | gint64 times[nrecord]
+ *            | guint32 sender_entries[nsender] | guint32 token_entries[ntoken]
+ *            | entries...
+ *
+ * entry is "guint32 key length | key | padding | guint32 count | ids".
+ * All integers are stored in host byte order.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+#include "path.h"
+#include "message_store.h"
+
+#define SEGMENT_SUFFIX          ".dat"
+#define INDEX_SUFFIX            ".idx"
+#define INDEX_MAGIC             "SRNIDX01"
+#define INDEX_HEADER_SIZE       48
+#define RECORD_HEADER_SIZE      14
+#define TOKEN_MIN_LEN           2
+#define TOKEN_MAX_LEN           64
+#define SEGMENT_IDLE_TIMEOUT    (60 * G_TIME_SPAN_SECOND)
+
+typedef struct _Segment Segment;
+typedef struct _SegmentRef SegmentRef;
+typedef struct _Index Index;
+typedef struct _IndexBuilder IndexBuilder;
+typedef void (*TokenFunc) (const char *token, gpointer user_data);
+
+struct _SrnMessageStore {
+    char *dir;
+    GHashTable *segment_table; // Opened segments, only used by writer
+};
+
+/* Opened segment for writing */
+struct _Segment {
+    char *date;
+    FILE *fp;
+    bool dirty;
+    gint64 last_used;
+};
+
+/* Segment to be searched */
+struct _SegmentRef {
+    char *srv_name;
+    char *chat_name;
+    char *date;
+};
+
+struct _Index {
+    GMappedFile *mapped;
+    GByteArray *buf;
+    const char *data;
+    gsize size;
+
+    guint64 data_size; // Size of segment when index is built
+    gint64 min_time;
+    gint64 max_time;
+    guint32 nrecord;
+    guint32 nsender;
+    guint32 ntoken;
+};
+
+struct _IndexBuilder {
+    guint32 id;
+    GHashTable *table;
+};
+
+static Segment* get_segment(SrnMessageStore *self, const char *srv_name,
+        const char *chat_name, gint64 time);
+static void segment_free(Segment *seg);
+static char* build_dir(const char *dir, const char *srv_name,
+        const char *chat_name);
+
+static void tokenize(const char *text, gsize len, TokenFunc func,
+        gpointer user_data);
+static bool is_token_char(char c);
+static void add_token(const char *token, gpointer user_data);
+static void add_posting(const char *key, gpointer user_data);
+
+static Index* index_load(const char *path);
+static Index* index_build(const char *data_path, const char *index_path,
+        Index *base);
+static bool index_load_dict(Index *idx, gsize table, guint32 n,
+        GHashTable *dict);
+static Index* index_new(const char *data, gsize size);
+static void index_free(Index *idx);
+static GArray* index_lookup(Index *idx, gsize table, guint32 n,
+        const char *key);
+static void serialize_dict(GByteArray *buf, GByteArray *entries,
+        gsize entry_base, GHashTable *table);
+
+static GList* list_dir(const char *path, const char *suffix);
+static GArray* intersect(GArray *a, GArray *b);
+static void search_segment(SrnMessageStore *self, SegmentRef *ref,
+        SrnMessageStoreQuery *query, GPtrArray *tokens, GList **results);
+static char* format_date(gint64 time);
+static void segment_ref_free(SegmentRef *ref);
+static int segment_ref_cmp(gconstpointer a, gconstpointer b);
+static int result_cmp(gconstpointer a, gconstpointer b);
+
+SrnMessageStore* srn_message_store_new(const char *dir){
+    SrnMessageStore *self;
+
+    self = g_malloc0(sizeof(SrnMessageStore));
+    self->dir = g_strdup(dir);
+    self->segment_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)segment_free);
+
+    return self;
+}
+
+void srn_message_store_free(SrnMessageStore *self){
+    g_hash_table_destroy(self->segment_table);
+    g_free(self->dir);
+    g_free(self);
+}
+
+/**
+ * @brief ``srn_message_store_append`` appends a message to the segment of
+ * given chat, segments are kept opened, so this function should only be
+ * called from one thread.
+ *
+ * @param self
+ * @param srv_name
+ * @param chat_name
+ * @param time Unix time of message
+ * @param sender
+ * @param content
+ *
+ * @return SRN_OK if success
+ */
+SrnRet srn_message_store_append(SrnMessageStore *self, const char *srv_name,
+        const char *chat_name, gint64 time, const char *sender,
+        const char *content){
+    guint32 len;
+    guint16 sender_len;
+    gsize content_len;
+    Segment *seg;
+
+    seg = get_segment(self, srv_name, chat_name, time);
+    if (!seg){
+        return RET_ERR(_("Failed to open message store segment"));
+    }
+
+    sender_len = MIN(strlen(sender), G_MAXUINT16);
+    content_len = strlen(content);
+    len = sizeof(time) + sizeof(sender_len) + sender_len + content_len;
+
+    if (fwrite(&len, sizeof(len), 1, seg->fp) != 1
+            || fwrite(&time, sizeof(time), 1, seg->fp) != 1
+            || fwrite(&sender_len, sizeof(sender_len), 1, seg->fp) != 1
+            || fwrite(sender, 1, sender_len, seg->fp) != sender_len
+            || fwrite(content, 1, content_len, seg->fp) != content_len){
+        return RET_ERR(_("Failed to write message store segment"));
+    }
+    seg->dirty = TRUE;
+    seg->last_used = g_get_monotonic_time();
+
+    return SRN_OK;
+}
+
+/**
+ * @brief ``srn_message_store_flush`` flushes written segments and closes idle
+ * ones, it should be called from the thread which appends messages.
+ *
+ * @param self
+ * @param sync Whether call fsync() after flushing
+ */
+void srn_message_store_flush(SrnMessageStore *self, bool sync){
+    gint64 now;
+    Segment *seg;
+    GHashTableIter iter;
+
+    now = g_get_monotonic_time();
+    g_hash_table_iter_init(&iter, self->segment_table);
+    while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&seg)){
+        if (seg->dirty){
+            if (fflush(seg->fp) != 0){
+                ERR_FR("Failed to flush message store segment");
+            }
+            if (sync){
+                fsync(fileno(seg->fp));
+            }
+            seg->dirty = FALSE;
+        }
+        if (now - seg->last_used > SEGMENT_IDLE_TIMEOUT){
+            g_hash_table_iter_remove(&iter);
+        }
+    }
+}
+
+/**
+ * @brief ``srn_message_store_search`` searches messages matched the query,
+ * it only reads files, so it is safe to call it from any thread.
+ *
+ * @param self
+ * @param query
+ * @param results Pass-out list of SrnMessageStoreResult, newest first, should
+ * be freed by caller
+ *
+ * @return SRN_OK if success
+ */
+SrnRet srn_message_store_search(SrnMessageStore *self,
+        SrnMessageStoreQuery *query, GList **results){
+    char *since_date;
+    char *until_date;
+    const char *last_date;
+    GList *srv_list;
+    GList *refs;
+    GList *lst;
+    GPtrArray *tokens;
+
+    tokens = g_ptr_array_new_with_free_func(g_free);
+    if (query->text){
+        tokenize(query->text, strlen(query->text), add_token, tokens);
+    }
+    if (tokens->len == 0 && !query->sender){
+        g_ptr_array_free(tokens, TRUE);
+        return RET_ERR(_("Nothing to search, words should contain at least %1$d characters"),
+                TOKEN_MIN_LEN);
+    }
+
+    /* Collect segments in date range */
+    since_date = query->since ? format_date(query->since) : NULL;
+    until_date = query->until ? format_date(query->until) : NULL;
+    refs = NULL;
+    // Names of directories are escaped, see build_dir()
+    srv_list = query->srv_name
+        ? g_list_append(NULL, srn_escape_file_name(query->srv_name))
+        : list_dir(self->dir, NULL);
+    for (GList *srv = srv_list; srv; srv = g_list_next(srv)){
+        char *srv_dir;
+        GList *chat_list;
+
+        srv_dir = g_build_filename(self->dir, srv->data, NULL);
+        chat_list = query->chat_name
+            ? g_list_append(NULL, srn_escape_file_name(query->chat_name))
+            : list_dir(srv_dir, NULL);
+        for (GList *chat = chat_list; chat; chat = g_list_next(chat)){
+            char *chat_dir;
+            GList *date_list;
+
+            chat_dir = g_build_filename(srv_dir, chat->data, NULL);
+            date_list = list_dir(chat_dir, SEGMENT_SUFFIX);
+            for (GList *date = date_list; date; date = g_list_next(date)){
+                SegmentRef *ref;
+
+                if ((since_date && strcmp(date->data, since_date) < 0)
+                        || (until_date && strcmp(date->data, until_date) > 0)){
+                    continue;
+                }
+                ref = g_malloc0(sizeof(SegmentRef));
+                ref->srv_name = g_strdup(srv->data);
+                ref->chat_name = g_strdup(chat->data);
+                ref->date = g_strdup(date->data);
+                refs = g_list_prepend(refs, ref);
+            }
+            g_list_free_full(date_list, g_free);
+            g_free(chat_dir);
+        }
+        g_list_free_full(chat_list, g_free);
+        g_free(srv_dir);
+    }
+    g_list_free_full(srv_list, g_free);
+    g_free(since_date);
+    g_free(until_date);
+
+    /* Search from the newest segment, stop when we have enough results and
+     * all segments of the same day are searched */
+    *results = NULL;
+    last_date = NULL;
+    refs = g_list_sort(refs, segment_ref_cmp);
+    for (lst = refs; lst; lst = g_list_next(lst)){
+        SegmentRef *ref;
+
+        ref = lst->data;
+        if (last_date && strcmp(last_date, ref->date) != 0
+                && g_list_length(*results) >= query->limit){
+            break;
+        }
+        search_segment(self, ref, query, tokens, results);
+        last_date = ref->date;
+    }
+
+    *results = g_list_sort(*results, result_cmp);
+    while (g_list_length(*results) > query->limit){
+        GList *last;
+
+        last = g_list_last(*results);
+        srn_message_store_result_free(last->data);
+        *results = g_list_delete_link(*results, last);
+    }
+
+    g_list_free_full(refs, (GDestroyNotify)segment_ref_free);
+    g_ptr_array_free(tokens, TRUE);
+
+    return SRN_OK;
+}
+
+SrnMessageStoreQuery* srn_message_store_query_new(void){
+    SrnMessageStoreQuery *query;
+
+    query = g_malloc0(sizeof(SrnMessageStoreQuery));
+    query->limit = SRN_MESSAGE_STORE_SEARCH_LIMIT;
+
+    return query;
+}
+
+void srn_message_store_query_free(SrnMessageStoreQuery *query){
+    g_free(query->srv_name);
+    g_free(query->chat_name);
+    g_free(query->sender);
+    g_free(query->text);
+    g_free(query);
+}
+
+void srn_message_store_result_free(SrnMessageStoreResult *result){
+    g_free(result->srv_name);
+    g_free(result->chat_name);
+    g_free(result->sender);
+    g_free(result->content);
+    g_free(result);
+}
+
+static Segment* get_segment(SrnMessageStore *self, const char *srv_name,
+        const char *chat_name, gint64 time){
+    char *key;
+    char *date;
+    char *dir;
+    char *fname;
+    char *path;
+    FILE *fp;
+    Segment *seg;
+
+    date = format_date(time);
+    key = g_strdup_printf("%s\n%s", srv_name, chat_name);
+    seg = g_hash_table_lookup(self->segment_table, key);
+    if (seg && strcmp(seg->date, date) == 0){
+        g_free(key);
+        g_free(date);
+        return seg;
+    }
+
+    dir = build_dir(self->dir, srv_name, chat_name);
+    if (g_mkdir_with_parents(dir, S_IRWXU) != 0){
+        ERR_FR("Failed to create directory '%s'", dir);
+        g_free(dir);
+        g_free(key);
+        g_free(date);
+        return NULL;
+    }
+    fname = g_strconcat(date, SEGMENT_SUFFIX, NULL);
+    path = g_build_filename(dir, fname, NULL);
+    fp = fopen(path, "ab");
+    g_free(fname);
+    g_free(dir);
+    if (!fp){
+        ERR_FR("Failed to open file '%s'", path);
+        g_free(path);
+        g_free(key);
+        g_free(date);
+        return NULL;
+    }
+    g_free(path);
+
+    seg = g_malloc0(sizeof(Segment));
+    seg->date = date;
+    seg->fp = fp;
+    // Segment of previous day is closed here if any
+    g_hash_table_replace(self->segment_table, key, seg);
+
+    return seg;
+}
+
+/**
+ * @brief Build directory of segments of chat, names are escaped so that they
+ * never escape from the store directory.
+ */
+static char* build_dir(const char *dir, const char *srv_name,
+        const char *chat_name){
+    char *path;
+    char *srv;
+    char *chat;
+
+    srv = srn_escape_file_name(srv_name);
+    chat = srn_escape_file_name(chat_name);
+    path = g_build_filename(dir, srv, chat, NULL);
+    g_free(srv);
+    g_free(chat);
+
+    return path;
+}
+
+static void segment_free(Segment *seg){
+    fclose(seg->fp);
+    g_free(seg->date);
+    g_free(seg);
+}
+
+/**
+ * @brief Split text into lowercase words, words shorter than TOKEN_MIN_LEN
+ * are ignored and words longer than TOKEN_MAX_LEN are truncated. Non-ASCII
+ * bytes are treated as parts of word.
+ */
+static void tokenize(const char *text, gsize len, TokenFunc func,
+        gpointer user_data){
+    gsize i;
+
+    i = 0;
+    while (i < len){
+        gsize start;
+
+        while (i < len && !is_token_char(text[i])) i++;
+        start = i;
+        while (i < len && is_token_char(text[i])) i++;
+
+        if (i - start >= TOKEN_MIN_LEN){
+            char *token;
+
+            token = g_ascii_strdown(text + start, MIN(i - start, TOKEN_MAX_LEN));
+            func(token, user_data);
+        }
+    }
+}
+
+static bool is_token_char(char c){
+    return g_ascii_isalnum(c) || c == '_' || (unsigned char)c >= 0x80;
+}
+
+static void add_token(const char *token, gpointer user_data){
+    g_ptr_array_add(user_data, (char *)token);
+}
+
+static void add_posting(const char *key, gpointer user_data){
+    GArray *ids;
+    IndexBuilder *builder;
+
+    builder = user_data;
+    ids = g_hash_table_lookup(builder->table, key);
+    if (!ids){
+        ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+        g_hash_table_insert(builder->table, (char *)key, ids);
+    } else {
+        g_free((char *)key);
+    }
+    // A record may contain same token more than once
+    if (ids->len == 0
+            || g_array_index(ids, guint32, ids->len - 1) != builder->id){
+        g_array_append_val(ids, builder->id);
+    }
+}
+
+static Index* index_load(const char *path){
+    Index *idx;
+    GMappedFile *mapped;
+
+    mapped = g_mapped_file_new(path, FALSE, NULL);
+    if (!mapped){
+        return NULL;
+    }
+
+    idx = index_new(g_mapped_file_get_contents(mapped),
+            g_mapped_file_get_length(mapped));
+    if (!idx){
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+    idx->mapped = mapped;
+
+    return idx;
+}
+
+/**
+ * @brief Scan a segment and build its index, the index is saved to
+ * index_path so that it can be reused.
+ *
+ * @param data_path
+ * @param index_path
+ * @param base Outdated index of the segment, can be NULL. Records it covers
+ * are taken from it rather than scanned again.
+ *
+ * @return The new index
+ */
+static Index* index_build(const char *data_path, const char *index_path,
+        Index *base){
+    guint32 nrecord;
+    gsize off;
+    gsize size;
+    gsize entry_base;
+    gint64 min_time;
+    gint64 max_time;
+    const char *data;
+    GError *err;
+    GMappedFile *mapped;
+    GArray *offsets;
+    GArray *times;
+    GHashTable *senders;
+    GHashTable *tokens;
+    GByteArray *buf;
+    GByteArray *entries;
+    IndexBuilder builder;
+    Index *idx;
+
+    err = NULL;
+    mapped = g_mapped_file_new(data_path, FALSE, &err);
+    if (!mapped){
+        ERR_FR("Failed to map file '%s': %s", data_path, err->message);
+        g_error_free(err);
+        return NULL;
+    }
+    data = g_mapped_file_get_contents(mapped);
+    size = g_mapped_file_get_length(mapped);
+
+    offsets = g_array_new(FALSE, FALSE, sizeof(guint64));
+    times = g_array_new(FALSE, FALSE, sizeof(gint64));
+    senders = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)g_array_unref);
+    tokens = g_hash_table_new_full(g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify)g_array_unref);
+
+    min_time = G_MAXINT64;
+    max_time = G_MININT64;
+    nrecord = 0;
+    off = 0;
+
+    /* Segment is append-only, so records covered by base are unchanged */
+    if (base && base->data_size <= size){
+        gsize table;
+
+        table = INDEX_HEADER_SIZE;
+        g_array_append_vals(offsets, base->data + table, base->nrecord);
+        table += (gsize)base->nrecord * 8;
+        g_array_append_vals(times, base->data + table, base->nrecord);
+        table += (gsize)base->nrecord * 8;
+        if (index_load_dict(base, table, base->nsender, senders)
+                && index_load_dict(base, table + (gsize)base->nsender * 4,
+                    base->ntoken, tokens)){
+            min_time = base->min_time;
+            max_time = base->max_time;
+            nrecord = base->nrecord;
+            off = base->data_size;
+        } else {
+            WARN_FR("Index of '%s' is corrupted, rebuilding", data_path);
+            g_array_set_size(offsets, 0);
+            g_array_set_size(times, 0);
+            g_hash_table_remove_all(senders);
+            g_hash_table_remove_all(tokens);
+        }
+    }
+
+    while (off + RECORD_HEADER_SIZE <= size){
+        guint32 len;
+        guint16 sender_len;
+        guint64 offset;
+        gint64 time;
+        const char *sender;
+        const char *content;
+
+        memcpy(&len, data + off, sizeof(len));
+        memcpy(&time, data + off + 4, sizeof(time));
+        memcpy(&sender_len, data + off + 12, sizeof(sender_len));
+        if (len < RECORD_HEADER_SIZE - 4 + sender_len
+                || off + 4 + len > size){
+            break; // Incomplete record
+        }
+        sender = data + off + RECORD_HEADER_SIZE;
+        content = sender + sender_len;
+
+        offset = off;
+        g_array_append_val(offsets, offset);
+        g_array_append_val(times, time);
+        min_time = MIN(min_time, time);
+        max_time = MAX(max_time, time);
+
+        builder.id = nrecord;
+        builder.table = senders;
+        add_posting(g_ascii_strdown(sender, sender_len), &builder);
+        builder.table = tokens;
+        tokenize(content, len - (RECORD_HEADER_SIZE - 4) - sender_len,
+                add_posting, &builder);
+
+        nrecord++;
+        off += 4 + len;
+    }
+    g_mapped_file_unref(mapped);
+
+    /* Serialize. The size of indexed records rather than the whole segment
+     * is recorded, so an incomplete record is scanned next time */
+    buf = g_byte_array_new();
+    g_byte_array_append(buf, (guint8 *)INDEX_MAGIC, 8);
+    g_byte_array_append(buf, (guint8 *)&(guint64){off}, 8);
+    g_byte_array_append(buf, (guint8 *)&min_time, 8);
+    g_byte_array_append(buf, (guint8 *)&max_time, 8);
+    g_byte_array_append(buf, (guint8 *)&nrecord, 4);
+    g_byte_array_append(buf, (guint8 *)&(guint32){g_hash_table_size(senders)}, 4);
+    g_byte_array_append(buf, (guint8 *)&(guint32){g_hash_table_size(tokens)}, 4);
+    g_byte_array_append(buf, (guint8 *)&(guint32){0}, 4); // Reserved
+    g_byte_array_append(buf, (guint8 *)offsets->data, nrecord * sizeof(guint64));
+    g_byte_array_append(buf, (guint8 *)times->data, nrecord * sizeof(gint64));
+
+    entry_base = buf->len + (g_hash_table_size(senders)
+            + g_hash_table_size(tokens)) * sizeof(guint32);
+    entries = g_byte_array_new();
+    serialize_dict(buf, entries, entry_base, senders);
+    serialize_dict(buf, entries, entry_base, tokens);
+    g_byte_array_append(buf, entries->data, entries->len);
+    g_byte_array_free(entries, TRUE);
+
+    g_array_free(offsets, TRUE);
+    g_array_free(times, TRUE);
+    g_hash_table_destroy(senders);
+    g_hash_table_destroy(tokens);
+
+    err = NULL;
+    if (!g_file_set_contents(index_path, (char *)buf->data, buf->len, &err)){
+        WARN_FR("Failed to save index '%s': %s", index_path, err->message);
+        g_error_free(err);
+    }
+
+    idx = index_new((char *)buf->data, buf->len);
+    if (!idx){
+        g_byte_array_free(buf, TRUE);
+        return NULL;
+    }
+    idx->buf = buf;
+
+    return idx;
+}
+
+static Index* index_new(const char *data, gsize size){
+    Index *idx;
+
+    if (size < INDEX_HEADER_SIZE || memcmp(data, INDEX_MAGIC, 8) != 0){
+        return NULL;
+    }
+
+    idx = g_malloc0(sizeof(Index));
+    idx->data = data;
+    idx->size = size;
+    memcpy(&idx->data_size, data + 8, sizeof(idx->data_size));
+    memcpy(&idx->min_time, data + 16, sizeof(idx->min_time));
+    memcpy(&idx->max_time, data + 24, sizeof(idx->max_time));
+    memcpy(&idx->nrecord, data + 32, sizeof(idx->nrecord));
+    memcpy(&idx->nsender, data + 36, sizeof(idx->nsender));
+    memcpy(&idx->ntoken, data + 40, sizeof(idx->ntoken));
+
+    if (INDEX_HEADER_SIZE + (guint64)idx->nrecord * 16
+            + ((guint64)idx->nsender + idx->ntoken) * 4 > size){
+        g_free(idx);
+        return NULL;
+    }
+
+    return idx;
+}
+
+static void index_free(Index *idx){
+    if (idx->mapped){
+        g_mapped_file_unref(idx->mapped);
+    }
+    if (idx->buf){
+        g_byte_array_free(idx->buf, TRUE);
+    }
+    g_free(idx);
+}
+
+/**
+ * @brief Load all keys and posting lists of a dictionary of index into dict.
+ *
+ * @return FALSE if the dictionary is corrupted
+ */
+static bool index_load_dict(Index *idx, gsize table, guint32 n,
+        GHashTable *dict){
+    for (guint32 i = 0; i < n; i++){
+        guint32 entry;
+        guint32 len;
+        guint32 count;
+        gsize ids;
+        GArray *arr;
+
+        memcpy(&entry, idx->data + table + (gsize)i * 4, sizeof(entry));
+        if (entry + 4 > idx->size) return FALSE;
+        memcpy(&len, idx->data + entry, sizeof(len));
+        if (entry + 4 + len > idx->size) return FALSE;
+
+        ids = (entry + 4 + len + 3) / 4 * 4; // Skip padding
+        if (ids + 4 > idx->size) return FALSE;
+        memcpy(&count, idx->data + ids, sizeof(count));
+        ids += 4;
+        if (ids + (guint64)count * 4 > idx->size) return FALSE;
+
+        arr = g_array_sized_new(FALSE, FALSE, sizeof(guint32), count);
+        g_array_append_vals(arr, idx->data + ids, count);
+        g_hash_table_insert(dict, g_strndup(idx->data + entry + 4, len), arr);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Binary search key in a dictionary of index.
+ *
+ * @param idx
+ * @param table Offset of entry table of dictionary
+ * @param n Size of entry table
+ * @param key
+ *
+ * @return A array of record IDs, NULL if key not found
+ */
+static GArray* index_lookup(Index *idx, gsize table, guint32 n,
+        const char *key){
+    gsize key_len;
+    guint32 lo;
+    guint32 hi;
+
+    key_len = strlen(key);
+    lo = 0;
+    hi = n;
+    while (lo < hi){
+        int cmp;
+        guint32 mid;
+        guint32 entry;
+        guint32 len;
+        guint32 count;
+        gsize ids;
+        GArray *arr;
+
+        mid = lo + (hi - lo) / 2;
+        memcpy(&entry, idx->data + table + mid * 4, sizeof(entry));
+        if (entry + 4 > idx->size) return NULL;
+        memcpy(&len, idx->data + entry, sizeof(len));
+        if (entry + 4 + len > idx->size) return NULL;
+
+        cmp = memcmp(idx->data + entry + 4, key, MIN(len, key_len));
+        if (cmp == 0){
+            cmp = len < key_len ? -1 : len > key_len ? 1 : 0;
+        }
+        if (cmp < 0){
+            lo = mid + 1;
+            continue;
+        }
+        if (cmp > 0){
+            hi = mid;
+            continue;
+        }
+
+        ids = (entry + 4 + len + 3) / 4 * 4; // Skip padding
+        if (ids + 4 > idx->size) return NULL;
+        memcpy(&count, idx->data + ids, sizeof(count));
+        ids += 4;
+        if (ids + (guint64)count * 4 > idx->size) return NULL;
+
+        arr = g_array_sized_new(FALSE, FALSE, sizeof(guint32), count);
+        g_array_append_vals(arr, idx->data + ids, count);
+        return arr;
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Append sorted entry table of dictionary to buf, and entries to
+ * entries.
+ */
+static void serialize_dict(GByteArray *buf, GByteArray *entries,
+        gsize entry_base, GHashTable *table){
+    GList *keys;
+
+    keys = g_list_sort(g_hash_table_get_keys(table), (GCompareFunc)strcmp);
+    for (GList *lst = keys; lst; lst = g_list_next(lst)){
+        guint32 entry;
+        guint32 len;
+        guint32 count;
+        GArray *ids;
+
+        entry = entry_base + entries->len;
+        g_byte_array_append(buf, (guint8 *)&entry, sizeof(entry));
+
+        len = strlen(lst->data);
+        ids = g_hash_table_lookup(table, lst->data);
+        count = ids->len;
+        g_byte_array_append(entries, (guint8 *)&len, sizeof(len));
+        g_byte_array_append(entries, lst->data, len);
+        while (entries->len % 4 != 0){
+            g_byte_array_append(entries, (guint8 *)"", 1);
+        }
+        g_byte_array_append(entries, (guint8 *)&count, sizeof(count));
+        g_byte_array_append(entries, (guint8 *)ids->data, count * sizeof(guint32));
+    }
+    g_list_free(keys);
+}
+
+/**
+ * @brief List names of entries in directory.
+ *
+ * @param path
+ * @param suffix If not NULL, only list names with the suffix, and the suffix
+ * is removed from returned names
+ *
+ * @return List of names
+ */
+static GList* list_dir(const char *path, const char *suffix){
+    const char *name;
+    GDir *dir;
+    GList *lst;
+
+    dir = g_dir_open(path, 0, NULL);
+    if (!dir){
+        return NULL;
+    }
+
+    lst = NULL;
+    while ((name = g_dir_read_name(dir)) != NULL){
+        if (!suffix){
+            lst = g_list_prepend(lst, g_strdup(name));
+        } else if (g_str_has_suffix(name, suffix)){
+            lst = g_list_prepend(lst,
+                    g_strndup(name, strlen(name) - strlen(suffix)));
+        }
+    }
+    g_dir_close(dir);
+
+    return lst;
+}
+
+/**
+ * @brief Intersect two sorted arrays of record IDs, both of arrays are freed.
+ */
+static GArray* intersect(GArray *a, GArray *b){
+    guint i;
+    guint j;
+    GArray *res;
+
+    res = g_array_new(FALSE, FALSE, sizeof(guint32));
+    i = j = 0;
+    while (i < a->len && j < b->len){
+        guint32 x;
+        guint32 y;
+
+        x = g_array_index(a, guint32, i);
+        y = g_array_index(b, guint32, j);
+        if (x < y){
+            i++;
+        } else if (x > y){
+            j++;
+        } else {
+            g_array_append_val(res, x);
+            i++;
+            j++;
+        }
+    }
+    g_array_free(a, TRUE);
+    g_array_free(b, TRUE);
+
+    return res;
+}
+
+static void search_segment(SrnMessageStore *self, SegmentRef *ref,
+        SrnMessageStoreQuery *query, GPtrArray *tokens, GList **results){
+    int count;
+    char *fname;
+    char *data_path;
+    char *index_path;
+    gsize offsets;
+    gsize times;
+    GStatBuf st;
+    GArray *ids;
+    GMappedFile *mapped;
+    Index *idx;
+
+    fname = g_strconcat(ref->date, SEGMENT_SUFFIX, NULL);
+    data_path = g_build_filename(self->dir,
+            ref->srv_name, ref->chat_name, fname, NULL);
+    g_free(fname);
+    fname = g_strconcat(ref->date, INDEX_SUFFIX, NULL);
+    index_path = g_build_filename(self->dir,
+            ref->srv_name, ref->chat_name, fname, NULL);
+    g_free(fname);
+
+    ids = NULL;
+    mapped = NULL;
+    idx = NULL;
+    if (g_stat(data_path, &st) != 0){
+        goto FIN;
+    }
+
+    idx = index_load(index_path);
+    if (!idx || idx->data_size != (guint64)st.st_size){
+        Index *base;
+
+        DBG_FR("%s index of '%s'", idx ? "Extending" : "Building", data_path);
+        base = idx;
+        idx = index_build(data_path, index_path, base);
+        if (base){
+            index_free(base);
+        }
+    }
+    if (!idx || idx->nrecord == 0){
+        goto FIN;
+    }
+    if ((query->since && idx->max_time < query->since)
+            || (query->until && idx->min_time > query->until)){
+        goto FIN;
+    }
+
+    /* Intersect posting lists */
+    offsets = INDEX_HEADER_SIZE;
+    times = offsets + (gsize)idx->nrecord * 8;
+    for (int i = 0; i < tokens->len; i++){
+        GArray *arr;
+
+        arr = index_lookup(idx, times + (gsize)idx->nrecord * 8
+                + (gsize)idx->nsender * 4, idx->ntoken, tokens->pdata[i]);
+        if (!arr){
+            goto FIN;
+        }
+        ids = ids ? intersect(ids, arr) : arr;
+    }
+    if (query->sender){
+        char *sender;
+        GArray *arr;
+
+        sender = g_ascii_strdown(query->sender, -1);
+        arr = index_lookup(idx, times + (gsize)idx->nrecord * 8,
+                idx->nsender, sender);
+        g_free(sender);
+        if (!arr){
+            goto FIN;
+        }
+        ids = ids ? intersect(ids, arr) : arr;
+    }
+    if (!ids || ids->len == 0){
+        goto FIN;
+    }
+
+    mapped = g_mapped_file_new(data_path, FALSE, NULL);
+    if (!mapped){
+        goto FIN;
+    }
+
+    /* Read matched records, newest first */
+    count = 0;
+    for (int i = ids->len - 1; i >= 0 && count < query->limit; i--){
+        guint32 id;
+        guint32 len;
+        guint16 sender_len;
+        guint64 off;
+        gint64 time;
+        const char *data;
+        SrnMessageStoreResult *res;
+
+        id = g_array_index(ids, guint32, i);
+        if (id >= idx->nrecord){
+            continue;
+        }
+        memcpy(&off, idx->data + offsets + (gsize)id * 8, sizeof(off));
+        memcpy(&time, idx->data + times + (gsize)id * 8, sizeof(time));
+        if ((query->since && time < query->since)
+                || (query->until && time > query->until)){
+            continue;
+        }
+        if (off + RECORD_HEADER_SIZE > g_mapped_file_get_length(mapped)){
+            continue;
+        }
+
+        data = g_mapped_file_get_contents(mapped) + off;
+        memcpy(&len, data, sizeof(len));
+        memcpy(&sender_len, data + 12, sizeof(sender_len));
+        if (off + 4 + len > g_mapped_file_get_length(mapped)
+                || len < RECORD_HEADER_SIZE - 4 + sender_len){
+            continue;
+        }
+
+        res = g_malloc0(sizeof(SrnMessageStoreResult));
+        res->srv_name = g_strdup(ref->srv_name);
+        res->chat_name = g_strdup(ref->chat_name);
+        res->time = time;
+        res->sender = g_strndup(data + RECORD_HEADER_SIZE, sender_len);
+        res->content = g_strndup(data + RECORD_HEADER_SIZE + sender_len,
+                len - (RECORD_HEADER_SIZE - 4) - sender_len);
+        *results = g_list_prepend(*results, res);
+        count++;
+    }
+
+FIN:
+    if (mapped){
+        g_mapped_file_unref(mapped);
+    }
+    if (ids){
+        g_array_free(ids, TRUE);
+    }
+    if (idx){
+        index_free(idx);
+    }
+    g_free(index_path);
+    g_free(data_path);
+}
+
+static char* format_date(gint64 time){
+    char *date;
+    GDateTime *dt;
+
+    dt = g_date_time_new_from_unix_local(time);
+    date = g_date_time_format(dt, "%F");
+    g_date_time_unref(dt);
+
+    return date;
+}
+
+static void segment_ref_free(SegmentRef *ref){
+    g_free(ref->srv_name);
+    g_free(ref->chat_name);
+    g_free(ref->date);
+    g_free(ref);
+}
+
+/* Newer segment first */
+static int segment_ref_cmp(gconstpointer a, gconstpointer b){
+    return strcmp(((SegmentRef *)b)->date, ((SegmentRef *)a)->date);
+}
+
+/* Newer result first */
+static int result_cmp(gconstpointer a, gconstpointer b){
+    gint64 ta;
+    gint64 tb;
+
+    ta = ((SrnMessageStoreResult *)a)->time;
+    tb = ((SrnMessageStoreResult *)b)->time;
+
+    return ta < tb ? 1 : ta > tb ? -1 : 0;
+}
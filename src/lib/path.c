@@ -25,6 +25,7 @@
  */
 
 
+#include <string.h>
 #include <sys/stat.h>
 #include <glib.h>
 #include <glib/gstdio.h>
@@ -34,6 +35,7 @@
 #include "meta.h"
 #include "log.h"
 #include "i18n.h"
+#include "path.h"
 
 #define DEFAULT_FILE_MODE   (S_IRUSR | S_IWUSR)
 #define DEFAULT_DIR_MODE    (S_IRWXU)
@@ -98,11 +100,14 @@ char *srn_get_system_config_file(){
 // FIXME: actually it only create the dir.
 char *srn_create_log_file(const char *srv_name, const char *fname){
     char *path;
+    char *name;
     SrnRet ret;
 
     // $XDG_DATA_HOME/srain/logs/<srv_name>/<fname>
+    name = srn_escape_file_name(srv_name);
     path = g_build_filename(g_get_user_data_dir(),
-            PACKAGE, "logs", srv_name, fname, NULL);
+            PACKAGE, "logs", name, fname, NULL);
+    g_free(name);
 
     ret = create_file_if_not_exist(path);
     if (!RET_IS_OK(ret)){
@@ -115,6 +120,73 @@ char *srn_create_log_file(const char *srv_name, const char *fname){
     return path;
 }
 
+/**
+ * @brief srn_get_log_dir returns the directory of chat logs of given server
+ *
+ * @param srv_name Name of server, NULL for the root directory of all logs
+ *
+ * @return Path of directory, it may be not existent
+ */
+char *srn_get_log_dir(const char *srv_name){
+    char *name;
+    char *path;
+
+    // $XDG_DATA_HOME/srain/logs/<srv_name>
+    name = srv_name ? srn_escape_file_name(srv_name) : NULL;
+    path = g_build_filename(g_get_user_data_dir(),
+            PACKAGE, "logs", name, NULL);
+    g_free(name);
+
+    return path;
+}
+
+char *srn_get_message_store_dir(){
+    // $XDG_DATA_HOME/srain/store
+    return g_build_filename(g_get_user_data_dir(), PACKAGE, "store", NULL);
+}
+
+/**
+ * @brief srn_get_ignore_list_file returns the file which stores hostmasks
+ *  ignored via command of given server
+ *
+ * @param srv_name Name of server
+ *
+ * @return Path of file, it may be not existent
+ */
+char *srn_get_ignore_list_file(const char *srv_name){
+    char *name;
+    char *path;
+
+    // $XDG_DATA_HOME/srain/ignore/<srv_name>
+    name = srn_escape_file_name(srv_name);
+    path = g_build_filename(g_get_user_data_dir(),
+            PACKAGE, "ignore", name, NULL);
+    g_free(name);
+
+    return path;
+}
+
+/**
+ * @brief srn_escape_file_name makes name of server or chat safe to be used
+ *  in file name or as a component of path. Path separators are replaced
+ *  by '_', and "." and ".." are prefixed by '_'.
+ *
+ * @param name
+ *
+ * @return Escaped name, must be freed by g_free.
+ */
+char *srn_escape_file_name(const char *name){
+    char *escaped;
+
+    if (name[0] == '\0' || strcmp(name, ".") == 0 || strcmp(name, "..") == 0){
+        escaped = g_strconcat("_", name, NULL);
+    } else {
+        escaped = g_strdup(name);
+    }
+
+    return g_strdelimit(escaped, "/\\", '_');
+}
+
 /**
  * @brief srn_create_user_files creates users files which required for
  *  running of Srain
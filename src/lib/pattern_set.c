@@ -28,14 +28,28 @@
 
 #include <glib.h>
 
+#include "srain.h"
+#include "log.h"
 #include "ret.h"
 #include "i18n.h"
 #include "pattern_set.h"
 
 struct _SrnPatternSet {
     GHashTable *table;
+    unsigned serial; // Increased when any pattern is added or removed
 };
 
+struct _SrnPatternCache {
+    bool compiled;
+    unsigned serial;        // Serial of pattern names when compiled
+    unsigned set_serial;    // Serial of SrnPatternSet when compiled
+    GList *regexes;         // List of GRegex, NULL if no pattern available
+    GRegex *regex;          // All regexes combined into one, NULL if not combinable
+};
+
+static void clear_cache(SrnPatternCache *self);
+static bool has_reference(const char *pattern);
+
 SrnPatternSet* srn_pattern_set_new(void) {
     SrnPatternSet *self;
 
@@ -61,7 +75,7 @@ SrnRet srn_pattern_set_add(SrnPatternSet *self, const char *name,
     }
 
     err = NULL;
-    regex = g_regex_new(pattern, 0, 0, &err);
+    regex = g_regex_new(pattern, G_REGEX_OPTIMIZE, 0, &err);
     if (err) {
         SrnRet ret;
         ret = RET_ERR("%s", err->message);
@@ -69,6 +83,7 @@ SrnRet srn_pattern_set_add(SrnPatternSet *self, const char *name,
         return ret;
     }
     g_hash_table_insert(self->table, g_strdup(name), regex);
+    self->serial++;
 
     return SRN_OK;
 }
@@ -78,7 +93,12 @@ GRegex *srn_pattern_set_get(SrnPatternSet *self, const char *name) {
 }
 
 SrnRet srn_pattern_set_rm(SrnPatternSet *self, const char *name) {
-    return g_hash_table_remove(self->table, name) ? SRN_OK : SRN_ERR;
+    if (!g_hash_table_remove(self->table, name)) {
+        return SRN_ERR;
+    }
+    self->serial++;
+
+    return SRN_OK;
 }
 
 /**
@@ -103,3 +123,191 @@ GList* srn_pattern_set_list(SrnPatternSet *self) {
 
     return lst;
 }
+
+/**
+ * @brief srn_pattern_set_get_serial returns a number which is changed
+ * whenever pattern set is changed, it is useful for invalidating regexes
+ * compiled from pattern set.
+ *
+ * @param self
+ *
+ * @return
+ */
+unsigned srn_pattern_set_get_serial(SrnPatternSet *self) {
+    return self->serial;
+}
+
+/**
+ * @brief srn_pattern_cache_new creates a cache of patterns compiled from
+ * SrnPatternSet. A cache is usually attached to a SrnExtraData and updated
+ * when it is no longer valid, see srn_pattern_cache_is_valid().
+ *
+ * @return
+ */
+SrnPatternCache* srn_pattern_cache_new(void) {
+    return g_malloc0(sizeof(SrnPatternCache));
+}
+
+void srn_pattern_cache_free(SrnPatternCache *self) {
+    clear_cache(self);
+    g_free(self);
+}
+
+/**
+ * @brief srn_pattern_cache_is_valid checks whether the cache is compiled from
+ * the current patterns.
+ *
+ * @param self
+ * @param set
+ * @param serial is a number which is changed whenever the list of pattern
+ * names is changed.
+ *
+ * @return
+ */
+bool srn_pattern_cache_is_valid(SrnPatternCache *self, SrnPatternSet *set,
+        unsigned serial) {
+    return self->compiled
+        && self->serial == serial
+        && self->set_serial == set->serial;
+}
+
+/**
+ * @brief srn_pattern_cache_update compiles the given patterns into cache.
+ *
+ * @param self
+ * @param set
+ * @param names is a list of pattern name, nonexistent names are ignored.
+ * @param serial is the same as srn_pattern_cache_is_valid().
+ *
+ * Patterns are compiled into one regex which matches if any of them matches,
+ * so that unmatched text is rejected in one pass. When any of patterns
+ * contains references to other groups, whose numbers are shifted in the
+ * combined regex, or the combined regex fails to compile, patterns are
+ * matched one by one.
+ */
+void srn_pattern_cache_update(SrnPatternCache *self, SrnPatternSet *set,
+        GList *names, unsigned serial) {
+    bool combinable;
+    GError *err;
+    GList *lst;
+    GString *str;
+
+    clear_cache(self);
+    self->compiled = TRUE;
+    self->serial = serial;
+    self->set_serial = set->serial;
+
+    combinable = TRUE;
+    str = g_string_new(NULL);
+    lst = names;
+    while (lst) {
+        GRegex *regex;
+
+        regex = g_hash_table_lookup(set->table, lst->data);
+        if (regex) {
+            const char *pattern;
+
+            pattern = g_regex_get_pattern(regex);
+            if (has_reference(pattern)) {
+                combinable = FALSE;
+            }
+            if (str->len) {
+                g_string_append_c(str, '|');
+            }
+            g_string_append_printf(str, "(?:%s)", pattern);
+            self->regexes = g_list_append(self->regexes, g_regex_ref(regex));
+        }
+        lst = g_list_next(lst);
+    }
+
+    if (combinable && g_list_length(self->regexes) > 1) {
+        err = NULL;
+        self->regex = g_regex_new(str->str,
+                G_REGEX_OPTIMIZE | G_REGEX_DUPNAMES, 0, &err);
+        if (err) {
+            WARN_FR("Failed to combine patterns, match them one by one: %s",
+                    err->message);
+            g_error_free(err);
+        }
+    }
+    g_string_free(str, TRUE);
+}
+
+/**
+ * @brief srn_pattern_cache_match checks whether any of cached patterns
+ * matches the given string.
+ *
+ * @param self
+ * @param str
+ *
+ * @return
+ */
+bool srn_pattern_cache_match(SrnPatternCache *self, const char *str) {
+    GList *lst;
+
+    if (self->regex) {
+        return g_regex_match(self->regex, str, 0, NULL);
+    }
+
+    lst = self->regexes;
+    while (lst) {
+        if (g_regex_match(lst->data, str, 0, NULL)) {
+            return TRUE;
+        }
+        lst = g_list_next(lst);
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief srn_pattern_cache_get_regexes returns the cached patterns in order.
+ *
+ * @param self
+ *
+ * @return A GList which contains GRegex, NULL if no pattern available.
+ * The GList is owned by cache and MUST not be freed by user.
+ */
+GList* srn_pattern_cache_get_regexes(SrnPatternCache *self) {
+    return self->regexes;
+}
+
+static void clear_cache(SrnPatternCache *self) {
+    if (self->regex) {
+        g_regex_unref(self->regex);
+        self->regex = NULL;
+    }
+    g_list_free_full(self->regexes, (GDestroyNotify)g_regex_unref);
+    self->regexes = NULL;
+    self->compiled = FALSE;
+}
+
+/**
+ * @brief has_reference checks whether the pattern refers to any group by
+ * number or name, such as "\1", "\g{-1}", "\k<name>", "(?1)" and "(?R)".
+ */
+static bool has_reference(const char *pattern) {
+    for (const char *ptr = pattern; *ptr; ptr++) {
+        if (ptr[0] == '\\') {
+            if (!ptr[1]) {
+                break;
+            }
+            if ((ptr[1] >= '1' && ptr[1] <= '9')
+                    || ptr[1] == 'g' || ptr[1] == 'k') {
+                return TRUE;
+            }
+            ptr++; // Skip escaped character
+            continue;
+        }
+        if (ptr[0] == '(' && ptr[1] == '?') {
+            if (g_ascii_isdigit(ptr[2]) || ptr[2] == '+' || ptr[2] == '-'
+                    || ptr[2] == 'R' || ptr[2] == '&'
+                    || g_str_has_prefix(ptr + 2, "P=")
+                    || g_str_has_prefix(ptr + 2, "P>")) {
+                return TRUE;
+            }
+        }
+    }
+
+    return FALSE;
+}
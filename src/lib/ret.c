@@ -38,14 +38,17 @@ struct _SrnRetMessage {
     SrnRet id;
     int no;
     char *msg;
+    bool read;  // Message has been got by ``ret_get_message()``
 };
 
+/* Messages are stored in a ring indexed by ``id % SRN_RET_MESSAGE_COUNT``,
+ * a new message evicts the oldest one in the same slot. */
+static SrnRetMessage msg_ring[SRN_RET_MESSAGE_COUNT];
 static SrnRet msgid = 0;
-static GList *msg_list = NULL;
+static unsigned evicted_unread = 0;
 static GMutex mutex;
 
-static SrnRetMessage* srn_ret_message_new(SrnRet id, int no, const char *msg);
-static void srn_ret_message_free(SrnRetMessage *rmsg);
+static SrnRetMessage* lookup_message(SrnRet id);
 static SrnRet ret_with_message(int no, const char *fmt, va_list ap);
 
 void ret_init(){
@@ -53,7 +56,17 @@ void ret_init(){
 }
 
 void ret_finalize(){
-    g_list_free_full(msg_list, (GDestroyNotify)srn_ret_message_free);
+    g_mutex_lock(&mutex);
+    if (evicted_unread > 0){
+        WARN_FR("%u messages were evicted before being read", evicted_unread);
+    }
+
+    // The sirc I/O thread may still be running
+    for (int i = 0; i < SRN_RET_MESSAGE_COUNT; i++){
+        g_free(msg_ring[i].msg);
+        msg_ring[i].msg = NULL;
+    }
+    g_mutex_unlock(&mutex);
 }
 
 SrnRet ret_err(const char *fmt, ...){
@@ -80,35 +93,25 @@ SrnRet ret_ok(const char *fmt, ...){
 
 const char *ret_get_message(SrnRet id){
     const char *msg;
-    GList *lst;
-    SrnRetMessage *err;
-
-    g_mutex_lock(&mutex);
-
-    msg = NULL;
+    SrnRetMessage *rmsg;
 
     if (id == SRN_OK) {
-        goto fin;
+        return NULL;
     }
     if (id == SRN_ERR) {
-        msg = _("Some error occurred");
-        goto fin;
+        return _("Some error occurred");
     }
 
-    lst = msg_list;
-    while (lst){
-        err = lst->data;
-
-        if (err->id == id) {
-            msg = err->msg;
-            break;
-        }
-        lst = g_list_next(lst);
+    msg = NULL;
+    g_mutex_lock(&mutex);
+    rmsg = lookup_message(id);
+    if (rmsg){
+        rmsg->read = TRUE;
+        msg = rmsg->msg;
     }
-
-fin:
     g_mutex_unlock(&mutex);
-    if (id != SRN_OK && !msg){
+
+    if (!msg){
         msg = _("Invalid error id, maybe this error is removed because out of date");
     }
 
@@ -117,74 +120,84 @@ fin:
 
 int ret_get_no(SrnRet id){
     int no;
-    GList *lst;
     SrnRetMessage *rmsg;
 
-    no = SRN_ERR;
-    g_mutex_lock(&mutex);
-
     if (id == SRN_OK || id == SRN_ERR){
-        no = id;
-        goto fin;
+        return id;
     }
 
-    rmsg = NULL;
-    lst = msg_list;
-    while (lst){
-        rmsg = lst->data;
-        if (rmsg->id == id) {
-            no = rmsg->no;
-            break;
-        }
-        lst = g_list_next(lst);
+    no = SRN_ERR;
+    g_mutex_lock(&mutex);
+    rmsg = lookup_message(id);
+    if (rmsg){
+        no = rmsg->no;
     }
-
-fin:
     g_mutex_unlock(&mutex);
+
     return no;
 }
 
-static SrnRet ret_with_message(int no, const char *fmt, va_list ap){
-    GString *msg;
-    SrnRetMessage *rmsg;
+/**
+ * @brief ``ret_get_evicted_count`` returns count of messages which were
+ * evicted from ring before being read, a large count means that
+ * SRN_RET_MESSAGE_COUNT is too small or messages are produced but never
+ * used.
+ *
+ * @return
+ */
+unsigned ret_get_evicted_count(){
+    unsigned count;
 
     g_mutex_lock(&mutex);
+    count = evicted_unread;
+    g_mutex_unlock(&mutex);
 
-    if (g_list_length(msg_list) > SRN_RET_MESSAGE_COUNT){
-        // If msg_list full
-        GList *last;
-        last = g_list_last(msg_list);
-        srn_ret_message_free((SrnRetMessage *)last->data);
-        msg_list = g_list_delete_link(msg_list, last);
-    }
-
-    msg = g_string_new(NULL);
-    g_string_append_vprintf(msg, fmt, ap);
-
-    rmsg = srn_ret_message_new(++msgid, no, msg->str);
-    g_string_free(msg, TRUE);
+    return count;
+}
 
-    msg_list = g_list_prepend(msg_list, rmsg);
+/**
+ * @brief Lookup message by id, mutex must be held.
+ */
+static SrnRetMessage* lookup_message(SrnRet id){
+    SrnRetMessage *rmsg;
 
-    g_mutex_unlock(&mutex);
+    if (id <= 0){
+        return NULL;
+    }
+    rmsg = &msg_ring[id % SRN_RET_MESSAGE_COUNT];
+    if (rmsg->id != id || !rmsg->msg){
+        return NULL; // Evicted
+    }
 
-    return rmsg->id;
+    return rmsg;
 }
 
-static SrnRetMessage* srn_ret_message_new(SrnRet id, int no, const char *msg){
+static SrnRet ret_with_message(int no, const char *fmt, va_list ap){
+    SrnRet id;
+    char *msg;
     SrnRetMessage *rmsg;
 
-    rmsg = g_malloc0(sizeof(SrnRetMessage));
+    msg = g_strdup_vprintf(fmt, ap);
+
+    g_mutex_lock(&mutex);
+
+    // Id is always positive, SRN_OK and SRN_ERR are reserved
+    msgid = msgid == G_MAXINT ? 1 : msgid + 1;
+    id = msgid;
+
+    rmsg = &msg_ring[id % SRN_RET_MESSAGE_COUNT];
+    if (rmsg->msg && !rmsg->read){
+        evicted_unread++;
+    }
+    g_free(rmsg->msg);
     rmsg->id = id;
     rmsg->no = no;
-    rmsg->msg = g_strdup(msg);
+    rmsg->msg = msg;
+    rmsg->read = FALSE;
 
     DBG_FR("SrnRet: id: %d, no: %d, msg: %s", id, no, msg);
 
-    return rmsg;
-}
+    g_mutex_unlock(&mutex);
 
-static void srn_ret_message_free(SrnRetMessage *rmsg){
-    g_free(rmsg->msg);
-    g_free(rmsg);
+    return id;
 }
@@ -0,0 +1,390 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file scrollback.c
+ * @brief Read history messages of chat from chat logs
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-10
+ *
+ * Log files of chat (``<YYYY-MM-DD>.<chat_name>.log``) are mapped into
+ * memory one by one from the newest, and lines are read backwards from the
+ * end of file, so only the pages containing requested lines are touched.
+ * Compressed log files and monthly archives are decompressed when they are
+ * reached.
+ *
+ * The newest log file is mapped when scrollback is created, lines appended
+ * after that are belong to current session and never returned.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+
+#include "srain.h"
+#include "log.h"
+#include "utils.h"
+#include "chat_log.h"
+#include "scrollback.h"
+
+#define LOG_TIME_LEN        11  // "[HH:MM:SS] "
+
+typedef struct _LogDay LogDay;
+
+struct _LogDay {
+    char *date;
+    GBytes *bytes;
+};
+
+struct _SrnScrollback {
+    GList *files;       // SrnChatLogFile not yet opened, newest first
+    GList *days;        // LogDay of opened file not yet read, newest first
+
+    GBytes *bytes;      // Log of the day being read
+    char *date;         // Date of log being read
+    gsize pos;          // Lines before this offset are not yet read
+    GString *pending;   // Continuation lines of a multi-line message
+    gint64 last_time;   // Unix time of the newest entry, 0 if no log
+};
+
+static bool open_next_day(SrnScrollback *self);
+static gint64 get_last_time(SrnScrollback *self);
+static void close_day(SrnScrollback *self);
+static bool read_day(const char *date, GBytes *bytes, gpointer user_data);
+static void log_day_free(LogDay *day);
+static SrnScrollbackEntry* parse_line(const char *date, const char *line,
+        gsize len);
+static const char* find_prev_line(const char *data, gsize end);
+
+/**
+ * @brief ``srn_scrollback_new`` creates a scrollback of chat.
+ *
+ * @param log_dir Directory where log files of chat's server are located
+ * @param chat_name
+ *
+ * @return A new SrnScrollback, never be NULL
+ */
+SrnScrollback* srn_scrollback_new(const char *log_dir, const char *chat_name){
+    SrnScrollback *self;
+
+    self = g_malloc0(sizeof(SrnScrollback));
+    self->pending = g_string_new(NULL);
+    self->files = srn_chat_log_list_files(log_dir, chat_name);
+    open_next_day(self);
+    self->last_time = get_last_time(self);
+
+    return self;
+}
+
+void srn_scrollback_free(SrnScrollback *self){
+    close_day(self);
+    g_list_free_full(self->days, (GDestroyNotify)log_day_free);
+    g_list_free_full(self->files, (GDestroyNotify)srn_chat_log_file_free);
+    g_string_free(self->pending, TRUE);
+    g_free(self);
+}
+
+/**
+ * @brief ``srn_scrollback_get_last_time`` returns time of the newest entry,
+ * which is found when scrollback is created.
+ *
+ * @param self
+ *
+ * @return Unix time, 0 if there is no log
+ */
+gint64 srn_scrollback_get_last_time(SrnScrollback *self){
+    return self->last_time;
+}
+
+/**
+ * @brief ``srn_scrollback_read`` reads history entries which are older than
+ * the entries read by last call.
+ *
+ * @param self
+ * @param count Max count of entries to read
+ * @param entries Return location of list of SrnScrollbackEntry, entries are
+ *        in chronological order
+ *
+ * @return Count of read entries, 0 if no more history
+ */
+int srn_scrollback_read(SrnScrollback *self, int count, GList **entries){
+    int n;
+    GList *lst;
+
+    n = 0;
+    lst = NULL;
+    while (n < count){
+        gsize end;
+        const char *data;
+        const char *line;
+        SrnScrollbackEntry *entry;
+
+        if (!self->bytes && !open_next_day(self)){
+            break; // No more log
+        }
+        if (self->pos == 0){
+            close_day(self);
+            continue;
+        }
+
+        /* Find the last unread line */
+        data = g_bytes_get_data(self->bytes, NULL);
+        end = self->pos;
+        if (data[end - 1] == '\n'){
+            end--;
+        }
+        line = find_prev_line(data, end);
+        self->pos = line - data;
+
+        entry = parse_line(self->date, line, data + end - line);
+        if (!entry){
+            // Not the first line of message, read it with previous line
+            g_string_prepend_len(self->pending, line, data + end - line);
+            g_string_prepend_c(self->pending, '\n');
+            continue;
+        }
+        if (self->pending->len){
+            char *content;
+
+            content = g_strconcat(entry->content, self->pending->str, NULL);
+            g_free(entry->content);
+            entry->content = content;
+            g_string_truncate(self->pending, 0);
+        }
+
+        lst = g_list_prepend(lst, entry);
+        n++;
+    }
+
+    *entries = lst;
+
+    return n;
+}
+
+void srn_scrollback_entry_free(SrnScrollbackEntry *entry){
+    g_date_time_unref(entry->time);
+    g_free(entry->sender);
+    g_free(entry->content);
+    g_free(entry);
+}
+
+static bool open_next_day(SrnScrollback *self){
+    LogDay *day;
+
+    while (!self->days && self->files){
+        SrnChatLogFile *file;
+        SrnRet ret;
+
+        file = self->files->data;
+        self->files = g_list_delete_link(self->files, self->files);
+        ret = srn_chat_log_file_read(file, read_day, self);
+        if (!RET_IS_OK(ret)){
+            WARN_FR("Failed to read log file: %s", RET_MSG(ret));
+        }
+        srn_chat_log_file_free(file);
+    }
+    if (!self->days){
+        return FALSE;
+    }
+
+    day = self->days->data;
+    self->days = g_list_delete_link(self->days, self->days);
+    self->bytes = day->bytes;
+    self->date = day->date;
+    self->pos = g_bytes_get_size(day->bytes);
+    g_free(day);
+
+    return TRUE;
+}
+
+/**
+ * @brief Find time of the last entry of the newest day without changing read
+ * position.
+ */
+static gint64 get_last_time(SrnScrollback *self){
+    gsize end;
+    const char *data;
+
+    if (!self->bytes){
+        return 0;
+    }
+
+    data = g_bytes_get_data(self->bytes, NULL);
+    end = self->pos;
+    while (end > 0){
+        gint64 time;
+        const char *line;
+        SrnScrollbackEntry *entry;
+
+        if (data[end - 1] == '\n'){
+            end--;
+        }
+        line = find_prev_line(data, end);
+        entry = parse_line(self->date, line, data + end - line);
+        end = line - data;
+        if (entry){
+            time = g_date_time_to_unix(entry->time);
+            srn_scrollback_entry_free(entry);
+            return time;
+        }
+    }
+
+    return 0;
+}
+
+static void close_day(SrnScrollback *self){
+    if (self->bytes){
+        g_bytes_unref(self->bytes);
+        self->bytes = NULL;
+    }
+    str_assign(&self->date, NULL);
+    self->pos = 0;
+    // Lines without a leading line can not be shown
+    g_string_truncate(self->pending, 0);
+}
+
+/**
+ * @brief Days of a file are read in chronological order, keep them newest
+ * first.
+ */
+static bool read_day(const char *date, GBytes *bytes, gpointer user_data){
+    LogDay *day;
+    SrnScrollback *self;
+
+    self = user_data;
+    day = g_malloc0(sizeof(LogDay));
+    day->date = g_strdup(date);
+    day->bytes = g_bytes_ref(bytes);
+    self->days = g_list_prepend(self->days, day);
+
+    return TRUE;
+}
+
+static void log_day_free(LogDay *day){
+    g_bytes_unref(day->bytes);
+    g_free(day->date);
+    g_free(day);
+}
+
+/**
+ * @brief Parse a line of chat log, which is generated by
+ * ``srn_message_to_string()``.
+ *
+ * @param date Date of log file, in format "YYYY-MM-DD"
+ * @param line
+ * @param len Length of line
+ *
+ * @return A new SrnScrollbackEntry or NULL if the line is not the first line
+ *         of a message
+ */
+static SrnScrollbackEntry* parse_line(const char *date, const char *line,
+        gsize len){
+    int year;
+    int month;
+    int day;
+    int hour;
+    int min;
+    int sec;
+    const char *ptr;
+    const char *end;
+    const char *sep;
+    SrnScrollbackEntry *entry;
+
+    if (len < LOG_TIME_LEN + 2
+            || line[0] != '[' || line[9] != ']' || line[10] != ' '){
+        return NULL;
+    }
+    if (sscanf(date, "%4d-%2d-%2d", &year, &month, &day) != 3
+            || sscanf(line, "[%2d:%2d:%2d]", &hour, &min, &sec) != 3){
+        return NULL;
+    }
+
+    entry = g_malloc0(sizeof(SrnScrollbackEntry));
+    ptr = line + LOG_TIME_LEN;
+    end = line + len;
+    switch (*ptr){
+        case '<': // "<nick> content" or "<nick*> content"
+            sep = g_strstr_len(ptr, end - ptr, "> ");
+            if (!sep){
+                goto ERR;
+            }
+            if (sep[-1] == '*'){
+                entry->type = SRN_SCROLLBACK_ENTRY_SENT;
+                entry->sender = g_strndup(ptr + 1, sep - ptr - 2);
+            } else {
+                entry->type = SRN_SCROLLBACK_ENTRY_RECV;
+                entry->sender = g_strndup(ptr + 1, sep - ptr - 1);
+            }
+            ptr = sep + 2;
+            break;
+        case '*': // "* nick content"
+            if (ptr[1] != ' '){
+                goto ERR;
+            }
+            ptr += 2;
+            sep = memchr(ptr, ' ', end - ptr);
+            if (!sep){
+                goto ERR;
+            }
+            entry->type = SRN_SCROLLBACK_ENTRY_ACTION;
+            entry->sender = g_strndup(ptr, sep - ptr);
+            ptr = sep + 1;
+            break;
+        case '=': // "= content"
+            entry->type = SRN_SCROLLBACK_ENTRY_MISC;
+            ptr += 2;
+            break;
+        case '!': // "! content"
+            entry->type = SRN_SCROLLBACK_ENTRY_ERROR;
+            ptr += 2;
+            break;
+        default:
+            goto ERR;
+    }
+    if (ptr > end){
+        goto ERR;
+    }
+
+    entry->time = g_date_time_new_local(year, month, day, hour, min, sec);
+    if (!entry->time){
+        goto ERR;
+    }
+    entry->content = g_strndup(ptr, end - ptr);
+
+    return entry;
+
+ERR:
+    g_free(entry->sender);
+    g_free(entry);
+    return NULL;
+}
+
+/**
+ * @brief Find the start of line which ends at ``data + end``.
+ */
+static const char* find_prev_line(const char *data, gsize end){
+    const char *ptr;
+
+    ptr = data + end;
+    while (ptr > data && ptr[-1] != '\n'){
+        ptr--;
+    }
+
+    return ptr;
+}
@@ -0,0 +1,389 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file timer_wheel.c
+ * @brief Coalescing timers shared by the whole application
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-23
+ *
+ * Timers are kept in a hierarchical timing wheel of WHEEL_LEVELS levels,
+ * each level has WHEEL_SLOTS slots. A slot of level 0 spans one tick
+ * (SRN_TIMER_WHEEL_TICK), a slot of level N spans all slots of level N-1.
+ * Timers of higher levels are cascaded to lower levels when the wheel turns.
+ *
+ * The wheel is driven by a single GSource of the default main context. It
+ * wakes at the earliest expiry rounded up to a multiple of slack, so timers
+ * expiring close to each other are fired in one wakeup, and timers of
+ * different servers are aligned. A timer may be delayed by at most the slack.
+ *
+ * The earliest expiry is found by scanning the slots rather than the timers
+ * after each turn, adding a timer only brings the wakeup forward, and
+ * removing one leaves it as is, a spurious wakeup is harmless.
+ *
+ * All functions must be called from the main thread.
+ */
+
+#include <glib.h>
+
+#include "srain.h"
+#include "log.h"
+#include "timer_wheel.h"
+
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS    4
+
+typedef struct _Timer Timer;
+typedef struct _TimerWheel TimerWheel;
+
+struct _Timer {
+    guint id;
+    gint64 expire;      // In ticks
+    guint interval;     // In ms
+    GSourceFunc func;
+    gpointer user_data;
+
+    bool running;       // Callback is being invoked
+    bool removed;       // Removed during callback
+    Timer **list;       // List containing the timer
+    Timer *prev;
+    Timer *next;
+};
+
+struct _TimerWheel {
+    gint64 tick;        // Ticks before this are processed
+    gint64 slack;       // In ticks
+    gint64 next;        // Tick to wake at before rounding, G_MAXINT64 for never
+    guint last_id;
+    Timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    GHashTable *timers; // ID -> Timer
+    GSource *source;
+};
+
+static TimerWheel *wheel = NULL;
+
+static TimerWheel* get_wheel(void);
+static gboolean wheel_dispatch(GSource *source, GSourceFunc callback,
+        gpointer user_data);
+static void wheel_advance(TimerWheel *self, gint64 now);
+static void wheel_cascade(TimerWheel *self, int level);
+static void wheel_insert(TimerWheel *self, Timer *timer);
+static void wheel_reschedule(TimerWheel *self);
+static void wheel_set_ready(TimerWheel *self, gint64 next);
+static void timer_link(Timer *timer, Timer **list);
+static void timer_unlink(Timer *timer);
+static gint64 get_tick(void);
+static gint64 get_expire(guint interval);
+
+static GSourceFuncs wheel_source_funcs = {
+    NULL,
+    NULL,
+    wheel_dispatch,
+    NULL,
+};
+
+/**
+ * @brief ``srn_timer_wheel_add`` is similar to ``g_timeout_add()``, but the
+ * timer may be delayed by coalescing slack.
+ *
+ * @param interval Time between calls to the function, in milliseconds
+ * @param func The function is called repeatedly until it returns
+ *        G_SOURCE_REMOVE
+ * @param user_data
+ *
+ * @return ID of timer, which is greater than 0
+ */
+guint srn_timer_wheel_add(guint interval, GSourceFunc func, gpointer user_data){
+    Timer *timer;
+    TimerWheel *self;
+
+    self = get_wheel();
+    if (g_hash_table_size(self->timers) == 0){
+        self->tick = get_tick(); // Catch up, no timer to fire
+    }
+
+    timer = g_malloc0(sizeof(Timer));
+    do {
+        timer->id = ++self->last_id;
+    } while (timer->id == 0 || g_hash_table_contains(self->timers,
+                GUINT_TO_POINTER(timer->id)));
+    timer->interval = interval;
+    timer->func = func;
+    timer->user_data = user_data;
+    timer->expire = get_expire(interval);
+
+    g_hash_table_insert(self->timers, GUINT_TO_POINTER(timer->id), timer);
+    wheel_insert(self, timer);
+    if (timer->expire < self->next){
+        wheel_set_ready(self, timer->expire);
+    }
+
+    return timer->id;
+}
+
+/**
+ * @brief ``srn_timer_wheel_remove`` removes a timer, it is safe to be called
+ * in callback of any timer.
+ *
+ * @param id
+ */
+void srn_timer_wheel_remove(guint id){
+    Timer *timer;
+    TimerWheel *self;
+
+    self = get_wheel();
+    timer = g_hash_table_lookup(self->timers, GUINT_TO_POINTER(id));
+    g_return_if_fail(timer);
+
+    g_hash_table_remove(self->timers, GUINT_TO_POINTER(id));
+    if (timer->running){
+        timer->removed = TRUE; // Freed after callback returns
+        return;
+    }
+    timer_unlink(timer);
+    g_free(timer);
+    if (g_hash_table_size(self->timers) == 0){
+        wheel_set_ready(self, G_MAXINT64);
+    }
+}
+
+/**
+ * @brief ``srn_timer_wheel_set_slack`` sets how long timers may be delayed
+ * for being fired together.
+ *
+ * @param slack In milliseconds, 0 for no coalescing
+ */
+void srn_timer_wheel_set_slack(guint slack){
+    TimerWheel *self;
+
+    self = get_wheel();
+    self->slack = MAX(slack / SRN_TIMER_WHEEL_TICK, 1);
+    wheel_set_ready(self, self->next);
+}
+
+static TimerWheel* get_wheel(void){
+    if (!wheel){
+        wheel = g_malloc0(sizeof(TimerWheel));
+        wheel->tick = get_tick();
+        wheel->slack = SRN_TIMER_WHEEL_SLACK / SRN_TIMER_WHEEL_TICK;
+        wheel->next = G_MAXINT64;
+        wheel->timers = g_hash_table_new(g_direct_hash, g_direct_equal);
+        wheel->source = g_source_new(&wheel_source_funcs, sizeof(GSource));
+        g_source_set_name(wheel->source, "timer-wheel");
+        g_source_attach(wheel->source, NULL);
+    }
+    return wheel;
+}
+
+static gboolean wheel_dispatch(GSource *source, GSourceFunc callback,
+        gpointer user_data){
+    wheel_advance(wheel, get_tick());
+    wheel_reschedule(wheel);
+
+    return G_SOURCE_CONTINUE;
+}
+
+/**
+ * @brief Turn the wheel to tick ``now``, fire all expired timers.
+ */
+static void wheel_advance(TimerWheel *self, gint64 now){
+    while (self->tick <= now){
+        int idx;
+        Timer *expired;
+
+        idx = self->tick & WHEEL_MASK;
+        if (idx == 0){
+            wheel_cascade(self, 1);
+        }
+
+        /* Take the whole slot, callbacks may add or remove timers */
+        expired = NULL;
+        while (self->slots[0][idx]){
+            Timer *timer;
+
+            timer = self->slots[0][idx];
+            timer_unlink(timer);
+            timer_link(timer, &expired);
+        }
+        self->tick++;
+
+        while (expired){
+            gboolean again;
+            Timer *timer;
+
+            timer = expired;
+            timer_unlink(timer);
+            timer->running = TRUE;
+            again = timer->func(timer->user_data);
+            timer->running = FALSE;
+
+            if (timer->removed){
+                g_free(timer);
+            } else if (again == G_SOURCE_CONTINUE){
+                timer->expire = get_expire(timer->interval);
+                wheel_insert(self, timer);
+            } else {
+                g_hash_table_remove(self->timers, GUINT_TO_POINTER(timer->id));
+                g_free(timer);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Move timers of current slot of given level to lower levels, the
+ * current slot of next level is cascaded first when this level wraps.
+ */
+static void wheel_cascade(TimerWheel *self, int level){
+    int idx;
+
+    if (level >= WHEEL_LEVELS){
+        return;
+    }
+    idx = (self->tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    if (idx == 0){
+        wheel_cascade(self, level + 1);
+    }
+
+    while (self->slots[level][idx]){
+        Timer *timer;
+
+        timer = self->slots[level][idx];
+        timer_unlink(timer);
+        wheel_insert(self, timer);
+    }
+}
+
+static void wheel_insert(TimerWheel *self, Timer *timer){
+    int level;
+    gint64 delta;
+    gint64 expire;
+
+    expire = MAX(timer->expire, self->tick);
+    delta = expire - self->tick;
+    for (level = 0; level < WHEEL_LEVELS - 1; level++){
+        if (delta < ((gint64)1 << (WHEEL_BITS * (level + 1)))){
+            break;
+        }
+    }
+    if (level == WHEEL_LEVELS - 1
+            && delta >= ((gint64)1 << (WHEEL_BITS * WHEEL_LEVELS))){
+        // Too far, it is re-inserted when the slot is cascaded
+        expire = self->tick + ((gint64)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
+    }
+
+    timer_link(timer, &self->slots[level][
+            (expire >> (WHEEL_BITS * level)) & WHEEL_MASK]);
+}
+
+/**
+ * @brief Set ready time of wheel source to the start of the earliest
+ * non-empty slot, where timers of level 0 expire and timers of higher levels
+ * are cascaded.
+ */
+static void wheel_reschedule(TimerWheel *self){
+    gint64 next;
+
+    next = G_MAXINT64;
+    for (int level = 0; level < WHEEL_LEVELS; level++){
+        int shift;
+        gint64 base;
+
+        shift = WHEEL_BITS * level;
+        base = self->tick >> shift;
+        for (int i = 0; i < WHEEL_SLOTS; i++){
+            gint64 start;
+
+            if (!self->slots[level][(base + i) & WHEEL_MASK]){
+                continue;
+            }
+            start = (base + i) << shift;
+            if (start < self->tick){
+                // Slot is already cascaded, timers in it are of next round
+                start += (gint64)WHEEL_SLOTS << shift;
+            }
+            next = MIN(next, start);
+        }
+    }
+
+    wheel_set_ready(self, next);
+}
+
+/**
+ * @brief Set ready time of wheel source to tick ``next`` rounded up to
+ * multiple of slack.
+ */
+static void wheel_set_ready(TimerWheel *self, gint64 next){
+    self->next = next;
+    if (next == G_MAXINT64){
+        g_source_set_ready_time(self->source, -1);
+        return;
+    }
+
+    next = MAX(next, self->tick);
+    next = (next + self->slack - 1) / self->slack * self->slack;
+    g_source_set_ready_time(self->source,
+            next * SRN_TIMER_WHEEL_TICK * G_TIME_SPAN_MILLISECOND);
+}
+
+static void timer_link(Timer *timer, Timer **list){
+    timer->list = list;
+    timer->prev = NULL;
+    timer->next = *list;
+    if (*list){
+        (*list)->prev = timer;
+    }
+    *list = timer;
+}
+
+static void timer_unlink(Timer *timer){
+    if (!timer->list){
+        return;
+    }
+    if (timer->prev){
+        timer->prev->next = timer->next;
+    } else {
+        *timer->list = timer->next;
+    }
+    if (timer->next){
+        timer->next->prev = timer->prev;
+    }
+    timer->list = NULL;
+    timer->prev = NULL;
+    timer->next = NULL;
+}
+
+static gint64 get_tick(void){
+    return g_get_monotonic_time()
+        / (SRN_TIMER_WHEEL_TICK * G_TIME_SPAN_MILLISECOND);
+}
+
+/**
+ * @brief Get the first tick after ``interval`` milliseconds from now.
+ */
+static gint64 get_expire(guint interval){
+    gint64 tick;
+
+    tick = SRN_TIMER_WHEEL_TICK * G_TIME_SPAN_MILLISECOND;
+
+    return (g_get_monotonic_time() + interval * G_TIME_SPAN_MILLISECOND
+            + tick - 1) / tick;
+}
@@ -0,0 +1,174 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file mirc.c
+ * @brief Table driven scanner shared by mIRC renderers.
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-03
+ *
+ * Text between control characters is copied to output in bulk, only bytes
+ * classified as MIRC_CHAR_ESCAPE need special handling, so no temporary
+ * string is allocated while rendering.
+ */
+
+#include <glib.h>
+
+#include "./mirc.h"
+
+/* NOTE: All bytes >= 0x80 are MIRC_CHAR_TEXT, so as all printable ASCII
+ * characters except the markup special ones. Bytes >= 0x80 which are not
+ * parts of a valid UTF-8 sequence are escaped, see ``mirc_scan_text()`` */
+const unsigned char mirc_char_class[256] = {
+    [0x01] = MIRC_CHAR_ESCAPE,
+    [MIRC_BOLD] = MIRC_CHAR_FORMAT,
+    [MIRC_COLOR] = MIRC_CHAR_COLOR,
+    [0x04] = MIRC_CHAR_ESCAPE,
+    [0x05] = MIRC_CHAR_ESCAPE,
+    [MIRC_BLINK] = MIRC_CHAR_FORMAT,
+    [0x07] = MIRC_CHAR_ESCAPE,
+    [0x08] = MIRC_CHAR_ESCAPE,
+    [0x0B] = MIRC_CHAR_ESCAPE,
+    [0x0C] = MIRC_CHAR_ESCAPE,
+    [0x0E] = MIRC_CHAR_ESCAPE,
+    [MIRC_PLAIN] = MIRC_CHAR_FORMAT,
+    [0x10] = MIRC_CHAR_ESCAPE,
+    [0x11] = MIRC_CHAR_ESCAPE,
+    [0x12] = MIRC_CHAR_ESCAPE,
+    [0x13] = MIRC_CHAR_ESCAPE,
+    [0x14] = MIRC_CHAR_ESCAPE,
+    [0x15] = MIRC_CHAR_ESCAPE,
+    [MIRC_REVERSE] = MIRC_CHAR_FORMAT,
+    [0x17] = MIRC_CHAR_ESCAPE,
+    [0x18] = MIRC_CHAR_ESCAPE,
+    [0x19] = MIRC_CHAR_ESCAPE,
+    [0x1A] = MIRC_CHAR_ESCAPE,
+    [0x1B] = MIRC_CHAR_ESCAPE,
+    [0x1C] = MIRC_CHAR_ESCAPE,
+    [MIRC_ITALICS] = MIRC_CHAR_FORMAT,
+    [0x1E] = MIRC_CHAR_ESCAPE,
+    [MIRC_UNDERLINE] = MIRC_CHAR_FORMAT,
+    ['&'] = MIRC_CHAR_ESCAPE,
+    ['<'] = MIRC_CHAR_ESCAPE,
+    ['>'] = MIRC_CHAR_ESCAPE,
+    ['\''] = MIRC_CHAR_ESCAPE,
+    ['"'] = MIRC_CHAR_ESCAPE,
+    [0x7F] = MIRC_CHAR_ESCAPE,
+};
+
+/**
+ * @brief ``mirc_scan_text`` returns the length of the leading run of
+ * MIRC_CHAR_TEXT bytes. The run stops at the first byte of an invalid UTF-8
+ * sequence, which should be escaped by ``mirc_append_escaped()``, valid
+ * UTF-8 sequences (including C1 control characters) are kept as is.
+ *
+ * @param text
+ * @param len
+ *
+ * @return
+ */
+gsize mirc_scan_text(const char *text, gsize len){
+    gsize i;
+
+    i = 0;
+    while (i < len){
+        unsigned char ch;
+
+        ch = text[i];
+        if (ch < 0x80){
+            if (mirc_char_class[ch] != MIRC_CHAR_TEXT){
+                break;
+            }
+            i++;
+            continue;
+        }
+
+        // Returns (gunichar)-1 or (gunichar)-2 for invalid or partial sequence
+        if (g_utf8_get_char_validated(text + i, len - i) >= (gunichar)-2){
+            break;
+        }
+        i += g_utf8_skip[ch];
+    }
+
+    return i;
+}
+
+/**
+ * @brief ``mirc_append_escaped`` appends a MIRC_CHAR_ESCAPE character to
+ * markup, in the same way as ``g_markup_escape_text()``.
+ *
+ * @param str
+ * @param ch
+ */
+void mirc_append_escaped(GString *str, char ch){
+    switch (ch){
+        case '&':
+            g_string_append(str, "&amp;");
+            break;
+        case '<':
+            g_string_append(str, "&lt;");
+            break;
+        case '>':
+            g_string_append(str, "&gt;");
+            break;
+        case '\'':
+            g_string_append(str, "&apos;");
+            break;
+        case '"':
+            g_string_append(str, "&quot;");
+            break;
+        default:
+            g_string_append_printf(str, "&#x%x;", (unsigned char)ch);
+            break;
+    }
+}
+
+/**
+ * @brief ``mirc_parse_color`` parses the color code following a MIRC_COLOR,
+ * format: "[fg_color][,bg_color]", 0 <= length of fg_color or bg_color <= 2.
+ *
+ * @param text Text after MIRC_COLOR
+ * @param len
+ * @param fg_color Set to parsed foreground color, untouched if not present
+ * @param bg_color Set to parsed background color, untouched if not present
+ *
+ * @return Number of bytes consumed
+ */
+gsize mirc_parse_color(const char *text, gsize len,
+        unsigned *fg_color, unsigned *bg_color){
+    gsize i;
+
+    i = 0;
+    if (i < len && g_ascii_isdigit(text[i])){
+        *fg_color = text[i++] - '0';
+        if (i < len && g_ascii_isdigit(text[i])){
+            *fg_color = *fg_color * 10 + text[i++] - '0';
+        }
+    }
+    // Comma belongs to color code only if a background color follows
+    if (i + 1 < len && text[i] == ',' && g_ascii_isdigit(text[i + 1])){
+        i++;
+        *bg_color = text[i++] - '0';
+        if (i < len && g_ascii_isdigit(text[i])){
+            *bg_color = *bg_color * 10 + text[i++] - '0';
+        }
+    }
+
+    return i;
+}
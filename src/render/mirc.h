@@ -19,6 +19,8 @@
 #ifndef __MIRC_H
 #define __MIRC_H
 
+#include <glib.h>
+
 /* mIRC color control characters */
 #define MIRC_BOLD       0x02
 #define MIRC_ITALICS    0x1D
@@ -49,4 +51,19 @@ enum {
     MIRC_COLOR_UNKNOWN      = 16, // Not a part of protocol, just for convenience
 };
 
+/* Class of a byte in message text, see mirc_char_class */
+enum {
+    MIRC_CHAR_TEXT      = 0, // Can be copied as is
+    MIRC_CHAR_ESCAPE    = 1, // Should be escaped in markup
+    MIRC_CHAR_FORMAT    = 2, // Format control character except MIRC_COLOR
+    MIRC_CHAR_COLOR     = 3, // MIRC_COLOR
+};
+
+extern const unsigned char mirc_char_class[256];
+
+gsize mirc_scan_text(const char *text, gsize len);
+void mirc_append_escaped(GString *str, char ch);
+gsize mirc_parse_color(const char *text, gsize len,
+        unsigned *fg_color, unsigned *bg_color);
+
 #endif /* __MIRC_H */
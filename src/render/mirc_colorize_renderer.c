@@ -39,9 +39,8 @@ typedef struct _ColorlizeContext {
     GString *str;
 } ColorlizeContext;
 
-static void init(void);
-static void finalize(void);
 static SrnRet render(SrnMessage *msg);
+static void setup_parser(GMarkupParser *parser);
 static void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error);
 static void do_colorize(ColorlizeContext *ctx, char ch);
@@ -54,11 +53,12 @@ static void do_colorize(ColorlizeContext *ctx, char ch);
  */
 SrnMessageRenderer mirc_colorize_renderer = {
     .name = "mirc_colorize",
-    .init = init,
-    .finalize = finalize,
     .render = render,
 };
 
+/* Markup renderer is reused by messages rendered in the same thread */
+static GPrivate markup_renderer_key = MARKUP_RENDERER_PRIVATE_INIT;
+
 // TODO: define in theme CSS?
 static const char *color_map[] = {
     [MIRC_COLOR_WHITE]          = "#FFFFFF",
@@ -80,24 +80,14 @@ static const char *color_map[] = {
     [MIRC_COLOR_UNKNOWN]        = "", // Preventing out of bound
 };
 
-static SrnMarkupRenderer *markup_renderer;
-
-void init(void) {
-    GMarkupParser *parser;
-
-    markup_renderer = srn_markup_renderer_new();
-    parser = srn_markup_renderer_get_markup_parser(markup_renderer);
-    parser->text = text;
-}
-
-void finalize(void) {
-    srn_markup_renderer_free(markup_renderer);
-}
-
 SrnRet render(SrnMessage *msg) {
     char *rendered_content;
+    SrnMarkupRenderer *markup_renderer;
     SrnRet ret;
 
+    markup_renderer = srn_renderer_get_markup_renderer(&markup_renderer_key,
+            setup_parser);
+
     rendered_content = NULL;
     ret = srn_markup_renderer_render(markup_renderer,
             msg->rendered_content, &rendered_content, msg);
@@ -112,83 +102,65 @@ SrnRet render(SrnMessage *msg) {
     return SRN_OK;
 }
 
+static void setup_parser(GMarkupParser *parser){
+    parser->text = text;
+}
+
 void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error) {
-    ColorlizeContext *ctx;
+    gsize i;
+    ColorlizeContext ctx = {
+        .ptr = 0,
+        .fg_color = MIRC_COLOR_UNKNOWN,
+        .bg_color = MIRC_COLOR_UNKNOWN,
+        .str = srn_markup_renderer_get_markup(user_data),
+    };
 
-    ctx = g_malloc0(sizeof(ColorlizeContext));
-    ctx->fg_color = MIRC_COLOR_UNKNOWN;
-    ctx->bg_color = MIRC_COLOR_UNKNOWN;
-    ctx->str = srn_markup_renderer_get_markup(user_data);
+    i = 0;
+    while (i < text_len){
+        gsize len;
 
-    for (int i = 0; i < text_len; i++){
-        switch (text[i]){
-            case MIRC_COLOR:
+        // Copy plain text in bulk
+        len = mirc_scan_text(text + i, text_len - i);
+        if (len) {
+            g_string_append_len(ctx.str, text + i, len);
+            i += len;
+            continue;
+        }
+
+        switch (mirc_char_class[(unsigned char)text[i]]){
+            case MIRC_CHAR_COLOR:
                 {
-                    /* Format: "\30[fg_color],[bg_color]",
-                     * 0 <= length of fg_color or bg_color <= 2*/
-                    const char *startptr = &text[i] + 1;
-                    char *endptr = NULL;
-                    bool has_fg_color = FALSE;
-                    bool has_bg_color = FALSE;
-                    unsigned fg_color = strtoul(startptr, &endptr, 10);
-                    if (endptr > startptr){ // Get foreground color
-                        has_fg_color = TRUE;
-                        while (endptr - startptr > 2){ // Wrong number of digits
-                            fg_color = fg_color / 10;
-                            endptr--;
-                        }
-                        DBG_FR("Get foreground color: %u", fg_color);
-                        ctx->fg_color = fg_color;
-                    }
-                    i += endptr - startptr;
-                    if (*endptr == ',') { // background color exists
-                        endptr++;
-                        startptr = endptr;
-                        endptr = NULL;
-                        unsigned bg_color = strtoul(startptr, &endptr, 10);
-                        if (endptr > startptr){ // Get background color
-                            has_bg_color = TRUE;
-                            while (endptr - startptr > 2){ // Wrong number of digits
-                                bg_color = bg_color / 10;
-                                endptr--;
-                            }
-                            DBG_FR("Get background color: %u", bg_color);
-                            ctx->bg_color = bg_color;
-                        }
-                        i += endptr - startptr;
-                    }
-                    if (!has_fg_color && !has_bg_color) { // Clear previous color
-                        ctx->fg_color = MIRC_COLOR_UNKNOWN;
-                        ctx->bg_color = MIRC_COLOR_UNKNOWN;
+                    unsigned fg_color = ctx.fg_color;
+                    unsigned bg_color = ctx.bg_color;
+
+                    i++;
+                    len = mirc_parse_color(text + i, text_len - i,
+                            &fg_color, &bg_color);
+                    if (len) {
+                        DBG_FR("Get color: %u,%u", fg_color, bg_color);
+                        ctx.fg_color = fg_color;
+                        ctx.bg_color = bg_color;
+                        i += len;
+                    } else { // Clear previous color
+                        ctx.fg_color = MIRC_COLOR_UNKNOWN;
+                        ctx.bg_color = MIRC_COLOR_UNKNOWN;
                     }
-                    do_colorize(ctx, MIRC_COLOR);
+                    do_colorize(&ctx, MIRC_COLOR);
                     break;
                 }
-            case MIRC_BOLD:
-            case MIRC_ITALICS:
-            case MIRC_UNDERLINE:
-            case MIRC_BLINK:
-            case MIRC_REVERSE:
-            case MIRC_PLAIN:
-                do_colorize(ctx, text[i]);
+            case MIRC_CHAR_FORMAT:
+                do_colorize(&ctx, text[i++]);
                 break;
+            case MIRC_CHAR_ESCAPE:
             default:
-                {
-                    // No control character, it is a utf-8 sequence
-                    const char *next = g_utf8_next_char(&text[i]);
-                    char *escape = g_markup_escape_text(&text[i], next - &text[i]);
-                    g_string_append(ctx->str, escape);
-                    g_free(escape);
-                    i += next - &text[i] - 1;
-                    break;
-                }
+                mirc_append_escaped(ctx.str, text[i++]);
+                break;
         }
     }
 
     // Close all unclosed tags
-    do_colorize(ctx, MIRC_PLAIN);
-    g_free(ctx);
+    do_colorize(&ctx, MIRC_PLAIN);
 }
 
 static void do_colorize(ColorlizeContext *ctx, char ch){
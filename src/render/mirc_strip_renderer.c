@@ -25,14 +25,16 @@
 #include "i18n.h"
 #include "markup_renderer.h"
 
+#include "render/render.h"
 #include "./renderer.h"
 #include "./mirc.h"
 
-static void init(void);
-static void finalize(void);
 static SrnRet render(SrnMessage *msg);
+static void setup_parser(GMarkupParser *parser);
 static void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error);
+static void strip_mirc(GString *str, const char *text, gsize text_len,
+        bool escape);
 
 /**
  * @brief mirc_strip_renderer is a render moduele for strip mIRC color from
@@ -42,29 +44,20 @@ static void text(GMarkupParseContext *context, const gchar *text,
  */
 SrnMessageRenderer mirc_strip_renderer = {
     .name = "mirc_strip",
-    .init = init,
-    .finalize = finalize,
     .render = render,
 };
 
-static SrnMarkupRenderer *markup_renderer;
-
-void init(void) {
-    GMarkupParser *parser;
-
-    markup_renderer = srn_markup_renderer_new();
-    parser = srn_markup_renderer_get_markup_parser(markup_renderer);
-    parser->text = text;
-}
-
-void finalize(void) {
-    srn_markup_renderer_free(markup_renderer);
-}
+/* Markup renderer is reused by messages rendered in the same thread */
+static GPrivate markup_renderer_key = MARKUP_RENDERER_PRIVATE_INIT;
 
 SrnRet render(SrnMessage *msg) {
     char *rendered_content;
+    SrnMarkupRenderer *markup_renderer;
     SrnRet ret;
 
+    markup_renderer = srn_renderer_get_markup_renderer(&markup_renderer_key,
+            setup_parser);
+
     rendered_content = NULL;
     ret = srn_markup_renderer_render(markup_renderer,
             msg->rendered_content, &rendered_content, msg);
@@ -79,56 +72,74 @@ SrnRet render(SrnMessage *msg) {
     return SRN_OK;
 }
 
+static void setup_parser(GMarkupParser *parser){
+    parser->text = text;
+}
+
 static void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error){
+    strip_mirc(srn_markup_renderer_get_markup(user_data), text, text_len, TRUE);
+}
+
+char* srn_render_strip_mirc(const char *text){
+    gsize text_len;
     GString *str;
 
-    str = srn_markup_renderer_get_markup(user_data);
+    text_len = strlen(text);
+    str = g_string_sized_new(text_len);
+    // Not markup, no need to escape
+    strip_mirc(str, text, text_len, FALSE);
 
-    for (int i = 0; i < text_len; i++){
-        switch (text[i]){
-            case MIRC_COLOR:
+    return g_string_free(str, FALSE);
+}
+
+/**
+ * @brief strip_mirc appends text to str with mIRC formatting characters
+ * removed.
+ *
+ * @param str
+ * @param text is a plain text, not nul-terminated.
+ * @param text_len
+ * @param escape whether characters should be escaped as markup.
+ */
+static void strip_mirc(GString *str, const char *text, gsize text_len,
+        bool escape){
+    gsize i;
+
+    i = 0;
+    while (i < text_len){
+        gsize len;
+
+        // Copy plain text in bulk
+        len = mirc_scan_text(text + i, text_len - i);
+        if (len) {
+            g_string_append_len(str, text + i, len);
+            i += len;
+            continue;
+        }
+
+        switch (mirc_char_class[(unsigned char)text[i]]){
+            case MIRC_CHAR_COLOR:
                 {
-                    const char *startptr = &text[i] + 1;
-                    char *endptr = NULL;
-                    strtoul(startptr, &endptr, 10);
-                    if (endptr > startptr){ // Get foreground color
-                        while (endptr - startptr > 2){ // Wrong number of digits
-                            endptr--;
-                        }
-                    }
-                    i += endptr - startptr;
-                    if (*endptr == ',') { // background color exists
-                        endptr++;
-                        startptr = endptr;
-                        endptr = NULL;
-                        strtoul(startptr, &endptr, 10);
-                        if (endptr > startptr){ // Get background color
-                            while (endptr - startptr > 2){ // Wrong number of digits
-                                endptr--;
-                            }
-                        }
-                        i += endptr - startptr;
-                    }
+                    unsigned fg_color;
+                    unsigned bg_color;
+
+                    i++;
+                    i += mirc_parse_color(text + i, text_len - i,
+                            &fg_color, &bg_color);
                     break;
                 }
-            case MIRC_BOLD:
-            case MIRC_ITALICS:
-            case MIRC_UNDERLINE:
-            case MIRC_BLINK:
-            case MIRC_REVERSE:
-            case MIRC_PLAIN:
+            case MIRC_CHAR_FORMAT:
+                i++;
                 break;
+            case MIRC_CHAR_ESCAPE:
             default:
-                {
-                    // No control character, it is a utf-8 sequence
-                    const char *next = g_utf8_next_char(&text[i]);
-                    char *escape = g_markup_escape_text(&text[i], next - &text[i]);
-                    str = g_string_append(str, escape);
-                    g_free(escape);
-                    i += next - &text[i] - 1;
-                    break;
+                if (escape) {
+                    mirc_append_escaped(str, text[i++]);
+                } else {
+                    g_string_append_c(str, text[i++]);
                 }
+                break;
         }
     }
 }
@@ -19,21 +19,25 @@
 #include "core/core.h"
 #include "markup_renderer.h"
 #include "pattern_set.h"
+#include "i18n.h"
+#include "utils.h"
 
+#include "render/render.h"
 #include "./renderer.h"
 
 #define PATTERNS_KEY "pattern_render_module_patterns"
+#define CACHE_KEY "pattern_render_module_cache"
 
-static void init(void);
-static void finalize(void);
 static SrnRet render(SrnMessage *msg);
 static GList** alloc_patterns();
 static void free_patterns(GList **patterns);
 static GList* get_patterns(SrnMessage *msg);
+static SrnPatternCache* get_cache(SrnMessage *msg);
+static void setup_parser(GMarkupParser *parser);
 static void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error);
 
-static SrnMarkupRenderer *markup_renderer;
+static unsigned patterns_serial; // Increased when any pattern is attached or detached
 
 /**
  * @brief pattern_renderer is a render module for extracting text from message
@@ -43,89 +47,81 @@ static SrnMarkupRenderer *markup_renderer;
  */
 SrnMessageRenderer pattern_renderer = {
     .name = "pattern",
-    .init = init,
-    .finalize = finalize,
     .render = render,
 };
 
-void init(void) {
-    GMarkupParser *parser;
-
-    markup_renderer = srn_markup_renderer_new();
-    parser = srn_markup_renderer_get_markup_parser(markup_renderer);
-    parser->start_element = NULL;
-    parser->end_element = NULL;
-    parser->text = text;
-}
-
-void finalize(void) {
-    srn_markup_renderer_free(markup_renderer);
-}
+/* Markup renderer is reused by messages rendered in the same thread */
+static GPrivate markup_renderer_key = MARKUP_RENDERER_PRIVATE_INIT;
 
 static SrnRet render(SrnMessage *msg) {
     char *raw_content;
-    GList *patterns;
     GList *lst;
+    SrnMarkupRenderer *markup_renderer;
+    SrnPatternCache *cache;
     SrnRet ret;
-    SrnPatternSet *pattern_set;
 
-    pattern_set = srn_application_get_default()->pattern_set;
-    g_return_val_if_fail(pattern_set, SRN_ERR);
+    cache = get_cache(msg);
+    if (!cache) {
+        return SRN_OK;
+    }
 
-    patterns = get_patterns(msg);
+    markup_renderer = srn_renderer_get_markup_renderer(&markup_renderer_key,
+            setup_parser);
 
     raw_content = NULL;
     ret = srn_markup_renderer_render(markup_renderer,
             msg->rendered_content, &raw_content, NULL);
     if (!RET_IS_OK(ret)){
-        // ret = RET_ERR(_("Failed to render markup text: %1$s"), RET_MSG(ret));
-        // return TRUE;
+        g_free(raw_content);
+        return RET_ERR(_("Failed to render markup text: %1$s"), RET_MSG(ret));
     }
-    lst = patterns;
+
+    // Most messages match no pattern, reject them in one pass
+    if (!srn_pattern_cache_match(cache, raw_content)) {
+        g_free(raw_content);
+        return SRN_OK;
+    }
+
+    /* Every matched pattern is applied in order, so the later one wins */
+    lst = srn_pattern_cache_get_regexes(cache);
     while (lst) {
-        const char *pattern;
-        const GRegex *regex;
-
-        pattern = lst->data;
-        regex = srn_pattern_set_get(pattern_set, pattern);
-        if (regex) {
-            GMatchInfo *match_info;
-
-            match_info = NULL;
-            g_regex_match(regex, raw_content, 0, &match_info);
-            if (g_match_info_matches(match_info)) {
-                char *sender;
-                char *content;
-                char *time;
-
-                sender = g_match_info_fetch_named(match_info, "sender");
-                content = g_match_info_fetch_named(match_info, "content");
-                time = g_match_info_fetch_named(match_info, "time");
-
-                if (sender) {
-                    g_free(msg->rendered_remark);
-                    msg->rendered_remark = msg->rendered_sender;
-                    msg->rendered_sender = g_markup_escape_text(sender, -1);
-                }
-                if (content) {
-                    g_free(msg->rendered_content);
-                    msg->rendered_content = g_markup_escape_text(content, -1);
-                }
-                if (time) {
-                    g_free(msg->rendered_short_time);
-                    msg->rendered_short_time = g_markup_escape_text(time, -1);
-                }
-
-                g_free(sender);
-                g_free(content);
-                g_free(time);
-                g_match_info_free(match_info);
+        GMatchInfo *match_info;
+
+        match_info = NULL;
+        if (g_regex_match(lst->data, raw_content, 0, &match_info)) {
+            char *sender;
+            char *content;
+            char *time;
+
+            sender = g_match_info_fetch_named(match_info, "sender");
+            content = g_match_info_fetch_named(match_info, "content");
+            time = g_match_info_fetch_named(match_info, "time");
+
+            /* NOTE: Unmatched group in matched pattern is fetched as "" */
+            if (!str_is_empty(sender)) {
+                g_free(msg->rendered_remark);
+                msg->rendered_remark = msg->rendered_sender;
+                msg->rendered_sender = g_markup_escape_text(sender, -1);
             }
+            if (!str_is_empty(content)) {
+                g_free(msg->rendered_content);
+                msg->rendered_content = g_markup_escape_text(content, -1);
+                g_free(msg->plain_content);
+                msg->plain_content = srn_render_strip_mirc(content);
+            }
+            if (!str_is_empty(time)) {
+                g_free(msg->rendered_short_time);
+                msg->rendered_short_time = g_markup_escape_text(time, -1);
+            }
+
+            g_free(sender);
+            g_free(content);
+            g_free(time);
         }
+        g_match_info_free(match_info);
         lst = g_list_next(lst);
     }
-
-    g_list_free(patterns);
+    g_free(raw_content);
 
     return SRN_OK;
 }
@@ -160,6 +156,7 @@ SrnRet srn_render_attach_pattern(SrnExtraData *extra_data, const char *pattern){
     }
 
     *patterns = g_list_append(*patterns, g_strdup(pattern));
+    patterns_serial++;
 
     return SRN_OK;
 }
@@ -184,6 +181,7 @@ SrnRet srn_render_detach_pattern(SrnExtraData *extra_data, const char *pattern){
 
     g_free(lst->data);
     *patterns = g_list_delete_link(*patterns, lst);
+    patterns_serial++;
 
     return SRN_OK;
 }
@@ -236,6 +234,42 @@ static GList* get_patterns(SrnMessage *msg) {
     return patterns;
 }
 
+/**
+ * @brief get_cache returns the compiled patterns which should be applied to
+ * given message. The cache is attached to sender of message and recompiled
+ * when any pattern is attached, detached, added or removed.
+ *
+ * @return a SrnPatternCache, or NULL if no pattern available.
+ */
+static SrnPatternCache* get_cache(SrnMessage *msg) {
+    GList *patterns;
+    SrnPatternCache *cache;
+    SrnPatternSet *pattern_set;
+
+    pattern_set = srn_application_get_default()->pattern_set;
+    g_return_val_if_fail(pattern_set, NULL);
+
+    cache = srn_extra_data_get(msg->sender->extra_data, CACHE_KEY);
+    if (!cache) {
+        cache = srn_pattern_cache_new();
+        srn_extra_data_set(msg->sender->extra_data, CACHE_KEY, cache,
+                (GDestroyNotify)srn_pattern_cache_free);
+    }
+    if (!srn_pattern_cache_is_valid(cache, pattern_set, patterns_serial)) {
+        patterns = get_patterns(msg);
+        srn_pattern_cache_update(cache, pattern_set, patterns, patterns_serial);
+        g_list_free(patterns);
+    }
+
+    return srn_pattern_cache_get_regexes(cache) ? cache : NULL;
+}
+
+static void setup_parser(GMarkupParser *parser){
+    parser->start_element = NULL;
+    parser->end_element = NULL;
+    parser->text = text;
+}
+
 static void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error){
     g_string_append_len(srn_markup_renderer_get_markup(user_data), text, text_len);
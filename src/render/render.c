@@ -27,6 +27,27 @@
 
 // Bits of a SrnRenderFlags(int)
 #define MAX_RENDERER   sizeof(SrnRenderFlags) * 8
+#define MAX_RENDER_WORKER   4
+
+/* Renderers which access states of SrnChat or SrnServer, they must be run
+ * in main thread, before or after the worker renderers */
+#define RENDER_FLAG_PRE     (SRN_RENDER_FLAG_PATTERN)
+#define RENDER_FLAG_POST    (SRN_RENDER_FLAG_MENTION)
+/* Renderers which only transform message content, can be run in workers */
+#define RENDER_FLAG_WORKER  (SRN_RENDER_FLAG_MIRC_STRIP \
+        | SRN_RENDER_FLAG_MIRC_COLORIZE \
+        | SRN_RENDER_FLAG_URL)
+
+struct _SrnRenderJob {
+    SrnMessage *msg;
+    SrnRenderFlags flags;
+    SrnRet ret;
+    bool rendered;  // Rendered by worker, protected by job_mutex
+    bool cancelled;
+
+    SrnRenderCallback cb;
+    void *user_data;
+};
 
 extern SrnMessageRenderer pattern_renderer;
 extern SrnMessageRenderer mirc_colorize_renderer;
@@ -35,8 +56,17 @@ extern SrnMessageRenderer url_renderer;
 extern SrnMessageRenderer mention_renderer;
 static SrnMessageRenderer *renderers[MAX_RENDERER];
 
+static GThreadPool *worker_pool;
+static GMutex job_mutex;
+static GCond job_cond;
+static int running_jobs; // Jobs pushed to worker_pool but not yet rendered
+
+static void render_job(gpointer data, gpointer user_data);
+static gboolean finish_job(gpointer user_data);
+
 void srn_render_init(void){
     int i;
+    GError *err;
 
     /* NOTE: Do not change the order renderer . */
     i = 0;
@@ -54,9 +84,25 @@ void srn_render_init(void){
         }
         renderers[i]->init();
     }
+
+    /* Create render workers */
+    err = NULL;
+    worker_pool = g_thread_pool_new(render_job, NULL,
+            MIN(g_get_num_processors(), MAX_RENDER_WORKER), FALSE, &err);
+    if (err){
+        ERR_FR("Failed to create render workers, fallback to render in "
+                "main thread: %s", err->message);
+        g_error_free(err);
+        worker_pool = NULL;
+    }
 }
 
 void srn_render_finalize(void){
+    if (worker_pool){
+        g_thread_pool_free(worker_pool, FALSE, TRUE);
+        worker_pool = NULL;
+    }
+
     /* Finalize all renderers */
     for (int i = 0; i < MAX_RENDERER; i++){
         if (!renderers[i] || !renderers[i]->finalize) {
@@ -91,3 +137,125 @@ SrnRet srn_render_message(SrnMessage *msg, SrnRenderFlags flags){
 
     return SRN_OK;
 }
+
+SrnRenderJob* srn_render_job_new(SrnMessage *msg, SrnRenderFlags flags,
+        SrnRenderCallback cb, void *user_data){
+    SrnRenderJob *job;
+
+    g_return_val_if_fail(msg, NULL);
+    g_return_val_if_fail(cb, NULL);
+
+    job = g_malloc0(sizeof(SrnRenderJob));
+    job->msg = msg;
+    job->flags = flags;
+    job->ret = SRN_OK;
+    job->cb = cb;
+    job->user_data = user_data;
+
+    return job;
+}
+
+void srn_render_job_submit(SrnRenderJob *job){
+    job->ret = srn_render_message(job->msg, job->flags & RENDER_FLAG_PRE);
+    if (RET_IS_OK(job->ret)
+            && (job->flags & RENDER_FLAG_WORKER)
+            && worker_pool){
+        g_mutex_lock(&job_mutex);
+        running_jobs++;
+        g_mutex_unlock(&job_mutex);
+
+        g_thread_pool_push(worker_pool, job, NULL);
+        return;
+    }
+
+    /* Render it in main thread */
+    if (RET_IS_OK(job->ret)){
+        job->ret = srn_render_message(job->msg, job->flags & RENDER_FLAG_WORKER);
+    }
+    job->rendered = TRUE;
+    finish_job(job);
+}
+
+void srn_render_job_cancel(SrnRenderJob *job){
+    g_mutex_lock(&job_mutex);
+    while (!job->rendered){
+        g_cond_wait(&job_cond, &job_mutex);
+    }
+    g_mutex_unlock(&job_mutex);
+
+    // finish_job() will free it
+    job->cancelled = TRUE;
+}
+
+void srn_render_sync(void){
+    g_mutex_lock(&job_mutex);
+    while (running_jobs > 0){
+        g_cond_wait(&job_cond, &job_mutex);
+    }
+    g_mutex_unlock(&job_mutex);
+}
+
+/**
+ * @brief ``srn_renderer_get_markup_renderer`` returns the markup renderer of
+ * current thread stored in ``key``, it is created and set up at first use and
+ * reused by all following messages rendered in the same thread.
+ *
+ * @param key is a GPrivate owned by the calling renderer module, it should be
+ * initialized with ``MARKUP_RENDERER_PRIVATE_INIT``.
+ * @param setup is used for changing callbacks of the backend markup parser.
+ *
+ * @return a SrnMarkupRenderer, do not free it.
+ */
+SrnMarkupRenderer* srn_renderer_get_markup_renderer(GPrivate *key,
+        void (*setup)(GMarkupParser *parser)){
+    SrnMarkupRenderer *markup_renderer;
+
+    markup_renderer = g_private_get(key);
+    if (!markup_renderer){
+        markup_renderer = srn_markup_renderer_new();
+        setup(srn_markup_renderer_get_markup_parser(markup_renderer));
+        g_private_set(key, markup_renderer);
+    }
+
+    return markup_renderer;
+}
+
+/**
+ * @brief render_job is run in render worker thread.
+ */
+static void render_job(gpointer data, gpointer user_data){
+    SrnRet ret;
+    SrnRenderJob *job;
+
+    job = data;
+    ret = srn_render_message(job->msg, job->flags & RENDER_FLAG_WORKER);
+
+    g_mutex_lock(&job_mutex);
+    job->ret = ret;
+    job->rendered = TRUE;
+    running_jobs--;
+    g_cond_broadcast(&job_cond);
+    g_mutex_unlock(&job_mutex);
+
+    /* Use default priority rather than idle priority, so that rendered
+     * messages are not starved by incoming IRC messages */
+    g_idle_add_full(G_PRIORITY_DEFAULT, finish_job, job, NULL);
+}
+
+/**
+ * @brief finish_job is run in main thread after job is rendered by worker.
+ */
+static gboolean finish_job(gpointer user_data){
+    SrnRenderJob *job;
+
+    job = user_data;
+    if (!job->cancelled){
+        if (RET_IS_OK(job->ret)){
+            job->ret = srn_render_message(job->msg, job->flags & RENDER_FLAG_POST);
+        }
+        job->cb(job->msg, job->ret, job->user_data);
+    }
+    g_free(job);
+
+    return G_SOURCE_REMOVE;
+}
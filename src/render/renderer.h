@@ -22,6 +22,7 @@
 #define __IN_RENDERER_H
 
 #include "core/core.h"
+#include "markup_renderer.h"
 
 /**
  * @brief SrnMessageRenderer defines a module context of a SrnMessgae rendering
@@ -36,4 +37,11 @@ struct _SrnMessageRenderer {
     void (*finalize) (void);
 };
 
+/* Markup renderer is freed when the thread owns it exits */
+#define MARKUP_RENDERER_PRIVATE_INIT \
+    G_PRIVATE_INIT((GDestroyNotify) srn_markup_renderer_free)
+
+SrnMarkupRenderer* srn_renderer_get_markup_renderer(GPrivate *key,
+        void (*setup)(GMarkupParser *parser));
+
 #endif /* __IN_RENDERER_H */
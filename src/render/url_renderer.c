@@ -27,26 +27,24 @@
 #include "render/render.h"
 #include "./renderer.h"
 
-static void init(void);
-static void finalize(void);
 static SrnRet render(SrnMessage *msg);
+static void setup_parser(GMarkupParser *parser);
 static void text(GMarkupParseContext *context, const gchar *text,
         gsize text_len, gpointer user_data, GError **error);
 static bool match_pattern(const char *pattern, const char *str, int *start,
         int *end);
 
-static SrnMarkupRenderer *markup_renderer;
-
  /**
   * @brief url_renderer is a render moduele for rendering URL in message.
   */
 SrnMessageRenderer url_renderer = {
     .name = "url",
-    .init = init,
-    .finalize = finalize,
     .render = render,
 };
 
+/* Markup renderer is reused by messages rendered in the same thread */
+static GPrivate markup_renderer_key = MARKUP_RENDERER_PRIVATE_INIT;
+
 /* Some patterns are copied from hexchat/src/common/url.c */
 #define PROTO_PATTERN       "(http|https|ftp|git|svn|irc|ircs|xmpp)"
 
@@ -94,22 +92,14 @@ static char* patterns[MATCH_MAX + 1] = {
     [MATCH_HOST] = SINGLY_HOST_PATTERN,
 };
 
-void init(void) {
-    GMarkupParser *parser;
-
-    markup_renderer = srn_markup_renderer_new();
-    parser = srn_markup_renderer_get_markup_parser(markup_renderer);
-    parser->text = text;
-}
-
-void finalize(void) {
-    srn_markup_renderer_free(markup_renderer);
-}
-
 SrnRet render(SrnMessage *msg) {
     char *rendered_content;
+    SrnMarkupRenderer *markup_renderer;
     SrnRet ret;
 
+    markup_renderer = srn_renderer_get_markup_renderer(&markup_renderer_key,
+            setup_parser);
+
     rendered_content = NULL;
     ret = srn_markup_renderer_render(markup_renderer,
             msg->rendered_content, &rendered_content, msg);
@@ -124,6 +114,10 @@ SrnRet render(SrnMessage *msg) {
     return SRN_OK;
 }
 
+static void setup_parser(GMarkupParser *parser){
+    parser->text = text;
+}
+
 void text(GMarkupParseContext *context, const gchar *text, gsize text_len,
         gpointer user_data, GError **error) {
     int start, end;
@@ -183,20 +177,16 @@ void text(GMarkupParseContext *context, const gchar *text, gsize text_len,
                             "<a href=\"http://%s\">%s</a>", url, url);
                     break;
                 case MATCH_CHANNEL:
-                    if (msg->chat->srv->cfg->irc->tls){
+                    /* NOTE: This renderer may run in render worker, so
+                     * do not access msg->chat->srv here */
+                    if (msg->server_url){
                         markuped_url = g_markup_printf_escaped(
-                                "<a href=\"ircs://%s:%d/%s\">%s</a>",
-                                msg->chat->srv->addr->host,
-                                msg->chat->srv->addr->port,
+                                "<a href=\"%s/%s\">%s</a>",
+                                msg->server_url,
                                 url,
                                 url);
                     } else {
-                        markuped_url = g_markup_printf_escaped(
-                                "<a href=\"irc://%s:%d/%s\">%s</a>",
-                                msg->chat->srv->addr->host,
-                                msg->chat->srv->addr->port,
-                                url,
-                                url);
+                        markuped_url = g_markup_escape_text(url, -1);
                     }
                     break;
                 case MATCH_EMAIL:
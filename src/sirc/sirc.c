@@ -23,6 +23,31 @@
  * @version 0.06.2
  * @date 2016-03-02
  *
+ * When I/O thread is enabled via ``sirc_set_io_thread()``, sockets of newly
+ * connected sessions are owned by a dedicated thread with its own
+ * GMainContext: reading, line splitting, parsing and transcoding are done
+ * there. Parsed messages and connection events are pushed to a lock-free
+ * queue and handled in the main loop in batches, at most once per frame.
+ * Commands are still sent from the main thread.
+ *
+ * Hosts given to ``sirc_connect_any()`` are resolved one by one via the
+ * caching resolver (see sirc_resolver.c), connection attempts to resolved
+ * addresses are started in a staggered way (RFC 8305): the next attempt is
+ * started when previous one fails or does not succeed in
+ * SIRC_CONNECT_ATTEMPT_DELAY, the first attempt finishing TLS handshake wins
+ * and the others are cancelled.
+ *
+ * TLS connections are given the server identity (host and port), which is
+ * sent as SNI and is the key of the session cache of TLS backend, so
+ * reconnecting to the same address resumes the cached session while its
+ * ticket is still valid. Full and resumed handshakes are counted when GIO
+ * tells whether a session is resumed.
+ *
+ * Received data is read in chunks into a buffer which grows on demand up to
+ * SIRC_RECV_BUF_MAX, enough for a line with full length of IRCv3 message
+ * tags. Consumed lines are skipped by moving the start offset; the unfinished
+ * line is moved to the front only when there is no room for next read. A line
+ * longer than the limit is dropped as a whole.
  */
 
 
@@ -33,21 +58,84 @@
 #include "sirc/sirc.h"
 #include "sirc_parse.h"
 #include "sirc_event_hdr.h"
+#include "sirc_resolver.h"
 
 #include "srain.h"
 #include "log.h"
 #include "i18n.h"
 
+typedef struct _IoEvent IoEvent;
+typedef enum _IoEventType IoEventType;
+
+enum _IoEventType {
+    IO_EVENT_CONNECT,
+    IO_EVENT_CONNECT_FAIL,
+    IO_EVENT_MESSAGE,
+    IO_EVENT_DISCONNECT,
+};
+
+struct _IoEvent {
+    IoEventType type;
+    SircSession *sirc;
+    SircMessage *imsg;  // For IO_EVENT_MESSAGE
+    char *reason;       // For IO_EVENT_CONNECT_FAIL and IO_EVENT_DISCONNECT
+    IoEvent *next;
+};
+
+#define SIRC_CONNECT_ATTEMPT_DELAY  250 // ms
+#define SIRC_RECV_BUF_INIT          SIRC_BUF_LEN
+#define SIRC_RECV_BUF_MAX           (SIRC_TAGS_LEN + SIRC_MSG_LEN)
+
+typedef struct _ConnectTarget ConnectTarget;
+
+struct _ConnectTarget {
+    int index;              // Index of host
+    GInetAddress *addr;     // Resolved address of host
+};
+
+typedef struct _ConnectAttempt ConnectAttempt;
+
+struct _ConnectAttempt {
+    SircSession *sirc;
+    int index;              // Index of host being resolved or connected
+    bool abandoned;         // Another attempt won, ``sirc`` may be invalid
+    GCancellable *cancel;
+    GCancellable *parent;   // Cancellable of session
+    gulong cancel_handler;
+};
+
 struct _SircSession {
-    int bufptr;
-    char buf[SIRC_BUF_LEN];
+    char *buf;              // Receive buffer
+    gsize buf_size;         // Allocated size of buffer
+    gsize buf_start;        // Offset of unconsumed data
+    gsize buf_end;          // Offset of end of received data
+    bool buf_overflow;      // Dropping a line which exceeds SIRC_RECV_BUF_MAX
     GSocketClient *client;
     GIOStream *stream;
     GCancellable *cancel;
+    GMainContext *io_ctx;   // Context of I/O thread, NULL if socket is owned
+                            // by main thread
+    char *encoding;         // Copied from config when connecting, because
+                            // config may be replaced during I/O
+
+    char **hosts;           // Addresses to connect
+    int *ports;
+    int naddr;
+    int next_addr;          // Index of address to be resolved next
+    int addr_index;         // Index of connected address
+    GList *targets;         // List of ConnectTarget not yet attempted
+    bool resolving;
+    GList *attempts;        // List of ConnectAttempt in progress
+    GSource *attempt_timer; // Starts next attempt when it expires
+    char *attempt_err;      // Error message of last failed attempt
+
+    int tls_full;           // Count of full TLS handshakes, atomic
+    int tls_resumed;        // Count of resumed TLS handshakes, atomic
 
     SircEvents *events; // Event callbacks
     SircConfig *cfg;
     void *ctx;
+    SircMessage *imsg;  // Message being handled, only valid in event callbacks
 
     // ONLY FOR DEBUG
     int msgid;          // Message ID
@@ -59,11 +147,70 @@ static void on_connect_ready(GObject *obj, GAsyncResult *result, gpointer user_d
 static gboolean on_accept_certificate(GTlsClientConnection *conn,
         GTlsCertificate *cert, GTlsCertificateFlags errors, gpointer user_data);
 static void on_connect_fail(SircSession *sirc, const char *reason);
+static gboolean start_attempt(SircSession *sirc);
+static void on_resolve_ready(GList *addrs, const char *error,
+        gpointer user_data);
+static void stop_attempt_timer(SircSession *sirc);
+static gboolean on_attempt_timeout(gpointer user_data);
+static void on_attempt_fail(ConnectAttempt *attempt, const char *reason);
+static void on_attempt_finish(ConnectAttempt *attempt, GIOStream *stream);
+static void on_session_cancelled(GCancellable *cancel, gpointer user_data);
+static ConnectAttempt* connect_attempt_new(SircSession *sirc, int index);
+static void connect_attempt_free(ConnectAttempt *attempt);
+static void count_tls_handshake(SircSession *sirc, GTlsConnection *conn);
+static void connect_target_free(ConnectTarget *target);
 static void on_connect_finish(SircSession *sirc, GIOStream *stream);
 static void on_disconnect_ready(GObject *obj, GAsyncResult *result, gpointer user_data);
 static void on_recv_ready(GObject *obj, GAsyncResult *res, gpointer user_data);
+static void sirc_recv_line(SircSession *sirc, char *line);
 static void on_disconnect(SircSession *sirc, const char *reason);
 
+static void emit_event(SircSession *sirc, IoEventType type,
+        SircMessage *imsg, const char *reason);
+static void dispatch_event(IoEvent *event);
+static gboolean dispatch_events(gpointer user_data);
+static gboolean io_connect(gpointer user_data);
+static gboolean io_disconnect(gpointer user_data);
+static gpointer io_thread(gpointer user_data);
+static GMainContext* get_io_context(void);
+
+static int io_thread_enabled = FALSE;   // Accessed atomically
+static GMainContext *io_thread_ctx = NULL;
+static GMainLoop *io_thread_loop = NULL;
+static GThread *io_thread_handle = NULL;
+static IoEvent *io_queue = NULL;    // Lock-free stack of events pushed by
+                                    // I/O thread, newest first
+
+/**
+ * @brief ``sirc_set_io_thread`` sets whether the sockets of sessions
+ * connected afterwards are owned by the I/O thread. Already connected
+ * sessions are not affected.
+ *
+ * @param enable
+ */
+void sirc_set_io_thread(bool enable){
+    g_atomic_int_set(&io_thread_enabled, enable);
+}
+
+/**
+ * @brief ``sirc_stop_io_thread`` stops the I/O thread and waits for it to
+ * exit, sockets owned by it are no longer served. It should be called from
+ * main thread before exiting.
+ */
+void sirc_stop_io_thread(void){
+    if (!io_thread_ctx){
+        return;
+    }
+
+    g_main_loop_quit(io_thread_loop);
+    g_thread_join(io_thread_handle);
+    g_main_loop_unref(io_thread_loop);
+    g_main_context_unref(io_thread_ctx);
+    io_thread_handle = NULL;
+    io_thread_loop = NULL;
+    io_thread_ctx = NULL;
+}
+
 SircSession* sirc_new_session(SircEvents *events, SircConfig *cfg){
     SircSession *sirc;
 
@@ -75,7 +222,7 @@ SircSession* sirc_new_session(SircEvents *events, SircConfig *cfg){
     sirc->events = events;
     sirc->cfg = cfg;
     sirc->msgid = 0;
-    /* sirc->bufptr = 0; // via g_malloc0() */
+    /* sirc->buf = NULL; // via g_malloc0(), allocated on first receiving */
     /* sirc->stream = NULL; // via g_malloc0() */
     sirc->client = g_socket_client_new();
     // g_socket_client_set_timeout(sirc->client, SERVER_PING_INTERVAL);
@@ -97,6 +244,15 @@ void sirc_free_session(SircSession *sirc){
 
     g_object_unref(sirc->client);
     g_object_unref(sirc->cancel);
+    if (sirc->io_ctx){
+        g_main_context_unref(sirc->io_ctx);
+    }
+    g_free(sirc->encoding);
+    g_strfreev(sirc->hosts);
+    g_free(sirc->ports);
+    g_free(sirc->attempt_err);
+    g_list_free_full(sirc->targets, (GDestroyNotify)connect_target_free);
+    g_free(sirc->buf);
 
     g_free(sirc);
 }
@@ -141,14 +297,180 @@ void* sirc_get_ctx(SircSession *sirc){
     return sirc->ctx;
 }
 
+/**
+ * @brief ``sirc_get_origin_user`` returns the user part of prefix of the
+ * message currently being handled, it is only meaningful in event callbacks.
+ *
+ * @param sirc
+ *
+ * @return Username or NULL if prefix has no user part
+ */
+const char* sirc_get_origin_user(SircSession *sirc){
+    g_return_val_if_fail(sirc, NULL);
+
+    return sirc->imsg ? sirc->imsg->user : NULL;
+}
+
+/**
+ * @brief ``sirc_get_origin_host`` is similar to ``sirc_get_origin_user``,
+ * but returns the host part of prefix.
+ *
+ * @param sirc
+ *
+ * @return Hostname or NULL if prefix has no host part
+ */
+const char* sirc_get_origin_host(SircSession *sirc){
+    g_return_val_if_fail(sirc, NULL);
+
+    return sirc->imsg ? sirc->imsg->host : NULL;
+}
+
+/**
+ * @brief ``sirc_get_message_time`` returns the time given by "time" tag of
+ * the message currently being handled, it is only meaningful in event
+ * callbacks.
+ *
+ * @param sirc
+ *
+ * @return Microseconds since epoch, 0 if message has no time tag
+ */
+gint64 sirc_get_message_time(SircSession *sirc){
+    g_return_val_if_fail(sirc, 0);
+
+    return sirc->imsg ? sirc->imsg->time : 0;
+}
+
+/**
+ * @brief ``sirc_get_message_msgid`` is similar to ``sirc_get_message_time``,
+ * but returns the "msgid" tag.
+ */
+const char* sirc_get_message_msgid(SircSession *sirc){
+    g_return_val_if_fail(sirc, NULL);
+
+    return sirc->imsg ? sirc->imsg->msgid : NULL;
+}
+
+/**
+ * @brief ``sirc_get_message_batch`` is similar to ``sirc_get_message_time``,
+ * but returns the reference tag of batch which message belongs to.
+ */
+const char* sirc_get_message_batch(SircSession *sirc){
+    g_return_val_if_fail(sirc, NULL);
+
+    return sirc->imsg ? sirc->imsg->batch : NULL;
+}
+
+/**
+ * @brief ``sirc_get_message_account`` is similar to ``sirc_get_message_time``,
+ * but returns the "account" tag.
+ */
+const char* sirc_get_message_account(SircSession *sirc){
+    g_return_val_if_fail(sirc, NULL);
+
+    return sirc->imsg ? sirc->imsg->account : NULL;
+}
+
+/**
+ * @brief ``sirc_get_message_tag`` returns any tag of the message currently
+ * being handled, it is decoded when called.
+ *
+ * @param sirc
+ * @param key
+ *
+ * @return A newly allocated value, NULL if there is no such tag
+ */
+char* sirc_get_message_tag(SircSession *sirc, const char *key){
+    g_return_val_if_fail(sirc, NULL);
+
+    return sirc->imsg ? sirc_message_get_tag(sirc->imsg, key) : NULL;
+}
+
+/**
+ * @brief ``sirc_get_addr_index`` returns index of the address which session
+ * is connected to, it is only meaningful after "CONNECT" event.
+ *
+ * @param sirc
+ *
+ * @return Index of address passed to ``sirc_connect_any()``
+ */
+int sirc_get_addr_index(SircSession *sirc){
+    g_return_val_if_fail(sirc, -1);
+
+    return sirc->addr_index;
+}
+
+/**
+ * @brief ``sirc_get_tls_stats`` gets count of TLS handshakes of session.
+ *
+ * @param sirc
+ * @param full Return location of count of full handshakes
+ * @param resumed Return location of count of resumed handshakes
+ *
+ * @return FALSE if GIO can not tell whether a session is resumed, nothing is
+ *         counted then
+ */
+bool sirc_get_tls_stats(SircSession *sirc, int *full, int *resumed){
+    g_return_val_if_fail(sirc, FALSE);
+
+    *full = g_atomic_int_get(&sirc->tls_full);
+    *resumed = g_atomic_int_get(&sirc->tls_resumed);
+
+    return *full + *resumed > 0;
+}
+
 void sirc_connect(SircSession *sirc, const char *host, int port){
+    sirc_connect_any(sirc, &host, &port, 1);
+}
+
+/**
+ * @brief ``sirc_connect_any`` connects to one of given addresses, addresses
+ * are attempted in the given order.
+ *
+ * @param sirc
+ * @param hosts
+ * @param ports
+ * @param count Count of addresses
+ */
+void sirc_connect_any(SircSession *sirc, const char **hosts, const int *ports,
+        int count){
     g_return_if_fail(sirc);
-    g_return_if_fail(host);
-    g_return_if_fail(port > 0);
+    g_return_if_fail(hosts);
+    g_return_if_fail(ports);
+    g_return_if_fail(count > 0);
+
+    g_strfreev(sirc->hosts);
+    g_free(sirc->ports);
+    sirc->hosts = g_malloc0_n(count + 1, sizeof(char *));
+    sirc->ports = g_malloc0_n(count, sizeof(int));
+    for (int i = 0; i < count; i++){
+        sirc->hosts[i] = g_strdup(hosts[i]);
+        sirc->ports[i] = ports[i];
+    }
+    sirc->naddr = count;
+    sirc->next_addr = 0;
+    sirc->addr_index = -1;
+    g_list_free_full(sirc->targets, (GDestroyNotify)connect_target_free);
+    sirc->targets = NULL;
+    sirc->resolving = FALSE;
+    g_free(sirc->attempt_err);
+    sirc->attempt_err = NULL;
 
     g_cancellable_reset(sirc->cancel);
-    g_socket_client_connect_to_host_async (sirc->client, host,
-            port, sirc->cancel, on_connect_ready, sirc);
+    g_free(sirc->encoding);
+    sirc->encoding = g_strdup(sirc->cfg->encoding);
+    if (sirc->io_ctx){
+        g_main_context_unref(sirc->io_ctx);
+        sirc->io_ctx = NULL;
+    }
+    if (g_atomic_int_get(&io_thread_enabled)){
+        sirc->io_ctx = g_main_context_ref(get_io_context());
+    }
+
+    if (sirc->io_ctx){
+        g_main_context_invoke(sirc->io_ctx, io_connect, sirc);
+    } else {
+        io_connect(sirc);
+    }
 }
 
 void sirc_cancel_connect(SircSession *sirc){
@@ -162,23 +484,83 @@ void sirc_disconnect(SircSession *sirc){
     g_return_if_fail(sirc);
     g_return_if_fail(sirc->stream);
 
-    g_io_stream_close_async(sirc->stream, 0, NULL, on_disconnect_ready, sirc);
+    if (sirc->io_ctx){
+        g_main_context_invoke(sirc->io_ctx, io_disconnect, sirc);
+    } else {
+        io_disconnect(sirc);
+    }
 }
 
 static void sirc_recv(SircSession *sirc){
     GInputStream *in;
 
+    if (sirc->buf_start == sirc->buf_end){
+        // All received data is consumed
+        sirc->buf_start = 0;
+        sirc->buf_end = 0;
+    }
+    if (sirc->buf_end == sirc->buf_size){
+        if (sirc->buf_start > 0){
+            // Move the unfinished line to the front
+            memmove(sirc->buf, sirc->buf + sirc->buf_start,
+                    sirc->buf_end - sirc->buf_start);
+            sirc->buf_end -= sirc->buf_start;
+            sirc->buf_start = 0;
+        } else if (sirc->buf_size < SIRC_RECV_BUF_MAX){
+            sirc->buf_size = sirc->buf_size
+                ? MIN(sirc->buf_size * 2, SIRC_RECV_BUF_MAX)
+                : SIRC_RECV_BUF_INIT;
+            sirc->buf = g_realloc(sirc->buf, sirc->buf_size);
+        } else {
+            if (!sirc->buf_overflow){
+                WARN_FR("Length of the line exceeds %d bytes, dropped",
+                        SIRC_RECV_BUF_MAX);
+            }
+            // Drop data until the end of line, keep the last byte which
+            // may be a '\r'
+            sirc->buf[0] = sirc->buf[sirc->buf_end - 1];
+            sirc->buf_end = 1;
+            sirc->buf_overflow = TRUE;
+        }
+    }
+
     in = g_io_stream_get_input_stream(sirc->stream);
-    g_input_stream_read_async(in, &sirc->buf[sirc->bufptr], 1, G_PRIORITY_DEFAULT,
+    g_input_stream_read_async(in, sirc->buf + sirc->buf_end,
+            sirc->buf_size - sirc->buf_end, G_PRIORITY_DEFAULT,
             sirc->cancel, on_recv_ready, sirc);
 }
 
+/**
+ * @brief ``sirc_recv_line`` handles a line in receive buffer.
+ *
+ * @param sirc
+ * @param line A line without CRLF, NUL-terminated
+ */
+static void sirc_recv_line(SircSession *sirc, char *line){
+    SircMessage *imsg;
+
+    DBG_FR("Line: %s", line);
+
+    imsg = sirc_parse(line);
+    if (!imsg){
+        ERR_FR("Failed to parse line: %s", line);
+        return;
+    }
+
+    /* Transcoding */
+    sirc_message_transcoding(imsg,
+            SRN_ENCODING, sirc->encoding, SRN_FALLBACK_CHAR);
+    /* Handle event */
+    emit_event(sirc, IO_EVENT_MESSAGE, imsg, NULL);
+}
+
 static void on_recv_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
-    int size;
+    gssize size;
+    char *ptr;
+    char *end;
     GInputStream *in;
     GError *err;
     SircSession *sirc;
-    SircMessage *imsg;
 
     sirc = user_data;
 
@@ -200,45 +582,30 @@ static void on_recv_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
         return;
     }
 
-    sirc->bufptr++;
-    if (sirc->bufptr > sizeof(sirc->buf)){
-        WARN_FR("Length of the line exceeds the buffer");
-        goto FIN;
-    }
-
-    /* Read a line */
-    if (!(sirc->bufptr >= 2
-            && sirc->buf[sirc->bufptr-2] == '\r'
-            && sirc->buf[sirc->bufptr-1] == '\n')){
-        goto NOTREADY;
-    }
-
-    sirc->buf[sirc->bufptr-2] = '\0';
-    sirc->buf[sirc->bufptr-1] = '\0';
-    sirc->bufptr -= 2;
-    sirc->buf[sirc->bufptr] = '\0';
-
-    DBG_FR("Line: %s", sirc->buf);
-
-    imsg = sirc_parse(sirc->buf);
-    if (!imsg){
-        ERR_FR("Failed to parse line: %s", sirc->buf);
-        goto FIN;
+    /* Handle all finished lines */
+    ptr = sirc->buf + sirc->buf_end; // Older data has no CRLF
+    sirc->buf_end += size;
+    end = sirc->buf + sirc->buf_end;
+    while ((ptr = memchr(ptr, '\n', end - ptr))){
+        char *line;
+
+        line = sirc->buf + sirc->buf_start;
+        if (ptr == line || ptr[-1] != '\r'){
+            ptr++; // Not a CRLF
+            continue;
+        }
+        ptr[-1] = '\0';
+        ptr++;
+        sirc->buf_start = ptr - sirc->buf;
+
+        if (sirc->buf_overflow){
+            // Tail of the dropped line
+            sirc->buf_overflow = FALSE;
+            continue;
+        }
+        sirc_recv_line(sirc, line);
     }
 
-    /* Transcoding */
-    sirc_message_transcoding(imsg,
-            SRN_ENCODING, sirc->cfg->encoding, SRN_FALLBACK_CHAR);
-    /* Handle event */
-    sirc_event_hdr(sirc, imsg);
-
-    sirc_message_free(imsg);
-
-FIN:
-    /* Clear buffer */
-    sirc->bufptr = 0;
-    memset(sirc->buf, 0, sizeof(sirc->buf));
-NOTREADY:
     sirc_recv(sirc); // Continute receiving
 }
 
@@ -268,22 +635,25 @@ static gboolean on_accept_certificate(GTlsClientConnection *conn,
 static void on_handshake_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
     GError *err;
     GTlsConnection *tls_conn;
-    SircSession *sirc;
+    ConnectAttempt *attempt;
 
     tls_conn = G_TLS_CONNECTION(obj);
-    sirc = user_data;
+    attempt = user_data;
 
     err = NULL;
     g_tls_connection_handshake_finish(tls_conn, res, &err);
     if (err){
         g_object_unref(tls_conn);
-        on_connect_fail(sirc, err->message);
+        on_attempt_fail(attempt, err->message);
         g_error_free(err);
         return;
     }
     LOG_FR("TLS handshake successed");
+    if (!attempt->abandoned){
+        count_tls_handshake(attempt->sirc, tls_conn);
+    }
 
-    on_connect_finish(sirc, G_IO_STREAM(tls_conn));
+    on_attempt_finish(attempt, G_IO_STREAM(tls_conn));
 }
 
 static void on_connect_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
@@ -292,16 +662,23 @@ static void on_connect_ready(GObject *obj, GAsyncResult *res, gpointer user_data
     GSocketConnection *conn;
     GSocketAddress *addr;
     SircSession *sirc;
+    ConnectAttempt *attempt;
 
     client = G_SOCKET_CLIENT(obj);
-    sirc = user_data;
+    attempt = user_data;
     err = NULL;
     conn = g_socket_client_connect_finish(client, res, &err);
     if (err){
-        on_connect_fail(sirc, err->message);
+        on_attempt_fail(attempt, err->message);
         g_error_free(err);
         return;
     }
+    if (attempt->abandoned){
+        g_object_unref(conn);
+        connect_attempt_free(attempt);
+        return;
+    }
+    sirc = attempt->sirc;
 
     err = NULL;
     addr = g_socket_connection_get_remote_address(conn, &err);
@@ -316,12 +693,17 @@ static void on_connect_ready(GObject *obj, GAsyncResult *res, gpointer user_data
 
     if (sirc->cfg->tls){
          GIOStream *tls_conn;
+         GSocketConnectable *identity;
 
+         /* Server identity is used for SNI and certificate verification */
+         identity = g_network_address_new(
+                 sirc->hosts[attempt->index], sirc->ports[attempt->index]);
          err = NULL;
-         tls_conn = g_tls_client_connection_new(G_IO_STREAM(conn), NULL, &err);
+         tls_conn = g_tls_client_connection_new(G_IO_STREAM(conn), identity, &err);
+         g_object_unref(identity);
          g_object_unref(conn);
          if (err){
-             on_connect_fail(sirc, err->message);
+             on_attempt_fail(attempt, err->message);
              g_error_free(err);
              return;
          }
@@ -340,9 +722,10 @@ static void on_connect_ready(GObject *obj, GAsyncResult *res, gpointer user_data
          /* "CONNECT" event will be triggered after TLS handshake,
           * see `on_handshake_ready` */
          g_tls_connection_handshake_async(G_TLS_CONNECTION(tls_conn),
-                     G_PRIORITY_DEFAULT, sirc->cancel, on_handshake_ready, sirc);
+                     G_PRIORITY_DEFAULT, attempt->cancel, on_handshake_ready,
+                     attempt);
      } else {
-         on_connect_finish(sirc, G_IO_STREAM(conn));
+         on_attempt_finish(attempt, G_IO_STREAM(conn));
      }
 }
 
@@ -361,29 +744,428 @@ static void on_connect_finish(SircSession *sirc, GIOStream *stream){
     LOG_FR("Connected");
 
     sirc->stream = stream;
+    sirc->buf_start = 0;
+    sirc->buf_end = 0;
+    sirc->buf_overflow = FALSE;
     sirc_recv(sirc);
 
-    g_return_if_fail(sirc->events->connect);
-    sirc->events->connect(sirc, "CONNECT");
+    emit_event(sirc, IO_EVENT_CONNECT, NULL, NULL);
 }
 
 static void on_connect_fail(SircSession *sirc, const char *reason){
-    const char *params[] = { reason };
-
     ERR_FR("Connect failed: %s", reason);
 
-    g_return_if_fail(sirc->events->connect_fail);
-    sirc->events->connect_fail(sirc, "CONNECT_FAIL", "", params, 1);
+    emit_event(sirc, IO_EVENT_CONNECT_FAIL, NULL, reason);
 }
 
-static void on_disconnect(SircSession *sirc, const char *reason){
-    const char *params[] = { reason };
+/**
+ * @brief ``start_attempt`` starts a connection attempt to next resolved
+ * address, or resolves next host if there is no resolved address.
+ *
+ * @return FALSE if no more address to attempt
+ */
+static gboolean start_attempt(SircSession *sirc){
+    char *str;
+    ConnectAttempt *attempt;
+    ConnectTarget *target;
+    GSocketAddress *addr;
+
+    stop_attempt_timer(sirc);
+    if (g_cancellable_is_cancelled(sirc->cancel)){
+        return FALSE;
+    }
+
+    if (!sirc->targets){
+        if (sirc->resolving){
+            return TRUE; // Continued when host is resolved
+        }
+        if (sirc->next_addr >= sirc->naddr){
+            return FALSE;
+        }
+        attempt = connect_attempt_new(sirc, sirc->next_addr++);
+        sirc->resolving = TRUE;
+        sirc_resolver_lookup(sirc->hosts[attempt->index], attempt->cancel,
+                on_resolve_ready, attempt);
+        return TRUE;
+    }
+
+    target = sirc->targets->data;
+    sirc->targets = g_list_delete_link(sirc->targets, sirc->targets);
+    attempt = connect_attempt_new(sirc, target->index);
+
+    str = g_inet_address_to_string(target->addr);
+    LOG_FR("Connecting to %s(%s):%d",
+            sirc->hosts[attempt->index], str, sirc->ports[attempt->index]);
+    g_free(str);
+
+    addr = g_inet_socket_address_new(target->addr, sirc->ports[target->index]);
+    g_socket_client_connect_async(sirc->client, G_SOCKET_CONNECTABLE(addr),
+            attempt->cancel, on_connect_ready, attempt);
+    g_object_unref(addr);
+    connect_target_free(target);
+
+    if (sirc->targets || sirc->next_addr < sirc->naddr){
+        // Attach to the thread default context, see ``io_thread()``
+        sirc->attempt_timer = g_timeout_source_new(SIRC_CONNECT_ATTEMPT_DELAY);
+        g_source_set_callback(sirc->attempt_timer, on_attempt_timeout, sirc, NULL);
+        g_source_attach(sirc->attempt_timer, g_main_context_get_thread_default());
+    }
+
+    return TRUE;
+}
+
+static void stop_attempt_timer(SircSession *sirc){
+    if (!sirc->attempt_timer){
+        return;
+    }
+    g_source_destroy(sirc->attempt_timer);
+    g_source_unref(sirc->attempt_timer);
+    sirc->attempt_timer = NULL;
+}
+
+static gboolean on_attempt_timeout(gpointer user_data){
+    SircSession *sirc;
+
+    sirc = user_data;
+    g_source_unref(sirc->attempt_timer);
+    sirc->attempt_timer = NULL;
+    start_attempt(sirc);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Resolved addresses of a host are attempted in the order of
+ * alternating IPv6 and IPv4 addresses, as RFC 8305 recommends.
+ */
+static void on_resolve_ready(GList *addrs, const char *error,
+        gpointer user_data){
+    GList *lst;
+    GList *ipv4;
+    GList *ipv6;
+    SircSession *sirc;
+    ConnectAttempt *attempt;
+
+    attempt = user_data;
+    if (attempt->abandoned){
+        g_resolver_free_addresses(addrs);
+        connect_attempt_free(attempt);
+        return;
+    }
+
+    sirc = attempt->sirc;
+    sirc->resolving = FALSE;
+    if (!addrs){
+        on_attempt_fail(attempt, error);
+        return;
+    }
+
+    ipv4 = NULL;
+    ipv6 = NULL;
+    for (lst = addrs; lst; lst = g_list_next(lst)){
+        if (g_inet_address_get_family(lst->data) == G_SOCKET_FAMILY_IPV6){
+            ipv6 = g_list_append(ipv6, lst->data);
+        } else {
+            ipv4 = g_list_append(ipv4, lst->data);
+        }
+    }
+    g_list_free(addrs); // Addresses are owned by targets
+
+    while (ipv6 || ipv4){
+        GList **family[] = { &ipv6, &ipv4 };
+
+        for (int i = 0; i < G_N_ELEMENTS(family); i++){
+            ConnectTarget *target;
+
+            if (!*family[i]){
+                continue;
+            }
+            target = g_malloc0(sizeof(ConnectTarget));
+            target->index = attempt->index;
+            target->addr = (*family[i])->data;
+            sirc->targets = g_list_append(sirc->targets, target);
+            *family[i] = g_list_delete_link(*family[i], *family[i]);
+        }
+    }
+    connect_attempt_free(attempt);
+
+    if (start_attempt(sirc) || sirc->attempts){
+        return;
+    }
+    on_connect_fail(sirc, sirc->attempt_err);
+}
+
+static void on_attempt_fail(ConnectAttempt *attempt, const char *reason){
+    SircSession *sirc;
+
+    if (attempt->abandoned){
+        connect_attempt_free(attempt);
+        return;
+    }
+
+    sirc = attempt->sirc;
+    WARN_FR("Failed to connect to %s:%d: %s",
+            sirc->hosts[attempt->index], sirc->ports[attempt->index], reason);
+    g_free(sirc->attempt_err);
+    sirc->attempt_err = g_strdup(reason);
+    connect_attempt_free(attempt);
+
+    if (start_attempt(sirc) || sirc->attempts){
+        return; // Not all attempts fail
+    }
+    on_connect_fail(sirc, sirc->attempt_err);
+}
+
+static void on_attempt_finish(ConnectAttempt *attempt, GIOStream *stream){
+    GList *lst;
+    SircSession *sirc;
+
+    if (attempt->abandoned){
+        g_object_unref(stream);
+        connect_attempt_free(attempt);
+        return;
+    }
+
+    sirc = attempt->sirc;
+    sirc->addr_index = attempt->index;
+    stop_attempt_timer(sirc);
+    connect_attempt_free(attempt);
+
+    /* Cancel other attempts, they are freed in their callbacks */
+    for (lst = sirc->attempts; lst; lst = g_list_next(lst)){
+        ConnectAttempt *other;
+
+        other = lst->data;
+        other->abandoned = TRUE;
+        g_cancellable_cancel(other->cancel);
+    }
+    g_list_free(sirc->attempts);
+    sirc->attempts = NULL;
+    g_list_free_full(sirc->targets, (GDestroyNotify)connect_target_free);
+    sirc->targets = NULL;
+    sirc->resolving = FALSE;
+
+    on_connect_finish(sirc, stream);
+}
 
+/**
+ * @brief Propagates cancellation of session to connection attempts, it may
+ * be called from main thread.
+ */
+static void on_session_cancelled(GCancellable *cancel, gpointer user_data){
+    g_cancellable_cancel(G_CANCELLABLE(user_data));
+}
+
+static ConnectAttempt* connect_attempt_new(SircSession *sirc, int index){
+    ConnectAttempt *attempt;
+
+    attempt = g_malloc0(sizeof(ConnectAttempt));
+    attempt->sirc = sirc;
+    attempt->index = index;
+    attempt->cancel = g_cancellable_new();
+    attempt->parent = g_object_ref(sirc->cancel);
+    attempt->cancel_handler = g_cancellable_connect(attempt->parent,
+            G_CALLBACK(on_session_cancelled), attempt->cancel, NULL);
+    sirc->attempts = g_list_append(sirc->attempts, attempt);
+
+    return attempt;
+}
+
+static void connect_attempt_free(ConnectAttempt *attempt){
+    if (!attempt->abandoned){
+        attempt->sirc->attempts = g_list_remove(attempt->sirc->attempts, attempt);
+    }
+    g_cancellable_disconnect(attempt->parent, attempt->cancel_handler);
+    g_object_unref(attempt->parent);
+    g_object_unref(attempt->cancel);
+    g_free(attempt);
+}
+
+/**
+ * @brief ``count_tls_handshake`` counts a finished handshake as full or
+ * resumed one, via "session-resumed" property which is not provided by
+ * older GIO.
+ */
+static void count_tls_handshake(SircSession *sirc, GTlsConnection *conn){
+    gboolean resumed;
+
+    if (!g_object_class_find_property(G_OBJECT_GET_CLASS(conn),
+                "session-resumed")){
+        return;
+    }
+    g_object_get(conn, "session-resumed", &resumed, NULL);
+    if (resumed){
+        g_atomic_int_inc(&sirc->tls_resumed);
+    } else {
+        g_atomic_int_inc(&sirc->tls_full);
+    }
+    LOG_FR("TLS session %s", resumed ? "resumed" : "established");
+}
+
+static void connect_target_free(ConnectTarget *target){
+    g_object_unref(target->addr);
+    g_free(target);
+}
+
+static void on_disconnect(SircSession *sirc, const char *reason){
     LOG_FR("Disconnected: %s", reason);
 
-    g_object_unref(sirc->stream);
-    sirc->stream = NULL;
+    // Stream is released in main thread, see ``dispatch_event()``
+    emit_event(sirc, IO_EVENT_DISCONNECT, NULL, reason);
+}
+
+/**
+ * @brief ``emit_event`` handles the event immediately if socket of session
+ * is owned by main thread, otherwise queues it for main thread.
+ *
+ * @param sirc
+ * @param type
+ * @param imsg Parsed message, its ownership is taken
+ * @param reason
+ */
+static void emit_event(SircSession *sirc, IoEventType type,
+        SircMessage *imsg, const char *reason){
+    IoEvent *event;
+    IoEvent *head;
+
+    event = g_malloc0(sizeof(IoEvent));
+    event->type = type;
+    event->sirc = sirc;
+    event->imsg = imsg;
+    event->reason = g_strdup(reason);
+
+    if (!sirc->io_ctx){
+        dispatch_event(event);
+        return;
+    }
+
+    do {
+        head = g_atomic_pointer_get(&io_queue);
+        event->next = head;
+    } while (!g_atomic_pointer_compare_and_exchange(&io_queue, head, event));
+
+    /* Queue was empty, no pending dispatching will take this event. The idle
+     * priority lets GTK redraw between batches. */
+    if (!head){
+        g_idle_add(dispatch_events, NULL);
+    }
+}
+
+static void dispatch_event(IoEvent *event){
+    const char *params[] = { event->reason };
+    SircSession *sirc;
+
+    sirc = event->sirc;
+    switch (event->type){
+        case IO_EVENT_CONNECT:
+            if (sirc->events->connect){
+                sirc->events->connect(sirc, "CONNECT");
+            }
+            break;
+        case IO_EVENT_CONNECT_FAIL:
+            if (sirc->events->connect_fail){
+                sirc->events->connect_fail(sirc, "CONNECT_FAIL", "", params, 1);
+            }
+            break;
+        case IO_EVENT_MESSAGE:
+            sirc->imsg = event->imsg;
+            sirc_event_hdr(sirc, event->imsg);
+            sirc->imsg = NULL;
+            sirc_message_free(event->imsg);
+            break;
+        case IO_EVENT_DISCONNECT:
+            g_object_unref(sirc->stream);
+            sirc->stream = NULL;
+            // Session may be freed in callback
+            if (sirc->events->disconnect){
+                sirc->events->disconnect(sirc, "DISCONNECT", "", params, 1);
+            }
+            break;
+        default:
+            g_warn_if_reached();
+    }
+
+    g_free(event->reason);
+    g_free(event);
+}
+
+/**
+ * @brief ``dispatch_events`` handles all events queued by I/O thread in the
+ * order they are queued.
+ */
+static gboolean dispatch_events(gpointer user_data){
+    IoEvent *head;
+    IoEvent *prev;
+
+    do {
+        head = g_atomic_pointer_get(&io_queue);
+    } while (!g_atomic_pointer_compare_and_exchange(&io_queue, head, NULL));
+
+    /* Reverse the stack */
+    prev = NULL;
+    while (head){
+        IoEvent *next;
+
+        next = head->next;
+        head->next = prev;
+        prev = head;
+        head = next;
+    }
+
+    while (prev){
+        IoEvent *next;
+
+        next = prev->next;
+        dispatch_event(prev);
+        prev = next;
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean io_connect(gpointer user_data){
+    SircSession *sirc;
+
+    sirc = user_data;
+    if (!start_attempt(sirc)){
+        on_connect_fail(sirc, _("Operation was cancelled"));
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean io_disconnect(gpointer user_data){
+    SircSession *sirc;
+
+    sirc = user_data;
+    g_io_stream_close_async(sirc->stream, 0, NULL, on_disconnect_ready, sirc);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer io_thread(gpointer user_data){
+    GMainContext *ctx;
+    GMainLoop *loop;
+
+    loop = user_data;
+    ctx = g_main_loop_get_context(loop);
+    g_main_context_push_thread_default(ctx);
+    g_main_loop_run(loop); // Quit by sirc_stop_io_thread()
+    g_main_context_pop_thread_default(ctx);
+
+    return NULL;
+}
+
+/**
+ * @brief ``get_io_context`` returns context of I/O thread, the thread is
+ * started on first call. It must be called from main thread.
+ */
+static GMainContext* get_io_context(void){
+    if (!io_thread_ctx){
+        io_thread_ctx = g_main_context_new();
+        io_thread_loop = g_main_loop_new(io_thread_ctx, FALSE);
+        io_thread_handle = g_thread_new("sirc-io", io_thread, io_thread_loop);
+    }
 
-    g_return_if_fail(sirc->events->disconnect);
-    sirc->events->disconnect(sirc, "DISCONNECT", "", params, 1);
+    return io_thread_ctx;
 }
@@ -74,6 +74,86 @@ int sirc_cmd_join(SircSession *sirc, const char *chan, const char *passwd){
     }
 }
 
+// sirc_cmd_join_list: For joining multiple chans with as few messages as
+// possible, passwds[i] is key of chans[i] and can be NULL, max_targets is
+// the max count of chans in one message, 0 for unlimited
+int sirc_cmd_join_list(SircSession *sirc, const char **chans,
+        const char **passwds, int count, int max_targets){
+    int ret;
+    int ntarget;
+    GString *chan_buf;
+    GString *key_buf;
+
+    ret = SRN_OK;
+    ntarget = 0;
+    chan_buf = g_string_new(NULL);
+    key_buf = g_string_new(NULL);
+
+    /* Chans with key must precede chans without key, as keys are matched
+     * by position */
+    for (int keyed = 1; keyed >= 0; keyed--){
+        for (int i = 0; i < count; i++){
+            gsize len;
+            gsize chan_len;
+            gsize key_len;
+            const char *key;
+
+            key = str_is_empty(passwds[i]) ? NULL : passwds[i];
+            if (str_is_empty(chans[i]) || (key != NULL) != keyed){
+                continue;
+            }
+
+            /* Length of "JOIN <chans> <keys>\r\n" after appending */
+            chan_len = chan_buf->len + (ntarget ? 1 : 0) + strlen(chans[i]);
+            key_len = key ? key_buf->len + (key_buf->len ? 1 : 0) + strlen(key)
+                : key_buf->len;
+            len = strlen("JOIN ") + chan_len + (key_len ? 1 + key_len : 0) + 2;
+            if (ntarget && (len > SIRC_MSG_LEN
+                        || (max_targets > 0 && ntarget >= max_targets))){
+                if (key_buf->len){
+                    ret = sirc_cmd_raw(sirc, "JOIN %s %s\r\n",
+                            chan_buf->str, key_buf->str);
+                } else {
+                    ret = sirc_cmd_raw(sirc, "JOIN %s\r\n", chan_buf->str);
+                }
+                g_string_truncate(chan_buf, 0);
+                g_string_truncate(key_buf, 0);
+                ntarget = 0;
+                if (!RET_IS_OK(ret)){
+                    goto FIN;
+                }
+            }
+
+            if (ntarget){
+                g_string_append_c(chan_buf, ',');
+            }
+            g_string_append(chan_buf, chans[i]);
+            if (key){
+                if (key_buf->len){
+                    g_string_append_c(key_buf, ',');
+                }
+                g_string_append(key_buf, key);
+            }
+            ntarget++;
+        }
+    }
+
+    if (ntarget){
+        if (key_buf->len){
+            ret = sirc_cmd_raw(sirc, "JOIN %s %s\r\n",
+                    chan_buf->str, key_buf->str);
+        } else {
+            ret = sirc_cmd_raw(sirc, "JOIN %s\r\n", chan_buf->str);
+        }
+    }
+
+FIN:
+    g_string_free(chan_buf, TRUE);
+    g_string_free(key_buf, TRUE);
+
+    return ret;
+}
+
 // sirc_cmd_part: For leaving a chan
 int sirc_cmd_part(SircSession *sirc, const char *chan, const char *reason){
     g_return_val_if_fail(!str_is_empty(chan), SRN_ERR);
@@ -190,6 +190,10 @@ void sirc_event_hdr(SircSession *sirc, SircMessage *imsg){
              g_return_if_fail(events->error);
              events->error(sirc, event, origin, params, imsg->nparam);
          }
+         else if (strcasecmp(event, "BATCH") == 0){
+             g_return_if_fail(events->batch);
+             events->batch(sirc, event, origin, params, imsg->nparam);
+         }
          else {
              g_return_if_fail(events->unknown);
              events->unknown(sirc, event, origin, params, imsg->nparam);
@@ -23,6 +23,10 @@
  * @version 0.06.2
  * @date 2016-03-01
  *
+ * IRCv3 message tags are kept as a raw slice and only unescaped when a key
+ * is requested via ``sirc_message_get_tag()``. The frequently used tags
+ * "time", "msgid", "batch" and "account" are decoded while parsing, into
+ * fields of SircMessage, without building a table of all tags.
  */
 
 #include <string.h>
@@ -35,11 +39,22 @@
 #include "log.h"
 #include "utils.h"
 
+static void parse_tags(SircMessage *imsg);
+static bool find_tag(const char *tags, const char *key,
+        const char **val, gsize *len);
+static char* unescape_tag_value(const char *val, gsize len);
+static const char* intern_tag_value(char *val, gsize len);
+static gint64 parse_time_tag(const char *val);
+static gint64 parse_unix_time_tag(const char *val);
+
 SircMessage *sirc_message_new(){
     return g_malloc0(sizeof(SircMessage));
 }
 
 void sirc_message_free(SircMessage *imsg){
+    str_assign(&imsg->tags, NULL);
+    str_assign(&imsg->msgid, NULL);
+    str_assign(&imsg->batch, NULL);
     str_assign(&imsg->prefix, NULL);
     str_assign(&imsg->nick, NULL);
     str_assign(&imsg->user, NULL);
@@ -89,6 +104,24 @@ SircMessage* sirc_parse(char *line){
     char *trailing_ptr, *params_ptr;
     char *nick_ptr, *user_ptr, *host_ptr;
 
+    // <message> ::= ['@' <tags> <SPACE>] [':' <prefix> <SPACE> ] <command> <params> <crlf>
+    // See: https://ircv3.net/specs/extensions/message-tags
+    if (line[0] == '@'){
+        char *tags_ptr;
+
+        tags_ptr = line + 1; // Skip '@'
+        line = strchr(tags_ptr, ' ');
+        if (!line){
+            line = tags_ptr;
+            goto bad;
+        }
+        *line++ = '\0';
+        while (*line == ' ') line++;
+
+        imsg->tags = g_strdup(tags_ptr);
+        parse_tags(imsg);
+    }
+
     // <message> ::= [':' <prefix> <SPACE> ] <command> <params> <crlf>
     if (line[0] == ':'){
         prefix_ptr = strtok(line + 1, " "); // Skip ':'
@@ -169,3 +202,254 @@ bad:
 
     return NULL;
 }
+
+/**
+ * @brief ``sirc_message_get_tag`` gets value of a message tag.
+ *
+ * @param imsg
+ * @param key Key of tag, including vendor prefix and client-only prefix '+'
+ *
+ * @return A newly allocated unescaped value, empty string if the tag has no
+ *         value, NULL if the tag does not exist
+ */
+char* sirc_message_get_tag(SircMessage *imsg, const char *key){
+    gsize len;
+    const char *val;
+
+    g_return_val_if_fail(imsg, NULL);
+    g_return_val_if_fail(key, NULL);
+
+    if (!imsg->tags || !find_tag(imsg->tags, key, &val, &len)){
+        return NULL;
+    }
+
+    return unescape_tag_value(val, len);
+}
+
+/**
+ * @brief Decode the frequently used tags in a single pass over raw tags.
+ */
+static void parse_tags(SircMessage *imsg){
+    char *ptr;
+    char *end;
+
+    for (ptr = imsg->tags; *ptr; ptr = *end ? end + 1 : end){
+        char *val;
+        gsize klen;
+        gsize vlen;
+
+        end = strchr(ptr, ';');
+        if (!end){
+            end = ptr + strlen(ptr);
+        }
+        val = memchr(ptr, '=', end - ptr);
+        if (val){
+            klen = val - ptr;
+            val++;
+            vlen = end - val;
+        } else {
+            klen = end - ptr;
+            val = end;
+            vlen = 0;
+        }
+
+        switch (klen){
+            case 1:
+                // "znc.in/server-time" only provides unix time as "t"
+                if (ptr[0] == 't' && !imsg->time){
+                    imsg->time = parse_unix_time_tag(val);
+                }
+                break;
+            case 4:
+                if (strncmp(ptr, "time", klen) == 0){
+                    imsg->time = parse_time_tag(val);
+                }
+                break;
+            case 5:
+                if (strncmp(ptr, "msgid", klen) == 0){
+                    str_assign(&imsg->msgid, NULL);
+                    imsg->msgid = unescape_tag_value(val, vlen);
+                } else if (strncmp(ptr, "batch", klen) == 0){
+                    str_assign(&imsg->batch, NULL);
+                    imsg->batch = unescape_tag_value(val, vlen);
+                }
+                break;
+            case 7:
+                if (strncmp(ptr, "account", klen) == 0){
+                    imsg->account = intern_tag_value(val, vlen);
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * @brief Find the value slice of tag, the later one wins if a key is
+ * duplicated.
+ */
+static bool find_tag(const char *tags, const char *key,
+        const char **val, gsize *len){
+    bool found;
+    gsize klen;
+    const char *ptr;
+    const char *end;
+
+    found = FALSE;
+    klen = strlen(key);
+    for (ptr = tags; *ptr; ptr = *end ? end + 1 : end){
+        end = strchr(ptr, ';');
+        if (!end){
+            end = ptr + strlen(ptr);
+        }
+        if ((gsize)(end - ptr) < klen || strncmp(ptr, key, klen) != 0){
+            continue;
+        }
+        if (ptr[klen] == '='){
+            *val = ptr + klen + 1;
+            *len = end - *val;
+            found = TRUE;
+        } else if (ptr + klen == end){
+            *val = end;
+            *len = 0;
+            found = TRUE;
+        }
+    }
+
+    return found;
+}
+
+static char* unescape_tag_value(const char *val, gsize len){
+    char *str;
+    char *dst;
+    const char *end;
+
+    str = g_malloc(len + 1);
+    dst = str;
+    end = val + len;
+    while (val < end){
+        if (*val != '\\'){
+            *dst++ = *val++;
+            continue;
+        }
+        if (++val == end){
+            break; // Trailing backslash is dropped
+        }
+        switch (*val){
+            case ':':
+                *dst++ = ';';
+                break;
+            case 's':
+                *dst++ = ' ';
+                break;
+            case 'r':
+                *dst++ = '\r';
+                break;
+            case 'n':
+                *dst++ = '\n';
+                break;
+            default: // Including '\\'
+                *dst++ = *val;
+        }
+        val++;
+    }
+    *dst = '\0';
+
+    return str;
+}
+
+/**
+ * @brief Intern the value of tag, it is terminated in place temporarily
+ * when it needs no unescaping.
+ */
+static const char* intern_tag_value(char *val, gsize len){
+    char c;
+    char *str;
+    const char *interned;
+
+    if (!memchr(val, '\\', len)){
+        c = val[len];
+        val[len] = '\0';
+        interned = g_intern_string(val);
+        val[len] = c;
+        return interned;
+    }
+
+    str = unescape_tag_value(val, len);
+    interned = g_intern_string(str);
+    g_free(str);
+
+    return interned;
+}
+
+/**
+ * @brief Parse time in format "YYYY-MM-DDThh:mm:ss.sssZ", which is used by
+ * "server-time" and "znc.in/server-time-iso".
+ *
+ * @return Microseconds since epoch, 0 if failed
+ */
+static gint64 parse_time_tag(const char *val){
+    int year;
+    int month;
+    int day;
+    int hour;
+    int min;
+    int sec;
+    int n;
+    int era;
+    int yoe;
+    int doy;
+    int doe;
+    gint64 days;
+    gint64 usec;
+    gint64 scale;
+    const char *ptr;
+
+    n = 0;
+    if (sscanf(val, "%4d-%2d-%2dT%2d:%2d:%2d%n",
+                &year, &month, &day, &hour, &min, &sec, &n) != 6 || !n){
+        return 0;
+    }
+    if (month < 1 || month > 12 || day < 1 || day > 31
+            || hour > 23 || min > 59 || sec > 60){
+        return 0;
+    }
+
+    /* Fraction of second, at most microseconds are taken */
+    usec = 0;
+    ptr = val + n;
+    if (*ptr == '.'){
+        scale = G_USEC_PER_SEC;
+        while (g_ascii_isdigit(*++ptr)){
+            scale /= 10;
+            usec += (*ptr - '0') * scale;
+        }
+    }
+
+    /* Days since epoch of proleptic Gregorian calendar date */
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    days = (gint64)era * 146097 + doe - 719468;
+
+    return ((days * 24 + hour) * 60 * 60 + min * 60 + sec) * G_USEC_PER_SEC
+        + usec;
+}
+
+/**
+ * @brief Parse unix time in seconds, which is used by "znc.in/server-time".
+ *
+ * @return Microseconds since epoch, 0 if failed
+ */
+static gint64 parse_unix_time_tag(const char *val){
+    gint64 sec;
+    char *end;
+
+    sec = g_ascii_strtoll(val, &end, 10);
+    if (end == val || (*end && *end != ';')){
+        return 0;
+    }
+
+    return sec * G_USEC_PER_SEC;
+}
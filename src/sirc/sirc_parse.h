@@ -19,9 +19,18 @@
 #ifndef __SIRC_PARSE_H
 #define __SIRC_PARSE_H
 
+#include <glib.h>
+
 #define SIRC_PARAM_COUNT    64      // RFC 2812 limits it to 14
 
 typedef struct {
+    char *tags;     // Raw IRCv3 message tags without leading '@', values are
+                    // unescaped on demand, see sirc_message_get_tag()
+    gint64 time;            // "time" tag in microseconds since epoch, 0 if absent
+    char *msgid;            // "msgid" tag
+    char *batch;            // "batch" tag
+    const char *account;    // "account" tag, interned string
+
     char *prefix; // servername or nick!user@host
     char *nick, *user, *host;
 
@@ -34,5 +43,6 @@ SircMessage *sirc_message_new();
 void sirc_message_free(SircMessage *imsg);
 void sirc_message_transcoding(SircMessage *imsg, const char *to, const char *from, const char *fallback);
 SircMessage *sirc_parse(char *line);
+char* sirc_message_get_tag(SircMessage *imsg, const char *key);
 
 #endif /* __SIRC_PARSE_H */
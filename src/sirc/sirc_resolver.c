@@ -0,0 +1,352 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/**
+ * @file sirc_resolver.c
+ * @brief Caching host name resolver
+ * @author Shengyu Zhang <i@silverrainz.me>
+ * @version
+ * @date 2019-06-22
+ *
+ * Resolved addresses of hosts are cached for SIRC_RESOLVER_TTL, GResolver
+ * does not tell TTL of records so it is a fixed value. A timer resolves a
+ * cached host again in background SIRC_RESOLVER_PREFETCH before expiry if
+ * it has been used since it was resolved, so hosts in use are always fresh
+ * and unused ones simply expire. A host used in the prefetch window is also
+ * resolved again.
+ *
+ * When an expired host is being resolved, the last known-good addresses are
+ * used if resolver fails or does not reply in SIRC_RESOLVER_FALLBACK_DELAY.
+ *
+ * Lookups may be issued from any thread, callbacks are invoked in the thread
+ * default main context of caller.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include "sirc_resolver.h"
+
+#include "srain.h"
+#include "log.h"
+#include "i18n.h"
+
+#define SIRC_RESOLVER_TTL               (5 * 60 * G_TIME_SPAN_SECOND)
+#define SIRC_RESOLVER_PREFETCH          (60 * G_TIME_SPAN_SECOND)
+#define SIRC_RESOLVER_FALLBACK_DELAY    1500 // ms
+
+typedef struct _CacheEntry CacheEntry;
+typedef struct _LookupRequest LookupRequest;
+
+struct _CacheEntry {
+    GList *addrs;       // List of GInetAddress
+    gint64 expire;      // Monotonic time
+    bool used;          // Looked up since resolved
+    bool prefetching;
+    GSource *refresh_timer;
+};
+
+struct _LookupRequest {
+    char *host;
+    bool answered;      // Callback is invoked
+    GSource *fallback_timer;
+    GCancellable *cancel;
+
+    SircResolverFunc func; // NULL for prefetching
+    gpointer user_data;
+};
+
+static GMutex cache_mutex;
+static GHashTable *cache = NULL; // Host -> CacheEntry
+
+static void start_lookup(LookupRequest *req, bool fallback);
+static void on_lookup_ready(GObject *obj, GAsyncResult *res, gpointer user_data);
+static gboolean on_fallback_timeout(gpointer user_data);
+static gboolean on_refresh_timeout(gpointer user_data);
+static gboolean on_cache_hit(gpointer user_data);
+static GList* get_cached_addrs(const char *host);
+static void answer(LookupRequest *req, GList *addrs, const char *error);
+static void lookup_request_free(LookupRequest *req);
+static void cache_entry_free(CacheEntry *entry);
+static GList* copy_addrs(GList *addrs);
+
+/**
+ * @brief ``sirc_resolver_lookup`` resolves host asynchronously, cached
+ * addresses are used if possible.
+ *
+ * @param host
+ * @param cancel
+ * @param func Callback, it is never invoked before this function returns
+ * @param user_data
+ */
+void sirc_resolver_lookup(const char *host, GCancellable *cancel,
+        SircResolverFunc func, gpointer user_data){
+    bool hit;
+    bool prefetch;
+    bool fallback;
+    gint64 now;
+    CacheEntry *entry;
+    LookupRequest *req;
+
+    hit = FALSE;
+    prefetch = FALSE;
+    fallback = FALSE;
+    now = g_get_monotonic_time();
+
+    g_mutex_lock(&cache_mutex);
+    if (!cache){
+        cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+                g_free, (GDestroyNotify)cache_entry_free);
+    }
+    entry = g_hash_table_lookup(cache, host);
+    if (entry){
+        if (now < entry->expire){
+            hit = TRUE;
+            entry->used = TRUE;
+            if (now > entry->expire - SIRC_RESOLVER_PREFETCH
+                    && !entry->prefetching){
+                entry->prefetching = TRUE;
+                prefetch = TRUE;
+            }
+        } else {
+            fallback = TRUE;
+        }
+    }
+    g_mutex_unlock(&cache_mutex);
+
+    req = g_malloc0(sizeof(LookupRequest));
+    req->host = g_strdup(host);
+    req->cancel = cancel ? g_object_ref(cancel) : NULL;
+    req->func = func;
+    req->user_data = user_data;
+
+    if (hit){
+        GSource *source;
+
+        DBG_FR("Cache hit: %s", host);
+        // Invoked later to avoid reentrance of caller
+        source = g_idle_source_new();
+        g_source_set_callback(source, on_cache_hit, req, NULL);
+        g_source_attach(source, g_main_context_get_thread_default());
+        g_source_unref(source);
+
+        if (prefetch){
+            DBG_FR("Prefetching: %s", host);
+            req = g_malloc0(sizeof(LookupRequest));
+            req->host = g_strdup(host);
+            start_lookup(req, FALSE);
+        }
+        return;
+    }
+
+    start_lookup(req, fallback);
+}
+
+static void start_lookup(LookupRequest *req, bool fallback){
+    GResolver *resolver;
+
+    if (fallback){
+        req->fallback_timer = g_timeout_source_new(SIRC_RESOLVER_FALLBACK_DELAY);
+        g_source_set_callback(req->fallback_timer, on_fallback_timeout, req, NULL);
+        g_source_attach(req->fallback_timer, g_main_context_get_thread_default());
+    }
+
+    resolver = g_resolver_get_default();
+    g_resolver_lookup_by_name_async(resolver, req->host, req->cancel,
+            on_lookup_ready, req);
+    g_object_unref(resolver);
+}
+
+static void on_lookup_ready(GObject *obj, GAsyncResult *res, gpointer user_data){
+    GList *addrs;
+    GError *err;
+    LookupRequest *req;
+
+    req = user_data;
+    err = NULL;
+    addrs = g_resolver_lookup_by_name_finish(G_RESOLVER(obj), res, &err);
+
+    g_mutex_lock(&cache_mutex);
+    if (addrs){
+        CacheEntry *entry;
+
+        entry = g_malloc0(sizeof(CacheEntry));
+        entry->addrs = copy_addrs(addrs);
+        entry->expire = g_get_monotonic_time() + SIRC_RESOLVER_TTL;
+        entry->refresh_timer = g_timeout_source_new(
+                (SIRC_RESOLVER_TTL - SIRC_RESOLVER_PREFETCH) / G_TIME_SPAN_MILLISECOND);
+        g_source_set_callback(entry->refresh_timer, on_refresh_timeout,
+                g_strdup(req->host), g_free);
+        g_source_attach(entry->refresh_timer, g_main_context_get_thread_default());
+        g_hash_table_replace(cache, g_strdup(req->host), entry);
+    } else {
+        CacheEntry *entry;
+
+        entry = g_hash_table_lookup(cache, req->host);
+        if (entry){
+            entry->prefetching = FALSE;
+        }
+    }
+    g_mutex_unlock(&cache_mutex);
+
+    if (addrs){
+        answer(req, addrs, NULL);
+    } else if (g_error_matches(err, G_IO_ERROR, G_IO_ERROR_CANCELLED)){
+        answer(req, NULL, err->message);
+    } else {
+        GList *cached;
+
+        WARN_FR("Failed to resolve %s: %s", req->host, err->message);
+        cached = get_cached_addrs(req->host);
+        answer(req, cached, cached ? NULL : err->message);
+    }
+
+    if (err){
+        g_error_free(err);
+    }
+    lookup_request_free(req);
+}
+
+/**
+ * @brief Resolver is slow, use the last known-good addresses. Request is
+ * freed when lookup finishes.
+ */
+static gboolean on_fallback_timeout(gpointer user_data){
+    GList *addrs;
+    LookupRequest *req;
+
+    req = user_data;
+    g_source_unref(req->fallback_timer);
+    req->fallback_timer = NULL;
+
+    addrs = get_cached_addrs(req->host);
+    if (addrs){
+        WARN_FR("Resolving %s is slow, use last known addresses", req->host);
+        answer(req, addrs, NULL);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Resolve a cached host again before it expires if it is in use.
+ */
+static gboolean on_refresh_timeout(gpointer user_data){
+    bool refresh;
+    const char *host;
+    CacheEntry *entry;
+    LookupRequest *req;
+
+    host = user_data;
+    refresh = FALSE;
+
+    g_mutex_lock(&cache_mutex);
+    entry = g_hash_table_lookup(cache, host);
+    if (entry && entry->refresh_timer == g_main_current_source()){
+        g_source_unref(entry->refresh_timer);
+        entry->refresh_timer = NULL;
+        if (entry->used && !entry->prefetching){
+            entry->prefetching = TRUE;
+            refresh = TRUE;
+        }
+    }
+    g_mutex_unlock(&cache_mutex);
+
+    if (refresh){
+        DBG_FR("Refreshing: %s", host);
+        req = g_malloc0(sizeof(LookupRequest));
+        req->host = g_strdup(host);
+        start_lookup(req, FALSE);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean on_cache_hit(gpointer user_data){
+    GList *addrs;
+    LookupRequest *req;
+
+    req = user_data;
+    addrs = NULL;
+    if (!req->cancel || !g_cancellable_is_cancelled(req->cancel)){
+        addrs = get_cached_addrs(req->host);
+    }
+    if (addrs){
+        answer(req, addrs, NULL);
+    } else {
+        answer(req, NULL, _("Operation was cancelled"));
+    }
+    lookup_request_free(req);
+
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * @brief Get a copy of cached addresses of host, even if they are expired.
+ */
+static GList* get_cached_addrs(const char *host){
+    GList *addrs;
+    CacheEntry *entry;
+
+    addrs = NULL;
+    g_mutex_lock(&cache_mutex);
+    entry = g_hash_table_lookup(cache, host);
+    if (entry){
+        addrs = copy_addrs(entry->addrs);
+    }
+    g_mutex_unlock(&cache_mutex);
+
+    return addrs;
+}
+
+/**
+ * @brief Invoke callback of request once, the ownership of addrs is taken.
+ */
+static void answer(LookupRequest *req, GList *addrs, const char *error){
+    if (req->answered || !req->func){
+        g_resolver_free_addresses(addrs);
+        return;
+    }
+    req->answered = TRUE;
+    req->func(addrs, error, req->user_data);
+}
+
+static void lookup_request_free(LookupRequest *req){
+    if (req->fallback_timer){
+        g_source_destroy(req->fallback_timer);
+        g_source_unref(req->fallback_timer);
+    }
+    if (req->cancel){
+        g_object_unref(req->cancel);
+    }
+    g_free(req->host);
+    g_free(req);
+}
+
+static void cache_entry_free(CacheEntry *entry){
+    if (entry->refresh_timer){
+        g_source_destroy(entry->refresh_timer);
+        g_source_unref(entry->refresh_timer);
+    }
+    g_resolver_free_addresses(entry->addrs);
+    g_free(entry);
+}
+
+static GList* copy_addrs(GList *addrs){
+    return g_list_copy_deep(addrs, (GCopyFunc)g_object_ref, NULL);
+}
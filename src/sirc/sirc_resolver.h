@@ -0,0 +1,37 @@
+/* Copyright (C) 2016-2019 Shengyu Zhang <i@silverrainz.me>
+ *
+ * This file is part of Srain.
+ *
+ * Srain is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SIRC_RESOLVER_H
+#define __SIRC_RESOLVER_H
+
+#include <gio/gio.h>
+
+/**
+ * @brief Called when host is resolved.
+ *
+ * @param addrs List of GInetAddress, owned by callee, NULL if failed
+ * @param error Error message, NULL if succeeded
+ * @param user_data
+ */
+typedef void (*SircResolverFunc) (GList *addrs, const char *error,
+        gpointer user_data);
+
+void sirc_resolver_lookup(const char *host, GCancellable *cancel,
+        SircResolverFunc func, gpointer user_data);
+
+#endif /* __SIRC_RESOLVER_H */
@@ -48,6 +48,9 @@
 #include "sui_send_message.h"
 #include "sui_recv_message.h"
 
+static void append_message(SuiBuffer *buf, SuiMessageList *list,
+        SuiMessage *msg);
+
 void sui_proc_pending_event(){
     while (gtk_events_pending()) gtk_main_iteration();
 }
@@ -122,7 +125,6 @@ void sui_activate_buffer(SuiBuffer *buf){
 }
 
 void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg){
-    GType type;
     SuiWindow *win;
     SuiSideBar *sidebar;
     SuiSideBarItem *item;
@@ -132,19 +134,8 @@ void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg){
     g_return_if_fail(SUI_IS_MESSAGE(msg));
 
     /* Add message */
-    sui_message_set_buffer(msg, buf);
-    sui_message_update(msg);
     list = sui_buffer_get_message_list(buf);
-    type = G_OBJECT_TYPE(msg);
-    if (type == SUI_TYPE_MISC_MESSAGE){
-        sui_message_list_add_message(list, msg, GTK_ALIGN_CENTER);
-    } else if (type == SUI_TYPE_SEND_MESSAGE){
-        sui_message_list_add_message(list, msg, GTK_ALIGN_END);
-    } else if (type == SUI_TYPE_RECV_MESSAGE){
-        sui_message_list_add_message(list, msg, GTK_ALIGN_START);
-    } else {
-        g_warn_if_reached();
-    }
+    append_message(buf, list, msg);
 
     /* Update side bar */
     win = SUI_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(buf)));
@@ -160,6 +151,75 @@ void sui_buffer_add_message(SuiBuffer *buf, SuiMessage *msg){
     }
 }
 
+/**
+ * @brief ``sui_buffer_add_messages`` adds a list of messages to the bottom of
+ * buffer at once, the message list is scrolled only once after all messages
+ * are added.
+ *
+ * @param buf
+ * @param msgs List of SuiMessage, in chronological order
+ */
+void sui_buffer_add_messages(SuiBuffer *buf, GList *msgs){
+    SuiWindow *win;
+    SuiSideBar *sidebar;
+    SuiSideBarItem *item;
+    SuiMessageList *list;
+
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+
+    win = SUI_WINDOW(gtk_widget_get_toplevel(GTK_WIDGET(buf)));
+    g_return_if_fail(SUI_IS_WINDOW(win));
+    sidebar = sui_window_get_side_bar(win);
+    item = sui_side_bar_get_item(sidebar, buf);
+    list = sui_buffer_get_message_list(buf);
+
+    sui_message_list_freeze(list);
+    for (GList *lst = msgs; lst; lst = g_list_next(lst)){
+        SuiMessage *msg;
+
+        msg = lst->data;
+        g_warn_if_fail(SUI_IS_MESSAGE(msg));
+
+        append_message(buf, list, msg);
+        sui_message_update_side_bar_item(msg, item);
+    }
+    sui_message_list_thaw(list);
+
+    if (buf == sui_common_get_cur_buffer()){
+        // Don't show counter while buffer is active
+        sui_side_bar_item_clear_count(item);
+    }
+}
+
+/**
+ * @brief ``sui_buffer_prepend_message`` adds a history message to the top of
+ * buffer, unlike ``sui_buffer_add_message()``, it never updates side bar.
+ *
+ * @param buf
+ * @param msg
+ */
+void sui_buffer_prepend_message(SuiBuffer *buf, SuiMessage *msg){
+    GType type;
+    SuiMessageList *list;
+
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+    g_return_if_fail(SUI_IS_MESSAGE(msg));
+
+    sui_message_set_buffer(msg, buf);
+    sui_message_update(msg);
+    list = sui_buffer_get_message_list(buf);
+    type = G_OBJECT_TYPE(msg);
+    if (type == SUI_TYPE_MISC_MESSAGE){
+        sui_message_list_prepend_message(list, msg, GTK_ALIGN_CENTER);
+    } else if (type == SUI_TYPE_SEND_MESSAGE){
+        sui_message_list_prepend_message(list, msg, GTK_ALIGN_END);
+    } else if (type == SUI_TYPE_RECV_MESSAGE){
+        sui_message_list_prepend_message(list, msg, GTK_ALIGN_START);
+    } else {
+        g_warn_if_reached();
+    }
+}
+
 void sui_free_message(SuiMessage *msg){
     // TODO
 }
@@ -358,3 +418,53 @@ void sui_chan_list_end(SuiBuffer *buf){
 
     sui_join_panel_set_is_adding(panel, FALSE);
 }
+
+void sui_search_result_start(SuiBuffer *buf){
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+
+    sui_buffer_clear_search_results(buf);
+}
+
+void sui_search_result_add(SuiBuffer *buf, const char *time, const char *chat,
+        const char *sender, const char *content){
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+    g_return_if_fail(time);
+    g_return_if_fail(chat);
+    g_return_if_fail(sender);
+    g_return_if_fail(content);
+
+    sui_buffer_add_search_result(buf, time, chat, sender, content);
+}
+
+void sui_search_result_end(SuiBuffer *buf, const char *summary){
+    g_return_if_fail(SUI_IS_BUFFER(buf));
+    g_return_if_fail(summary);
+
+    sui_buffer_show_search_results(buf, summary);
+}
+
+/*****************************************************************************
+ * Static functions
+ *****************************************************************************/
+
+/**
+ * @brief Add a message to the bottom of message list of buffer, aligned by
+ * its type.
+ */
+static void append_message(SuiBuffer *buf, SuiMessageList *list,
+        SuiMessage *msg){
+    GType type;
+
+    sui_message_set_buffer(msg, buf);
+    sui_message_update(msg);
+    type = G_OBJECT_TYPE(msg);
+    if (type == SUI_TYPE_MISC_MESSAGE){
+        sui_message_list_add_message(list, msg, GTK_ALIGN_CENTER);
+    } else if (type == SUI_TYPE_SEND_MESSAGE){
+        sui_message_list_add_message(list, msg, GTK_ALIGN_END);
+    } else if (type == SUI_TYPE_RECV_MESSAGE){
+        sui_message_list_add_message(list, msg, GTK_ALIGN_START);
+    } else {
+        g_warn_if_reached();
+    }
+}
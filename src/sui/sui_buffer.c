@@ -50,6 +50,8 @@ static void sui_buffer_set_ctx(SuiBuffer *self, void *ctx);
 static void sui_buffer_set_events(SuiBuffer *self, SuiBufferEvents *events);
 
 static void topic_menu_item_on_toggled(GtkWidget* widget, gpointer user_data);
+static void search_close_button_on_clicked(GtkButton *button,
+        gpointer user_data);
 
 /*****************************************************************************
  * GObject functions
@@ -145,6 +147,8 @@ static void sui_buffer_init(SuiBuffer *self){
             G_CALLBACK(sui_common_activate_gtk_label_link), self);
     g_signal_connect(self->topic_menu_item, "toggled",
             G_CALLBACK(topic_menu_item_on_toggled), self);
+    g_signal_connect(self->search_close_button, "clicked",
+            G_CALLBACK(search_close_button_on_clicked), self);
 }
 
 static void sui_buffer_constructed(GObject *object){
@@ -218,6 +222,10 @@ static void sui_buffer_class_init(SuiBufferClass *class){
     gtk_widget_class_bind_template_child(widget_class, SuiBuffer, menu);
     gtk_widget_class_bind_template_child(widget_class, SuiBuffer, topic_revealer);
     gtk_widget_class_bind_template_child(widget_class, SuiBuffer, topic_label);
+    gtk_widget_class_bind_template_child(widget_class, SuiBuffer, search_revealer);
+    gtk_widget_class_bind_template_child(widget_class, SuiBuffer, search_label);
+    gtk_widget_class_bind_template_child(widget_class, SuiBuffer, search_close_button);
+    gtk_widget_class_bind_template_child(widget_class, SuiBuffer, search_list_box);
     gtk_widget_class_bind_template_child(widget_class, SuiBuffer, user_list_revealer);
     gtk_widget_class_bind_template_child(widget_class, SuiBuffer, msg_list_box);
     gtk_widget_class_bind_template_child(widget_class, SuiBuffer, input_text_buffer);
@@ -455,6 +463,90 @@ GtkTextBuffer* sui_buffer_get_input_text_buffer(SuiBuffer *self){
     return self->input_text_buffer;
 }
 
+/**
+ * @brief ``sui_buffer_load_initial_history`` asks for recent history messages
+ * when the buffer is viewed for the first time, it does nothing afterwards.
+ *
+ * @param self
+ */
+void sui_buffer_load_initial_history(SuiBuffer *self){
+    g_return_if_fail(SUI_IS_BUFFER(self));
+
+    if (self->history_loaded){
+        return;
+    }
+    self->history_loaded = TRUE;
+
+    sui_buffer_event_hdr(self, SUI_EVENT_LOAD_HISTORY, NULL);
+}
+
+/**
+ * @brief ``sui_buffer_clear_search_results`` removes results of previous
+ * search from search panel.
+ *
+ * @param self
+ */
+void sui_buffer_clear_search_results(SuiBuffer *self){
+    GList *children;
+
+    g_return_if_fail(SUI_IS_BUFFER(self));
+
+    children = gtk_container_get_children(GTK_CONTAINER(self->search_list_box));
+    for (GList *lst = children; lst; lst = g_list_next(lst)){
+        gtk_widget_destroy(lst->data);
+    }
+    g_list_free(children);
+}
+
+/**
+ * @brief ``sui_buffer_add_search_result`` appends a found message to search
+ * panel.
+ *
+ * @param self
+ * @param time Formatted time of message
+ * @param chat Where the message is from
+ * @param sender
+ * @param content Plain text content of message
+ */
+void sui_buffer_add_search_result(SuiBuffer *self, const char *time,
+        const char *chat, const char *sender, const char *content){
+    char *markup;
+    GtkLabel *label;
+    GtkStyleContext *style_context;
+
+    g_return_if_fail(SUI_IS_BUFFER(self));
+
+    markup = g_markup_printf_escaped(
+            "<small>%s  %s</small>\n<b>%s</b>: %s",
+            time, chat, sender, content);
+    label = GTK_LABEL(gtk_label_new(NULL));
+    gtk_label_set_markup(label, markup);
+    gtk_label_set_xalign(label, 0.0);
+    gtk_label_set_line_wrap(label, TRUE);
+    gtk_label_set_line_wrap_mode(label, PANGO_WRAP_WORD_CHAR);
+    gtk_label_set_selectable(label, TRUE);
+    style_context = gtk_widget_get_style_context(GTK_WIDGET(label));
+    gtk_style_context_add_class(style_context, "sui-buffer-search-result");
+    g_free(markup);
+
+    gtk_container_add(GTK_CONTAINER(self->search_list_box), GTK_WIDGET(label));
+    gtk_widget_show(GTK_WIDGET(label));
+}
+
+/**
+ * @brief ``sui_buffer_show_search_results`` reveals search panel with given
+ * summary of search.
+ *
+ * @param self
+ * @param summary
+ */
+void sui_buffer_show_search_results(SuiBuffer *self, const char *summary){
+    g_return_if_fail(SUI_IS_BUFFER(self));
+
+    gtk_label_set_text(self->search_label, summary);
+    gtk_revealer_set_reveal_child(self->search_revealer, TRUE);
+}
+
 /*****************************************************************************
  * Static functions
  *****************************************************************************/
@@ -467,6 +559,14 @@ static void sui_buffer_set_events(SuiBuffer *self, SuiBufferEvents *events){
     self->events = events;
 }
 
+static void search_close_button_on_clicked(GtkButton *button,
+        gpointer user_data){
+    SuiBuffer *self;
+
+    self = SUI_BUFFER(user_data);
+    gtk_revealer_set_reveal_child(self->search_revealer, FALSE);
+}
+
 static void topic_menu_item_on_toggled(GtkWidget* widget, gpointer user_data){
     bool active;
     SuiBuffer *self = SUI_BUFFER(user_data);
@@ -49,6 +49,12 @@ struct _SuiBuffer {
     GtkRevealer *topic_revealer;
     GtkLabel *topic_label;
 
+    /* Search results */
+    GtkRevealer *search_revealer;
+    GtkLabel *search_label;
+    GtkButton *search_close_button;
+    GtkListBox *search_list_box;
+
     /* User list */
     // FIXME: this is part of SuiChatBuffer
     GtkRevealer *user_list_revealer;
@@ -56,6 +62,7 @@ struct _SuiBuffer {
     /* Message list */
     GtkBox *msg_list_box;
     SuiMessageList *msg_list;
+    bool history_loaded;
 
     GtkTextBuffer *input_text_buffer;
     SuiCompletion *completion;
@@ -93,5 +100,10 @@ void sui_buffer_set_topic_setter(SuiBuffer *self, const char *setter);
 GtkMenu* sui_buffer_get_menu(SuiBuffer *self);
 SuiMessageList* sui_buffer_get_message_list(SuiBuffer *self);
 GtkTextBuffer* sui_buffer_get_input_text_buffer(SuiBuffer *self);
+void sui_buffer_load_initial_history(SuiBuffer *self);
+void sui_buffer_clear_search_results(SuiBuffer *self);
+void sui_buffer_add_search_result(SuiBuffer *self, const char *time,
+        const char *chat, const char *sender, const char *content);
+void sui_buffer_show_search_results(SuiBuffer *self, const char *summary);
 
 #endif /* __SUI_BUFFER_H */
@@ -57,6 +57,10 @@ static void popover_on_hide(GtkWidget *widget, gpointer user_data);
  */
 
 GtkListBoxRow* sui_common_add_gtk_list_box_unfocusable_row(GtkListBox *listbox, GtkWidget *widget){
+    return sui_common_insert_gtk_list_box_unfocusable_row(listbox, widget, -1);
+}
+
+GtkListBoxRow* sui_common_insert_gtk_list_box_unfocusable_row(GtkListBox *listbox, GtkWidget *widget, int position){
     GtkListBoxRow *row;
 
     row = GTK_LIST_BOX_ROW(gtk_list_box_row_new());
@@ -65,7 +69,7 @@ GtkListBoxRow* sui_common_add_gtk_list_box_unfocusable_row(GtkListBox *listbox,
     gtk_widget_set_can_focus(GTK_WIDGET(row), FALSE);
 
     gtk_container_add(GTK_CONTAINER(row), widget);
-    gtk_list_box_insert(listbox, GTK_WIDGET(row), -1);
+    gtk_list_box_insert(listbox, GTK_WIDGET(row), position);
 
     gtk_widget_show(GTK_WIDGET(row));
     gtk_widget_show(widget);
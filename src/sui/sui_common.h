@@ -27,6 +27,7 @@
 
 /* Misc */
 GtkListBoxRow* sui_common_add_gtk_list_box_unfocusable_row(GtkListBox *listbox, GtkWidget *widget);
+GtkListBoxRow* sui_common_insert_gtk_list_box_unfocusable_row(GtkListBox *listbox, GtkWidget *widget, int position);
 void sui_common_scale_size(int src_width, int src_height, int max_width, int max_height, int *dst_width, int *dst_height);
 gboolean sui_common_activate_gtk_label_link(GtkLabel *label, const char *uri, gpointer user_data);
 SrnRet sui_common_open_url(const char *url);
@@ -31,21 +31,29 @@
 
 #include "sui_common.h"
 #include "sui_window.h"
+#include "sui_event_hdr.h"
 #include "sui_message_list.h"
 
 #include "i18n.h"
 #include "log.h"
+#include "timer_wheel.h"
 
 struct _SuiMessageList {
     GtkBox parent;
 
     int scroll_timer;
+    int freeze_count;       // Scrolling is deferred to thawing if positive
     GtkScrolledWindow *scrolled_window;
     GtkViewport *viewport;
     GtkListBox *list_box;
     GtkButton *go_bottom_button;
     SuiMessage *first_msg;
     SuiMessage *last_msg;
+
+    /* Used for keeping the position of viewport when messages are prepended */
+    bool keep_position;
+    bool adjusting;         // Value of adjustment is being changed by us
+    double bottom_offset;   // Distance from viewport to bottom of list
 };
 
 struct _SuiMessageListClass {
@@ -63,6 +71,8 @@ static void scrolled_window_on_edge_overshot(GtkScrolledWindow *swin,
         GtkPositionType pos, gpointer user_data);
 static void scrolled_window_vadjustment_on_value_changed(
         GtkAdjustment *adjustment, gpointer user_data);
+static void scrolled_window_vadjustment_on_changed(
+        GtkAdjustment *adjustment, gpointer user_data);
 
 /*****************************************************************************
  * GObject functions
@@ -83,6 +93,10 @@ static void sui_message_list_init(SuiMessageList *self){
             gtk_scrolled_window_get_vadjustment(self->scrolled_window),
             "value-changed",
             G_CALLBACK(scrolled_window_vadjustment_on_value_changed), self);
+    g_signal_connect(
+            gtk_scrolled_window_get_vadjustment(self->scrolled_window),
+            "changed",
+            G_CALLBACK(scrolled_window_vadjustment_on_changed), self);
 
     g_object_bind_property(
             gtk_scrolled_window_get_vscrollbar(self->scrolled_window),
@@ -97,7 +111,7 @@ static void sui_message_list_finalize(GObject *object){
 
     self = SUI_MESSAGE_LIST(object);
     if (self->scroll_timer) {
-        g_source_remove(self->scroll_timer);
+        srn_timer_wheel_remove(self->scroll_timer);
     }
 
     G_OBJECT_CLASS(sui_message_list_parent_class)->finalize(object);
@@ -154,18 +168,60 @@ void sui_message_list_append_message(SuiMessageList *self, SuiMessage *msg,
         sui_message_compose_prev(msg, self->last_msg);
     }
     self->last_msg = msg;
+    if (!self->first_msg){
+        self->first_msg = msg;
+    }
 
     box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0));
     gtk_box_pack_start(box, GTK_WIDGET(msg), TRUE, TRUE, 0);
     gtk_widget_set_halign(GTK_WIDGET(msg), halign);
     sui_common_add_gtk_list_box_unfocusable_row(self->list_box, GTK_WIDGET(box));
 
-    smart_scroll(self);
+    if (!self->freeze_count){
+        smart_scroll(self);
+    }
+}
+
+/**
+ * @brief ``sui_message_list_freeze`` stops list from scrolling when messages
+ * are appended, until ``sui_message_list_thaw()`` is called, it is used for
+ * appending a large number of messages.
+ *
+ * @param self
+ */
+void sui_message_list_freeze(SuiMessageList *self){
+    self->freeze_count++;
+}
+
+void sui_message_list_thaw(SuiMessageList *self){
+    g_return_if_fail(self->freeze_count > 0);
+
+    self->freeze_count--;
+    if (!self->freeze_count){
+        smart_scroll(self);
+    }
 }
 
+/**
+ * @brief ``sui_message_list_prepend_message`` adds a message to the top of
+ * list, the messages currently shown stay where they are.
+ *
+ * @param self
+ * @param msg
+ * @param halign
+ */
 void sui_message_list_prepend_message(SuiMessageList *self, SuiMessage *msg,
         GtkAlign halign){
     GtkBox *box;
+    GtkAdjustment *adj;
+
+    if (!self->keep_position){
+        adj = gtk_scrolled_window_get_vadjustment(self->scrolled_window);
+        self->keep_position = TRUE;
+        self->bottom_offset = gtk_adjustment_get_upper(adj)
+            - gtk_adjustment_get_page_size(adj)
+            - gtk_adjustment_get_value(adj);
+    }
 
     if (self->first_msg
             && (G_OBJECT_TYPE(msg) == G_OBJECT_TYPE(self->first_msg))) {
@@ -173,13 +229,14 @@ void sui_message_list_prepend_message(SuiMessageList *self, SuiMessage *msg,
         sui_message_compose_next(msg, self->first_msg);
     }
     self->first_msg = msg;
+    if (!self->last_msg){
+        self->last_msg = msg;
+    }
 
     box = GTK_BOX(gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0));
     gtk_box_pack_start(box, GTK_WIDGET(msg), TRUE, TRUE, 0);
     gtk_widget_set_halign(GTK_WIDGET(msg), halign);
-    gtk_list_box_prepend(self->list_box, GTK_WIDGET(box)); // FIXME: theme & fcous
-
-    smart_scroll(self);
+    sui_common_insert_gtk_list_box_unfocusable_row(self->list_box, GTK_WIDGET(box), 0);
 }
 
 void sui_message_list_add_message(SuiMessageList *self, SuiMessage *msg,
@@ -231,7 +288,7 @@ static void scroll_to_bottom(SuiMessageList *self){
     // Use timer for avoiding duplicated calls of this function.
     // And the allocated size of the ``SuiMessage`` may changed after being
     // added into list. So do scroll later.
-    self->scroll_timer = g_timeout_add(100, scroll_to_bottom_timeout, self);
+    self->scroll_timer = srn_timer_wheel_add(100, scroll_to_bottom_timeout, self);
 }
 
 static gboolean scroll_to_bottom_timeout(gpointer user_data){
@@ -295,9 +352,24 @@ static void smart_scroll(SuiMessageList *self){
 
 static void scrolled_window_on_edge_overshot(GtkScrolledWindow *swin,
         GtkPositionType pos, gpointer user_data){
+    SuiWindow *win;
+    SuiBuffer *buf;
+    SuiMessageList *self;
+
+    self = SUI_MESSAGE_LIST(user_data);
+
     switch (pos) {
         case GTK_POS_TOP:
-            // TODO: Dynamic load
+            // Load history messages of buffer
+            win = sui_common_get_cur_window();
+            g_return_if_fail(SUI_IS_WINDOW(win));
+            buf = sui_window_get_cur_buffer(win);
+            g_return_if_fail(SUI_IS_BUFFER(buf));
+
+            if (sui_buffer_get_message_list(buf) != self){
+                break;
+            }
+            sui_buffer_event_hdr(buf, SUI_EVENT_LOAD_HISTORY, NULL);
             break;
         case GTK_POS_BOTTOM:
             break;
@@ -348,9 +420,36 @@ static void scrolled_window_vadjustment_on_value_changed(
 
     self = SUI_MESSAGE_LIST((user_data));
 
+    if (!self->adjusting){
+        // User scrolls the list, stop keeping position
+        self->keep_position = FALSE;
+    }
+
     // The go bottom button appears each time the distance from current
     // position to bottom is greater than 0.5 page (we think user is browsing
     // message now).
     gtk_widget_set_visible(GTK_WIDGET(self->go_bottom_button),
             get_page_count_to_bottom(self) > 0.5);
 }
+
+/**
+ * @brief ``scrolled_window_vadjustment_on_changed`` is called when the size
+ * of list is changed, if messages are prepended, keep the distance from
+ * viewport to bottom of list unchanged, so that the viewport does not jump
+ * to the top.
+ */
+static void scrolled_window_vadjustment_on_changed(
+        GtkAdjustment *adj, gpointer user_data){
+    SuiMessageList *self;
+
+    self = SUI_MESSAGE_LIST((user_data));
+    if (!self->keep_position){
+        return;
+    }
+
+    self->adjusting = TRUE;
+    gtk_adjustment_set_value(adj, gtk_adjustment_get_upper(adj)
+            - gtk_adjustment_get_page_size(adj)
+            - self->bottom_offset);
+    self->adjusting = FALSE;
+}
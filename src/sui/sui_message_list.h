@@ -33,7 +33,10 @@ GType sui_message_list_get_type(void);
 SuiMessageList *sui_message_list_new(void);
 
 void sui_message_list_add_message(SuiMessageList *self, SuiMessage *msg, GtkAlign halign);
+void sui_message_list_prepend_message(SuiMessageList *self, SuiMessage *msg, GtkAlign halign);
 GList *sui_message_list_get_recent_messages(SuiMessageList *self, int limit);
+void sui_message_list_freeze(SuiMessageList *self);
+void sui_message_list_thaw(SuiMessageList *self);
 
 void sui_message_list_scroll_up(SuiMessageList *self, double step);
 void sui_message_list_scroll_down(SuiMessageList *self, double step);
@@ -766,4 +766,6 @@ static void buffer_stack_on_child_changed(GtkWidget *widget, GParamSpec *pspec,
             sui_buffer_get_input_text_buffer(buf));
     gtk_menu_button_set_popup(self->buffer_menu_button,
             GTK_WIDGET(sui_buffer_get_menu(buf)));
+
+    sui_buffer_load_initial_history(buf);
 }